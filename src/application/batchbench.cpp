@@ -0,0 +1,194 @@
+/*
+ * Microbenchmark for the per-frame matrix work of the render loop. Each instance needs:
+ *   - its camera MVP and MV matrices,
+ *   - the normal matrix, as the inverse transpose of the MV,
+ *   - its world space bounding box.
+ * The glm code the render loop used to run per model is timed against the batch functions in
+ * scene/batchtransform.hpp, on every path this CPU can run.
+ *
+ * usage: batchbench [-instances N] [-iterations N]
+ *
+ *   -instances N   instances per frame (default: 100000)
+ *   -iterations N  frames to average over (default: 50)
+ *
+ * Prints nanoseconds per instance for each variant and the largest difference from the glm results. It
+ * also checks that every batch path gives exactly the scalar path's results.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../scene/batchtransform.hpp"
+#include "../scene/transform.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+// keeps the compiler from dropping results that are never read
+volatile float sink;
+
+struct Frame
+{
+	glm::mat4 view;
+	glm::mat4 viewProj;
+	std::vector<glm::mat4x3> world;
+	std::vector<glm::vec3> localMin, localMax;
+};
+
+struct Results
+{
+	std::vector<glm::mat4> mvp, mv, normal;
+	std::vector<glm::vec3> worldMin, worldMax;
+
+	explicit Results( size_t count ) : mvp( count ), mv( count ), normal( count ), worldMin( count ), worldMax( count )
+	{
+	}
+};
+
+void createFrame( Frame& frame, int count )
+{
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> position( -100.0f, 100.0f );
+	std::uniform_real_distribution<float> angle( -180.0f, 180.0f );
+	std::uniform_real_distribution<float> scale( 0.5f, 2.0f );
+
+	frame.view = glm::lookAt( glm::vec3( 0.0f, 10.0f, 30.0f ), glm::vec3( 0.0f ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
+	frame.viewProj = glm::perspective( glm::radians( 60.0f ), 16.0f / 9.0f, 0.1f, 500.0f ) * frame.view;
+	for ( int i = 0; i < count; i++ )
+	{
+		glm::quat rotation = orientationToQuat( glm::vec3( angle( random ), angle( random ), angle( random ) ) );
+		glm::vec3 p( position( random ), position( random ), position( random ) );
+		frame.world.push_back( composeAffine( p, rotation, glm::vec3( scale( random ), scale( random ), scale( random ) ) ) );
+		frame.localMin.push_back( glm::vec3( -scale( random ), -scale( random ), -scale( random ) ) );
+		frame.localMax.push_back( glm::vec3( scale( random ), scale( random ), scale( random ) ) );
+	}
+}
+
+// what the render loop did per model before the batch functions
+void runGlm( const Frame& frame, Results& results )
+{
+	for ( size_t i = 0; i < frame.world.size(); i++ )
+	{
+		glm::mat4 model = affineToMat4( frame.world[i] );
+		results.mvp[i] = frame.viewProj * model;
+		results.mv[i] = frame.view * model;
+		results.normal[i] = glm::transpose( glm::inverse( results.mv[i] ) );
+
+		glm::vec3 lo( std::numeric_limits<float>::max() ), hi( -std::numeric_limits<float>::max() );
+		for ( int corner = 0; corner < 8; corner++ )
+		{
+			glm::vec3 local( corner & 1 ? frame.localMax[i].x : frame.localMin[i].x,
+			                 corner & 2 ? frame.localMax[i].y : frame.localMin[i].y,
+			                 corner & 4 ? frame.localMax[i].z : frame.localMin[i].z );
+			glm::vec3 p( model * glm::vec4( local, 1.0f ) );
+			lo = glm::min( lo, p );
+			hi = glm::max( hi, p );
+		}
+		results.worldMin[i] = lo;
+		results.worldMax[i] = hi;
+	}
+}
+
+void runBatch( const Frame& frame, Results& results )
+{
+	size_t count = frame.world.size();
+	batchConcatenate( frame.viewProj, frame.world.data(), count, results.mvp.data() );
+	batchConcatenate( frame.view, frame.world.data(), count, results.mv.data() );
+	batchNormalMatrices( frame.view, frame.world.data(), count, results.normal.data() );
+	batchTransformBounds( frame.world.data(), frame.localMin.data(), frame.localMax.data(), count, results.worldMin.data(), results.worldMax.data() );
+}
+
+// nanoseconds per instance
+template <typename Run>
+double timeRuns( const Frame& frame, Results& results, int iterations, Run run )
+{
+	run( frame, results ); // untimed, so every variant starts with its output pages touched
+	Clock::time_point start = Clock::now();
+	for ( int i = 0; i < iterations; i++ )
+	{
+		run( frame, results );
+		sink = results.normal[i % results.normal.size()][0][0];
+	}
+	double ns = std::chrono::duration<double, std::nano>( Clock::now() - start ).count();
+	return ns / ( (double)frame.world.size() * iterations );
+}
+
+float largestDifference( const Results& a, const Results& b )
+{
+	float difference = 0.0f;
+	for ( size_t i = 0; i < a.mvp.size(); i++ )
+	{
+		for ( int c = 0; c < 4; c++ )
+		{
+			glm::vec4 d = glm::max( glm::abs( a.mvp[i][c] - b.mvp[i][c] ), glm::max( glm::abs( a.mv[i][c] - b.mv[i][c] ), glm::abs( a.normal[i][c] - b.normal[i][c] ) ) );
+			difference = std::max( difference, std::max( std::max( d.x, d.y ), std::max( d.z, d.w ) ) );
+		}
+		glm::vec3 d = glm::max( glm::abs( a.worldMin[i] - b.worldMin[i] ), glm::abs( a.worldMax[i] - b.worldMax[i] ) );
+		difference = std::max( difference, std::max( d.x, std::max( d.y, d.z ) ) );
+	}
+	return difference;
+}
+
+bool identical( const Results& a, const Results& b )
+{
+	size_t matrices = a.mvp.size() * sizeof( glm::mat4 );
+	size_t vectors = a.worldMin.size() * sizeof( glm::vec3 );
+	return std::memcmp( a.mvp.data(), b.mvp.data(), matrices ) == 0 && std::memcmp( a.mv.data(), b.mv.data(), matrices ) == 0 &&
+	       std::memcmp( a.normal.data(), b.normal.data(), matrices ) == 0 &&
+	       std::memcmp( a.worldMin.data(), b.worldMin.data(), vectors ) == 0 && std::memcmp( a.worldMax.data(), b.worldMax.data(), vectors ) == 0;
+}
+
+int main( int argc, char ** argv )
+{
+	int count = 100000;
+	int iterations = 50;
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string arg( argv[i] );
+		if ( arg == "-instances" && i + 1 < argc )
+			count = std::max( 1, std::atoi( argv[++i] ) );
+		else if ( arg == "-iterations" && i + 1 < argc )
+			iterations = std::max( 1, std::atoi( argv[++i] ) );
+		else
+			std::fprintf( stderr, "Ignoring unknown argument %s\n", arg.c_str() );
+	}
+
+	Frame frame;
+	createFrame( frame, count );
+
+	BatchTransformPath best = getBatchTransformPath();
+	std::printf( "%d instances, %d frames, default path %s\n\n", count, iterations, batchTransformPathName( best ) );
+	std::printf( "%-16s %12s %10s %14s %12s\n", "", "ns/instance", "speedup", "max vs glm", "vs scalar" );
+
+	Results glmResults( count );
+	double glmNs = timeRuns( frame, glmResults, iterations, runGlm );
+	std::printf( "%-16s %12.2f %9.1fx %14s %12s\n", "glm per model", glmNs, 1.0, "-", "-" );
+
+	Results scalarResults( count );
+	const BatchTransformPath paths[] = { BATCH_TRANSFORM_SCALAR, BATCH_TRANSFORM_SSE2, BATCH_TRANSFORM_AVX };
+	for ( BatchTransformPath path : paths )
+	{
+		std::string name = std::string( "batch " ) + batchTransformPathName( path );
+		if ( !setBatchTransformPath( path ) )
+		{
+			std::printf( "%-16s %12s\n", name.c_str(), "not available" );
+			continue;
+		}
+
+		Results results( count );
+		double ns = timeRuns( frame, results, iterations, runBatch );
+		if ( path == BATCH_TRANSFORM_SCALAR )
+			scalarResults = results;
+		std::printf( "%-16s %12.2f %9.1fx %14.2e %12s\n", name.c_str(), ns, glmNs / ns, largestDifference( results, glmResults ),
+		             identical( results, scalarResults ) ? "identical" : "DIFFERENT" );
+	}
+	setBatchTransformPath( best );
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,482 @@
+/*
+ * Headless benchmark runner. Renders a scene into an offscreen framebuffer on a surfaceless
+ * EGL context (no window or display server needed, works on Mesa llvmpipe), flies the camera
+ * along a scripted path with a fixed timestep and writes per-frame CPU/GPU timings plus the
+ * final frame image.
+ *
+ * usage: benchmark [-path file] [-frames N] [-out prefix] [-capture N] [-stream bytes] [-nomips] [-compress] [-batch] [-permutations] [-ldr] [-prepass] [-overdraw] [-nolod] [-noclusters] [-occlusion] [-softocclusion] [-pipeline] <scene file> <shader path>
+ *
+ *   -path file   camera path to replay (see camerapath.hpp); default is an orbit around the origin
+ *   -frames N    number of frames to render (default: the length of the path, or 300 for the orbit)
+ *   -out prefix  prefix for output files (default "benchmark"): <prefix>_timings.csv,
+ *                <prefix>_final.png and <prefix>_trace.json
+ *   -capture N   also save every Nth frame as <prefix>_frame<N>.png
+ *   -stream bytes  draw proxies and stream meshes/textures in after the first frame, uploading at
+ *                  most this many bytes per frame (see Renderer::setStreaming)
+ *   -nomips      sample only the base level of each texture, for comparison with the default trilinear filtering
+ *   -compress    block compress textures (see Scene::setTextureCompression)
+ *   -batch       draw the material pass in batches over texture arrays (see Renderer::setBatching)
+ *   -permutations  draw with shaders specialized per light type and material textures instead of the
+ *                  uber-shaders (see Renderer::setShaderPermutations); compare the pass timings of both runs
+ *   -ldr         clip the HDR target to [0, 1] instead of tone mapping it (see Renderer::setToneMapping)
+ *   -prepass     render a depth pre-pass and fill the G-buffer with GL_EQUAL (see Renderer::setDepthPrepass)
+ *   -overdraw    record fragments shaded per pixel (see Renderer::setOverdrawMeasurement); reads back every
+ *                frame, so use a separate run for timings
+ *   -nolod       draw every model at full detail (see Renderer::setLevelOfDetail); compare the "triangles
+ *                drawn" counter and pass timings with the default run
+ *   -noclusters  draw whole levels of detail instead of the clusters each pass can see (see
+ *                Renderer::setClusterCulling); compare "triangles drawn" and the pass timings
+ *   -occlusion   skip models and submeshes hidden behind the depth of a recent frame (see
+ *                Renderer::setOcclusionCulling); see the "culled (occlusion)" counters
+ *   -softocclusion  skip what the scene's occluders hide, drawn on the CPU for each frame (see
+ *                   Renderer::setSoftwareOcclusion); see the "occluders" pass and the same counters
+ *   -pipeline    update and prepare frame N+1 on a worker thread while frame N is drawn, like the application
+ *                (see Renderer::prepareFrame); compare the "frame" time with a serial run. There is no vsync
+ *                here, so it shows the throughput. The "wait" timer is the render thread waiting for the worker.
+ */
+
+#define GLEW_STATIC
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <SFML/Graphics/Image.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "../renderer/camera.hpp"
+#include "../renderer/camerapath.hpp"
+#include "../renderer/renderer.hpp"
+#include "../scene/scene.hpp"
+#include "../scene/threadpool.hpp"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// fixed simulation step, so every run sees exactly the same camera and light positions
+#define BENCHMARK_TIMESTEP CAMERA_PATH_TIMESTEP
+
+struct HeadlessContext
+{
+	EGLDisplay display;
+	EGLContext context;
+
+	HeadlessContext() : display( EGL_NO_DISPLAY ), context( EGL_NO_CONTEXT )
+	{
+	}
+};
+
+// creates a surfaceless OpenGL context; falls back to the default display if the Mesa surfaceless platform is missing
+bool createHeadlessContext( HeadlessContext& headless )
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+	if ( getPlatformDisplay )
+		headless.display = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+	if ( headless.display == EGL_NO_DISPLAY )
+		headless.display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+
+	EGLint major, minor;
+	if ( headless.display == EGL_NO_DISPLAY || !eglInitialize( headless.display, &major, &minor ) )
+	{
+		std::cerr << "Could not initialize an EGL display." << std::endl;
+		return false;
+	}
+	std::cout << "EGL " << major << "." << minor << " (" << eglQueryString( headless.display, EGL_VENDOR ) << ")" << std::endl;
+
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if ( !eglChooseConfig( headless.display, configAttribs, &config, 1, &numConfigs ) || numConfigs == 0 )
+	{
+		std::cerr << "No EGL config supports desktop OpenGL." << std::endl;
+		return false;
+	}
+
+	if ( !eglBindAPI( EGL_OPENGL_API ) )
+	{
+		std::cerr << "Could not bind the desktop OpenGL API." << std::endl;
+		return false;
+	}
+
+	// same version as the windowed application requests (compatibility profile, like SFML's default)
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 0,
+		EGL_NONE
+	};
+	headless.context = eglCreateContext( headless.display, config, EGL_NO_CONTEXT, contextAttribs );
+	if ( headless.context == EGL_NO_CONTEXT )
+	{
+		std::cerr << "Could not create an EGL context." << std::endl;
+		return false;
+	}
+
+	// no surface at all - everything is drawn into framebuffer objects
+	if ( !eglMakeCurrent( headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless.context ) )
+	{
+		std::cerr << "Could not make the surfaceless context current." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void destroyHeadlessContext( HeadlessContext& headless )
+{
+	if ( headless.display == EGL_NO_DISPLAY )
+		return;
+
+	eglMakeCurrent( headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+	if ( headless.context != EGL_NO_CONTEXT )
+		eglDestroyContext( headless.display, headless.context );
+	eglTerminate( headless.display );
+}
+
+// the stand-in for the window's default framebuffer
+struct OffscreenTarget
+{
+	GLuint framebuffer;
+	GLuint colorBuffer;
+	GLuint depthBuffer;
+};
+
+bool createOffscreenTarget( OffscreenTarget& target, int width, int height )
+{
+	glGenFramebuffers( 1, &target.framebuffer );
+	glBindFramebuffer( GL_FRAMEBUFFER, target.framebuffer );
+
+	glGenRenderbuffers( 1, &target.colorBuffer );
+	glBindRenderbuffer( GL_RENDERBUFFER, target.colorBuffer );
+	glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, width, height );
+	glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.colorBuffer );
+
+	glGenRenderbuffers( 1, &target.depthBuffer );
+	glBindRenderbuffer( GL_RENDERBUFFER, target.depthBuffer );
+	glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height );
+	glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depthBuffer );
+
+	glDrawBuffer( GL_COLOR_ATTACHMENT0 );
+	glReadBuffer( GL_COLOR_ATTACHMENT0 );
+
+	bool complete = glCheckFramebufferStatus( GL_FRAMEBUFFER ) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	if ( !complete )
+		std::cerr << "Offscreen framebuffer is incomplete." << std::endl;
+	return complete;
+}
+
+void releaseOffscreenTarget( OffscreenTarget& target )
+{
+	glDeleteFramebuffers( 1, &target.framebuffer );
+	glDeleteRenderbuffers( 1, &target.colorBuffer );
+	glDeleteRenderbuffers( 1, &target.depthBuffer );
+}
+
+bool saveFramebuffer( const OffscreenTarget& target, int width, int height, const std::string& filename )
+{
+	std::vector<unsigned char> pixels( width * height * 4 );
+	glBindFramebuffer( GL_READ_FRAMEBUFFER, target.framebuffer );
+	glReadBuffer( GL_COLOR_ATTACHMENT0 );
+	glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+	glReadPixels( 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0] );
+	glBindFramebuffer( GL_READ_FRAMEBUFFER, 0 );
+
+	// the lighting passes don't write alpha; store the image opaque
+	for ( size_t i = 3; i < pixels.size(); i += 4 )
+		pixels[i] = 255;
+
+	sf::Image image;
+	image.create( width, height, &pixels[0] );
+	image.flipVertically(); // GL rows start at the bottom
+	if ( !image.saveToFile( filename ) )
+	{
+		std::cerr << "Could not write image " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// scripted camera: follows the path if one was given, otherwise a slow orbit around the origin
+void scriptedCamera( Camera& camera, const CameraPath& path, float time )
+{
+	if ( !path.empty() )
+	{
+		path.apply( camera, path.getKeyframes().front().time + time );
+		return;
+	}
+
+	float angle = time * 0.5f;
+	glm::vec3 eye( 8.0f * glm::sin( angle ), 3.0f, 8.0f * glm::cos( angle ) );
+	camera.setView( eye, glm::vec3( 0.0f, 1.0f, 0.0f ) - eye );
+}
+
+const char * csvPasses[] = { "stream", "shadow", "intermediate", "material", "final" };
+
+void writeCsvHeader( std::ofstream& csv )
+{
+	csv << "frame,frame_cpu_ms,update_cpu_ms,render_cpu_ms";
+	for ( const char * pass : csvPasses )
+		csv << "," << pass << "_cpu_ms," << pass << "_gpu_ms";
+	csv << "\n";
+}
+
+void writeCsvRow( std::ofstream& csv, const Profiler& profiler, unsigned int frame )
+{
+	const std::vector<Profiler::Event>& events = profiler.getFrameEvents( frame );
+
+	// looks up one event's duration in ms, 0 if it wasn't recorded
+	auto duration = [&events]( const std::string& name, bool gpu )
+	{
+		for ( const Profiler::Event& event : events )
+			if ( event.gpu == gpu && event.name == name )
+				return event.durationUs / 1000.0;
+		return 0.0;
+	};
+
+	csv << frame << "," << duration( "frame", false ) << "," << duration( "update", false ) << "," << duration( "render", false );
+	for ( const char * pass : csvPasses )
+		csv << "," << duration( pass, false ) << "," << duration( pass, true );
+	csv << "\n";
+}
+
+int main( int argc, char ** argv )
+{
+	int numFrames = 0;
+	int captureInterval = 0;
+	size_t streamBudget = 0;
+	bool mipmapping = true;
+	bool compressTextures = false;
+	bool batching = false;
+	bool permutations = false;
+	bool toneMapping = true;
+	bool depthPrepass = false;
+	bool measureOverdraw = false;
+	bool levelOfDetail = true;
+	bool clusterCulling = true;
+	bool occlusionCulling = false;
+	bool softwareOcclusion = false;
+	bool pipelined = false;
+	std::string outPrefix = "benchmark";
+	Profiler::Clock::time_point startTime = Profiler::Clock::now();
+
+	if ( argc < 3 )
+	{
+		std::cerr << "usage: " << argv[0] << " [-path file] [-frames N] [-out prefix] [-capture N] [-stream bytes] [-nomips] [-compress] [-batch] [-permutations] [-ldr] [-prepass] [-overdraw] [-nolod] [-noclusters] [-occlusion] [-softocclusion] [-pipeline] <scene file> <shader path>" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	CameraPath path;
+	for ( int i = 1; i < argc - 2; i++ )
+	{
+		std::string arg( argv[i] );
+		if ( arg == "-path" && i + 1 < argc - 2 )
+		{
+			if ( !path.loadFromFile( argv[++i] ) )
+				return EXIT_FAILURE;
+		}
+		else if ( arg == "-frames" && i + 1 < argc - 2 )
+			numFrames = std::atoi( argv[++i] );
+		else if ( arg == "-out" && i + 1 < argc - 2 )
+			outPrefix = argv[++i];
+		else if ( arg == "-capture" && i + 1 < argc - 2 )
+			captureInterval = std::atoi( argv[++i] );
+		else if ( arg == "-stream" && i + 1 < argc - 2 )
+			streamBudget = std::strtoul( argv[++i], NULL, 10 );
+		else if ( arg == "-nomips" )
+			mipmapping = false;
+		else if ( arg == "-compress" )
+			compressTextures = true;
+		else if ( arg == "-batch" )
+			batching = true;
+		else if ( arg == "-permutations" )
+			permutations = true;
+		else if ( arg == "-ldr" )
+			toneMapping = false;
+		else if ( arg == "-prepass" )
+			depthPrepass = true;
+		else if ( arg == "-overdraw" )
+			measureOverdraw = true;
+		else if ( arg == "-nolod" )
+			levelOfDetail = false;
+		else if ( arg == "-noclusters" )
+			clusterCulling = false;
+		else if ( arg == "-occlusion" )
+			occlusionCulling = true;
+		else if ( arg == "-softocclusion" )
+			softwareOcclusion = true;
+		else if ( arg == "-pipeline" )
+			pipelined = true;
+		else
+			std::cerr << "Ignoring unknown argument " << arg << std::endl;
+	}
+
+	if ( numFrames <= 0 )
+		numFrames = path.empty() ? 300 : (int)( path.getDuration() / BENCHMARK_TIMESTEP ) + 1;
+
+	std::string filename( argv[argc - 2] );
+	std::string shaderPath( argv[argc - 1] );
+
+	HeadlessContext headless;
+	if ( !createHeadlessContext( headless ) )
+	{
+		destroyHeadlessContext( headless );
+		return EXIT_FAILURE;
+	}
+
+	Scene scene;
+	scene.setTextureCompression( compressTextures );
+	if ( !scene.loadFromFile( filename ) )
+	{
+		std::cerr << "FATAL ERROR: Failed to load scene file" << std::endl;
+		destroyHeadlessContext( headless );
+		return EXIT_FAILURE;
+	}
+
+	Camera camera;
+	camera.toggle1 = true; // textured materials (T in the application)
+	Renderer renderer;
+	renderer.setStreaming( streamBudget > 0, streamBudget );
+	renderer.setBatching( batching );
+	renderer.setShaderPermutations( permutations );
+	renderer.setToneMapping( toneMapping );
+	renderer.setDepthPrepass( depthPrepass );
+	renderer.setOverdrawMeasurement( measureOverdraw );
+	renderer.setLevelOfDetail( levelOfDetail );
+	renderer.setClusterCulling( clusterCulling );
+	renderer.setOcclusionCulling( occlusionCulling );
+	renderer.setSoftwareOcclusion( softwareOcclusion );
+	renderer.mipmapping = mipmapping;
+	if ( !renderer.initialize( camera, scene, shaderPath ) )
+	{
+		std::cerr << "FATAL ERROR: Failed to initialize renderer" << std::endl;
+		destroyHeadlessContext( headless );
+		return EXIT_FAILURE;
+	}
+	std::cout << "GL_RENDERER: " << glGetString( GL_RENDERER ) << std::endl;
+
+	OffscreenTarget target;
+	if ( !createOffscreenTarget( target, SCREEN_WIDTH, SCREEN_HEIGHT ) )
+	{
+		renderer.release();
+		destroyHeadlessContext( headless );
+		return EXIT_FAILURE;
+	}
+	renderer.setOutputFramebuffer( target.framebuffer );
+
+	std::ofstream csv( outPrefix + "_timings.csv" );
+	writeCsvHeader( csv );
+
+	Profiler& profiler = renderer.profiler;
+	int streamedFrame = -1;
+	unsigned int csvFrames = 0;
+
+	// pipelined, frame 0 is prepared up front and every frame prepares the next on the worker
+	ThreadPool frameWorker( 1 );
+	if ( pipelined )
+	{
+		scriptedCamera( camera, path, 0.0f );
+		scene.update( BENCHMARK_TIMESTEP );
+		renderer.syncFrame();
+		renderer.prepareFrame( camera, scene );
+	}
+
+	for ( int frame = 0; frame < numFrames; frame++ )
+	{
+		profiler.beginFrame();
+
+		Profiler::Clock::time_point updateStart, updateEnd;
+		std::future<void> next;
+		if ( pipelined )
+		{
+			renderer.syncFrame();
+			renderer.swapFrames( camera, scene );
+			if ( frame + 1 < numFrames )
+			{
+				next = frameWorker.submit( [&, frame]()
+				{
+					updateStart = Profiler::Clock::now();
+					scriptedCamera( camera, path, ( frame + 1 ) * BENCHMARK_TIMESTEP );
+					scene.update( BENCHMARK_TIMESTEP );
+					updateEnd = Profiler::Clock::now();
+					renderer.prepareFrame( camera, scene );
+				} );
+			}
+		}
+		else
+		{
+			Profiler::ScopedTimer timer( profiler, "update" );
+			scriptedCamera( camera, path, frame * BENCHMARK_TIMESTEP );
+			scene.update( BENCHMARK_TIMESTEP );
+		}
+
+		{
+			Profiler::ScopedTimer timer( profiler, "render" );
+			if ( pipelined )
+				renderer.renderFrame();
+			else
+				renderer.render( camera, scene );
+		}
+
+		if ( captureInterval > 0 && frame % captureInterval == 0 )
+		{
+			std::ostringstream name;
+			name << outPrefix << "_frame" << frame << ".png";
+			saveFramebuffer( target, SCREEN_WIDTH, SCREEN_HEIGHT, name.str() );
+		}
+
+		// there is no swap; flush so the frame's work is submitted like a display() would
+		glFlush();
+
+		if ( next.valid() )
+		{
+			{
+				Profiler::ScopedTimer timer( profiler, "wait" );
+				next.get();
+			}
+			profiler.addCpuTime( "update", updateStart, updateEnd );
+		}
+		profiler.endFrame();
+
+		if ( frame == 0 )
+		{
+			glFinish();
+			std::cout << "Time to first frame: " << std::chrono::duration<double>( Profiler::Clock::now() - startTime ).count() << " s" << std::endl;
+		}
+		if ( streamedFrame < 0 && !renderer.isStreaming() )
+		{
+			streamedFrame = frame;
+			std::cout << "All models resident after frame " << frame << " ("
+			          << std::chrono::duration<double>( Profiler::Clock::now() - startTime ).count() << " s)" << std::endl;
+		}
+
+		// a frame's row is written once the GPU times of all its passes have been read back
+		while ( csvFrames < profiler.getResolvedFrames() )
+			writeCsvRow( csv, profiler, csvFrames++ );
+	}
+
+	profiler.flush();
+	while ( csvFrames < (unsigned int)numFrames )
+		writeCsvRow( csv, profiler, csvFrames++ );
+
+	saveFramebuffer( target, SCREEN_WIDTH, SCREEN_HEIGHT, outPrefix + "_final.png" );
+
+	profiler.printSummary();
+	profiler.writeChromeTrace( outPrefix + "_trace.json" );
+
+	releaseOffscreenTarget( target );
+	renderer.release();
+	destroyHeadlessContext( headless );
+	return EXIT_SUCCESS;
+}
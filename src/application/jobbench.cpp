@@ -0,0 +1,219 @@
+/*
+ * Scaling benchmark of the job system in scene/jobsystem.hpp, on the CPU only. Every workload runs on a job
+ * system of 1, 2, ... up to N threads:
+ *   - parallelFor over a span of points, each animated with a few rounds of sin/cos,
+ *   - the cluster culling of meshlet.hpp on a grid of dense spheres, as a frame's camera pass does it,
+ *   - a fork-join graph that sums a range by halving it, one job per split and a continuation per join,
+ *     which measures what a job costs.
+ *
+ * usage: jobbench [-threads N] [-points N] [-leaves N] [-iterations N]
+ *
+ *   -threads N     the most threads to try, more than the cores to see oversubscription (default: one per
+ *                  hardware thread, at least 4)
+ *   -points N      points for parallelFor (default: 1048576)
+ *   -leaves N      leaves of the fork-join graph (default: 65536)
+ *   -iterations N  runs to average over (default: 10)
+ *
+ * Prints milliseconds per run, the speedup over one thread and the efficiency (speedup per thread) of every
+ * workload, and checks that every thread count gives the same results.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../scene/jobsystem.hpp"
+#include "../scene/meshlet.hpp"
+#include "../scene/transform.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+void createSphere( int rings, std::vector<glm::vec3>& positions, std::vector<int>& indices )
+{
+	int segments = rings * 2;
+	for ( int r = 0; r <= rings; r++ )
+	{
+		for ( int s = 0; s <= segments; s++ )
+		{
+			float theta = 3.14159265f * r / rings, phi = 2.0f * 3.14159265f * ( s % segments ) / segments;
+			float ring = ( r == 0 || r == rings ) ? 0.0f : std::sin( theta );
+			positions.push_back( glm::vec3( ring * std::cos( phi ), std::cos( theta ), ring * std::sin( phi ) ) );
+		}
+	}
+	for ( int r = 0; r < rings; r++ )
+	{
+		for ( int s = 0; s < segments; s++ )
+		{
+			int a = r * ( segments + 1 ) + s, b = a + 1, c = a + segments + 1, d = c + 1;
+			int quad[6] = { a, b, c, b, d, c };
+			indices.insert( indices.end(), quad, quad + 6 );
+		}
+	}
+}
+
+// Sums begin + 1 ... end into out: one job per split, whose halves are children of an empty job that the join follows
+void sumRange( JobSystem& jobs, const JobSystem::JobHandle& parent, size_t begin, size_t end, long long * out )
+{
+	jobs.run( jobs.create( [&jobs, parent, begin, end, out]()
+	{
+		if ( end - begin == 1 )
+		{
+			*out = (long long)end;
+			return;
+		}
+		std::shared_ptr<std::array<long long, 2>> halves = std::make_shared<std::array<long long, 2>>();
+		JobSystem::JobHandle both = jobs.create( nullptr, parent );
+		size_t middle = begin + ( end - begin ) / 2;
+		sumRange( jobs, both, begin, middle, &( *halves )[0] );
+		sumRange( jobs, both, middle, end, &( *halves )[1] );
+		jobs.continueWith( both, [halves, out]() { *out = ( *halves )[0] + ( *halves )[1]; }, parent );
+		jobs.run( both );
+	}, parent ) );
+}
+
+struct Workload {
+	const char * name;
+	std::function<double( JobSystem& )> run;    // returns a checksum
+	std::vector<double> ms;
+	std::vector<double> checksums;
+};
+
+int main( int argc, char ** argv )
+{
+	int maxThreads = std::max( (int)std::thread::hardware_concurrency(), 4 );
+	int numPoints = 1 << 20;
+	int numLeaves = 1 << 16;
+	int iterations = 10;
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string arg( argv[i] );
+		if ( arg == "-threads" && i + 1 < argc )
+			maxThreads = std::max( 1, std::atoi( argv[++i] ) );
+		else if ( arg == "-points" && i + 1 < argc )
+			numPoints = std::max( 1, std::atoi( argv[++i] ) );
+		else if ( arg == "-leaves" && i + 1 < argc )
+			numLeaves = std::max( 1, std::atoi( argv[++i] ) );
+		else if ( arg == "-iterations" && i + 1 < argc )
+			iterations = std::max( 1, std::atoi( argv[++i] ) );
+		else
+			std::fprintf( stderr, "Ignoring unknown argument %s\n", arg.c_str() );
+	}
+
+	std::vector<glm::vec3> points( numPoints );
+	for ( int i = 0; i < numPoints; i++ )
+		points[i] = glm::vec3( i % 101, i % 37, i % 53 ) * 0.1f;
+	std::vector<glm::vec3> animated( numPoints );
+
+	std::vector<glm::vec3> positions;
+	std::vector<int> indices;
+	createSphere( 128, positions, indices );
+	MeshletSet set;
+	buildMeshlets( positions, indices, 0, indices.size(), set );
+	std::vector<MeshletInstance> instances;
+	for ( int z = 0; z < 16; z++ )
+	{
+		for ( int x = 0; x < 16; x++ )
+		{
+			glm::vec3 position( ( x - 8.0f ) * 4.0f, 1.0f, ( z - 8.0f ) * 4.0f );
+			MeshletInstance instance = { &set, 0, set.size(), composeAffine( position, orientationToQuat( glm::vec3( 0.0f, x * 37.0f + z * 11.0f, 0.0f ) ),
+			                                                                 glm::vec3( 1.0f ) ), true };
+			instances.push_back( instance );
+		}
+	}
+	glm::vec3 eye( 0.0f, 6.0f, 38.0f );
+	MeshletCullView view = MeshletCullView::perspective( glm::perspective( glm::radians( 60.0f ), 4.0f / 3.0f, 0.1f, 200.0f ) *
+	                                                     glm::lookAt( eye, glm::vec3( 0.0f ), glm::vec3( 0.0f, 1.0f, 0.0f ) ), eye );
+	std::vector<std::vector<MeshletDrawRange>> ranges;
+
+	Workload workloads[3];
+	workloads[0].name = "parallelFor over points";
+	workloads[0].run = [&]( JobSystem& jobs )
+	{
+		jobs.parallelFor( makeSpan( points ), 4096, [&]( Span<glm::vec3> piece, size_t offset )
+		{
+			for ( size_t i = 0; i < piece.size(); i++ )
+			{
+				glm::vec3 p = piece[i];
+				for ( int round = 0; round < 4; round++ )
+					p = glm::vec3( std::sin( p.y ) + p.z * 0.5f, std::cos( p.z ) + p.x * 0.5f, std::sin( p.x ) * std::cos( p.y ) );
+				animated[offset + i] = p;
+			}
+		} );
+		double sum = 0.0;
+		for ( const glm::vec3& p : animated )
+			sum += p.x + p.y + p.z;
+		return sum;
+	};
+	std::unique_ptr<MeshletCuller> culler;
+	unsigned int cullerThreads = 0;
+	workloads[1].name = "cluster culling";
+	workloads[1].run = [&]( JobSystem& jobs )
+	{
+		// the culler keeps a system of its own for more than one thread, so it gets one of the same size
+		if ( !culler || cullerThreads != jobs.size() )
+		{
+			culler.reset( new MeshletCuller( jobs.size() ) );
+			cullerThreads = jobs.size();
+		}
+		culler->cull( view, instances, ranges );
+		double sum = 0.0;
+		for ( const std::vector<MeshletDrawRange>& instance : ranges )
+			for ( const MeshletDrawRange& range : instance )
+				sum += range.numIndices;
+		return sum;
+	};
+	workloads[2].name = "fork-join job graph";
+	workloads[2].run = [&]( JobSystem& jobs )
+	{
+		long long sum = 0;
+		JobSystem::JobHandle root = jobs.create( nullptr );
+		sumRange( jobs, root, 0, numLeaves, &sum );
+		jobs.run( root );
+		jobs.wait( root );
+		return (double)sum;
+	};
+
+	std::printf( "up to %d threads (%u hardware), %d points, %zu clusters in %zu instances, %d leaves, %d runs each\n\n", maxThreads,
+	             std::thread::hardware_concurrency(), numPoints, set.size() * instances.size(), instances.size(), numLeaves, iterations );
+
+	for ( int threads = 1; threads <= maxThreads; threads++ )
+	{
+		JobSystem jobs( threads );
+		for ( Workload& workload : workloads )
+		{
+			double checksum = workload.run( jobs ); // untimed, so the workers are up and the memory is touched
+			Clock::time_point start = Clock::now();
+			for ( int i = 0; i < iterations; i++ )
+				workload.run( jobs );
+			workload.ms.push_back( std::chrono::duration<double, std::milli>( Clock::now() - start ).count() / iterations );
+			workload.checksums.push_back( checksum );
+		}
+	}
+
+	bool same = true;
+	for ( Workload& workload : workloads )
+	{
+		std::printf( "%s:\n  %7s %10s %9s %11s\n", workload.name, "threads", "ms", "speedup", "efficiency" );
+		for ( int t = 0; t < maxThreads; t++ )
+		{
+			double speedup = workload.ms[0] / workload.ms[t];
+			std::printf( "  %7d %10.2f %8.2fx %10.0f%%\n", t + 1, workload.ms[t], speedup, 100.0 * speedup / ( t + 1 ) );
+			same = same && workload.checksums[t] == workload.checksums[0];
+		}
+		std::printf( "\n" );
+	}
+	size_t graphJobs = 4 * (size_t)numLeaves - 2;
+	std::printf( "fork-join graph: %zu jobs, %.2f million jobs per second on 1 thread\n", graphJobs, graphJobs / workloads[2].ms[0] / 1000.0 );
+	std::printf( "results %s across thread counts\n", same ? "identical" : "DIFFERENT" );
+	return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,189 @@
+/*
+ * Microbenchmark for the light animation in Scene::update: the original loop over the light structs
+ * (copy each light out, glm::sin/cos, write it back) against LightStore::animate on the same lights,
+ * with and without copying the results back into the structs like Scene::update does.
+ *
+ * usage: lightbench [-iterations N]
+ *
+ *   -iterations N  frames to animate per run (default: enough for about 20 million light updates)
+ *
+ * Runs 1k, 10k and 100k lights, half of them point lights and half spot lights, one in eight not moving.
+ * Prints nanoseconds per light for each variant and the largest difference from the original's positions.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "../scene/lightstore.hpp"
+#include "../scene/scene.hpp"
+
+#define LIGHTBENCH_TIMESTEP ( 1.0f / 60.0f )
+
+typedef std::chrono::steady_clock Clock;
+
+// keeps the compiler from dropping animation whose results are never read
+volatile float sink;
+
+struct Lights
+{
+	std::vector<Scene::PointLight> pointlights;
+	std::vector<Scene::SpotLight> spotlights;
+	LightStore store;
+};
+
+void createLights( Lights& lights, int count )
+{
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> position( -20.0f, 20.0f );
+	std::uniform_real_distribution<float> velocity( 0.1f, 3.0f );
+
+	for ( int i = 0; i < count; i++ )
+	{
+		glm::vec3 p( position( random ), position( random ) * 0.25f, position( random ) );
+		float v = i % 8 == 7 ? 0.0f : velocity( random );
+		if ( i % 2 == 0 )
+		{
+			Scene::PointLight light = Scene::PointLight();
+			light.initialPosition = light.position = p;
+			light.velocity = v;
+			lights.pointlights.push_back( light );
+			lights.store.addPointLight( p, v );
+		}
+		else
+		{
+			Scene::SpotLight light;
+			light.initialPosition = light.position = p;
+			light.direction = glm::vec3( 0.0f, -1.0f, 0.0f );
+			light.velocity = v;
+			lights.spotlights.push_back( light );
+			lights.store.addSpotLight( p, light.direction, v );
+		}
+	}
+}
+
+// Scene::update as it was before the light store
+void animateStructs( Lights& lights, float totalTime )
+{
+	for ( int i = 0; i < lights.pointlights.size(); i++ )
+	{
+		Scene::PointLight p = lights.pointlights[i];
+		if ( p.velocity > 0 )
+		{
+			p.position = p.initialPosition + 5.0f * glm::vec3( glm::sin( totalTime * p.velocity ), 0, glm::cos( totalTime * p.velocity ) );
+			lights.pointlights[i] = p;
+		}
+	}
+
+	for ( int i = 0; i < lights.spotlights.size(); i++ )
+	{
+		Scene::SpotLight s = lights.spotlights[i];
+		if ( s.velocity > 0 )
+		{
+			s.direction = glm::vec3( glm::sin( totalTime * s.velocity ), -2.0f, glm::cos( totalTime * s.velocity ) );
+			s.position = s.initialPosition + glm::vec3( glm::sin( totalTime * -s.velocity ), 0, glm::cos( totalTime * -s.velocity ) );
+			lights.spotlights[i] = s;
+		}
+	}
+}
+
+// LightStore::animate plus the copy back into the structs, as Scene::update does it now
+void animateStore( Lights& lights, float totalTime, bool writeBack )
+{
+	lights.store.animate( totalTime );
+	if ( !writeBack )
+		return;
+
+	const LightStore::PointLights& points = lights.store.getPointLights();
+	for ( size_t i = 0; i < lights.pointlights.size(); i++ )
+	{
+		if ( points.velocity[i] > 0 )
+			lights.pointlights[i].position = glm::vec3( points.x[i], points.y[i], points.z[i] );
+	}
+
+	const LightStore::SpotLights& spots = lights.store.getSpotLights();
+	for ( size_t i = 0; i < lights.spotlights.size(); i++ )
+	{
+		if ( spots.velocity[i] > 0 )
+		{
+			lights.spotlights[i].position = glm::vec3( spots.x[i], spots.y[i], spots.z[i] );
+			lights.spotlights[i].direction = glm::vec3( spots.directionX[i], spots.directionY[i], spots.directionZ[i] );
+		}
+	}
+}
+
+// nanoseconds per light update; the variants run on their own copy of the lights so caches start out equally cold
+template <typename Animate>
+double timeRuns( Lights lights, int count, int iterations, Animate animate )
+{
+	Clock::time_point start = Clock::now();
+	for ( int i = 0; i < iterations; i++ )
+		animate( lights, i * LIGHTBENCH_TIMESTEP );
+	double ns = std::chrono::duration<double, std::nano>( Clock::now() - start ).count();
+	if ( !lights.pointlights.empty() )
+		sink = lights.pointlights[0].position.x + lights.store.getPointLightPosition( 0 ).x;
+	return ns / ( (double)count * iterations );
+}
+
+float largestDifference( const Lights& lights )
+{
+	float difference = 0.0f;
+	for ( size_t i = 0; i < lights.pointlights.size(); i++ )
+	{
+		glm::vec3 d = glm::abs( lights.pointlights[i].position - lights.store.getPointLightPosition( i ) );
+		difference = std::max( difference, std::max( d.x, std::max( d.y, d.z ) ) );
+	}
+	for ( size_t i = 0; i < lights.spotlights.size(); i++ )
+	{
+		glm::vec3 d = glm::abs( lights.spotlights[i].position - lights.store.getSpotLightPosition( i ) );
+		glm::vec3 e = glm::abs( lights.spotlights[i].direction - lights.store.getSpotLightDirection( i ) );
+		difference = std::max( difference, std::max( glm::max( d.x, e.x ), std::max( glm::max( d.y, e.y ), glm::max( d.z, e.z ) ) ) );
+	}
+	return difference;
+}
+
+int main( int argc, char ** argv )
+{
+	int iterations = 0;
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string arg( argv[i] );
+		if ( arg == "-iterations" && i + 1 < argc )
+			iterations = std::atoi( argv[++i] );
+		else
+			std::fprintf( stderr, "Ignoring unknown argument %s\n", arg.c_str() );
+	}
+
+#ifdef __SSE2__
+	std::printf( "LightStore::animate uses SSE2, %d lights per batch\n\n", LIGHT_STORE_BATCH );
+#else
+	std::printf( "LightStore::animate uses scalar code (no SSE2)\n\n" );
+#endif
+	std::printf( "%8s %10s %14s %14s %18s %8s %12s\n", "lights", "frames", "structs ns", "store ns", "store+copy ns", "speedup", "max error" );
+
+	const int counts[] = { 1000, 10000, 100000 };
+	for ( int count : counts )
+	{
+		int frames = iterations > 0 ? iterations : std::max( 10, 20000000 / count );
+
+		Lights lights;
+		createLights( lights, count );
+
+		double structsNs = timeRuns( lights, count, frames, []( Lights& l, float t ) { animateStructs( l, t ); } );
+		double storeNs = timeRuns( lights, count, frames, []( Lights& l, float t ) { animateStore( l, t, false ); } );
+		double copyNs = timeRuns( lights, count, frames, []( Lights& l, float t ) { animateStore( l, t, true ); } );
+
+		// both variants at the same, fairly late time, where the range reduction matters most
+		float lateTime = ( frames - 1 ) * LIGHTBENCH_TIMESTEP;
+		animateStructs( lights, lateTime );
+		lights.store.animate( lateTime );
+
+		std::printf( "%8d %10d %14.2f %14.2f %18.2f %7.1fx %12.2e\n", count, frames, structsNs, storeNs, copyNs,
+		             structsNs / copyNs, largestDifference( lights ) );
+	}
+	return EXIT_SUCCESS;
+}
@@ -6,10 +6,13 @@
 
 #include <SFML/OpenGL.hpp>
 #include <SFML/Window.hpp>
+#include <iostream>
 #include <string>
 #include "../renderer/camera.hpp"
+#include "../renderer/camerapath.hpp"
 #include "../renderer/renderer.hpp"
 #include "../scene/scene.hpp"
+#include "../scene/threadpool.hpp"
 
 int main( int argc, char ** argv )
 {
@@ -46,8 +49,119 @@ int main( int argc, char ** argv )
 		return EXIT_FAILURE;
 	}
 
+	// optional arguments before the scene file:
+	//   -replay file   fly the camera along a recorded path with a fixed timestep, then print timings and exit
+	//   -record file   where R-toggled recordings are saved (default camera.path)
+	//   -stream bytes  show bounding boxes right away and stream the models in, at most this many bytes per frame
+	//   -compress      block compress textures (cached next to each texture as <name>.bc)
+	//   -batch         draw the material pass in batches over texture arrays
+	//   -watch         rebuild shaders when their files change, without restarting
+	//   -permutations  use shaders specialized per light type and material textures
+	//   -prepass       lay down depth first and fill the G-buffer with GL_EQUAL (Z toggles it)
+	//   -overdraw      count fragments shaded per pixel (O toggles it, P prints the counters)
+	//   -nolod         draw every model at full detail (L toggles levels of detail)
+	//   -noclusters    draw whole levels instead of the visible clusters (C toggles cluster culling)
+	//   -occlusion     skip what a recent frame's depth hides (K toggles occlusion culling)
+	//   -softocclusion skip what the scene's occluders hide, drawn on the CPU (J toggles it)
+	//   -serial        update and prepare each frame on the render thread instead of overlapping them with the last one
+	//   -novsync       don't wait for the display's refresh, to measure how many frames the pipeline keeps up
+	CameraPath replayPath;
+	bool replaying = false;
+	std::string recordFile = "camera.path";
+	size_t streamBudget = 0;
+	bool compressTextures = false;
+	bool batching = false;
+	bool watchShaders = false;
+	bool permutations = false;
+	bool depthPrepass = false;
+	bool measureOverdraw = false;
+	bool levelOfDetail = true;
+	bool clusterCulling = true;
+	bool occlusionCulling = false;
+	bool softwareOcclusion = false;
+	bool pipelined = true;
+	bool verticalSync = true;
+	// the last two arguments are the scene file and the shader path, so options and their values come before them
+	for ( int i = 1; i < argc - 2; i++ )
+	{
+		std::string arg( argv[i] );
+		if ( arg == "-replay" && i + 1 < argc - 2 )
+		{
+			if ( !replayPath.loadFromFile( argv[++i] ) || replayPath.empty() )
+			{
+				sf::err() << "FATAL ERROR: Failed to load camera path" << std::endl;
+				window.close();
+				return EXIT_FAILURE;
+			}
+			replaying = true;
+		}
+		else if ( arg == "-record" && i + 1 < argc - 2 )
+		{
+			recordFile = argv[++i];
+		}
+		else if ( arg == "-stream" && i + 1 < argc - 2 )
+		{
+			streamBudget = std::strtoul( argv[++i], NULL, 10 );
+		}
+		else if ( arg == "-compress" )
+		{
+			compressTextures = true;
+		}
+		else if ( arg == "-batch" )
+		{
+			batching = true;
+		}
+		else if ( arg == "-watch" )
+		{
+			watchShaders = true;
+		}
+		else if ( arg == "-permutations" )
+		{
+			permutations = true;
+		}
+		else if ( arg == "-prepass" )
+		{
+			depthPrepass = true;
+		}
+		else if ( arg == "-overdraw" )
+		{
+			measureOverdraw = true;
+		}
+		else if ( arg == "-nolod" )
+		{
+			levelOfDetail = false;
+		}
+		else if ( arg == "-noclusters" )
+		{
+			clusterCulling = false;
+		}
+		else if ( arg == "-occlusion" )
+		{
+			occlusionCulling = true;
+		}
+		else if ( arg == "-softocclusion" )
+		{
+			softwareOcclusion = true;
+		}
+		else if ( arg == "-serial" )
+		{
+			pipelined = false;
+		}
+		else if ( arg == "-novsync" )
+		{
+			verticalSync = false;
+		}
+		else
+		{
+			sf::err() << "FATAL ERROR: Unknown option, or option missing its value: " << arg << std::endl;
+			window.close();
+			return EXIT_FAILURE;
+		}
+	}
+
 	// setup the renderer
 	Scene scene;
+	scene.setTextureCompression( compressTextures );
 	if ( !scene.loadFromFile( filename ) )
 	{
 		sf::err() << "FATAL ERROR: Failed to load scene file" << std::endl;
@@ -58,6 +172,16 @@ int main( int argc, char ** argv )
 
 	Camera camera;
 	Renderer renderer;
+	renderer.setStreaming( streamBudget > 0, streamBudget );
+	renderer.setBatching( batching );
+	renderer.setShaderHotReload( watchShaders );
+	renderer.setShaderPermutations( permutations );
+	renderer.setDepthPrepass( depthPrepass );
+	renderer.setOverdrawMeasurement( measureOverdraw );
+	renderer.setLevelOfDetail( levelOfDetail );
+	renderer.setClusterCulling( clusterCulling );
+	renderer.setOcclusionCulling( occlusionCulling );
+	renderer.setSoftwareOcclusion( softwareOcclusion );
 	if ( !renderer.initialize(camera, scene, shaderPath) )
 	{
 		sf::err() << "FATAL ERROR: Failed to initialize renderer" << std::endl;
@@ -65,6 +189,60 @@ int main( int argc, char ** argv )
 		return EXIT_FAILURE;
 	}
 
+	// frame times must not be capped by the display when comparing replays
+	if ( replaying || !verticalSync )
+		window.setVerticalSyncEnabled( false );
+
+	CameraPath recordedPath;
+	bool recording = false;
+	float recordTime = 0.0f;
+	float nextKeyframeTime = 0.0f;
+	int replayFrame = 0;
+
+	// moves the camera and the scene on by deltaTime; false once the replay has run out
+	auto update = [&]( float deltaTime )
+	{
+		bool more = true;
+		if ( replaying )
+		{
+			// replays ignore the wall clock, so every run renders the same frames
+			float replayTime = replayFrame * CAMERA_PATH_TIMESTEP;
+			more = replayTime <= replayPath.getDuration();
+			replayPath.apply( camera, replayPath.getKeyframes().front().time + replayTime );
+			scene.update( CAMERA_PATH_TIMESTEP );
+			replayFrame++;
+		}
+		else
+		{
+			camera.handleInput(deltaTime);
+			scene.update(deltaTime);
+		}
+
+		if ( recording )
+		{
+			if ( recordTime >= nextKeyframeTime )
+			{
+				recordedPath.addKeyframe( recordTime, camera.getEye(), camera.getDirection() );
+				nextKeyframeTime += CAMERA_PATH_RECORD_INTERVAL;
+			}
+			recordTime += deltaTime;
+		}
+		return more;
+	};
+
+	/*
+	 * Pipelined, the worker moves the scene on and prepares frame N+1 (see Renderer::prepareFrame) while this
+	 * thread, which owns the window and the GL context, draws and displays frame N. Both only meet between
+	 * frames: events and the toggles they set are handled while the worker is idle, and the prepared frame is
+	 * swapped in before the worker gets the next one.
+	 */
+	ThreadPool frameWorker( 1 );
+	if ( pipelined )
+	{
+		renderer.syncFrame();
+		renderer.prepareFrame( camera, scene );
+	}
+
 	sf::Clock clock;
 
 	// main loop - handle user input
@@ -89,6 +267,75 @@ int main( int argc, char ** argv )
 					 * like saving a screenshot, that you want to trigger immediately and not poll
 					 * for every frame, you should put that here.
 					 */
+					if ( event.key.code == sf::Keyboard::R && !replaying )
+					{
+						// toggle camera path recording; the path is saved when recording stops
+						recording = !recording;
+						if ( recording )
+						{
+							recordedPath.clear();
+							recordTime = 0.0f;
+							nextKeyframeTime = 0.0f;
+							std::cout << "Recording camera path" << std::endl;
+						}
+						else if ( recordedPath.saveToFile( recordFile ) )
+						{
+							std::cout << "Saved camera path to " << recordFile << std::endl;
+						}
+					}
+					if ( event.key.code == sf::Keyboard::M )
+					{
+						// compare mipmapped and base-level texture filtering (see the texture MB counter)
+						renderer.setMipmapping( !renderer.mipmapping );
+						std::cout << "Mipmapping " << ( renderer.mipmapping ? "on" : "off" ) << std::endl;
+					}
+					if ( event.key.code == sf::Keyboard::H )
+					{
+						// compare tone mapping with auto-exposure and the clipped HDR target
+						renderer.setToneMapping( !renderer.toneMapping );
+						std::cout << "Tone mapping " << ( renderer.toneMapping ? "on" : "off" ) << std::endl;
+					}
+					if ( event.key.code == sf::Keyboard::Z )
+					{
+						renderer.setDepthPrepass( !renderer.depthPrepass );
+						std::cout << "Depth pre-pass " << ( renderer.depthPrepass ? "on" : "off" ) << std::endl;
+					}
+					if ( event.key.code == sf::Keyboard::O )
+					{
+						// the overdraw counters show whether the pre-pass pays off for this scene
+						renderer.setOverdrawMeasurement( !renderer.measureOverdraw );
+						std::cout << "Overdraw measurement " << ( renderer.measureOverdraw ? "on" : "off" ) << std::endl;
+					}
+					if ( event.key.code == sf::Keyboard::L )
+					{
+						// the triangles drawn counter shows what the simplified levels save
+						renderer.setLevelOfDetail( !renderer.levelOfDetail );
+						std::cout << "Level of detail " << ( renderer.levelOfDetail ? "on" : "off" ) << std::endl;
+					}
+					if ( event.key.code == sf::Keyboard::C )
+					{
+						// the clusters culled counters show what each pass skips
+						renderer.setClusterCulling( !renderer.clusterCulling );
+						std::cout << "Cluster culling " << ( renderer.clusterCulling ? "on" : "off" ) << std::endl;
+					}
+					if ( event.key.code == sf::Keyboard::K )
+					{
+						// the occlusion counters show the draws and triangles a recent frame's depth hides
+						renderer.setOcclusionCulling( !renderer.occlusionCulling );
+						std::cout << "Occlusion culling " << ( renderer.occlusionCulling ? "on" : "off" ) << std::endl;
+					}
+					if ( event.key.code == sf::Keyboard::J )
+					{
+						// the same counters, with the scene's occluders drawn on the CPU for the current view
+						renderer.setSoftwareOcclusion( !renderer.softwareOcclusion );
+						std::cout << "Software occlusion culling " << ( renderer.softwareOcclusion ? "on" : "off" ) << std::endl;
+					}
+					if ( event.key.code == sf::Keyboard::P )
+					{
+						// dump the rolling averages and the recent frames as a Chrome trace
+						renderer.profiler.printSummary();
+						renderer.profiler.writeChromeTrace( "profile.json" );
+					}
 					 break;
 
 				case sf::Event::Resized:
@@ -104,23 +351,72 @@ int main( int argc, char ** argv )
 			}
 		}
 
+		renderer.profiler.beginFrame();
+
 		// update the camera position and orientation
         float deltaTime = clock.restart().asSeconds();
-		camera.handleInput(deltaTime);
-        scene.update(deltaTime);
-
-		renderer.render( camera, scene );
+		bool more = true;
+		Profiler::Clock::time_point updateStart, updateEnd;
+		std::future<void> next;
+		if ( pipelined )
+		{
+			renderer.syncFrame();
+			renderer.swapFrames( camera, scene );
+			next = frameWorker.submit( [&]()
+			{
+				updateStart = Profiler::Clock::now();
+				more = update( deltaTime );
+				updateEnd = Profiler::Clock::now();
+				renderer.prepareFrame( camera, scene );
+			} );
+		}
+		else
+		{
+			Profiler::ScopedTimer timer( renderer.profiler, "update" );
+			more = update( deltaTime );
+		}
 
-		float frameTime = clock.getElapsedTime().asSeconds();
+		{
+			Profiler::ScopedTimer timer( renderer.profiler, "render" );
+			if ( pipelined )
+				renderer.renderFrame();
+			else
+				renderer.render( camera, scene );
+		}
 
 		// if you want to show a frame rate counter, you can use sfml's 2D graphics library
 		// you will need to provide a font file in the location where your code will run
 		// be careful though, as SFML/Graphics will override OpenGL settings!
+		// frame times are collected by the profiler instead; press P to print them
 
 		// sfml handles presenting the frame for you
-		window.display();
+		{
+			Profiler::ScopedTimer timer( renderer.profiler, "display" );
+			window.display();
+		}
+
+		if ( next.valid() )
+		{
+			// the time the render thread sits idle because the next frame isn't ready
+			{
+				Profiler::ScopedTimer timer( renderer.profiler, "wait" );
+				next.get();
+			}
+			renderer.profiler.addCpuTime( "update", updateStart, updateEnd );
+		}
+
+		if ( !more )
+		{
+			renderer.profiler.printSummary();
+			running = false;
+		}
+
+		renderer.profiler.endFrame();
 	}
 
+	if ( recording && recordedPath.saveToFile( recordFile ) )
+		std::cout << "Saved camera path to " << recordFile << std::endl;
+
 	renderer.release();
 
 	window.close();
@@ -0,0 +1,239 @@
+/*
+ * Microbenchmark and check of the cluster culling in scene/meshlet.hpp, on the CPU only. A dense sphere
+ * is split into clusters, then a grid of instances of it is culled against a camera and against a sun
+ * shadow view:
+ *   - scalar code on one thread,
+ *   - SSE2 on one thread,
+ *   - SSE2 on the shared job system.
+ *
+ * usage: meshletbench [-rings N] [-instances N] [-iterations N]
+ *
+ *   -rings N       rings of the sphere; it has 4 N^2 triangles (default: 128)
+ *   -instances N   instances per side of the grid (default: 16)
+ *   -iterations N  culls to average over (default: 20)
+ *
+ * Prints the cluster sizes, the culled cluster statistics and microseconds per cull for each variant. It
+ * checks that the clusters respect their limits and hold every triangle once, that every variant emits
+ * the same ranges, and that no culled cluster has a triangle that faces the camera inside its frustum.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../scene/meshlet.hpp"
+#include "../scene/transform.hpp"
+
+typedef std::chrono::steady_clock Clock;
+typedef std::vector<std::vector<MeshletDrawRange>> Ranges;
+
+void createSphere( int rings, std::vector<glm::vec3>& positions, std::vector<int>& indices )
+{
+	int segments = rings * 2;
+	for ( int r = 0; r <= rings; r++ )
+	{
+		for ( int s = 0; s <= segments; s++ )
+		{
+			// the seam and the poles repeat positions exactly, so the sphere welds shut
+			float theta = 3.14159265f * r / rings, phi = 2.0f * 3.14159265f * ( s % segments ) / segments;
+			float ring = ( r == 0 || r == rings ) ? 0.0f : std::sin( theta );
+			positions.push_back( glm::vec3( ring * std::cos( phi ), std::cos( theta ), ring * std::sin( phi ) ) );
+		}
+	}
+
+	// counter-clockwise seen from outside
+	for ( int r = 0; r < rings; r++ )
+	{
+		for ( int s = 0; s < segments; s++ )
+		{
+			int a = r * ( segments + 1 ) + s, b = a + 1, c = a + segments + 1, d = c + 1;
+			int quad[6] = { a, b, c, b, d, c };
+			indices.insert( indices.end(), quad, quad + 6 );
+		}
+	}
+}
+
+// false if a cluster breaks its limits or the clusters don't hold every original triangle exactly once
+bool checkClusters( const std::vector<int>& original, const std::vector<int>& indices, const MeshletSet& set, double& averageVertices )
+{
+	size_t vertexSum = 0;
+	for ( size_t i = 0; i < set.size(); i++ )
+	{
+		std::set<int> vertices( indices.begin() + set.firstIndex[i], indices.begin() + set.firstIndex[i] + set.numIndices[i] );
+		vertexSum += vertices.size();
+		if ( vertices.size() > MESHLET_MAX_VERTICES || set.numIndices[i] > 3 * MESHLET_MAX_TRIANGLES )
+			return false;
+	}
+	averageVertices = (double)vertexSum / set.size();
+
+	std::multiset<std::vector<int>> before, after;
+	for ( size_t i = 0; i < original.size(); i += 3 )
+	{
+		before.insert( std::vector<int>( original.begin() + i, original.begin() + i + 3 ) );
+		after.insert( std::vector<int>( indices.begin() + i, indices.begin() + i + 3 ) );
+	}
+	return before == after;
+}
+
+/*
+ * Triangles of culled clusters that face the eye and aren't entirely outside one of the frustum planes;
+ * any of them could be visible, so there must be none
+ */
+size_t missedTriangles( const MeshletCullView& view, const std::vector<MeshletInstance>& instances, const Ranges& ranges,
+                        const std::vector<glm::vec3>& positions, const std::vector<int>& indices )
+{
+	size_t missed = 0;
+	for ( size_t i = 0; i < instances.size(); i++ )
+	{
+		std::vector<unsigned char> drawn( indices.size() / 3, 0 );
+		for ( const MeshletDrawRange& range : ranges[i] )
+			std::fill( drawn.begin() + range.firstIndex / 3, drawn.begin() + ( range.firstIndex + range.numIndices ) / 3, 1 );
+
+		const glm::mat4x3& m = instances[i].world;
+		for ( size_t t = 0; t < drawn.size(); t++ )
+		{
+			if ( drawn[t] )
+				continue;
+			glm::vec3 p[3];
+			for ( int k = 0; k < 3; k++ )
+				p[k] = m * glm::vec4( positions[indices[t * 3 + k]], 1.0f );
+			glm::vec3 normal = glm::cross( p[1] - p[0], p[2] - p[0] );
+			glm::vec3 toward = view.orthographic ? -view.direction : view.eye - p[0];
+			if ( glm::dot( normal, toward ) <= 0.0f )
+				continue;
+
+			bool outside = false;
+			for ( int k = 0; k < 6 && !outside; k++ )
+			{
+				glm::vec3 n( view.planes[k] );
+				outside = glm::dot( n, p[0] ) + view.planes[k].w < 0.0f && glm::dot( n, p[1] ) + view.planes[k].w < 0.0f &&
+				          glm::dot( n, p[2] ) + view.planes[k].w < 0.0f;
+			}
+			missed += outside ? 0 : 1;
+		}
+	}
+	return missed;
+}
+
+// microseconds per cull
+double timeCulls( MeshletCuller& culler, const MeshletCullView& view, const std::vector<MeshletInstance>& instances, Ranges& ranges,
+                  MeshletCullStats& stats, int iterations )
+{
+	stats = culler.cull( view, instances, ranges ); // untimed, so the range vectors have their memory
+	Clock::time_point start = Clock::now();
+	for ( int i = 0; i < iterations; i++ )
+		stats = culler.cull( view, instances, ranges );
+	return std::chrono::duration<double, std::micro>( Clock::now() - start ).count() / iterations;
+}
+
+size_t drawnIndices( const Ranges& ranges )
+{
+	size_t count = 0;
+	for ( const std::vector<MeshletDrawRange>& instance : ranges )
+		for ( const MeshletDrawRange& range : instance )
+			count += range.numIndices;
+	return count;
+}
+
+bool runView( const char * name, const MeshletCullView& view, const std::vector<MeshletInstance>& instances,
+              const std::vector<glm::vec3>& positions, const std::vector<int>& indices, int iterations )
+{
+	MeshletCuller single( 1 ), pooled( 0 );
+	Ranges scalarRanges, simdRanges, pooledRanges;
+	MeshletCullStats stats;
+
+	single.setSimd( false );
+	double scalarUs = timeCulls( single, view, instances, scalarRanges, stats, iterations );
+	single.setSimd( true );
+	double simdUs = timeCulls( single, view, instances, simdRanges, stats, iterations );
+	double pooledUs = timeCulls( pooled, view, instances, pooledRanges, stats, iterations );
+
+	size_t total = indices.size() * instances.size();
+	std::printf( "%s: %zu clusters, %zu outside the frustum (%.1f%%), %zu back-facing (%.1f%%), %.1f%% of the triangles drawn\n", name,
+	             stats.clusters, stats.frustumCulled, 100.0 * stats.frustumCulled / stats.clusters, stats.coneCulled,
+	             100.0 * stats.coneCulled / stats.clusters, 100.0 * drawnIndices( pooledRanges ) / total );
+	std::printf( "  %-24s %10.1f us\n", "scalar, 1 thread", scalarUs );
+	std::printf( "  %-24s %10.1f us %7.1fx\n", "SSE2, 1 thread", simdUs, scalarUs / simdUs );
+	std::printf( "  %-24s %10.1f us %7.1fx\n", "SSE2, job system", pooledUs, scalarUs / pooledUs );
+
+	bool same = true;
+	for ( size_t i = 0; i < instances.size() && same; i++ )
+	{
+		const std::vector<MeshletDrawRange>& a = scalarRanges[i];
+		same = a.size() == simdRanges[i].size() && a.size() == pooledRanges[i].size();
+		for ( size_t r = 0; r < a.size() && same; r++ )
+		{
+			same = a[r].firstIndex == simdRanges[i][r].firstIndex && a[r].numIndices == simdRanges[i][r].numIndices &&
+			       a[r].firstIndex == pooledRanges[i][r].firstIndex && a[r].numIndices == pooledRanges[i][r].numIndices;
+		}
+	}
+	size_t missed = missedTriangles( view, instances, pooledRanges, positions, indices );
+	std::printf( "  variants %s, %zu possibly visible triangles culled\n\n", same ? "identical" : "DIFFERENT", missed );
+	return same && missed == 0;
+}
+
+int main( int argc, char ** argv )
+{
+	int rings = 128;
+	int side = 16;
+	int iterations = 20;
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string arg( argv[i] );
+		if ( arg == "-rings" && i + 1 < argc )
+			rings = std::max( 2, std::atoi( argv[++i] ) );
+		else if ( arg == "-instances" && i + 1 < argc )
+			side = std::max( 1, std::atoi( argv[++i] ) );
+		else if ( arg == "-iterations" && i + 1 < argc )
+			iterations = std::max( 1, std::atoi( argv[++i] ) );
+		else
+			std::fprintf( stderr, "Ignoring unknown argument %s\n", arg.c_str() );
+	}
+
+	std::vector<glm::vec3> positions;
+	std::vector<int> indices;
+	createSphere( rings, positions, indices );
+	std::vector<int> original = indices;
+
+	MeshletSet set;
+	Clock::time_point start = Clock::now();
+	buildMeshlets( positions, indices, 0, indices.size(), set );
+	double buildMs = std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+
+	double averageVertices = 0.0;
+	bool valid = checkClusters( original, indices, set, averageVertices );
+	std::printf( "%zu triangles into %zu clusters in %.1f ms, %.1f triangles and %.1f vertices per cluster, %s\n\n", indices.size() / 3,
+	             set.size(), buildMs, indices.size() / 3.0 / set.size(), averageVertices, valid ? "valid" : "INVALID" );
+
+	// a grid of spheres on the ground, some rotated and scaled, looked at from one side of it
+	std::vector<MeshletInstance> instances;
+	for ( int z = 0; z < side; z++ )
+	{
+		for ( int x = 0; x < side; x++ )
+		{
+			glm::vec3 position( ( x - side * 0.5f ) * 4.0f, 1.0f, ( z - side * 0.5f ) * 4.0f );
+			glm::quat rotation = orientationToQuat( glm::vec3( 0.0f, (float)( ( x * 37 + z * 11 ) % 360 ), 0.0f ) );
+			MeshletInstance instance = { &set, 0, set.size(), composeAffine( position, rotation, glm::vec3( 1.0f + ( x + z ) % 3 * 0.25f ) ), true };
+			instances.push_back( instance );
+		}
+	}
+	std::printf( "%zu instances, %d culls per variant\n\n", instances.size(), iterations );
+
+	glm::vec3 eye( 0.0f, 6.0f, side * 2.0f + 6.0f );
+	glm::mat4 cameraViewProj = glm::perspective( glm::radians( 60.0f ), 4.0f / 3.0f, 0.1f, 200.0f ) *
+	                           glm::lookAt( eye, glm::vec3( 0.0f ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
+	valid = runView( "camera", MeshletCullView::perspective( cameraViewProj, eye ), instances, positions, indices, iterations ) && valid;
+
+	glm::vec3 sun = glm::normalize( glm::vec3( -1.0f, -2.0f, -1.0f ) );
+	glm::mat4 sunViewProj = glm::ortho( -side * 1.0f, side * 1.0f, -side * 1.0f, side * 1.0f, -side * 4.0f, side * 4.0f ) *
+	                        glm::lookAt( glm::vec3( 0.0f ), sun, glm::vec3( 0.0f, 1.0f, 0.0f ) );
+	valid = runView( "sun shadow", MeshletCullView::orthographicView( sunViewProj, sun ), instances, positions, indices, iterations ) && valid;
+
+	return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
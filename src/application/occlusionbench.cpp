@@ -0,0 +1,234 @@
+/*
+ * Microbenchmark and check of the software occlusion rasterizer in scene/occlusionraster.hpp, on the CPU
+ * only. A grid of buildings is drawn as occluders from street level, and a field of small boxes between
+ * them is tested against the depth pyramid built from the result:
+ *   - scalar code on one thread,
+ *   - SSE2 on one thread,
+ *   - AVX on one thread, if the CPU has it,
+ *   - the fastest path on the shared job system.
+ *
+ * usage: occlusionbench [-width N] [-height N] [-buildings N] [-boxes N] [-iterations N]
+ *
+ *   -width N       pixels across the depth buffer (default: 320)
+ *   -height N      pixels down the depth buffer (default: 180)
+ *   -buildings N   buildings per side of the grid (default: 8)
+ *   -boxes N       boxes per side of the field (default: 64)
+ *   -iterations N  frames to average over (default: 50)
+ *
+ * Prints the triangles drawn, microseconds per frame for each variant and the boxes culled. It checks that
+ * every variant gives the same depths, and that no culled box has a point inside the view that can be seen
+ * from the eye past the buildings.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../scene/depthpyramid.hpp"
+#include "../scene/occlusionraster.hpp"
+#include "../scene/transform.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+// the unit cube [-1, 1]^3, counter-clockwise seen from outside
+const float cubePositions[] = { -1, -1, -1,  1, -1, -1,  -1, 1, -1,  1, 1, -1,  -1, -1, 1,  1, -1, 1,  -1, 1, 1,  1, 1, 1 };
+const int cubeIndices[] = { 0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  0, 1, 4, 1, 5, 4,  2, 6, 3, 3, 6, 7,  0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5 };
+
+struct Box {
+	glm::mat4x3 world;
+	glm::mat4x3 inverse;
+};
+
+glm::mat4x3 inverseAffine( const glm::mat4x3& m )
+{
+	glm::mat3 linear = glm::inverse( glm::mat3( m ) );
+	glm::mat4x3 result( linear );
+	result[3] = -( linear * m[3] );
+	return result;
+}
+
+Box makeBox( const glm::vec3& position, float yaw, const glm::vec3& halfSize )
+{
+	Box box;
+	box.world = composeAffine( position, orientationToQuat( glm::vec3( 0.0f, yaw, 0.0f ) ), halfSize );
+	box.inverse = inverseAffine( box.world );
+	return box;
+}
+
+// whether the segment from eye to point passes through the box before it gets to point
+bool segmentBlocked( const Box& box, const glm::vec3& eye, const glm::vec3& point )
+{
+	glm::vec3 origin = box.inverse * glm::vec4( eye, 1.0f );
+	glm::vec3 direction = box.inverse * glm::vec4( point - eye, 0.0f );
+	float enter = 0.0f, leave = 1.0f;
+	for ( int k = 0; k < 3; k++ )
+	{
+		if ( std::abs( direction[k] ) < 1e-12f )
+		{
+			if ( std::abs( origin[k] ) > 1.0f )
+				return false;
+			continue;
+		}
+		float t0 = ( -1.0f - origin[k] ) / direction[k], t1 = ( 1.0f - origin[k] ) / direction[k];
+		enter = std::max( enter, std::min( t0, t1 ) );
+		leave = std::min( leave, std::max( t0, t1 ) );
+	}
+	return enter <= leave && enter < 0.999f;
+}
+
+/*
+ * Points on the faces of culled boxes that are inside the view and that the segment from the eye reaches without
+ * passing through a building; any of them could be visible, so there must be none
+ */
+size_t visiblePoints( const glm::mat4& viewProj, const glm::vec3& eye, const std::vector<Box>& buildings, const std::vector<Box>& boxes,
+                      const std::vector<bool>& culled )
+{
+	const int samples = 5;
+	size_t visible = 0;
+	for ( size_t b = 0; b < boxes.size(); b++ )
+	{
+		if ( !culled[b] )
+			continue;
+		for ( int face = 0; face < 6; face++ )
+		{
+			for ( int i = 0; i < samples * samples; i++ )
+			{
+				glm::vec3 local;
+				local[face / 2] = ( face % 2 ) ? 1.0f : -1.0f;
+				local[( face / 2 + 1 ) % 3] = -1.0f + 2.0f * ( i % samples ) / ( samples - 1 );
+				local[( face / 2 + 2 ) % 3] = -1.0f + 2.0f * ( i / samples ) / ( samples - 1 );
+				glm::vec3 point = boxes[b].world * glm::vec4( local, 1.0f );
+
+				glm::vec4 clip = viewProj * glm::vec4( point, 1.0f );
+				if ( clip.w <= 0.0f || std::abs( clip.x ) > clip.w || std::abs( clip.y ) > clip.w || std::abs( clip.z ) > clip.w )
+					continue;
+
+				bool blocked = false;
+				for ( size_t o = 0; o < buildings.size() && !blocked; o++ )
+					blocked = segmentBlocked( buildings[o], eye, point );
+				visible += blocked ? 0 : 1;
+			}
+		}
+	}
+	return visible;
+}
+
+// microseconds per frame
+double timeFrames( OcclusionRasterizer& rasterizer, const glm::mat4& viewProj, const std::vector<OccluderMesh>& occluders,
+                   DepthPyramid& pyramid, OcclusionRasterStats& stats, int iterations )
+{
+	stats = rasterizer.rasterize( viewProj, occluders, pyramid ); // untimed, so the bins have their memory
+	Clock::time_point start = Clock::now();
+	for ( int i = 0; i < iterations; i++ )
+		stats = rasterizer.rasterize( viewProj, occluders, pyramid );
+	return std::chrono::duration<double, std::micro>( Clock::now() - start ).count() / iterations;
+}
+
+int main( int argc, char ** argv )
+{
+	int width = 320;
+	int height = 180;
+	int buildingSide = 8;
+	int boxSide = 64;
+	int iterations = 50;
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string arg( argv[i] );
+		if ( arg == "-width" && i + 1 < argc )
+			width = std::max( 1, std::atoi( argv[++i] ) );
+		else if ( arg == "-height" && i + 1 < argc )
+			height = std::max( 1, std::atoi( argv[++i] ) );
+		else if ( arg == "-buildings" && i + 1 < argc )
+			buildingSide = std::max( 1, std::atoi( argv[++i] ) );
+		else if ( arg == "-boxes" && i + 1 < argc )
+			boxSide = std::max( 1, std::atoi( argv[++i] ) );
+		else if ( arg == "-iterations" && i + 1 < argc )
+			iterations = std::max( 1, std::atoi( argv[++i] ) );
+		else
+			std::fprintf( stderr, "Ignoring unknown argument %s\n", arg.c_str() );
+	}
+
+	// buildings on a grid of blocks 10 units apart, some turned, and small boxes scattered over the streets between them
+	float extent = buildingSide * 10.0f;
+	std::vector<Box> buildings, boxes;
+	std::vector<OccluderMesh> occluders;
+	for ( int z = 0; z < buildingSide; z++ )
+	{
+		for ( int x = 0; x < buildingSide; x++ )
+		{
+			float halfHeight = 3.0f + ( x * 7 + z * 3 ) % 5;
+			float yaw = ( x + z ) % 3 == 0 ? 20.0f : 0.0f;
+			buildings.push_back( makeBox( glm::vec3( x * 10.0f - extent * 0.5f + 5.0f, halfHeight, z * 10.0f - extent * 0.5f + 5.0f ), yaw,
+			                              glm::vec3( 3.5f, halfHeight, 3.5f ) ) );
+			OccluderMesh mesh = { cubePositions, 8, cubeIndices, 36, buildings.back().world };
+			occluders.push_back( mesh );
+		}
+	}
+	for ( int z = 0; z < boxSide; z++ )
+	{
+		for ( int x = 0; x < boxSide; x++ )
+		{
+			glm::vec3 position( ( x + 0.5f ) / boxSide * extent - extent * 0.5f, 0.5f, ( z + 0.5f ) / boxSide * extent - extent * 0.5f );
+			boxes.push_back( makeBox( position, (float)( ( x * 37 + z * 11 ) % 90 ), glm::vec3( 0.4f ) ) );
+		}
+	}
+
+	glm::vec3 eye( -extent * 0.5f - 2.0f, 1.7f, -extent * 0.5f + 5.0f * 0.5f );
+	glm::mat4 viewProj = glm::perspective( glm::radians( 60.0f ), (float)width / height, 0.1f, extent * 2.0f ) *
+	                     glm::lookAt( eye, glm::vec3( 0.0f, 1.7f, 0.0f ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
+
+	std::printf( "%zu buildings, %zu boxes, %dx%d pixels, %d frames per variant\n\n", buildings.size(), boxes.size(), width, height, iterations );
+
+	OcclusionRasterizer single( width, height, 1 ), pooled( width, height, 0 );
+	DepthPyramid pyramid;
+	OcclusionRasterStats stats;
+	std::vector<float> reference;
+	bool same = true;
+	double scalarUs = 0.0;
+	OcclusionRasterPath paths[] = { OCCLUSION_RASTER_SCALAR, OCCLUSION_RASTER_SSE2, OCCLUSION_RASTER_AVX };
+	for ( OcclusionRasterPath path : paths )
+	{
+		if ( !single.setPath( path ) )
+		{
+			std::printf( "  %-24s  not available\n", OcclusionRasterizer::pathName( path ) );
+			continue;
+		}
+		double us = timeFrames( single, viewProj, occluders, pyramid, stats, iterations );
+		scalarUs = path == OCCLUSION_RASTER_SCALAR ? us : scalarUs;
+		std::printf( "  %-24s %10.1f us %7.1fx\n", ( std::string( OcclusionRasterizer::pathName( path ) ) + ", 1 thread" ).c_str(), us, scalarUs / us );
+		if ( reference.empty() )
+			reference = single.getDepth();
+		same = same && single.getDepth() == reference;
+	}
+	double pooledUs = timeFrames( pooled, viewProj, occluders, pyramid, stats, iterations );
+	std::printf( "  %-24s %10.1f us %7.1fx\n", ( std::string( OcclusionRasterizer::pathName( pooled.getPath() ) ) + ", job system" ).c_str(),
+	             pooledUs, scalarUs / pooledUs );
+	same = same && pooled.getDepth() == reference;
+
+	std::printf( "\n%zu triangles, %zu drawn after clipping, %zu in tiles\n", stats.triangles, stats.rasterized, stats.binned );
+
+	std::vector<bool> culled( boxes.size() );
+	size_t culledCount = 0, inView = 0;
+	Clock::time_point start = Clock::now();
+	for ( size_t b = 0; b < boxes.size(); b++ )
+	{
+		culled[b] = pyramid.boxOccluded( boxes[b].world, glm::vec3( -1.0f ), glm::vec3( 1.0f ) );
+		culledCount += culled[b] ? 1 : 0;
+	}
+	double testUs = std::chrono::duration<double, std::micro>( Clock::now() - start ).count();
+	for ( const Box& box : boxes )
+	{
+		glm::vec4 clip = viewProj * glm::vec4( box.world[3], 1.0f );
+		inView += ( clip.w > 0.0f && std::abs( clip.x ) <= clip.w && std::abs( clip.y ) <= clip.w ) ? 1 : 0;
+	}
+	std::printf( "%zu boxes culled of %zu with their centre in view, tested in %.1f us\n", culledCount, inView, testUs );
+
+	size_t visible = visiblePoints( viewProj, eye, buildings, boxes, culled );
+	std::printf( "variants %s, %zu visible points on culled boxes\n", same ? "identical" : "DIFFERENT", visible );
+	return same && visible == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
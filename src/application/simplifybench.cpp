@@ -0,0 +1,188 @@
+/*
+ * Microbenchmark and check of the level of detail chains of scene/simplify.hpp, on the CPU only, for a
+ * curved and a flat mesh:
+ *   - a sphere, whose levels have to move away from the original surface,
+ *   - a flat grid, which loses triangles without moving at all.
+ *
+ * usage: simplifybench [-rings N] [-grid N] [-iterations N]
+ *
+ *   -rings N       rings of the sphere; it has 4 N^2 triangles (default: 32)
+ *   -grid N        vertices per side of the grid; it has 2 (N - 1)^2 triangles (default: 41)
+ *   -iterations N  chains to build for the timing (default: 5)
+ *
+ * Prints milliseconds per chain and, per level, the triangles, the stored error and the largest distance
+ * from an original vertex to the level measured by brute force. It checks that the stored error is never
+ * below the measured one, that it doesn't shrink along the chain, and that the grid's is about zero.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "../scene/simplify.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Mesh {
+	const char * name;
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<int> indices;
+	bool flat;
+};
+
+void createSphere( int rings, Mesh& mesh )
+{
+	int segments = rings * 2;
+	for ( int r = 0; r <= rings; r++ )
+	{
+		for ( int s = 0; s <= segments; s++ )
+		{
+			float theta = 3.14159265f * r / rings, phi = 2.0f * 3.14159265f * ( s % segments ) / segments;
+			float ring = ( r == 0 || r == rings ) ? 0.0f : std::sin( theta );
+			glm::vec3 p( ring * std::cos( phi ), std::cos( theta ), ring * std::sin( phi ) );
+			mesh.positions.push_back( p );
+			mesh.normals.push_back( p );
+		}
+	}
+	for ( int r = 0; r < rings; r++ )
+	{
+		for ( int s = 0; s < segments; s++ )
+		{
+			int a = r * ( segments + 1 ) + s, b = a + 1, c = a + segments + 1, d = c + 1;
+			int quad[6] = { a, b, c, b, d, c };
+			mesh.indices.insert( mesh.indices.end(), quad, quad + 6 );
+		}
+	}
+}
+
+// A side x side vertex grid over [-10, 10]^2 in the xz plane
+void createGrid( int side, Mesh& mesh )
+{
+	for ( int z = 0; z < side; z++ )
+	{
+		for ( int x = 0; x < side; x++ )
+		{
+			mesh.positions.push_back( glm::vec3( 20.0f * x / ( side - 1 ) - 10.0f, 0.0f, 20.0f * z / ( side - 1 ) - 10.0f ) );
+			mesh.normals.push_back( glm::vec3( 0.0f, 1.0f, 0.0f ) );
+		}
+	}
+	for ( int z = 0; z + 1 < side; z++ )
+	{
+		for ( int x = 0; x + 1 < side; x++ )
+		{
+			int a = z * side + x, b = a + 1, c = a + side, d = c + 1;
+			int quad[6] = { a, c, b, b, c, d };
+			mesh.indices.insert( mesh.indices.end(), quad, quad + 6 );
+		}
+	}
+}
+
+float triangleDistance( const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c )
+{
+	glm::vec3 ab = b - a, ac = c - a, normal = glm::cross( ab, ac );
+	float area = glm::dot( normal, normal );
+	if ( area > 0.0f )
+	{
+		// inside the triangle the closest point is the projection onto its plane
+		glm::vec3 ap = p - a;
+		float v = glm::dot( glm::cross( ap, ac ), normal ) / area, w = glm::dot( glm::cross( ab, ap ), normal ) / area;
+		if ( v >= 0.0f && w >= 0.0f && v + w <= 1.0f )
+			return std::fabs( glm::dot( ap, normal ) ) / std::sqrt( area );
+	}
+	// otherwise it is on an edge
+	const glm::vec3 * corners[4] = { &a, &b, &c, &a };
+	float best = -1.0f;
+	for ( int e = 0; e < 3; e++ )
+	{
+		glm::vec3 edge = *corners[e + 1] - *corners[e];
+		float length = glm::dot( edge, edge );
+		float t = length > 0.0f ? glm::clamp( glm::dot( p - *corners[e], edge ) / length, 0.0f, 1.0f ) : 0.0f;
+		float distance = glm::length( p - ( *corners[e] + edge * t ) );
+		best = best < 0.0f ? distance : std::min( best, distance );
+	}
+	return best;
+}
+
+// Largest distance from a vertex of the mesh to the nearest triangle of the level
+float measureError( const Mesh& mesh, const SimplifiedLevel& level )
+{
+	float largest = 0.0f;
+	for ( const glm::vec3& p : mesh.positions )
+	{
+		float nearest = -1.0f;
+		for ( size_t i = 0; i + 2 < level.indices.size(); i += 3 )
+		{
+			float distance = triangleDistance( p, mesh.positions[level.indices[i]], mesh.positions[level.indices[i + 1]], mesh.positions[level.indices[i + 2]] );
+			nearest = nearest < 0.0f ? distance : std::min( nearest, distance );
+		}
+		largest = std::max( largest, nearest );
+	}
+	return largest;
+}
+
+int main( int argc, char ** argv )
+{
+	int rings = 32;
+	int side = 41;
+	int iterations = 5;
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string arg( argv[i] );
+		if ( arg == "-rings" && i + 1 < argc )
+			rings = std::max( 4, std::atoi( argv[++i] ) );
+		else if ( arg == "-grid" && i + 1 < argc )
+			side = std::max( 8, std::atoi( argv[++i] ) );
+		else if ( arg == "-iterations" && i + 1 < argc )
+			iterations = std::max( 1, std::atoi( argv[++i] ) );
+		else
+			std::fprintf( stderr, "Ignoring unknown argument %s\n", arg.c_str() );
+	}
+
+	Mesh meshes[2];
+	meshes[0].name = "sphere";
+	meshes[0].flat = false;
+	createSphere( rings, meshes[0] );
+	meshes[1].name = "grid";
+	meshes[1].flat = true;
+	createGrid( side, meshes[1] );
+
+	bool valid = true;
+	for ( const Mesh& mesh : meshes )
+	{
+		std::vector<glm::vec2> texCoords;
+		std::vector<SimplifiedLevel> levels;
+		Clock::time_point start = Clock::now();
+		for ( int i = 0; i < iterations; i++ )
+			levels = buildLodChain( mesh.positions, mesh.normals, texCoords, mesh.indices );
+		double ms = std::chrono::duration<double, std::milli>( Clock::now() - start ).count() / iterations;
+
+		glm::vec3 boundsMin = mesh.positions[0], boundsMax = mesh.positions[0];
+		for ( const glm::vec3& p : mesh.positions )
+		{
+			boundsMin = glm::min( boundsMin, p );
+			boundsMax = glm::max( boundsMax, p );
+		}
+		float tolerance = 1e-5f * glm::length( boundsMax - boundsMin );
+
+		std::printf( "%s: %zu triangles, %zu levels in %.2f ms\n  %9s %10s %10s\n", mesh.name, mesh.indices.size() / 3, levels.size(), ms,
+		             "triangles", "stored", "measured" );
+		float previous = 0.0f;
+		for ( const SimplifiedLevel& level : levels )
+		{
+			float measured = measureError( mesh, level );
+			std::printf( "  %9zu %10.5f %10.5f\n", level.indices.size() / 3, level.error, measured );
+			valid = valid && level.error >= measured - tolerance && level.error >= previous;
+			valid = valid && ( !mesh.flat || level.error <= tolerance );
+			previous = level.error;
+		}
+		valid = valid && !levels.empty();
+		std::printf( "\n" );
+	}
+	std::printf( "errors %s\n", valid ? "valid" : "INVALID" );
+	return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,157 @@
+/*
+ * Microbenchmark for building model to world matrices: the renderer's original way (glm::translate, three
+ * glm::rotate calls from the orientation in degrees and glm::scale on 4x4 matrices, then the parent's world
+ * matrix times that) against composeAffine from the rotation quaternion the scene now stores, followed by
+ * multiplyAffine, both on 3x4 matrices.
+ *
+ * usage: transformbench [-instances N] [-iterations N]
+ *
+ *   -instances N   instances to build per run (default: 1000000)
+ *   -iterations N  runs to average over (default: 10)
+ *
+ * Every instance has a random position, orientation and scale and one of 256 parents. Prints nanoseconds
+ * per instance, the bytes each stored matrix takes and the largest difference between the two results.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../scene/transform.hpp"
+
+#define TRANSFORMBENCH_PARENTS 256
+
+typedef std::chrono::steady_clock Clock;
+
+// keeps the compiler from dropping matrices that are never read
+volatile float sink;
+
+struct Instances
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> orientations;	// degrees, as in the scene file
+	std::vector<glm::quat> rotations;		// converted once, as the scene loader does
+	std::vector<glm::vec3> scales;
+	std::vector<int> parents;
+
+	std::vector<glm::mat4> parentMatrices;
+	std::vector<glm::mat4x3> parentAffines;
+};
+
+void createInstances( Instances& instances, int count )
+{
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> position( -100.0f, 100.0f );
+	std::uniform_real_distribution<float> angle( -180.0f, 180.0f );
+	std::uniform_real_distribution<float> scale( 0.5f, 2.0f );
+
+	for ( int i = 0; i < TRANSFORMBENCH_PARENTS; i++ )
+	{
+		glm::vec3 p( position( random ), 0.0f, position( random ) );
+		glm::quat r = orientationToQuat( glm::vec3( 0.0f, angle( random ), 0.0f ) );
+		instances.parentAffines.push_back( composeAffine( p, r, glm::vec3( 1.0f ) ) );
+		instances.parentMatrices.push_back( affineToMat4( instances.parentAffines.back() ) );
+	}
+
+	for ( int i = 0; i < count; i++ )
+	{
+		glm::vec3 orientation( angle( random ), angle( random ), angle( random ) );
+		instances.positions.push_back( glm::vec3( position( random ), position( random ), position( random ) ) );
+		instances.orientations.push_back( orientation );
+		instances.rotations.push_back( orientationToQuat( orientation ) );
+		instances.scales.push_back( glm::vec3( scale( random ), scale( random ), scale( random ) ) );
+		instances.parents.push_back( random() % TRANSFORMBENCH_PARENTS );
+	}
+}
+
+// the renderer's model matrix before the scene stored quaternions
+void buildEuler( const Instances& instances, std::vector<glm::mat4>& world )
+{
+	for ( size_t i = 0; i < instances.positions.size(); i++ )
+	{
+		glm::mat4 transform = glm::mat4();
+		transform = glm::translate( transform, instances.positions[i] );
+		transform = glm::rotate( transform, glm::radians( instances.orientations[i].z ), glm::vec3( 0, 0, 1 ) );
+		transform = glm::rotate( transform, glm::radians( instances.orientations[i].y ), glm::vec3( 0, 1, 0 ) );
+		transform = glm::rotate( transform, glm::radians( instances.orientations[i].x ), glm::vec3( 1, 0, 0 ) );
+		transform = glm::scale( transform, instances.scales[i] );
+		world[i] = instances.parentMatrices[instances.parents[i]] * transform;
+	}
+}
+
+// Scene::localMatrix and SceneGraph::update as they are now
+void buildAffine( const Instances& instances, std::vector<glm::mat4x3>& world )
+{
+	for ( size_t i = 0; i < instances.positions.size(); i++ )
+	{
+		glm::mat4x3 local = composeAffine( instances.positions[i], instances.rotations[i], instances.scales[i] );
+		world[i] = multiplyAffine( instances.parentAffines[instances.parents[i]], local );
+	}
+}
+
+// nanoseconds per instance
+template <typename Matrix, typename Build>
+double timeRuns( const Instances& instances, std::vector<Matrix>& world, int iterations, Build build )
+{
+	Clock::time_point start = Clock::now();
+	for ( int i = 0; i < iterations; i++ )
+	{
+		build( instances, world );
+		sink = world[i % world.size()][3][0];
+	}
+	double ns = std::chrono::duration<double, std::nano>( Clock::now() - start ).count();
+	return ns / ( (double)world.size() * iterations );
+}
+
+float largestDifference( const std::vector<glm::mat4>& euler, const std::vector<glm::mat4x3>& affine )
+{
+	float difference = 0.0f;
+	for ( size_t i = 0; i < euler.size(); i++ )
+	{
+		glm::mat4 d = euler[i] - affineToMat4( affine[i] );
+		for ( int c = 0; c < 4; c++ )
+			for ( int r = 0; r < 4; r++ )
+				difference = std::max( difference, glm::abs( d[c][r] ) );
+	}
+	return difference;
+}
+
+int main( int argc, char ** argv )
+{
+	int count = 1000000;
+	int iterations = 10;
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string arg( argv[i] );
+		if ( arg == "-instances" && i + 1 < argc )
+			count = std::max( 1, std::atoi( argv[++i] ) );
+		else if ( arg == "-iterations" && i + 1 < argc )
+			iterations = std::max( 1, std::atoi( argv[++i] ) );
+		else
+			std::fprintf( stderr, "Ignoring unknown argument %s\n", arg.c_str() );
+	}
+
+	Instances instances;
+	createInstances( instances, count );
+	std::vector<glm::mat4> euler( count );
+	std::vector<glm::mat4x3> affine( count );
+
+	// one untimed run each, so both start with their output pages touched
+	buildEuler( instances, euler );
+	buildAffine( instances, affine );
+
+	double eulerNs = timeRuns( instances, euler, iterations, buildEuler );
+	double affineNs = timeRuns( instances, affine, iterations, buildAffine );
+
+	std::printf( "%d instances, %d runs\n\n", count, iterations );
+	std::printf( "%-24s %12s %16s\n", "", "ns/instance", "bytes/matrix" );
+	std::printf( "%-24s %12.2f %16d\n", "euler angles, mat4", eulerNs, (int)sizeof( glm::mat4 ) );
+	std::printf( "%-24s %12.2f %16d\n", "quaternion, 3x4 affine", affineNs, (int)sizeof( glm::mat4x3 ) );
+	std::printf( "\nspeedup %.1fx, max difference %.2e\n", eulerNs / affineNs, largestDifference( euler, affine ) );
+	return EXIT_SUCCESS;
+}
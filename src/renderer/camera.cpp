@@ -10,7 +10,8 @@ Camera::Camera() : eye_pos( glm::vec3( 0.0f, 0.0f, 0.0f ) ),
 				   view_dir( glm::vec3( 0.0f, 0.0f, -1.0f ) ),
 				   up_dir( glm::vec3( 0.0f, 1.0f, 0.0f ) ),
 				   proj_mat( glm::perspective( 45.0f, 1.25f, 1.0f, 1000.0f )),
-                   view_mat(glm::mat4())
+                   view_mat(glm::mat4()),
+                   toggle1(false)
 {
 }
 
@@ -18,7 +19,8 @@ Camera::Camera( float fovy, float aspect, float near, float far )
 	: eye_pos( glm::vec3( 0.0f, 0.0f, 0.0f ) ),
 	  view_dir( glm::vec3( 0.0f, 0.0f, -1.0f ) ),
 	  up_dir( glm::vec3( 0.0f, 1.0f, 0.0f ) ),
-	  proj_mat( glm::perspective( fovy, aspect, near, far ) )
+	  proj_mat( glm::perspective( fovy, aspect, near, far ) ),
+	  toggle1( false )
 {
 }
 
@@ -76,6 +78,13 @@ void Camera::handleInput( float deltaTime )
     view_mat = glm::lookAt(eye_pos, eye_pos + view_dir, up_dir);
 }
 
+void Camera::setView( const glm::vec3& eye, const glm::vec3& direction )
+{
+    eye_pos = eye;
+    view_dir = glm::normalize(direction);
+    view_mat = glm::lookAt(eye_pos, eye_pos + view_dir, up_dir);
+}
+
 // get a read-only handle to the projection matrix
 const glm::mat4& Camera::getProjectionMatrix() const
 {
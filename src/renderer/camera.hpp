@@ -27,6 +27,9 @@ public:
     glm::vec3 getUp() const;
 
 	void handleInput( float deltaTime );
+
+	// place the camera directly, e.g. when following a scripted path
+	void setView( const glm::vec3& eye, const glm::vec3& direction );
     bool toggle1;
 };
 
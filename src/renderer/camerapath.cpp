@@ -0,0 +1,182 @@
+#include "camerapath.hpp"
+#include <SFML/System/Err.hpp>
+#include <fstream>
+#include <limits>
+
+#define SKIP_THRU_CHAR( s , x ) if ( s.good() ) s.ignore( std::numeric_limits<std::streamsize>::max(), x )
+#ifdef _WIN32
+#define SKIP_RETURN( s ) if ( s.good() && s.peek() == '\r' ) s.get();
+#else
+#define SKIP_RETURN ;
+#endif
+
+bool CameraPath::loadFromFile(std::string filename) {
+    std::string token;
+    std::ifstream istream(filename);
+    if (!istream.good()) {
+        sf::err() << "Error opening camera path: " << filename << std::endl;
+        return false;
+    }
+
+    keyframes.clear();
+
+    while (istream.good() && (istream.peek() != EOF)) {
+        istream >> token;
+
+        if (token == "#") {
+            SKIP_THRU_CHAR(istream, '\n');
+            SKIP_RETURN(istream);
+        }
+        else if (token == "keyframe") {
+            SKIP_THRU_CHAR(istream, '{');
+            SKIP_THRU_CHAR(istream, '\n');
+            SKIP_RETURN(istream);
+
+            Keyframe keyframe;
+            keyframe.time = keyframes.empty() ? 0.0f : keyframes.back().time;
+            keyframe.position = glm::vec3(0.0f, 0.0f, 0.0f);
+            keyframe.direction = glm::vec3(0.0f, 0.0f, -1.0f);
+
+            while (istream.good() && istream.peek() != '}') {
+                istream >> token;
+
+                if (token == "time") {
+                    istream >> keyframe.time;
+                }
+                else if (token == "position") {
+                    float x, y, z;
+                    istream >> x;
+                    istream >> y;
+                    istream >> z;
+                    keyframe.position = glm::vec3(x, y, z);
+                }
+                else if (token == "direction") {
+                    float x, y, z;
+                    istream >> x;
+                    istream >> y;
+                    istream >> z;
+                    keyframe.direction = glm::normalize(glm::vec3(x, y, z));
+                }
+                SKIP_THRU_CHAR(istream, '\n');
+                SKIP_RETURN(istream);
+            }
+
+            if (!keyframes.empty() && keyframe.time < keyframes.back().time) {
+                sf::err() << "Camera path keyframes must be in time order (" << keyframe.time << ")" << std::endl;
+                return false;
+            }
+            keyframes.push_back(keyframe);
+
+            SKIP_THRU_CHAR(istream, '\n');
+            SKIP_RETURN(istream);
+        }
+        token.clear();
+    }
+
+    if (istream.fail() && !istream.eof()) {
+        sf::err() << "An error occured while reading camera path; last token was: " << token << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool CameraPath::saveToFile(std::string filename) const {
+    std::ofstream ostream(filename);
+    if (!ostream.good()) {
+        sf::err() << "Error writing camera path: " << filename << std::endl;
+        return false;
+    }
+
+    ostream << "# camera path: " << keyframes.size() << " keyframes, " << getDuration() << " seconds" << std::endl;
+    for (const Keyframe& keyframe : keyframes) {
+        ostream << "keyframe {" << std::endl;
+        ostream << "\ttime " << keyframe.time << std::endl;
+        ostream << "\tposition " << keyframe.position.x << " " << keyframe.position.y << " " << keyframe.position.z << std::endl;
+        ostream << "\tdirection " << keyframe.direction.x << " " << keyframe.direction.y << " " << keyframe.direction.z << std::endl;
+        ostream << "}" << std::endl;
+    }
+
+    return ostream.good();
+}
+
+void CameraPath::addKeyframe(float time, const glm::vec3& position, const glm::vec3& direction) {
+    Keyframe keyframe;
+    keyframe.time = time;
+    keyframe.position = position;
+    keyframe.direction = glm::normalize(direction);
+    keyframes.push_back(keyframe);
+}
+
+void CameraPath::clear() {
+    keyframes.clear();
+}
+
+bool CameraPath::empty() const {
+    return keyframes.empty();
+}
+
+float CameraPath::getDuration() const {
+    return keyframes.empty() ? 0.0f : keyframes.back().time - keyframes.front().time;
+}
+
+const std::vector<CameraPath::Keyframe>& CameraPath::getKeyframes() const {
+    return keyframes;
+}
+
+// Catmull-Rom spline through p1 and p2, t in [0,1]
+static glm::vec3 catmullRom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t) {
+    float t2 = t * t;
+    float t3 = t2 * t;
+    return 0.5f * ((2.0f * p1) +
+                   (p2 - p0) * t +
+                   (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+                   (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+}
+
+void CameraPath::evaluate(float time, glm::vec3& position, glm::vec3& direction) const {
+    if (keyframes.empty()) {
+        return;
+    }
+
+    int last = keyframes.size() - 1;
+    if (time <= keyframes.front().time || last == 0) {
+        position = keyframes.front().position;
+        direction = keyframes.front().direction;
+        return;
+    }
+    if (time >= keyframes.back().time) {
+        position = keyframes.back().position;
+        direction = keyframes.back().direction;
+        return;
+    }
+
+    // find the segment [i, i+1] containing time
+    int i = 0;
+    while (i < last - 1 && keyframes[i + 1].time <= time) {
+        i++;
+    }
+
+    const Keyframe& k0 = keyframes[glm::max(i - 1, 0)];
+    const Keyframe& k1 = keyframes[i];
+    const Keyframe& k2 = keyframes[i + 1];
+    const Keyframe& k3 = keyframes[glm::min(i + 2, last)];
+
+    float span = k2.time - k1.time;
+    float t = (span > 0.0f) ? (time - k1.time) / span : 0.0f;
+
+    position = catmullRom(k0.position, k1.position, k2.position, k3.position, t);
+    direction = catmullRom(k0.direction, k1.direction, k2.direction, k3.direction, t);
+
+    // the spline can pass near zero between opposite directions; fall back to the nearer keyframe
+    if (glm::length(direction) < 1e-4f) {
+        direction = (t < 0.5f) ? k1.direction : k2.direction;
+    }
+    direction = glm::normalize(direction);
+}
+
+void CameraPath::apply(Camera& camera, float time) const {
+    glm::vec3 position, direction;
+    evaluate(time, position, direction);
+    camera.setView(position, direction);
+}
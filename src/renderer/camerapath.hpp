@@ -0,0 +1,52 @@
+#ifndef _CAMERAPATH_H_
+#define _CAMERAPATH_H_
+
+#include <renderer/camera.hpp>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// Timestep used when replaying a path, so every replay renders exactly the same frames
+#define CAMERA_PATH_TIMESTEP (1.0f / 60.0f)
+
+// Spacing of keyframes captured while recording an interactive session
+#define CAMERA_PATH_RECORD_INTERVAL 0.25f
+
+/*
+ * A camera path: keyframes of position and view direction at increasing times, interpolated
+ * with a Catmull-Rom spline. Paths are stored as text, in the same block style as .scene files:
+ *
+ *     keyframe {
+ *         time 0.0
+ *         position 0 1 5
+ *         direction 0 0 -1
+ *     }
+ */
+class CameraPath {
+public:
+    struct Keyframe {
+        float time;
+        glm::vec3 position;
+        glm::vec3 direction;
+    };
+
+    bool loadFromFile(std::string filename);
+    bool saveToFile(std::string filename) const;
+
+    // keyframes must be added in time order
+    void addKeyframe(float time, const glm::vec3& position, const glm::vec3& direction);
+    void clear();
+
+    bool empty() const;
+    float getDuration() const;
+    const std::vector<Keyframe>& getKeyframes() const;
+
+    // times outside the path clamp to the first/last keyframe
+    void evaluate(float time, glm::vec3& position, glm::vec3& direction) const;
+    void apply(Camera& camera, float time) const;
+
+private:
+    std::vector<Keyframe> keyframes;
+};
+
+#endif // #ifndef _CAMERAPATH_H_
@@ -0,0 +1,354 @@
+#define GLEW_STATIC
+
+#include "profiler.hpp"
+#include <GL/glew.h>
+#include <SFML/OpenGL.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+Profiler::History::History() : count(0), next(0), last(0.0)
+{
+}
+
+void Profiler::History::add(double value) {
+    samples[next] = value;
+    next = (next + 1) % PROFILER_HISTORY;
+    if (count < PROFILER_HISTORY) {
+        count++;
+    }
+    last = value;
+}
+
+double Profiler::History::average() const {
+    if (count == 0) {
+        return 0.0;
+    }
+
+    double sum = 0.0;
+    for (unsigned int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    return sum / count;
+}
+
+Profiler::ScopedTimer::ScopedTimer(Profiler& profiler, const std::string& name)
+    : profiler(profiler), name(name), start(Clock::now())
+{
+    profiler.cpuDepth++;
+}
+
+Profiler::ScopedTimer::~ScopedTimer() {
+    profiler.cpuDepth--;
+    profiler.addCpuSample(name, start, Clock::now(), profiler.cpuDepth + 1);
+}
+
+Profiler::Profiler() : epoch(Clock::now()),
+                       gpuTimers(false),
+                       activeQuery(false),
+                       activePass(-1),
+                       cpuDepth(0),
+                       frameCount(0),
+                       frames(PROFILER_TRACE_FRAMES)
+{
+}
+
+bool Profiler::initialize() {
+    // GL_TIME_ELAPSED queries are core in 3.3 and exposed as ARB_timer_query on older contexts (including llvmpipe)
+    gpuTimers = GLEW_ARB_timer_query || GLEW_VERSION_3_3;
+
+    if (!gpuTimers) {
+        std::cout << "Timer queries not supported, GPU pass times will not be recorded." << std::endl;
+    }
+    return gpuTimers;
+}
+
+void Profiler::release() {
+    for (PassQuery& pass : passes) {
+        if (gpuTimers) {
+            glDeleteQueries(PROFILER_QUERY_FRAMES, pass.queries);
+        }
+    }
+    passes.clear();
+    passIDs.clear();
+    gpuTimers = false;
+}
+
+double Profiler::toUs(Clock::time_point t) const {
+    return std::chrono::duration<double, std::micro>(t - epoch).count();
+}
+
+void Profiler::addName(const std::string& name) {
+    if (std::find(names.begin(), names.end(), name) == names.end()) {
+        names.push_back(name);
+    }
+}
+
+Profiler::Frame& Profiler::currentFrame() {
+    return frames[frameCount % PROFILER_TRACE_FRAMES];
+}
+
+void Profiler::addCpuSample(const std::string& name, Clock::time_point start, Clock::time_point end, int depth, bool worker) {
+    double startUs = toUs(start);
+    double durationUs = toUs(end) - startUs;
+
+    addName(name);
+    cpuHistory[name].add(durationUs / 1000.0);
+
+    Event event = { name, startUs, durationUs, depth, false, worker };
+    currentFrame().events.push_back(event);
+}
+
+// Reads back the queries whose results are available, or all of them with wait
+void Profiler::resolveQueries(bool wait) {
+    for (PassQuery& pass : passes) {
+        for (unsigned int slot = 0; slot < PROFILER_QUERY_FRAMES; slot++) {
+            if (!pass.issued[slot]) {
+                continue;
+            }
+
+            if (!wait) {
+                GLuint available = GL_FALSE;
+                glGetQueryObjectuiv(pass.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) {
+                    continue;
+                }
+            }
+
+            GLuint64 elapsedNs = 0;
+            glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &elapsedNs);
+            pass.issued[slot] = false;
+
+            double durationUs = elapsedNs / 1000.0;
+
+            // a pass can't take longer than the wall time since it was submitted; drivers (llvmpipe
+            // on the very first frame) sometimes report garbage, so those samples are dropped and counted
+            if (durationUs > toUs(Clock::now()) - pass.cpuStartUs[slot]) {
+                pass.droppedSamples++;
+                continue;
+            }
+            gpuHistory[pass.name].add(durationUs / 1000.0);
+
+            // GPU timestamps aren't in the same timebase as the CPU; place the event where the pass was submitted,
+            // in its frame unless that has left the trace already
+            if (frameCount - pass.issuedFrames[slot] < PROFILER_TRACE_FRAMES) {
+                Event event = { pass.name, pass.cpuStartUs[slot], durationUs, 1, true, false };
+                frames[pass.issuedFrames[slot] % PROFILER_TRACE_FRAMES].events.push_back(event);
+            }
+        }
+    }
+}
+
+void Profiler::beginFrame() {
+    currentFrame().events.clear();
+
+    if (gpuTimers) {
+        resolveQueries(false);
+    }
+
+    cpuDepth = 0;
+    frameStart = Clock::now();
+}
+
+void Profiler::endFrame() {
+    if (activePass != -1) {
+        endPass();
+    }
+
+    addCpuSample("frame", frameStart, Clock::now(), 0);
+
+    frameCount++;
+}
+
+void Profiler::flush() {
+    if (!gpuTimers) {
+        return;
+    }
+
+    resolveQueries(true);
+}
+
+unsigned int Profiler::getResolvedFrames() const {
+    unsigned int resolved = frameCount;
+    for (const PassQuery& pass : passes) {
+        for (unsigned int slot = 0; slot < PROFILER_QUERY_FRAMES; slot++) {
+            if (pass.issued[slot]) {
+                resolved = std::min(resolved, pass.issuedFrames[slot]);
+            }
+        }
+    }
+    return resolved;
+}
+
+void Profiler::beginPass(const std::string& name) {
+    if (activePass != -1) {
+        endPass();
+    }
+
+    auto iter = passIDs.find(name);
+    if (iter == passIDs.end()) {
+        PassQuery pass;
+        pass.name = name;
+        for (int i = 0; i < PROFILER_QUERY_FRAMES; i++) {
+            pass.queries[i] = 0;
+            pass.issued[i] = false;
+            pass.issuedFrames[i] = 0;
+            pass.cpuStartUs[i] = 0.0;
+        }
+        pass.busyFrames = 0;
+        pass.droppedSamples = 0;
+        if (gpuTimers) {
+            glGenQueries(PROFILER_QUERY_FRAMES, pass.queries);
+        }
+
+        passIDs[name] = passes.size();
+        passes.push_back(pass);
+        iter = passIDs.find(name);
+    }
+
+    activePass = iter->second;
+    passStart = Clock::now();
+
+    unsigned int slot = frameCount % PROFILER_QUERY_FRAMES;
+    PassQuery& pass = passes[activePass];
+    pass.cpuStartUs[slot] = toUs(passStart);
+
+    // restarting a query that is still waiting would throw its result away
+    activeQuery = gpuTimers && !pass.issued[slot];
+    if (activeQuery) {
+        glBeginQuery(GL_TIME_ELAPSED, pass.queries[slot]);
+        pass.issued[slot] = true;
+        pass.issuedFrames[slot] = frameCount;
+    }
+    else if (gpuTimers) {
+        pass.busyFrames++;
+    }
+}
+
+void Profiler::endPass() {
+    if (activePass == -1) {
+        return;
+    }
+
+    if (activeQuery) {
+        glEndQuery(GL_TIME_ELAPSED);
+        activeQuery = false;
+    }
+
+    addCpuSample(passes[activePass].name, passStart, Clock::now(), 1);
+    activePass = -1;
+}
+
+void Profiler::addCpuTime(const std::string& name, Clock::time_point start, Clock::time_point end) {
+    addCpuSample(name, start, end, 1, true);
+}
+
+void Profiler::setCounter(const std::string& name, double value) {
+    addName(name);
+    counterHistory[name].add(value);
+}
+
+double Profiler::getAverageCpuMs(const std::string& name) const {
+    auto iter = cpuHistory.find(name);
+    return (iter != cpuHistory.end()) ? iter->second.average() : 0.0;
+}
+
+double Profiler::getAverageGpuMs(const std::string& name) const {
+    auto iter = gpuHistory.find(name);
+    return (iter != gpuHistory.end()) ? iter->second.average() : 0.0;
+}
+
+double Profiler::getAverageCounter(const std::string& name) const {
+    auto iter = counterHistory.find(name);
+    return (iter != counterHistory.end()) ? iter->second.average() : 0.0;
+}
+
+double Profiler::getLastCpuMs(const std::string& name) const {
+    auto iter = cpuHistory.find(name);
+    return (iter != cpuHistory.end()) ? iter->second.last : 0.0;
+}
+
+double Profiler::getLastGpuMs(const std::string& name) const {
+    auto iter = gpuHistory.find(name);
+    return (iter != gpuHistory.end()) ? iter->second.last : 0.0;
+}
+
+bool Profiler::hasGpuTimers() const {
+    return gpuTimers;
+}
+
+unsigned int Profiler::getFrameCount() const {
+    return frameCount;
+}
+
+const std::vector<std::string>& Profiler::getNames() const {
+    return names;
+}
+
+const std::vector<Profiler::Event>& Profiler::getFrameEvents(unsigned int frame) const {
+    return frames[frame % PROFILER_TRACE_FRAMES].events;
+}
+
+void Profiler::printSummary() const {
+    printf("Profile (average of last %d frames):\n", PROFILER_HISTORY);
+    for (const std::string& name : names) {
+        if (counterHistory.count(name) > 0) {
+            printf("  %-24s %12.1f\n", name.c_str(), getAverageCounter(name));
+        }
+        else if (gpuTimers && passIDs.count(name) > 0) {
+            const PassQuery& pass = passes[passIDs.at(name)];
+            printf("  %-24s cpu %8.3f ms   gpu %8.3f ms", name.c_str(), getAverageCpuMs(name), getAverageGpuMs(name));
+            if (pass.busyFrames > 0) {
+                printf("   (%u frames not timed, the GPU was behind)", pass.busyFrames);
+            }
+            if (pass.droppedSamples > 0) {
+                printf("   (%u GPU samples dropped, longer than the wall time since submission)", pass.droppedSamples);
+            }
+            printf("\n");
+        }
+        else {
+            printf("  %-24s cpu %8.3f ms\n", name.c_str(), getAverageCpuMs(name));
+        }
+    }
+}
+
+static std::string escapeJson(const std::string& str) {
+    std::string escaped;
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+bool Profiler::writeChromeTrace(const std::string& filename) const {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Could not write trace file " << filename << std::endl;
+        return false;
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}},\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":3,\"args\":{\"name\":\"CPU worker\"}}";
+
+    unsigned int numFrames = std::min(frameCount, (unsigned int)PROFILER_TRACE_FRAMES);
+    for (unsigned int i = frameCount - numFrames; i < frameCount; i++) {
+        for (const Event& event : frames[i % PROFILER_TRACE_FRAMES].events) {
+            out << ",\n{\"name\":\"" << escapeJson(event.name) << "\""
+                << ",\"cat\":\"" << (event.gpu ? "gpu" : "cpu") << "\""
+                << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event.gpu ? 2 : event.worker ? 3 : 1)
+                << ",\"ts\":" << std::fixed << event.startUs
+                << ",\"dur\":" << event.durationUs
+                << ",\"args\":{\"frame\":" << i << "}}";
+        }
+    }
+    out << "\n]}\n";
+
+    std::cout << "Wrote " << numFrames << " frames of trace events to " << filename << std::endl;
+    return true;
+}
@@ -0,0 +1,158 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Number of frames kept for the rolling averages
+#define PROFILER_HISTORY 64
+
+// Number of frames of events kept for trace dumps
+#define PROFILER_TRACE_FRAMES 256
+
+// Timer queries are double-buffered: results are read back once the GPU has them, polled every frame, so the CPU never
+// waits on the GPU; a pass whose slot is still waiting for its result when it comes around again isn't timed that frame
+#define PROFILER_QUERY_FRAMES 2
+
+/*
+ * Frame profiler with GPU pass timers (GL_TIME_ELAPSED queries) and CPU scoped timers.
+ *
+ * Usage per frame:
+ *     profiler.beginFrame();
+ *     { Profiler::ScopedTimer t(profiler, "update"); scene.update(dt); }
+ *     profiler.beginPass("shadow"); ... draw ... profiler.endPass();
+ *     profiler.endFrame();
+ *
+ * GPU passes must not overlap (GL does not allow nested GL_TIME_ELAPSED queries); CPU timers can nest.
+ */
+class Profiler {
+public:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Event {
+        std::string name;
+        double startUs; // microseconds since the profiler was created
+        double durationUs;
+        int depth;
+        bool gpu;
+        bool worker;    // measured on another thread (see addCpuTime)
+    };
+
+    // Measures CPU time from construction to destruction
+    class ScopedTimer {
+    public:
+        ScopedTimer(Profiler& profiler, const std::string& name);
+        ~ScopedTimer();
+
+    private:
+        Profiler& profiler;
+        std::string name;
+        Clock::time_point start;
+    };
+
+    Profiler();
+
+    // Creates timer queries; requires a current OpenGL context. CPU timers work without it.
+    bool initialize();
+    void release();
+
+    void beginFrame();
+    void endFrame();
+
+    // Blocks until all outstanding timer queries are read back (e.g. at the end of a benchmark)
+    void flush();
+
+    // Frames before this one have all their GPU times read back
+    unsigned int getResolvedFrames() const;
+
+    // Starts a GPU timer query and a CPU timer for a render pass
+    void beginPass(const std::string& name);
+    void endPass();
+
+    /*
+     * Records CPU time measured on another thread as a timer of the current frame; the profiler itself must only
+     * be used from one thread, so workers keep their start and end times for that thread to hand in
+     */
+    void addCpuTime(const std::string& name, Clock::time_point start, Clock::time_point end);
+
+    // Records a value (e.g. triangles drawn) that is averaged like the timers
+    void setCounter(const std::string& name, double value);
+
+    double getAverageCpuMs(const std::string& name) const;
+    double getAverageGpuMs(const std::string& name) const;
+    double getAverageCounter(const std::string& name) const;
+
+    double getLastCpuMs(const std::string& name) const;
+    double getLastGpuMs(const std::string& name) const;
+
+    bool hasGpuTimers() const;
+    unsigned int getFrameCount() const;
+    const std::vector<std::string>& getNames() const;
+
+    // Events recorded for a frame; only the last PROFILER_TRACE_FRAMES frames are kept, and GPU
+    // events appear once the frame is resolved (see getResolvedFrames)
+    const std::vector<Event>& getFrameEvents(unsigned int frame) const;
+
+    // Prints the rolling averages of all timers and counters
+    void printSummary() const;
+
+    // Writes the recorded events in Chrome's trace event format (load in chrome://tracing)
+    bool writeChromeTrace(const std::string& filename) const;
+
+private:
+    struct History {
+        double samples[PROFILER_HISTORY];
+        unsigned int count;
+        unsigned int next;
+        double last;
+
+        History();
+        void add(double value);
+        double average() const;
+    };
+
+    struct PassQuery {
+        std::string name;
+        unsigned int queries[PROFILER_QUERY_FRAMES];
+        bool issued[PROFILER_QUERY_FRAMES];             // waiting for its result
+        unsigned int issuedFrames[PROFILER_QUERY_FRAMES];
+        double cpuStartUs[PROFILER_QUERY_FRAMES];
+        unsigned int busyFrames;                        // frames not timed because the slot was still waiting
+        unsigned int droppedSamples;                    // results longer than the wall time since the pass was submitted
+    };
+
+    struct Frame {
+        std::vector<Event> events;
+    };
+
+    Clock::time_point epoch;
+    Clock::time_point frameStart;
+    Clock::time_point passStart;
+
+    bool gpuTimers;
+    bool activeQuery;
+    int activePass;
+    int cpuDepth;
+    unsigned int frameCount;
+
+    std::vector<PassQuery> passes;
+    std::unordered_map<std::string, int> passIDs;
+
+    std::unordered_map<std::string, History> cpuHistory;
+    std::unordered_map<std::string, History> gpuHistory;
+    std::unordered_map<std::string, History> counterHistory;
+    std::vector<std::string> names;
+
+    // ring buffer of per-frame events for trace dumps
+    std::vector<Frame> frames;
+
+    double toUs(Clock::time_point t) const;
+    void addName(const std::string& name);
+    void addCpuSample(const std::string& name, Clock::time_point start, Clock::time_point end, int depth, bool worker = false);
+    void resolveQueries(bool wait);
+    Frame& currentFrame();
+};
+
+#endif // #ifndef _PROFILER_H_
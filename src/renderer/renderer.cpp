@@ -4,104 +4,13 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <GL\glew.h>
-#include <SFML\OpenGL.hpp>
+#include <GL/glew.h>
+#include <SFML/OpenGL.hpp>
 #include <iostream>
 #include <fstream>
-
-// Shader compiling reference: http://www.nexcius.net/2012/11/20/how-to-load-a-glsl-shader-in-opengl-using-c/
-
-std::string readFile(const char *filePath) {
-    std::string content;
-    std::ifstream fileStream(filePath, std::ios::in);
-
-    if (!fileStream.is_open()) {
-        std::cerr << "Could not read file " << filePath << ". File does not exist." << std::endl;
-        return "";
-    }
-
-    std::string line = "";
-    while (!fileStream.eof()) {
-        std::getline(fileStream, line);
-        content.append(line + "\n");
-    }
-
-    fileStream.close();
-    return content;
-}
-
-GLuint loadVertexShader(const char* vertPath) {
-    GLuint vertShader = glCreateShader(GL_VERTEX_SHADER);
-    std::string vertShaderStr = readFile(vertPath);
-    const char *vertShaderSrc = vertShaderStr.c_str();
-
-    GLint result = GL_FALSE;
-    int logLength;
-
-    std::cout << "Compiling vertex shader." << std::endl;
-    glShaderSource(vertShader, 1, &vertShaderSrc, NULL);
-    glCompileShader(vertShader);
-
-    glGetShaderiv(vertShader, GL_COMPILE_STATUS, &result);
-    glGetShaderiv(vertShader, GL_INFO_LOG_LENGTH, &logLength);
-    Vector<GLchar> vertShaderError((logLength > 1) ? logLength : 1);
-    glGetShaderInfoLog(vertShader, logLength, NULL, &vertShaderError[0]);
-    std::cout << &vertShaderError[0] << std::endl;
-
-    return vertShader;
-}
-
-GLuint loadFragmentShader(const char* fragPath) {
-    GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
-    std::string fragShaderStr = readFile(fragPath);
-    const char *fragShaderSrc = fragShaderStr.c_str();
-
-    GLint result = GL_FALSE;
-    int logLength;
-
-    std::cout << "Compiling fragment shader." << std::endl;
-    glShaderSource(fragShader, 1, &fragShaderSrc, NULL);
-    glCompileShader(fragShader);
-
-    glGetShaderiv(fragShader, GL_COMPILE_STATUS, &result);
-    glGetShaderiv(fragShader, GL_INFO_LOG_LENGTH, &logLength);
-    Vector<GLchar> fragShaderError((logLength > 1) ? logLength : 1);
-    glGetShaderInfoLog(fragShader, logLength, NULL, &fragShaderError[0]);
-    std::cout << &fragShaderError[0] << std::endl;
-
-    return fragShader;
-}
-
-GLuint createShaderProgram(GLuint vertShader, GLuint fragShader) {
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vertShader);
-    glAttachShader(program, fragShader);
-
-    return program;
-}
-
-void linkShaderProgram(GLuint program) {
-    GLint result = GL_FALSE;
-    int logLength;
-
-    std::cout << "Linking program" << std::endl;
-
-    glLinkProgram(program);
-
-    glGetProgramiv(program, GL_LINK_STATUS, &result);
-    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
-    std::vector<char> programError((logLength > 1) ? logLength : 1);
-    glGetProgramInfoLog(program, logLength, NULL, &programError[0]);
-    std::cout << &programError[0] << std::endl;
-}
-
-void detachShaders(GLuint program, GLuint vertShader, GLuint fragShader) {
-    glDetachShader(program, vertShader);
-    glDetachShader(program, fragShader);
-
-    glDeleteShader(vertShader);
-    glDeleteShader(fragShader);
-}
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
 
 // Shadow map shader (Generates shadow maps)
 GLuint shadowMapShader;
@@ -124,13 +33,17 @@ GLint materialShader_cameraMVMat;
 GLint materialShader_normalMat;
 GLint materialShader_useTextures;
 GLint materialShader_ambientTexture;
-GLint materialShader_hasAmbientTexture;
 GLint materialShader_diffuseTexture;
-GLint materialShader_hasDiffuseTexture;
-GLint materialShader_ambientColor;
-GLint materialShader_diffuseColor;
-GLint materialShader_specularColor;
-GLint materialShader_specularExponent;
+GLint materialShader_materialIndex;
+
+// Batched material shader (material pass with texture arrays, see Renderer::setBatching)
+GLuint materialBatchShader;
+GLint materialBatchShader_cameraMVPMat;
+GLint materialBatchShader_cameraMVMat;
+GLint materialBatchShader_normalMat;
+GLint materialBatchShader_useTextures;
+GLint materialBatchShader_ambientTextures;
+GLint materialBatchShader_diffuseTextures;
 
 // Final pass shader (Does color computations)
 GLuint finalPassShader;
@@ -141,218 +54,300 @@ GLint finalPass_diffuseTexture;
 GLint finalPass_specularTexture;
 GLint finalPass_specularExponentTexture;
 GLint finalPass_viewTexture;
-GLint finalPass_ambientLight;
-GLint finalPass_lightColor;
-GLint finalPass_lightAttenuation;
-GLint finalPass_lightType;
-GLint finalPass_spotlightDirection; // For spotlights only
-GLint finalPass_cosHalfLightAngle; // For spotlights only
-GLint finalPass_spotlightFalloff; // For spotlights only
-GLint finalPass_normalMatrix;
-
-void initShaders(std::string shaderPath) {
-    // Loading shaders
-
-    GLuint vertShader;
-    GLuint fragShader;
-
-    //printf("%s\n", shaderPath.c_str);
-    std::cout << shaderPath << std::endl;
-
-
-    printf("Compiling shadow map shader...\n\n");
-    vertShader = loadVertexShader((shaderPath + "\\shadowMap.vert").c_str());
-    fragShader = loadFragmentShader((shaderPath + "\\shadowMap.frag").c_str());
-
-    shadowMapShader = createShaderProgram(vertShader, fragShader);
-    
-    linkShaderProgram(shadowMapShader);
-    detachShaders(shadowMapShader, vertShader, fragShader);
-
-    // Setup uniforms for shadow map shader
-    shadowMapShader_lightMVPMat = glGetUniformLocation(shadowMapShader, "lightMVPMat");
-    if (shadowMapShader_lightMVPMat == -1) {
-        printf("Could not find lightMVPMat\n\n");
+GLint finalPass_lightIndex;
+
+// Luminance shader (log luminance of the HDR target, averaged by the mip chain)
+GLuint luminanceShader;
+GLint luminanceShader_hdrTexture;
+
+// Adaptation shader (moves the exposure's average luminance towards the current frame's)
+GLuint adaptationShader;
+GLint adaptationShader_luminanceTexture;
+GLint adaptationShader_previousLuminance;
+GLint adaptationShader_averageLevel;
+GLint adaptationShader_adaptationRate;
+
+// Tone mapping shader (resolves the HDR target into the output framebuffer)
+GLuint toneMapShader;
+GLint toneMapShader_hdrTexture;
+GLint toneMapShader_adaptedLuminance;
+GLint toneMapShader_toneMapping;
+
+// Overdraw shader (adds one per fragment that passes the depth test, see Renderer::setOverdrawMeasurement)
+GLuint overdrawShader;
+GLint overdrawShader_mvpMat;
+
+// Depth pyramid shader (halves the depth buffer keeping the farthest depth, see Renderer::setOcclusionCulling)
+GLuint hiZShader;
+GLint hiZShader_source;
+GLint hiZShader_sourceSize;
+
+// Uniform buffers shared by the shaders above (see Renderer::createMaterialBuffer and updateFrameBuffer)
+#define MATERIALS_BINDING 0
+#define FRAME_BINDING 1
+GLuint materialUniformBuffer = 0;
+GLuint frameUniformBuffer = 0;
+
+/*
+ * std140 mirrors of the uniform blocks in the material and final pass shaders. Every member is a vec4 or
+ * mat4, so the C++ layout matches without padding.
+ */
+struct MaterialBlock {
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+};
+
+struct LightBlock {
+    glm::vec4 color;
+    glm::vec4 attenuation;
+    glm::vec4 direction;
+    glm::vec4 params;
+};
+
+struct FrameBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 normalMatrix;
+    LightBlock lights[RENDERER_LIGHTS_PER_BLOCK];
+};
+
+// Entries of the Materials block, passed to the shaders that declare it as MAX_MATERIALS (see Renderer::initialize)
+int materialBlockEntries = RENDERER_MIN_MATERIALS;
+
+// The frame buffer holds one FrameBlock per RENDERER_LIGHTS_PER_BLOCK lights, this many bytes apart
+GLintptr frameBlockStride = sizeof(FrameBlock);
+
+void bindUniformBlock(GLuint program, const char* name, GLuint binding) {
+    GLuint index = glGetUniformBlockIndex(program, name);
+    if (index == GL_INVALID_INDEX) {
+        printf("Could not find uniform block %s\n\n", name);
+        return;
     }
-    printf("Finished compiling shadow map shader.\n\n");
-
-    printf("Compiling intermediate shader...\n\n");
-    vertShader = loadVertexShader((shaderPath + "\\intermediate.vert").c_str());
-    fragShader = loadFragmentShader((shaderPath + "\\intermediate.frag").c_str());
-
-    intermediateShader = createShaderProgram(vertShader, fragShader);
-
-    linkShaderProgram(intermediateShader);
-    detachShaders(intermediateShader, vertShader, fragShader);
+    glUniformBlockBinding(program, index, binding);
+}
 
-    // Setup uniforms for intermediate shader
-    intermediateShader_lightMVPMat = glGetUniformLocation(intermediateShader, "lightMVPMat");
-    if (intermediateShader_lightMVPMat == -1) {
-        printf("Could not find lightMVPMat\n\n");
-    }
-    intermediateShader_cameraMVPMat = glGetUniformLocation(intermediateShader, "cameraMVPMat");
-    if (intermediateShader_cameraMVPMat == -1) {
-        printf("Could not find cameraMVPMat\n\n");
+enum ShaderID { SHADER_SHADOWMAP, SHADER_INTERMEDIATE, SHADER_MATERIAL, SHADER_MATERIALBATCH, SHADER_FINALPASS,
+                SHADER_LUMINANCE, SHADER_ADAPTATION, SHADER_TONEMAP, SHADER_OVERDRAW };
+
+// Feature bits of the shader permutations, in the order of each program's features below
+#define LIGHT_SUN_BIT 1u
+#define LIGHT_SPOT_BIT 2u
+#define LIGHT_POINT_BIT 4u
+#define FIXED_TEXTURES_BIT 1u
+#define AMBIENT_MAP_BIT 2u
+#define DIFFUSE_MAP_BIT 4u
+
+struct UniformLocation {
+    const char* name;
+    GLint* location;
+};
+
+struct UniformBlock {
+    const char* name;
+    GLuint binding;
+};
+
+struct ShaderVariant {
+    GLuint program;
+    Vector<GLint> locations;            // in the order of the program's uniforms
+};
+
+/*
+ * Each program is built from <name>.vert and <name>.frag, or <vertexShader>.vert when the vertex shader is
+ * shared (the fullscreen passes all use finalpass.vert). A program can be specialized with #define features:
+ * bit i of a variant mask defines features[i], and variants are compiled the first time they are used (see
+ * useShaderVariant). Variant 0 defines nothing; it is the uber-shader with runtime branches, built at startup.
+ * The program global and the uniform location globals always refer to the variant in use.
+ */
+struct ShaderProgram {
+    const char* name;
+    GLuint* program;
+    Vector<UniformLocation> uniforms;
+    Vector<UniformBlock> blocks;
+    Vector<std::string> fragOutputs;    // bound to locations 0, 1, ... for shaders without layout qualifiers
+    Vector<std::string> features;
+    Map<unsigned int, ShaderVariant> variants;
+    unsigned int current;
+    const char* vertexShader;           // NULL to use <name>.vert
+};
+
+ShaderProgram shaderPrograms[] = {
+    { "shadowmap", &shadowMapShader,
+      { { "lightMVPMat", &shadowMapShader_lightMVPMat } },
+      {}, {}, {}, {}, 0 },
+    { "intermediate", &intermediateShader,
+      { { "lightMVPMat", &intermediateShader_lightMVPMat }, { "cameraMVPMat", &intermediateShader_cameraMVPMat },
+        { "modelMat", &intermediateShader_modelMat }, { "shadowMap", &intermediateShader_shadowMap },
+        { "lightDirection", &intermediateShader_lightDirection }, { "lightPosition", &intermediateShader_lightPosition },
+        { "lightType", &intermediateShader_lightType } },
+      {}, {}, { "LIGHT_SUN", "LIGHT_SPOT", "LIGHT_POINT" }, {}, 0 },
+    { "material", &materialShader,
+      { { "cameraMVPMat", &materialShader_cameraMVPMat }, { "cameraMVMat", &materialShader_cameraMVMat },
+        { "normalMat", &materialShader_normalMat }, { "ambientTexture", &materialShader_ambientTexture },
+        { "useTextures", &materialShader_useTextures }, { "diffuseTexture", &materialShader_diffuseTexture },
+        { "materialIndex", &materialShader_materialIndex } },
+      { { "Materials", MATERIALS_BINDING } },
+      { "normal", "ambient", "diffuse", "specular", "specularEx" },
+      { "FIXED_TEXTURES", "AMBIENT_MAP", "DIFFUSE_MAP" }, {}, 0 },
+    { "materialbatch", &materialBatchShader,
+      { { "cameraMVPMat", &materialBatchShader_cameraMVPMat }, { "cameraMVMat", &materialBatchShader_cameraMVMat },
+        { "normalMat", &materialBatchShader_normalMat }, { "useTextures", &materialBatchShader_useTextures },
+        { "ambientTextures", &materialBatchShader_ambientTextures }, { "diffuseTextures", &materialBatchShader_diffuseTextures } },
+      { { "Materials", MATERIALS_BINDING } },
+      {}, {}, {}, 0 },
+    { "finalpass", &finalPassShader,
+      { { "lightMap", &finalPass_lightMap }, { "normalTexture", &finalPass_normalTexture },
+        { "ambientTexture", &finalPass_ambientTexture }, { "diffuseTexture", &finalPass_diffuseTexture },
+        { "specularTexture", &finalPass_specularTexture }, { "specularExponentTexture", &finalPass_specularExponentTexture },
+        { "viewTexture", &finalPass_viewTexture }, { "lightIndex", &finalPass_lightIndex } },
+      { { "Frame", FRAME_BINDING } },
+      {}, { "LIGHT_SUN", "LIGHT_SPOT", "LIGHT_POINT" }, {}, 0 },
+    { "luminance", &luminanceShader,
+      { { "hdrTexture", &luminanceShader_hdrTexture } },
+      {}, {}, {}, {}, 0, "finalpass" },
+    { "adaptation", &adaptationShader,
+      { { "luminanceTexture", &adaptationShader_luminanceTexture }, { "previousLuminance", &adaptationShader_previousLuminance },
+        { "averageLevel", &adaptationShader_averageLevel }, { "adaptationRate", &adaptationShader_adaptationRate } },
+      {}, {}, {}, {}, 0, "finalpass" },
+    { "tonemap", &toneMapShader,
+      { { "hdrTexture", &toneMapShader_hdrTexture }, { "adaptedLuminance", &toneMapShader_adaptedLuminance },
+        { "toneMapping", &toneMapShader_toneMapping } },
+      {}, {}, {}, {}, 0, "finalpass" },
+    { "overdraw", &overdrawShader,
+      { { "lightMVPMat", &overdrawShader_mvpMat } },
+      {}, {}, {}, {}, 0, "shadowmap" },
+    { "hiz", &hiZShader,
+      { { "source", &hiZShader_source }, { "sourceSize", &hiZShader_sourceSize } },
+      {}, {}, {}, {}, 0, "finalpass" },
+};
+
+// Builds one variant and looks up its uniforms; the program is 0 if it fails to build
+ShaderVariant buildShaderVariant(ShaderCache& cache, const std::string& shaderPath, const ShaderProgram& shader, unsigned int mask) {
+    Vector<std::string> defines;
+    for (size_t i = 0; i < shader.features.size(); i++) {
+        if (mask & (1u << i)) {
+            defines.push_back(shader.features[i]);
+        }
     }
-    intermediateShader_modelMat = glGetUniformLocation(intermediateShader, "modelMat");
-    if (intermediateShader_modelMat == -1) {
-        printf("Could not find modelMat\n\n");
+    for (const UniformBlock& block : shader.blocks) {
+        if (block.binding == MATERIALS_BINDING) {
+            defines.push_back("MAX_MATERIALS " + std::to_string(materialBlockEntries));
+        }
     }
-    intermediateShader_shadowMap = glGetUniformLocation(intermediateShader, "shadowMap");
-    if (intermediateShader_shadowMap == -1) {
-        printf("Could not find shadowMap\n\n");
+
+    std::string vertexShader = shader.vertexShader ? shader.vertexShader : shader.name;
+    ShaderVariant variant;
+    variant.program = cache.buildProgram(shader.name, shaderPath + "/" + vertexShader + ".vert", shaderPath + "/" + shader.name + ".frag",
+                                         shader.fragOutputs, defines);
+    if (variant.program == 0) {
+        return variant;
     }
-    intermediateShader_lightDirection = glGetUniformLocation(intermediateShader, "lightDirection");
-    if (intermediateShader_lightDirection == -1) {
-        printf("Could not find intermediateShader_lightDirection\n\n");
+
+    for (const UniformLocation& uniform : shader.uniforms) {
+        GLint location = glGetUniformLocation(variant.program, uniform.name);
+        // specialized variants compile out the uniforms of the features they leave out
+        if (location == -1 && mask == 0) {
+            printf("Could not find %s\n\n", uniform.name);
+        }
+        variant.locations.push_back(location);
     }
-    intermediateShader_lightPosition = glGetUniformLocation(intermediateShader, "lightPosition");
-    if (intermediateShader_lightPosition == -1) {
-        printf("Could not find lightPosition\n\n");
+    for (const UniformBlock& block : shader.blocks) {
+        bindUniformBlock(variant.program, block.name, block.binding);
     }
-    intermediateShader_lightType = glGetUniformLocation(intermediateShader, "lightType");
-    if (intermediateShader_lightType == -1) {
-        printf("Could not find lightType\n\n");
+    return variant;
+}
+
+void selectShaderVariant(ShaderProgram& shader, unsigned int mask) {
+    const ShaderVariant& variant = shader.variants.at(mask);
+    *shader.program = variant.program;
+    for (size_t i = 0; i < shader.uniforms.size(); i++) {
+        *shader.uniforms[i].location = variant.locations[i];
     }
-    printf("Finished compiling intermediate shader.\n\n");
+    shader.current = mask;
+}
 
-    printf("Compiling material shader...\n\n");
-    vertShader = loadVertexShader((shaderPath + "\\material.vert").c_str());
-    fragShader = loadFragmentShader((shaderPath + "\\material.frag").c_str());
+void deleteShaderVariants(ShaderProgram& shader) {
+    GLuint uberShader = shader.variants.count(0) ? shader.variants.at(0).program : 0;
+    for (auto& entry : shader.variants) {
+        // variants that failed to build share the uber-shader's program
+        if (entry.first == 0 || entry.second.program != uberShader) {
+            glDeleteProgram(entry.second.program);
+        }
+    }
+    shader.variants.clear();
+}
 
-    materialShader = createShaderProgram(vertShader, fragShader);
+/*
+ * Binds a variant of a program, compiling it on first use. Returns true if it is a different variant than
+ * the one in use before, whose uniform values then have to be set again. A variant that fails to build is
+ * replaced by the uber-shader for good.
+ */
+bool useShaderVariant(ShaderCache& cache, const std::string& shaderPath, ShaderID id, unsigned int mask) {
+    ShaderProgram& shader = shaderPrograms[id];
+    if (shader.variants.find(mask) == shader.variants.end()) {
+        ShaderVariant variant = buildShaderVariant(cache, shaderPath, shader, mask);
+        if (variant.program == 0) {
+            std::cout << "Using the " << shader.name << " uber-shader instead" << std::endl;
+            variant = shader.variants.at(0);
+        }
+        shader.variants[mask] = variant;
+    }
 
-    glBindFragDataLocation(materialShader, 0, "normal");
-    glBindFragDataLocation(materialShader, 1, "ambient");
-    glBindFragDataLocation(materialShader, 2, "diffuse");
-    glBindFragDataLocation(materialShader, 3, "specular");
-    glBindFragDataLocation(materialShader, 4, "specularEx");
+    bool changed = shader.current != mask;
+    selectShaderVariant(shader, mask);
+    glUseProgram(*shader.program);
+    return changed;
+}
 
-    linkShaderProgram(materialShader);
-    detachShaders(materialShader, vertShader, fragShader);
+// Builds every program's uber-shader (from the cache when possible); false if a shader fails to build
+bool initShaders(ShaderCache& cache, std::string shaderPath) {
+    std::cout << shaderPath << std::endl;
+    Profiler::Clock::time_point start = Profiler::Clock::now();
+    cache.setDirectory(shaderPath);
 
-    materialShader_cameraMVPMat = glGetUniformLocation(materialShader, "cameraMVPMat");
-    if (materialShader_cameraMVPMat == -1) {
-        printf("Could not find cameraMVPMat\n\n");
-    }
-    materialShader_cameraMVMat = glGetUniformLocation(materialShader, "cameraMVMat");
-    if (materialShader_cameraMVMat == -1) {
-        printf("Could not find cameraMVMat\n\n");
-    }
-    materialShader_normalMat = glGetUniformLocation(materialShader, "normalMat");
-    if (materialShader_normalMat == -1) {
-        printf("Could not find normalMat\n\n");
-    }
-    materialShader_ambientTexture = glGetUniformLocation(materialShader, "ambientTexture");
-    if (materialShader_ambientTexture == -1) {
-        printf("Could not find ambientTexture\n\n");
-    }
-    materialShader_useTextures = glGetUniformLocation(materialShader, "useTextures");
-    if (materialShader_useTextures == -1) {
-        printf("Could not find useTextures\n\n");
-    }
-    materialShader_hasAmbientTexture = glGetUniformLocation(materialShader, "hasAmbientTexture");
-    if (materialShader_hasAmbientTexture == -1) {
-        printf("Could not find hasAmbientTexture\n\n");
-    }
-    materialShader_diffuseTexture = glGetUniformLocation(materialShader, "diffuseTexture");
-    if (materialShader_diffuseTexture == -1) {
-        printf("Could not find diffuseTexture\n\n");
-    }
-    materialShader_hasDiffuseTexture = glGetUniformLocation(materialShader, "hasDiffuseTexture");
-    if (materialShader_hasDiffuseTexture == -1) {
-        printf("Could not find hasDiffuseTexture\n\n");
-    }
-    materialShader_ambientColor = glGetUniformLocation(materialShader, "ambientColor");
-    if (materialShader_ambientColor == -1) {
-        printf("Could not find ambientColor\n\n");
-    }
-    materialShader_diffuseColor = glGetUniformLocation(materialShader, "diffuseColor");
-    if (materialShader_diffuseColor == -1) {
-        printf("Could not find diffuseColor\n\n");
-    }
-    materialShader_specularColor = glGetUniformLocation(materialShader, "specularColor");
-    if (materialShader_specularColor == -1) {
-        printf("Could not find specularColor\n\n");
-    }
-    materialShader_specularExponent = glGetUniformLocation(materialShader, "specularExponent");
-    if (materialShader_specularExponent == -1) {
-        printf("Could not find specularExponent\n\n");
+    for (ShaderProgram& shader : shaderPrograms) {
+        ShaderVariant variant = buildShaderVariant(cache, shaderPath, shader, 0);
+        if (variant.program == 0) {
+            return false;
+        }
+        shader.variants[0] = variant;
+        selectShaderVariant(shader, 0);
     }
-    printf("Finished compiling material shader.\n\n");
-
-    printf("Compiling final pass shader...\n\n");
-    vertShader = loadVertexShader((shaderPath + "\\finalPass.vert").c_str());
-    fragShader = loadFragmentShader((shaderPath + "\\finalPass.frag").c_str());
 
-    finalPassShader = createShaderProgram(vertShader, fragShader);
+    double ms = std::chrono::duration<double, std::milli>(Profiler::Clock::now() - start).count();
+    std::cout << "Shaders ready in " << ms << " ms (" << cache.numLoaded() << " from cache, " << cache.numCompiled()
+              << " compiled)" << std::endl;
+    return true;
+}
 
-    linkShaderProgram(finalPassShader);
-    detachShaders(finalPassShader, vertShader, fragShader);
+/*
+ * Rebuilds the programs that use one of the changed files. Runs between frames, so a new program replaces the
+ * old one before the next draw; a program that fails to build keeps the old one, and the log shows why.
+ * The specialized variants are dropped and rebuilt from the new sources on their next use.
+ */
+void reloadShaders(ShaderCache& cache, std::string shaderPath, const Vector<std::string>& changedFiles) {
+    for (ShaderProgram& shader : shaderPrograms) {
+        std::string name = shader.name;
+        std::string vertexShader = shader.vertexShader ? shader.vertexShader : shader.name;
+        bool changed = false;
+        for (const std::string& file : changedFiles) {
+            changed = changed || file == vertexShader + ".vert" || file == name + ".frag";
+        }
+        if (!changed) {
+            continue;
+        }
 
-    // Setup uniforms for final pass shader
-    finalPass_lightMap = glGetUniformLocation(finalPassShader, "lightMap");
-    if (finalPass_lightMap == -1) {
-        printf("Could not find lightMap\n\n");
-    }
-    finalPass_normalTexture = glGetUniformLocation(finalPassShader, "normalTexture");
-    if (finalPass_normalTexture == -1) {
-        printf("Could not find normalTexture\n\n");
-    }
-    finalPass_ambientTexture = glGetUniformLocation(finalPassShader, "ambientTexture");
-    if (finalPass_ambientTexture == -1) {
-        printf("Could not find ambientTexture\n\n");
-    }
-    finalPass_diffuseTexture = glGetUniformLocation(finalPassShader, "diffuseTexture");
-    if (finalPass_diffuseTexture == -1) {
-        printf("Could not find diffuseTexture\n\n");
-    }
-    finalPass_specularTexture = glGetUniformLocation(finalPassShader, "specularTexture");
-    if (finalPass_specularTexture == -1) {
-        printf("Could not find specularTexture\n\n");
-    }
-    finalPass_specularExponentTexture = glGetUniformLocation(finalPassShader, "specularExponentTexture");
-    if (finalPass_specularExponentTexture == -1) {
-        printf("Could not find specularExponentTexture\n\n");
-    }
-    finalPass_viewTexture = glGetUniformLocation(finalPassShader, "viewTexture");
-    if (finalPass_viewTexture == -1) {
-        printf("Could not find viewTexture\n\n");
-    }
-    finalPass_ambientLight = glGetUniformLocation(finalPassShader, "ambientLight");
-    if (finalPass_ambientLight == -1) {
-        printf("Could not find ambientLight\n\n");
-    }
-    finalPass_lightColor = glGetUniformLocation(finalPassShader, "lightColor");
-    if (finalPass_lightColor == -1) {
-        printf("Could not find lightColor\n\n");
-    }
-    finalPass_lightType = glGetUniformLocation(finalPassShader, "lightType");
-    if (finalPass_lightType == -1) {
-        printf("Could not find lightTyper\n\n");
-    }
-    finalPass_lightAttenuation = glGetUniformLocation(finalPassShader, "lightAttenuation");
-    if (finalPass_lightAttenuation == -1) {
-        printf("Could not find lightAttenuation\n\n");
-    }
-    finalPass_spotlightDirection = glGetUniformLocation(finalPassShader, "spotlightDirection");
-    if (finalPass_spotlightDirection == -1) {
-        printf("Could not find spotlightDirection\n\n");
-    }
-    finalPass_cosHalfLightAngle = glGetUniformLocation(finalPassShader, "cosHalfLightAngle");
-    if (finalPass_cosHalfLightAngle == -1) {
-        printf("Could not find cosHalfLightAngle\n\n");
-    }
-    finalPass_spotlightFalloff = glGetUniformLocation(finalPassShader, "spotlightFalloff");
-    if (finalPass_spotlightFalloff == -1) {
-        printf("Could not find spotlightFalloff\n\n");
-    }
-    finalPass_normalMatrix = glGetUniformLocation(finalPassShader, "normalMatrix");
-    if (finalPass_normalMatrix == -1) {
-        printf("Could not find normalMatrix\n\n");
+        ShaderVariant variant = buildShaderVariant(cache, shaderPath, shader, 0);
+        if (variant.program == 0) {
+            std::cout << "Keeping the previous " << name << " shader" << std::endl;
+            continue;
+        }
+        deleteShaderVariants(shader);
+        shader.variants[0] = variant;
+        selectShaderVariant(shader, 0);
+        std::cout << "Reloaded " << name << " shader" << std::endl;
     }
-
-    printf("Finished compiling final pass shader.\n\n");
 }
 
 // Frame buffer that contains depth maps
@@ -373,9 +368,55 @@ GLuint matSpecularTexture;
 GLuint matSpecularExponentTexture;
 GLuint viewTexture;
 
+// HDR target the final pass adds the lights into, resolved to the output framebuffer by tone mapping
+GLuint hdrFrameBuffer;
+GLuint hdrTexture;
+
+// Auto-exposure: log luminance of the HDR target, mip-mapped down to its average, and two 1x1 textures
+// that take turns holding the adapted average (last frame's is read while this frame's is written)
+GLuint luminanceFrameBuffer;
+GLuint luminanceTexture;
+GLuint adaptedLuminanceFrameBuffers[2];
+GLuint adaptedLuminanceTextures[2];
+int adaptedLuminanceIndex = 0;
+bool adaptedLuminanceValid = false;     // false until the first frame, which snaps to its average
+bool hdrBudgetWarned = false;
+
+// Overdraw measurement: fragment counts per pixel, tested against the G-buffer's depth buffer
+GLuint overdrawFrameBuffer;
+GLuint overdrawTexture;
+
+// Occlusion culling: the G-buffer's depth halved on the GPU, and pixel buffers it is read back through in turns;
+// each holds the view it was drawn from, and a fence that tells when the copy has landed
+GLuint hiZFrameBuffer;
+GLuint hiZTextures[RENDERER_HIZ_REDUCTIONS];
+struct DepthReadback {
+    GLuint buffer;
+    GLsync fence;
+    glm::mat4 viewProj;
+};
+DepthReadback depthReadbacks[RENDERER_HIZ_READBACKS];
+int depthReadbackIndex = 0;             // the next one written
+
 // Fullscreen quad
 GLuint fullscreenQuadVAO;
 
+/*
+ * Estimate, not a measurement, of the bytes the HDR target costs per frame, from the target sizes alone:
+ * blending reads and writes it once per light, the luminance pass filters it down, the mip chain is read
+ * and written, and tone mapping reads it and writes the RGBA8 output. Texture caches make the real traffic
+ * lower; the GPU times of the final, luminance and tonemap passes are what was measured.
+ */
+double estimateHdrBytes(int numLights) {
+    double pixels = SCREEN_WIDTH * SCREEN_HEIGHT;
+    double luminanceTexels = RENDERER_LUMINANCE_SIZE * RENDERER_LUMINANCE_SIZE;
+    double accumulation = numLights * pixels * 8 * 2;
+    double luminance = pixels * 8 + luminanceTexels * 2;
+    double mipChain = luminanceTexels * 2 * 4 / 3.0;
+    double toneMap = pixels * 8 + pixels * 4;
+    return accumulation + luminance + mipChain + toneMap;
+}
+
 // Matrix for biasing depth map
 glm::mat4 biasMatrix(
     0.5, 0.0, 0.0, 0.0,
@@ -386,78 +427,328 @@ glm::mat4 biasMatrix(
 // Clear color
 GLuint clearColor[3] = { 0, 0, 0 };
 
+// Staging buffer for streaming uploads, orphaned before every chunk
+GLuint stagingBuffer = 0;
+
+// Creates the VAO and buffers for a submesh; without data the buffers are only allocated, for streaming to fill in later
+void createSubMeshObjects(Renderer::SubMesh& submesh, bool withData) {
+    glGenVertexArrays(1, &submesh.vao);
+    glBindVertexArray(submesh.vao);
+
+    glGenBuffers(1, &submesh.vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, submesh.vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Renderer::Point3f) * submesh.vertexArray.size(), withData ? &submesh.vertexArray[0] : NULL, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+    glBindAttribLocation(shadowMapShader, 0, "in_Position");
+    glBindAttribLocation(intermediateShader, 0, "in_Position");
+    glBindAttribLocation(materialShader, 0, "in_Position");
+
+    glGenBuffers(1, &submesh.normalBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, submesh.normalBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Renderer::Point3f) * submesh.normalArray.size(), withData ? &submesh.normalArray[0] : NULL, GL_STATIC_DRAW);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(1);
+    glBindAttribLocation(intermediateShader, 1, "in_Normal");
+    glBindAttribLocation(materialShader, 0, "in_Normal");
+
+    if (submesh.vType == Triangle::VertexType::POSITION_TEXCOORD || submesh.vType == Triangle::VertexType::POSITION_TEXCOORD_NORMAL) {
+        glGenBuffers(1, &submesh.texCoordBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, submesh.texCoordBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Renderer::TexCoord) * submesh.texCoordArray.size(), withData ? &submesh.texCoordArray[0] : NULL, GL_STATIC_DRAW);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(2);
+        glBindAttribLocation(materialShader, 2, "in_TexCoord");
+    }
+
+    glGenBuffers(1, &submesh.indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, submesh.indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * submesh.indexArray.size(), withData ? &submesh.indexArray[0] : NULL, GL_STATIC_DRAW);
+}
+
+// Triangles submitted this frame, for the "triangles drawn" counter
+size_t trianglesDrawn = 0;
+
+void deleteSubMeshObjects(Renderer::SubMesh& submesh) {
+    glDeleteVertexArrays(1, &submesh.vao);
+    glDeleteBuffers(1, &submesh.vertexBuffer);
+    glDeleteBuffers(1, &submesh.normalBuffer);
+    if (submesh.texCoordBuffer != 0) {
+        glDeleteBuffers(1, &submesh.texCoordBuffer);
+    }
+    glDeleteBuffers(1, &submesh.indexBuffer);
+}
+
+// Sets trilinear + anisotropic filtering, or plain bilinear on level 0; expects the texture to be bound
+void setTextureFiltering(bool mipmapped, GLenum target = GL_TEXTURE_2D) {
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (GLEW_EXT_texture_filter_anisotropic) {
+        GLfloat maxAnisotropy = 1.0f;
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+        glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, mipmapped ? glm::min(maxAnisotropy, RENDERER_MAX_ANISOTROPY) : 1.0f);
+    }
+}
+
+// GL format for a cooked texture, or 0 if there is none or the driver can't sample it
+GLenum compressedFormat(const CompressedTexture& compressed) {
+    if (compressed.empty()) {
+        return 0;
+    }
+    switch (compressed.format) {
+    case BLOCK_BC1: return GLEW_EXT_texture_compression_s3tc ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 0;
+    case BLOCK_BC3: return GLEW_EXT_texture_compression_s3tc ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : 0;
+    case BLOCK_BC5: return (GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc) ? GL_COMPRESSED_RG_RGTC2 : 0;
+    }
+    return 0;
+}
+
+/*
+ * Allocates a texture with its whole mip chain, block compressed if the scene cooked it and the driver supports
+ * the format; without data the contents are streamed in later. Returns the bytes the texture takes on the GPU.
+ */
+size_t createTexture(GLuint texture, const sf::Image& img, const Vector<MipLevel>& mips, const CompressedTexture& compressed, bool withData, bool mipmapped) {
+    size_t bytes = 0;
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    GLenum format = compressedFormat(compressed);
+    if (format != 0) {
+        for (int i = 0; i < compressed.levels.size(); i++) {
+            const Vector<unsigned char>& level = compressed.levels[i];
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, format, compressed.widths[i], compressed.heights[i], 0, level.size(), withData ? &level[0] : NULL);
+            bytes += level.size();
+        }
+    }
+    else {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img.getSize().x, img.getSize().y, 0, GL_RGBA, GL_UNSIGNED_BYTE, withData ? img.getPixelsPtr() : NULL);
+        bytes += (size_t)img.getSize().x * img.getSize().y * 4;
+        for (int i = 0; i < mips.size(); i++) {
+            glTexImage2D(GL_TEXTURE_2D, i + 1, GL_RGBA, mips[i].width, mips[i].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, withData ? &mips[i].pixels[0] : NULL);
+            bytes += mips[i].pixels.size();
+        }
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mips.size());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    setTextureFiltering(mipmapped && !mips.empty());
+    return bytes;
+}
+
+// size of a texture and its mip chain as RGBA8
+size_t uncompressedTextureSize(const sf::Image& img, const Vector<MipLevel>& mips) {
+    size_t bytes = (size_t)img.getSize().x * img.getSize().y * 4;
+    for (const MipLevel& level : mips) {
+        bytes += level.pixels.size();
+    }
+    return bytes;
+}
+
+// Planes of the frustum of a view-projection matrix, pointing inwards: left, right, bottom, top, near, far
+void frustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6]) {
+    glm::mat4 rows = glm::transpose(viewProj);
+    for (int axis = 0; axis < 3; axis++) {
+        planes[axis * 2] = rows[3] + rows[axis];
+        planes[axis * 2 + 1] = rows[3] - rows[axis];
+    }
+}
+
+// false only if the box is entirely behind one of the planes; boxes near a corner may pass without being visible
+bool boxInFrustum(const glm::vec4 planes[6], const Vec3& boxMin, const Vec3& boxMax) {
+    for (int i = 0; i < 6; i++) {
+        Vec3 normal(planes[i]);
+        Vec3 farthest = glm::mix(boxMin, boxMax, glm::step(Vec3(0.0f), normal));
+        if (glm::dot(normal, farthest) + planes[i].w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Model-space error a level of detail may have for a model to stay within pixelError pixels of a perspective
+ * target targetHeight pixels high, seen from eye; a pixel at distance d covers 2 d / (projScale targetHeight)
+ * world units. Zero when the eye is inside the model's world bounds.
+ */
+float perspectiveLodError(const glm::mat4x3& world, const Vec3& worldMin, const Vec3& worldMax, const Vec3& eye,
+                          float projScale, float targetHeight, float pixelError) {
+    float distance = glm::length(eye - glm::clamp(eye, worldMin, worldMax));
+    float scale = glm::max(glm::length(world[0]), glm::max(glm::length(world[1]), glm::length(world[2])));
+    return pixelError * 2.0f * distance / (projScale * targetHeight * glm::max(scale, 1e-6f));
+}
+
+// The same for an orthographic target, where a pixel covers 2 / (projScale targetHeight) world units everywhere
+float orthographicLodError(const glm::mat4x3& world, float projScale, float targetHeight, float pixelError) {
+    float scale = glm::max(glm::length(world[0]), glm::max(glm::length(world[1]), glm::length(world[2])));
+    return pixelError * 2.0f / (projScale * targetHeight * glm::max(scale, 1e-6f));
+}
+
+/*
+ * Rough estimate of the texture memory a draw reads, from its projected size on screen:
+ * with mipmaps the sampler reads the level whose texel count matches the covered pixels, plus the next
+ * level for trilinear filtering; without, a minified texture costs about one 64-byte cache line per pixel.
+ */
+double estimateTextureBytes(const Renderer::SubMesh& submesh, Vec2 textureSize, float texelBytes, const glm::mat4& mv, const glm::mat4& proj, bool mipmapped) {
+    Vec3 center = Vec3(mv * glm::vec4((submesh.boundsMin + submesh.boundsMax) * 0.5f, 1.0f));
+    float radius = glm::length(Vec3(mv * glm::vec4(submesh.boundsMax - submesh.boundsMin, 0.0f))) * 0.5f;
+    if (center.z - radius > 0.0f) {
+        return 0.0; // behind the camera
+    }
+
+    float distance = glm::max(-center.z, 0.1f);
+    float radiusPixels = radius * proj[1][1] / distance * SCREEN_HEIGHT * 0.5f;
+    double pixels = glm::min(3.14159 * radiusPixels * radiusPixels, (double)SCREEN_WIDTH * SCREEN_HEIGHT);
+
+    double texels = (double)textureSize.x * textureSize.y;
+    if (!mipmapped) {
+        return glm::min(texels * texelBytes, pixels * 64.0);
+    }
+    double level = glm::max(0.5 * glm::log2(texels / glm::max(pixels, 1.0)), 0.0);
+    double levelTexels = glm::max(texels / glm::pow(4.0, glm::floor(level)), 1.0);
+    return levelTexels * texelBytes * 1.25;
+}
+
+// Streaming placeholder: a box covering the model's vertices, drawn with the default material
+Renderer::ModelInfo makeProxy(const ObjModel& obj) {
+    Vector<Vec3> vertices = obj.getVertices();
+    Vec3 lo(0.0f), hi(0.0f);
+    if (!vertices.empty()) {
+        lo = hi = vertices[0];
+        for (const Vec3& v : vertices) {
+            lo = glm::min(lo, v);
+            hi = glm::max(hi, v);
+        }
+    }
+
+    // one quad per face so each face gets a flat normal
+    static const float faceNormals[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    Renderer::SubMesh box;
+    box.vType = Triangle::VertexType::POSITION_NORMAL;
+    for (int f = 0; f < 6; f++) {
+        Vec3 n(faceNormals[f][0], faceNormals[f][1], faceNormals[f][2]);
+        int axis = (f < 2) ? 0 : (f < 4) ? 1 : 2;
+        Vec3 u = (axis == 0) ? Vec3(0, 1, 0) : (axis == 1) ? Vec3(0, 0, 1) : Vec3(1, 0, 0);
+        Vec3 v = glm::cross(n, u);
+
+        int base = box.vertexArray.size();
+        float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+        for (int c = 0; c < 4; c++) {
+            Vec3 unit = n + u * corners[c][0] + v * corners[c][1]; // corner of the [-1,1] cube
+            box.vertexArray.push_back(Renderer::Point3f(glm::mix(lo, hi, unit * 0.5f + 0.5f)));
+            box.normalArray.push_back(Renderer::Point3f(n));
+        }
+        int quad[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int q = 0; q < 6; q++) {
+            box.indexArray.push_back(base + quad[q]);
+        }
+    }
+
+    box.computeBounds();
+    box.buildLods();
+    createSubMeshObjects(box, true);
+    glBindVertexArray(0);
+
+    Renderer::ModelInfo proxy;
+    proxy.submeshes.push_back(box);
+    proxy.computeBounds();
+    return proxy;
+}
+
 bool Renderer::initialize(const Camera& camera, const Scene& scene, std::string shaderPath)
 {
     // Initialize glew
     glewExperimental = TRUE;
     GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // Headless EGL contexts have no GLX display; the function pointers can still be loaded
+    if (err == GLEW_ERROR_NO_GLX_DISPLAY) {
+        err = glewContextInit();
+    }
+#endif
     if (err != GLEW_OK) {
         std::cout << "glewInit failed, aborting." << std::endl;
         return false;
     }
 
-    initShaders(shaderPath);
+    // every material gets its own entry in the Materials block, plus the default one; the block has to fit in one binding
+    GLint maxBlockSize = 0;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize);
+    materialBlockEntries = glm::max(scene.getAssets().numMaterials() + 1, RENDERER_MIN_MATERIALS);
+    if ((GLint64)materialBlockEntries * (GLint64)sizeof(MaterialBlock) > maxBlockSize) {
+        std::cout << "The scene has " << scene.getAssets().numMaterials() << " materials, but a uniform block holds at most "
+                  << maxBlockSize / sizeof(MaterialBlock) - 1 << ", aborting." << std::endl;
+        return false;
+    }
+
+    if (!initShaders(shaderCache, shaderPath)) {
+        std::cout << "Could not build the shaders, aborting." << std::endl;
+        return false;
+    }
+    this->shaderPath = shaderPath;
+    if (shaderHotReload && !shaderWatcher.start(shaderPath)) {
+        shaderHotReload = false;
+    }
+    profiler.initialize();
 
     // Loading the models and VAOs
-    const Vector<StaticModel> models = scene.getModels();
+    // this is the last loading stage: the scene has already read all files, only GL objects are created here
+    Profiler::Clock::time_point uploadStart = Profiler::Clock::now();
+    const Vector<StaticModel>& models = scene.getModels();
+
+    // sized once, so upload jobs can point at entries
+    assets = &scene.getAssets();
+    textures = Vector<TextureInfo>(assets->numTextures());
+
+    if (streaming && batching) {
+        std::cout << "Material batching is not available while streaming, drawing per submesh" << std::endl;
+        batching = false;
+    }
+    if (batching) {
+        createTextureArrays();
+    }
+    createMaterialBuffer();
+
+    if (streaming) {
+        streamingPool.reset(new ThreadPool());
+        glGenBuffers(1, &stagingBuffer);
+    }
 
     for (StaticModel sm : models) {
         if (meshMap.count(sm.model->getName()) == 0) {
+            if (streaming) {
+                // draw a bounding box until the real mesh has been built and uploaded
+                meshMap.insert({ sm.model->getName(), makeProxy(*sm.model) });
+
+                streamingModels.emplace_back();
+                StreamingModel * pending = &streamingModels.back();
+                pending->name = sm.model->getName();
+                pending->pendingJobs = 0;
+                pending->ready = false;
+                pending->built = streamingPool->submit([sm]() {
+                    return ModelInfo(sm);
+                });
+                continue;
+            }
+
             std::cout << "Loading " << sm.model->getName() << std::endl;
             ModelInfo mesh = ModelInfo(sm);
 
             for (int i = 0; i < mesh.submeshes.size(); i++) {
-
-                SubMesh submesh = mesh.submeshes[i];
-
-                glGenVertexArrays(1, &submesh.vao);
-                glBindVertexArray(submesh.vao);
-
-                glGenBuffers(1, &submesh.vertexBuffer);
-                glBindBuffer(GL_ARRAY_BUFFER, submesh.vertexBuffer);
-                glBufferData(GL_ARRAY_BUFFER, sizeof(Point3f) * submesh.vertexArray.size(), &submesh.vertexArray[0], GL_STATIC_DRAW);
-                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-                glEnableVertexAttribArray(0);
-                glBindAttribLocation(shadowMapShader, 0, "in_Position");
-                glBindAttribLocation(intermediateShader, 0, "in_Position");
-                glBindAttribLocation(materialShader, 0, "in_Position");
-
-                glGenBuffers(1, &submesh.normalBuffer);
-                glBindBuffer(GL_ARRAY_BUFFER, submesh.normalBuffer);
-                glBufferData(GL_ARRAY_BUFFER, sizeof(Point3f) * submesh.normalArray.size(), &submesh.normalArray[0], GL_STATIC_DRAW);
-                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-                glEnableVertexAttribArray(1);
-                glBindAttribLocation(intermediateShader, 1, "in_Normal");
-                glBindAttribLocation(materialShader, 0, "in_Normal");
-
-                if (submesh.vType == Triangle::VertexType::POSITION_TEXCOORD || submesh.vType == Triangle::VertexType::POSITION_TEXCOORD_NORMAL) {
-                    glGenBuffers(1, &submesh.texCoordBuffer);
-                    glBindBuffer(GL_ARRAY_BUFFER, submesh.texCoordBuffer);
-                    glBufferData(GL_ARRAY_BUFFER, sizeof(TexCoord) * submesh.texCoordArray.size(), &submesh.texCoordArray[0], GL_STATIC_DRAW);
-                    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-                    glEnableVertexAttribArray(2);
-                    glBindAttribLocation(materialShader, 2, "in_TexCoord");
-                }
-
-                glGenBuffers(1, &submesh.indexBuffer);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, submesh.indexBuffer);
-                glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * submesh.indexArray.size(), &submesh.indexArray[0], GL_STATIC_DRAW);
-
-                mesh.submeshes[i] = submesh;
+                createSubMeshObjects(mesh.submeshes[i], true);
             }
 
-            if (sm.model->numTextures() > 0) {
-                glGenTextures(sm.model->numTextures(), &mesh.textures[0]);
+            if (batching) {
+                buildBatches(mesh);
             }
-
-            for (int i = 0; i < sm.model->numTextures(); i++) {
-                sf::Image img = sm.model->getTexture(i);
-                glBindTexture(GL_TEXTURE_2D, mesh.textures[i]);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img.getSize().x, img.getSize().y, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.getPixelsPtr());
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            else {
+                for (const SubMesh& submesh : mesh.submeshes) {
+                    if (submesh.material.map_Kd != -1) {
+                        requireTexture(submesh.material.map_Kd, false);
+                    }
+                    if (submesh.material.map_Ka != -1) {
+                        requireTexture(submesh.material.map_Ka, false);
+                    }
+                }
             }
 
             std::cout << "Finished loading " << sm.model->getName() << std::endl;
@@ -469,14 +760,20 @@ bool Renderer::initialize(const Camera& camera, const Scene& scene, std::string
         }
     }
 
+    std::cout << "Built meshes and uploaded GL data in "
+              << std::chrono::duration<float>(Profiler::Clock::now() - uploadStart).count() << " s" << std::endl;
+    if (!streaming) {
+        printTextureMemory();
+    }
+
     for (StaticModel sm : models) {
         auto iter = meshMap.find(sm.model->getName());
 
         std::cout << "Checking " << sm.model->getName() << std::endl;
         if (iter != meshMap.end()) {
-            ModelInfo mesh = iter->second;
+            const ModelInfo& mesh = iter->second;
             
-            for (SubMesh submesh : mesh.submeshes) {
+            for (const SubMesh& submesh : mesh.submeshes) {
                 switch (submesh.vType) {
                 case Triangle::VertexType::POSITION_TEXCOORD_NORMAL:
                 case Triangle::VertexType::POSITION_TEXCOORD:
@@ -514,6 +811,7 @@ bool Renderer::initialize(const Camera& camera, const Scene& scene, std::string
 
     GLuint fullScreenQuad_VertexArray;
     glGenBuffers(1, &fullScreenQuad_VertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, fullScreenQuad_VertexArray);
     glBufferData(GL_ARRAY_BUFFER, sizeof(fullscreenQuadVertices), fullscreenQuadVertices, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(0);
@@ -645,100 +943,256 @@ bool Renderer::initialize(const Camera& camera, const Scene& scene, std::string
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
+    // HDR frame buffer; filtered linearly so the luminance pass averages neighbouring pixels while downsampling
+    glGenFramebuffers(1, &hdrFrameBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, hdrFrameBuffer);
+
+    glGenTextures(1, &hdrTexture);
+    glBindTexture(GL_TEXTURE_2D, hdrTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGBA, GL_FLOAT, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, hdrTexture, 0);
+
+    // Luminance frame buffer, square and a power of two so every mip level halves it exactly
+    glGenFramebuffers(1, &luminanceFrameBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, luminanceFrameBuffer);
+
+    glGenTextures(1, &luminanceTexture);
+    glBindTexture(GL_TEXTURE_2D, luminanceTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, RENDERER_LUMINANCE_SIZE, RENDERER_LUMINANCE_SIZE, 0, GL_RED, GL_FLOAT, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, luminanceTexture, 0);
+
+    glGenFramebuffers(2, adaptedLuminanceFrameBuffers);
+    glGenTextures(2, adaptedLuminanceTextures);
+    for (int i = 0; i < 2; i++) {
+        glBindFramebuffer(GL_FRAMEBUFFER, adaptedLuminanceFrameBuffers[i]);
+        glBindTexture(GL_TEXTURE_2D, adaptedLuminanceTextures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, 1, 1, 0, GL_RED, GL_FLOAT, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, adaptedLuminanceTextures[i], 0);
+    }
+    adaptedLuminanceIndex = 0;
+    adaptedLuminanceValid = false;
+
+    // Overdraw frame buffer; shares the G-buffer's depth so it can test against the pre-pass depth
+    glGenFramebuffers(1, &overdrawFrameBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, overdrawFrameBuffer);
+
+    glGenTextures(1, &overdrawTexture);
+    glBindTexture(GL_TEXTURE_2D, overdrawTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RED, GL_FLOAT, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, overdrawTexture, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthBuffer, 0);
+
+    // Depth pyramid levels, each half the one above; the last is read back
+    glGenFramebuffers(1, &hiZFrameBuffer);
+    glGenTextures(RENDERER_HIZ_REDUCTIONS, hiZTextures);
+    for (int i = 0; i < RENDERER_HIZ_REDUCTIONS; i++) {
+        glBindTexture(GL_TEXTURE_2D, hiZTextures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, glm::max(SCREEN_WIDTH >> (i + 1), 1), glm::max(SCREEN_HEIGHT >> (i + 1), 1), 0, GL_RED, GL_FLOAT, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    }
+    int readbackBytes = glm::max(SCREEN_WIDTH >> RENDERER_HIZ_REDUCTIONS, 1) * glm::max(SCREEN_HEIGHT >> RENDERER_HIZ_REDUCTIONS, 1) * sizeof(float);
+    for (DepthReadback& readback : depthReadbacks) {
+        glGenBuffers(1, &readback.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, readbackBytes, NULL, GL_STREAM_READ);
+        readback.fence = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    depthReadbackIndex = 0;
+    occluders.clear();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    hdrBudgetWarned = false;
+
     printf("Finished initializing\n");
 	return true;
 }
 
 void Renderer::render(const Camera& camera, const Scene& scene) {
-    const Vector<StaticModel> models = scene.getModels();
-
-    glEnable(GL_DEPTH_TEST);
-    ///*
-    // Rendering from sunlight's POV
-    glUseProgram(shadowMapShader);
-    glBindFramebuffer(GL_FRAMEBUFFER, depthFrameBuffer);
+    syncFrame();
+    prepareFrame(camera, scene);
+    swapFrames(camera, scene);
+    renderFrame();
+}
 
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, sunlightDepthTexture, 0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glViewport(0, 0, 1024, 1024);
+void Renderer::syncFrame() {
+    if (shaderHotReload) {
+        Vector<std::string> changed = shaderWatcher.takeChanges();
+        if (!changed.empty()) {
+            reloadShaders(shaderCache, shaderPath, changed);
+        }
+    }
 
-    Scene::DirectionalLight sunlight = scene.getSunlight();
+    if (!streamingModels.empty()) {
+        profiler.beginPass("stream");
+        streamUploads();
+        profiler.endPass();
+    }
 
-    glm::mat4 sunlightProj = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, -1.0f, 50.0f);
+    if (occlusionCulling && !softwareOcclusion) {
+        takeDepthPyramid();
+    }
+}
 
+// a view matrix looking along direction from position, with an up vector that isn't parallel to it
+glm::mat4 lightView(const Vec3& position, const Vec3& direction) {
     Vec3 up = Vec3(0, 1, 0);
-    if (1 - glm::abs(glm::dot(glm::normalize(sunlight.direction), up)) <= 0.01f) {
+    if (1 - glm::abs(glm::dot(glm::normalize(direction), up)) <= 0.01f) {
         up = Vec3(0, 0, 1);
     }
-    glm::mat4 sunlightView = glm::lookAt(glm::vec3(0), sunlight.direction, up);
+    return glm::lookAt(position, position + direction, up);
+}
 
-    for (StaticModel sm : models) {
-        auto iter = meshMap.find(sm.model->getName());
+void Renderer::prepareFrame(const Camera& camera, const Scene& scene) {
+    FrameData& frame = frames[1 - frontFrame];
+    const Vector<StaticModel>& models = scene.getModels();
+    frame.stages.clear();
+
+    frame.cameraProj = camera.getProjectionMatrix();
+    frame.cameraView = camera.getViewMatrix();
+    frame.eye = -glm::transpose(glm::mat3(frame.cameraView)) * Vec3(frame.cameraView[3]);
+    frame.textured = camera.toggle1;
+
+    frame.sunlight = scene.getSunlight();
+    frame.sunlightProj = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, -1.0f, 50.0f);
+    frame.sunlightView = lightView(Vec3(0), frame.sunlight.direction);
+
+    frame.pointlights = scene.getPointlights();
+    Vector<Scene::SpotLight> spotlights = scene.getSpotlights();
+    frame.spotlights.resize(spotlights.size());
+    for (size_t i = 0; i < spotlights.size(); i++) {
+        SpotlightPass& pass = frame.spotlights[i];
+        pass.light = spotlights[i];
+        pass.proj = glm::perspective(pass.light.angle, 1.0f, 0.1f, pass.light.length);
+        pass.view = lightView(pass.light.position, pass.light.direction);
+    }
 
-        if (iter != meshMap.end()) {
-            glm::mat4 modelTransform = glm::mat4();
+    // the world matrices as they are now, since the scene moves on while the frame is drawn
+    frame.worldMatrices = scene.getWorldMatrices();
+    frame.meshGeneration = meshGeneration;
+    frame.meshes.resize(models.size());
+    for (size_t m = 0; m < models.size(); m++) {
+        auto iter = meshMap.find(models[m].model->getName());
+        frame.meshes[m] = iter != meshMap.end() ? &iter->second : NULL;
+    }
 
-            Vec3 eulerAngles = sm.orientation;
+    StageTime transforms = { "transforms", Profiler::Clock::now() };
+    if (softwareOcclusion) {
+        startOccluders(scene, frame);
+    }
+    prepareTransforms(frame, scene);
+    transforms.end = Profiler::Clock::now();
+    frame.stages.push_back(transforms);
+
+    frame.occludersDrawn = softwareOcclusion;
+    if (softwareOcclusion) {
+        StageTime stage = { "occluders", transforms.end };
+        frame.occluderTriangles = occlusionRasterizer.finish(occluders).rasterized;
+        stage.end = Profiler::Clock::now();
+        frame.stages.push_back(stage);
+    }
+    cullOccludedModels(frame);
+
+    StageTime cull = { "cull", Profiler::Clock::now() };
+    frame.clusterStats = MeshletCullStats();
+    cullClusters(frame, frame.cameraClusters, frame.cameraLodErrors, true, MeshletCullView::perspective(frame.cameraProj * frame.cameraView, frame.eye));
+    cullClusters(frame, frame.sunlightClusters, frame.sunlightLodErrors, false,
+                 MeshletCullView::orthographicView(frame.sunlightProj * frame.sunlightView, frame.sunlight.direction));
+
+    // each spot light's shadow map gets its own matrices and ranges
+    size_t count = models.size();
+    frame.spotlightLodErrors.resize(count);
+    for (SpotlightPass& pass : frame.spotlights) {
+        pass.mvps.resize(count);
+        batchConcatenate(pass.proj * pass.view, frame.worldMatrices.data(), count, pass.mvps.data());
+        for (size_t m = 0; m < count; m++) {
+            frame.spotlightLodErrors[m] = levelOfDetail ? perspectiveLodError(frame.worldMatrices[m], frame.worldBoundsMin[m], frame.worldBoundsMax[m], pass.light.position,
+                                                                              pass.proj[1][1], 1024.0f, RENDERER_SHADOW_LOD_PIXEL_ERROR) : 0.0f;
+        }
+        cullClusters(frame, pass.clusters, frame.spotlightLodErrors, false, MeshletCullView::perspective(pass.proj * pass.view, pass.light.position));
+    }
+    cull.end = Profiler::Clock::now();
+    frame.stages.push_back(cull);
+}
+
+void Renderer::swapFrames(const Camera& camera, const Scene& scene) {
+    if (frames[1 - frontFrame].meshGeneration != meshGeneration) {
+        prepareFrame(camera, scene);
+    }
+    frontFrame = 1 - frontFrame;
+}
 
-            modelTransform = glm::translate(modelTransform, sm.position);
-            modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.z), Vec3(0, 0, 1)); //roll
-            modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.y), Vec3(0, 1, 0)); //yaw
-            modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.x), Vec3(1, 0, 0)); //pitch
-            modelTransform = glm::scale(modelTransform, sm.scale);
+void Renderer::renderFrame() {
+    const FrameData& frame = frames[frontFrame];
+    size_t numModels = frame.meshes.size();
 
-            glm::mat4 mvpMat = sunlightProj * sunlightView * modelTransform;
+    for (const StageTime& stage : frame.stages) {
+        profiler.addCpuTime(stage.name, stage.start, stage.end);
+    }
+    profiler.setCounter("models culled (frustum)", frame.frustumCulled);
+    if (frame.occludersDrawn) {
+        profiler.setCounter("occluder triangles", frame.occluderTriangles);
+    }
+    profiler.setCounter("models culled (occlusion)", frame.occludedModels);
+    trianglesDrawn = 0;
 
-            ModelInfo mesh = iter->second;
+    glEnable(GL_DEPTH_TEST);
+    ///*
+    profiler.beginPass("shadow");
 
-            glUniformMatrix4fv(shadowMapShader_lightMVPMat, 1, GL_FALSE, glm::value_ptr(mvpMat));
+    // Rendering from sunlight's POV
+    glUseProgram(shadowMapShader);
+    glBindFramebuffer(GL_FRAMEBUFFER, depthFrameBuffer);
 
-            for (SubMesh submesh : mesh.submeshes) {
-                glBindVertexArray(submesh.vao);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, sunlightDepthTexture, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glViewport(0, 0, 1024, 1024);
+
+    for (size_t m = 0; m < numModels; m++) {
+        if (frame.meshes[m] != NULL) {
+            const ModelInfo& mesh = *frame.meshes[m];
 
-                glDrawElements(GL_TRIANGLES, submesh.indexArray.size(), GL_UNSIGNED_INT, 0);
+            glUniformMatrix4fv(shadowMapShader_lightMVPMat, 1, GL_FALSE, glm::value_ptr(frame.sunlightMVPs[m]));
+
+            for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+                glBindVertexArray(mesh.submeshes[s].vao);
+
+                drawClusters(frame.sunlightClusters, m, s);
             }
         }
     }
 
     // Render a depth map for each spot light in the scene
-    for (int i = 0; i < scene.getSpotlights().size(); i++) {
+    for (size_t i = 0; i < frame.spotlights.size(); i++) {
         glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, spotlightDepthTextures[i], 0);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glViewport(0, 0, 1024, 1024);
 
-        Scene::SpotLight spotlight = scene.getSpotlights()[i];
-        glm::mat4 spotlightProj = glm::perspective(spotlight.angle, 1.0f, 0.1f, spotlight.length);
-
-        up = Vec3(0, 1, 0);
-        if (1 - glm::abs(glm::dot(glm::normalize(spotlight.direction), up)) <= 0.01f) {
-            up = Vec3(0, 0, 1);
-        }
-        glm::mat4 spotlightView = glm::lookAt(spotlight.position, spotlight.position + spotlight.direction, up);
-
-        for (StaticModel sm : models) {
-            auto iter = meshMap.find(sm.model->getName());
-
-            if (iter != meshMap.end()) {
-                glm::mat4 modelTransform = glm::mat4();
-
-                Vec3 eulerAngles = sm.orientation;
-
-                modelTransform = glm::translate(modelTransform, sm.position);
-                modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.z), Vec3(0, 0, 1)); //roll
-                modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.y), Vec3(0, 1, 0)); //yaw
-                modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.x), Vec3(1, 0, 0)); //pitch
-                modelTransform = glm::scale(modelTransform, sm.scale);
+        const SpotlightPass& pass = frame.spotlights[i];
+        for (size_t m = 0; m < numModels; m++) {
+            if (frame.meshes[m] != NULL) {
+                const ModelInfo& mesh = *frame.meshes[m];
 
-                glm::mat4 mvpMat = spotlightProj * spotlightView * modelTransform;
+                glUniformMatrix4fv(shadowMapShader_lightMVPMat, 1, GL_FALSE, glm::value_ptr(pass.mvps[m]));
 
-                ModelInfo mesh = iter->second;
+                for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+                    glBindVertexArray(mesh.submeshes[s].vao);
 
-                glUniformMatrix4fv(shadowMapShader_lightMVPMat, 1, GL_FALSE, glm::value_ptr(mvpMat));
-
-                for (SubMesh submesh : mesh.submeshes) {
-                    glBindVertexArray(submesh.vao);
-
-                    glDrawElements(GL_TRIANGLES, submesh.indexArray.size(), GL_UNSIGNED_INT, 0);
+                    drawClusters(pass.clusters, m, s);
                 }
             }
         }
@@ -749,150 +1203,121 @@ void Renderer::render(const Camera& camera, const Scene& scene) {
     // Render from camera's POV and write information to geometry buffer
     glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 
-    // First create light maps using the intermediate shader
-    glUseProgram(intermediateShader);
+    /*
+     * Depth pre-pass: the camera's depth is written once with the position-only shadow map program. The light
+     * maps and the material pass then test GL_EQUAL against it without writing depth, so each of them shades
+     * only the visible fragment of every pixel instead of everything drawn before it.
+     */
+    GLbitfield gBufferClear = GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT;
     glBindFramebuffer(GL_FRAMEBUFFER, geometryFrameBuffer);
+    if (depthPrepass) {
+        profiler.beginPass("prepass");
+        glUseProgram(shadowMapShader);
+        glDrawBuffer(GL_NONE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        drawPositions(frame, shadowMapShader_lightMVPMat);
+
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+        gBufferClear = GL_COLOR_BUFFER_BIT;
+    }
+
+    // First create light maps using the intermediate shader
+    profiler.beginPass("intermediate");
 
     glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, sunlightTexture, 0);
     glDrawBuffer(GL_COLOR_ATTACHMENT0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClear(gBufferClear);
 
+    useShaderVariant(shaderCache, shaderPath, SHADER_INTERMEDIATE, shaderPermutations ? LIGHT_SUN_BIT : 0);
     glUniform1i(intermediateShader_lightType, 0); // Sunlight
-    glUniform3fv(intermediateShader_lightDirection, 1, glm::value_ptr(-sunlight.direction));
+    glUniform3fv(intermediateShader_lightDirection, 1, glm::value_ptr(-frame.sunlight.direction));
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, sunlightDepthTexture);
     glUniform1i(intermediateShader_shadowMap, 0);
 
-    glm::mat4 cameraProj = camera.getProjectionMatrix();
-    glm::mat4 cameraView = camera.getViewMatrix();
-    glm::mat4 cameraVPMat = cameraProj * cameraView;
-
-    for (StaticModel sm : models) {
-        auto iter = meshMap.find(sm.model->getName());
-
-        if (iter != meshMap.end()) {
-            glm::mat4 modelTransform = glm::mat4();
-
-            Vec3 eulerAngles = sm.orientation;
-
-            modelTransform = glm::translate(modelTransform, sm.position);
-            modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.z), Vec3(0, 0, 1)); //roll
-            modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.y), Vec3(0, 1, 0)); //yaw
-            modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.x), Vec3(1, 0, 0)); //pitch
-            modelTransform = glm::scale(modelTransform, sm.scale);
+    for (size_t m = 0; m < numModels; m++) {
+        if (frame.meshes[m] != NULL && frame.inView[m]) {
+            const ModelInfo& mesh = *frame.meshes[m];
 
-            glm::mat4 lightMVPMat = sunlightProj * sunlightView * modelTransform;
-            glm::mat4 cameraMVPMat = cameraProj * cameraView * modelTransform;
+            glUniformMatrix4fv(intermediateShader_lightMVPMat, 1, GL_FALSE, glm::value_ptr(biasMatrix*frame.sunlightMVPs[m]));
+            glUniformMatrix4fv(intermediateShader_cameraMVPMat, 1, GL_FALSE, glm::value_ptr(frame.cameraMVPs[m]));
 
-            ModelInfo mesh = iter->second;
+            for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+                glBindVertexArray(mesh.submeshes[s].vao);
 
-            glUniformMatrix4fv(intermediateShader_lightMVPMat, 1, GL_FALSE, glm::value_ptr(biasMatrix*lightMVPMat));
-            glUniformMatrix4fv(intermediateShader_cameraMVPMat, 1, GL_FALSE, glm::value_ptr(cameraMVPMat));
-
-            for (SubMesh submesh : mesh.submeshes) {
-                glBindVertexArray(submesh.vao);
-
-                glDrawElements(GL_TRIANGLES, submesh.indexArray.size(), GL_UNSIGNED_INT, 0);
+                drawClusters(frame.cameraClusters, m, s);
             }
         }
     }
 
     // Do the above step, except for each spot light in the scene
-    for (int i = 0; i < scene.getSpotlights().size(); i++) {
-        Scene::SpotLight spotlight = scene.getSpotlights()[i];
-        glm::mat4 spotlightProj = glm::perspective(spotlight.angle, 1.0f, 0.1f, spotlight.length);
-
-        up = Vec3(0, 1, 0);
-        if (1 - glm::abs(glm::dot(glm::normalize(spotlight.direction), up)) <= 0.01f) {
-            up = Vec3(0, 0, 1);
-        }
-        glm::mat4 spotlightView = glm::lookAt(spotlight.position, spotlight.position + spotlight.direction, up);
+    for (size_t i = 0; i < frame.spotlights.size(); i++) {
+        const SpotlightPass& pass = frame.spotlights[i];
 
         glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, spotlightTextures[i], 0);
         glDrawBuffer(GL_COLOR_ATTACHMENT0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glClear(gBufferClear);
 
+        useShaderVariant(shaderCache, shaderPath, SHADER_INTERMEDIATE, shaderPermutations ? LIGHT_SPOT_BIT : 0);
         glUniform1i(intermediateShader_lightType, 1); // Spotlight
-        glUniform3fv(intermediateShader_lightPosition, 1, glm::value_ptr(spotlight.position));
+        glUniform3fv(intermediateShader_lightPosition, 1, glm::value_ptr(pass.light.position));
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, spotlightDepthTextures[i]);
         glUniform1i(intermediateShader_shadowMap, 0);
 
-        for (StaticModel sm : models) {
-            auto iter = meshMap.find(sm.model->getName());
-
-            if (iter != meshMap.end()) {
-                glm::mat4 modelTransform = glm::mat4();
-
-                Vec3 eulerAngles = sm.orientation;
-
-                modelTransform = glm::translate(modelTransform, sm.position);
-                modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.z), Vec3(0, 0, 1)); //roll
-                modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.y), Vec3(0, 1, 0)); //yaw
-                modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.x), Vec3(1, 0, 0)); //pitch
-                modelTransform = glm::scale(modelTransform, sm.scale);
+        for (size_t m = 0; m < numModels; m++) {
+            if (frame.meshes[m] != NULL && frame.inView[m]) {
+                glm::mat4 modelTransform = affineToMat4(frame.worldMatrices[m]);
 
-                glm::mat4 lightMVPMat = spotlightProj * spotlightView * modelTransform;
-                glm::mat4 cameraMVPMat = cameraVPMat * modelTransform;
+                const ModelInfo& mesh = *frame.meshes[m];
 
-                ModelInfo mesh = iter->second;
-
-                glUniformMatrix4fv(intermediateShader_lightMVPMat, 1, GL_FALSE, glm::value_ptr(biasMatrix*lightMVPMat));
-                glUniformMatrix4fv(intermediateShader_cameraMVPMat, 1, GL_FALSE, glm::value_ptr(cameraMVPMat));
+                glUniformMatrix4fv(intermediateShader_lightMVPMat, 1, GL_FALSE, glm::value_ptr(biasMatrix*pass.mvps[m]));
+                glUniformMatrix4fv(intermediateShader_cameraMVPMat, 1, GL_FALSE, glm::value_ptr(frame.cameraMVPs[m]));
                 glUniformMatrix4fv(intermediateShader_modelMat, 1, GL_FALSE, glm::value_ptr(modelTransform));
 
-                for (SubMesh submesh : mesh.submeshes) {
-                    glBindVertexArray(submesh.vao);
+                for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+                    glBindVertexArray(mesh.submeshes[s].vao);
 
-                    glDrawElements(GL_TRIANGLES, submesh.indexArray.size(), GL_UNSIGNED_INT, 0);
+                    drawClusters(frame.cameraClusters, m, s);
                 }
             }
         }
     }
 
     // Do the above step, except with each point light in the scene
-    for (int i = 0; i < scene.getPointlights().size(); i++) {
-        Scene::PointLight pointlight = scene.getPointlights()[i];
+    for (size_t i = 0; i < frame.pointlights.size(); i++) {
+        const Scene::PointLight& pointlight = frame.pointlights[i];
 
         glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, pointlightTextures[i], 0);
         glDrawBuffer(GL_COLOR_ATTACHMENT0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glClear(gBufferClear);
 
+        useShaderVariant(shaderCache, shaderPath, SHADER_INTERMEDIATE, shaderPermutations ? LIGHT_POINT_BIT : 0);
         glUniform1i(intermediateShader_lightType, 2); // Point light
         glUniform3fv(intermediateShader_lightPosition, 1, glm::value_ptr(pointlight.position));
 
-        for (StaticModel sm : models) {
-            auto iter = meshMap.find(sm.model->getName());
-
-            if (iter != meshMap.end()) {
-                glm::mat4 modelTransform = glm::mat4();
-
-                Vec3 eulerAngles = sm.orientation;
-
-                modelTransform = glm::translate(modelTransform, sm.position);
-                modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.z), Vec3(0, 0, 1)); //roll
-                modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.y), Vec3(0, 1, 0)); //yaw
-                modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.x), Vec3(1, 0, 0)); //pitch
-                modelTransform = glm::scale(modelTransform, sm.scale);
+        for (size_t m = 0; m < numModels; m++) {
+            if (frame.meshes[m] != NULL && frame.inView[m]) {
+                glm::mat4 modelTransform = affineToMat4(frame.worldMatrices[m]);
 
-                glm::mat4 cameraMVPMat = cameraProj * cameraView * modelTransform;
-
-                ModelInfo mesh = iter->second;
-                glUniformMatrix4fv(intermediateShader_cameraMVPMat, 1, GL_FALSE, glm::value_ptr(cameraMVPMat));
+                const ModelInfo& mesh = *frame.meshes[m];
+                glUniformMatrix4fv(intermediateShader_cameraMVPMat, 1, GL_FALSE, glm::value_ptr(frame.cameraMVPs[m]));
                 glUniformMatrix4fv(intermediateShader_modelMat, 1, GL_FALSE, glm::value_ptr(modelTransform));
 
-                for (SubMesh submesh : mesh.submeshes) {
-                    glBindVertexArray(submesh.vao);
+                for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+                    glBindVertexArray(mesh.submeshes[s].vao);
 
-                    glDrawElements(GL_TRIANGLES, submesh.indexArray.size(), GL_UNSIGNED_INT, 0);
+                    drawClusters(frame.cameraClusters, m, s);
                 }
             }
         }
     }
 
     // Populate the material buffers using the material shader
+    profiler.beginPass("material");
     glUseProgram(materialShader);
 
     glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, normalTexture, 0);
@@ -911,157 +1336,1153 @@ void Renderer::render(const Camera& camera, const Scene& scene) {
         GL_COLOR_ATTACHMENT5
     };
     glDrawBuffers(6, buffers);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    glUniform1i(materialShader_useTextures, camera.toggle1);
+    glClear(gBufferClear);
 
-    for (StaticModel sm : models) {
-        auto iter = meshMap.find(sm.model->getName());
-
-        if (iter != meshMap.end()) {
-            glm::mat4 modelTransform = glm::mat4();
-
-            Vec3 eulerAngles = sm.orientation;
+    if (batching) {
+        glUseProgram(materialBatchShader);
+        glUniform1i(materialBatchShader_useTextures, frame.textured);
+        glUniform1i(materialBatchShader_ambientTextures, 0);
+        glUniform1i(materialBatchShader_diffuseTextures, 1);
+    }
+    auto setMaterialPassUniforms = [&]() {
+        glUniform1i(materialShader_useTextures, frame.textured);
+        glUniform1i(materialShader_ambientTexture, 0);
+        glUniform1i(materialShader_diffuseTexture, 1);
+    };
+    if (!batching) {
+        setMaterialPassUniforms();
+    }
 
-            modelTransform = glm::translate(modelTransform, sm.position);
-            modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.z), Vec3(0, 0, 1)); //roll
-            modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.y), Vec3(0, 1, 0)); //yaw
-            modelTransform = glm::rotate(modelTransform, glm::radians(eulerAngles.x), Vec3(1, 0, 0)); //pitch
-            modelTransform = glm::scale(modelTransform, sm.scale);
+    double textureBytes = 0.0;
+    int materialDraws = 0;
+    int boundArrays[2] = { -1, -1 };
+    for (size_t m = 0; m < numModels; m++) {
+        if (frame.meshes[m] != NULL && frame.inView[m]) {
+            const glm::mat4& cameraMVMat = frame.cameraMVs[m];
+            const glm::mat4& cameraMVPMat = frame.cameraMVPs[m];
+            const glm::mat4& normalMat = frame.normalMatrices[m];
+
+            const ModelInfo& mesh = *frame.meshes[m];
+
+            if (batching) {
+                glUniformMatrix4fv(materialBatchShader_normalMat, 1, GL_FALSE, glm::value_ptr(normalMat));
+                glUniformMatrix4fv(materialBatchShader_cameraMVPMat, 1, GL_FALSE, glm::value_ptr(cameraMVPMat));
+                glUniformMatrix4fv(materialBatchShader_cameraMVMat, 1, GL_FALSE, glm::value_ptr(cameraMVMat));
+                glBindVertexArray(mesh.batched.vao);
+
+                for (const Batch& batch : mesh.batched.batches) {
+                    if (frame.textured) {
+                        for (int submesh : batch.submeshes) {
+                            const ObjModel::ObjMtl& material = mesh.submeshes[submesh].material;
+                            if (material.map_Ka != -1) {
+                                textureBytes += estimateTextureBytes(mesh.submeshes[submesh], textures[material.map_Ka].size, textures[material.map_Ka].texelBytes, cameraMVMat, frame.cameraProj, mipmapping);
+                            }
+                            if (material.map_Kd != -1) {
+                                textureBytes += estimateTextureBytes(mesh.submeshes[submesh], textures[material.map_Kd].size, textures[material.map_Kd].texelBytes, cameraMVMat, frame.cameraProj, mipmapping);
+                            }
+                        }
+                    }
 
-            glm::mat4 cameraMVMat = cameraView * modelTransform;
-            glm::mat4 cameraMVPMat = cameraProj * cameraMVMat;
-            glm::mat4 normalMat = glm::transpose(glm::inverse(cameraMVMat));
+                    // consecutive batches usually share arrays, so only changes are bound
+                    int arrays[2] = { batch.ambientArray, batch.diffuseArray };
+                    for (int unit = 0; unit < 2; unit++) {
+                        if (arrays[unit] != -1 && arrays[unit] != boundArrays[unit]) {
+                            glActiveTexture(GL_TEXTURE0 + unit);
+                            glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrays[arrays[unit]].texture);
+                            boundArrays[unit] = arrays[unit];
+                        }
+                    }
 
-            ModelInfo mesh = iter->second;
+                    glDrawElements(GL_TRIANGLES, batch.numIndices, GL_UNSIGNED_INT, (void *)(sizeof(unsigned int) * batch.firstIndex));
+                    trianglesDrawn += batch.numIndices / 3;
+                    materialDraws++;
+                }
+                continue;
+            }
 
-            glUniformMatrix4fv(materialShader_normalMat, 1, GL_FALSE, glm::value_ptr(normalMat));
-            glUniformMatrix4fv(materialShader_cameraMVPMat, 1, GL_FALSE, glm::value_ptr(cameraMVPMat));
-            glUniformMatrix4fv(materialShader_cameraMVMat, 1, GL_FALSE, glm::value_ptr(cameraMVMat));
+            auto setModelUniforms = [&]() {
+                glUniformMatrix4fv(materialShader_normalMat, 1, GL_FALSE, glm::value_ptr(normalMat));
+                glUniformMatrix4fv(materialShader_cameraMVPMat, 1, GL_FALSE, glm::value_ptr(cameraMVPMat));
+                glUniformMatrix4fv(materialShader_cameraMVMat, 1, GL_FALSE, glm::value_ptr(cameraMVMat));
+            };
+            setModelUniforms();
 
-            for (SubMesh submesh : mesh.submeshes) {
+            for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+                const SubMesh& submesh = mesh.submeshes[s];
                 glBindVertexArray(submesh.vao);
 
-                ObjModel::ObjMtl material = submesh.material;
+                const ObjModel::ObjMtl& material = submesh.material;
+
+                // the specialized program samples exactly the maps this material has, without testing per fragment
+                if (shaderPermutations) {
+                    unsigned int variant = FIXED_TEXTURES_BIT;
+                    if (frame.textured && material.map_Ka != -1) {
+                        variant |= AMBIENT_MAP_BIT;
+                    }
+                    if (frame.textured && material.map_Kd != -1) {
+                        variant |= DIFFUSE_MAP_BIT;
+                    }
+                    if (useShaderVariant(shaderCache, shaderPath, SHADER_MATERIAL, variant)) {
+                        setMaterialPassUniforms();
+                        setModelUniforms();
+                    }
+                }
 
                 if (material.map_Ka != -1) {
-                    GLuint meshAmbientTexture = mesh.textures[material.map_Ka - 1];
+                    if (frame.textured) {
+                        textureBytes += estimateTextureBytes(submesh, textures[material.map_Ka].size, textures[material.map_Ka].texelBytes, cameraMVMat, frame.cameraProj, mipmapping);
+                    }
                     glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, meshAmbientTexture);
-                    glUniform1i(materialShader_ambientTexture, 0);
-                    glUniform1i(materialShader_hasAmbientTexture, true);
-                }
-                else {
-                    glUniform1i(materialShader_hasAmbientTexture, false);
+                    glBindTexture(GL_TEXTURE_2D, textures[material.map_Ka].texture);
                 }
 
                 if (material.map_Kd != -1) {
-                    GLuint meshDiffuseTexture = mesh.textures[material.map_Kd - 1];
+                    if (frame.textured) {
+                        textureBytes += estimateTextureBytes(submesh, textures[material.map_Kd].size, textures[material.map_Kd].texelBytes, cameraMVMat, frame.cameraProj, mipmapping);
+                    }
                     glActiveTexture(GL_TEXTURE1);
-                    glBindTexture(GL_TEXTURE_2D, meshDiffuseTexture);
-                    glUniform1i(materialShader_diffuseTexture, 1);
-                    glUniform1i(materialShader_hasDiffuseTexture, true);
-                }
-                else {
-                    glUniform1i(materialShader_hasDiffuseTexture, false);
+                    glBindTexture(GL_TEXTURE_2D, textures[material.map_Kd].texture);
                 }
 
-                glUniform3fv(materialShader_ambientColor, 1, glm::value_ptr(material.Ka));
-                glUniform3fv(materialShader_diffuseColor, 1, glm::value_ptr(material.Kd));
-                glUniform3fv(materialShader_specularColor, 1, glm::value_ptr(material.Ks));
-                glUniform1f(materialShader_specularExponent, material.Ns);
+                // the colors are already in the material buffer
+                glUniform1i(materialShader_materialIndex, materialIndex(submesh));
 
-                glDrawElements(GL_TRIANGLES, submesh.indexArray.size(), GL_UNSIGNED_INT, 0);
+                drawClusters(frame.cameraClusters, m, s);
+                materialDraws++;
             }
         }
     }
     //*/
 
+    profiler.setCounter("texture MB (est.)", textureBytes / (1024.0 * 1024.0));
+    profiler.setCounter("material draws", materialDraws);
+
+    if (measureOverdraw) {
+        profiler.beginPass("overdraw");
+        countOverdraw(frame);
+    }
+    profiler.setCounter("triangles drawn", trianglesDrawn);
+    profiler.setCounter("clusters tested", frame.clusterStats.clusters);
+    profiler.setCounter("clusters culled (frustum)", frame.clusterStats.frustumCulled);
+    profiler.setCounter("clusters culled (cone)", frame.clusterStats.coneCulled);
+    profiler.setCounter("draws culled (occlusion)", frame.occludedDraws);
+    profiler.setCounter("triangles culled (occlusion)", frame.occludedTriangles);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+
+    // this frame's depth, for the occlusion tests of the frames after it
+    if (occlusionCulling && !softwareOcclusion) {
+        profiler.beginPass("hiz");
+        readDepthPyramid(frame.cameraProj * frame.cameraView);
+    }
+
     ///*
     // Render quad to the screen
+    profiler.beginPass("final");
     glUseProgram(finalPassShader);
     glDisable(GL_DEPTH_TEST); // Need to disable this for blending to work
     glEnable(GL_BLEND);
     glBlendFunc(GL_ONE, GL_ONE); // This blend function adds to the current color on screen
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, hdrFrameBuffer);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-    // For transforming light directions from world space to view space
-    glUniformMatrix4fv(finalPass_normalMatrix, 1, GL_FALSE, glm::value_ptr(glm::transpose(glm::inverse(cameraView))));
+    // camera and every light's parameters in one upload; each light's draw below only selects its entry
+    updateFrameBuffer(frame);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, normalTexture);
-    glUniform1i(finalPass_normalTexture, 0);
+    // the G-buffer textures stay bound to units 0-5 and the light maps to unit 6 for all lights
+    auto setFinalPassSamplers = [&]() {
+        glUniform1i(finalPass_normalTexture, 0);
+        glUniform1i(finalPass_ambientTexture, 1);
+        glUniform1i(finalPass_diffuseTexture, 2);
+        glUniform1i(finalPass_specularTexture, 3);
+        glUniform1i(finalPass_specularExponentTexture, 4);
+        glUniform1i(finalPass_viewTexture, 5);
+        glUniform1i(finalPass_lightMap, 6);
+    };
+    GLuint gBuffer[6] = { normalTexture, matAmbientTexture, matDiffuseTexture, matSpecularTexture, matSpecularExponentTexture, viewTexture };
+    for (int unit = 0; unit < 6; unit++) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, gBuffer[unit]);
+    }
+    setFinalPassSamplers();
+
+    glBindVertexArray(fullscreenQuadVAO);
+
+    // Lights in the order updateFrameBuffer writes them: sunlight, spotlights, point lights
+    glActiveTexture(GL_TEXTURE6);
+    int numSpotlights = frame.spotlights.size();
+    int numLights = 1 + numSpotlights + (int)frame.pointlights.size();
+    for (int light = 0; light < numLights; light++) {
+        // the shader sees one block of lights at a time
+        if (light % RENDERER_LIGHTS_PER_BLOCK == 0) {
+            glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BINDING, frameUniformBuffer, (light / RENDERER_LIGHTS_PER_BLOCK) * frameBlockStride,
+                              sizeof(FrameBlock));
+        }
+        unsigned int variant;
+        if (light == 0) {
+            glBindTexture(GL_TEXTURE_2D, sunlightTexture);
+            variant = LIGHT_SUN_BIT;
+        }
+        else if (light <= numSpotlights) {
+            glBindTexture(GL_TEXTURE_2D, spotlightTextures[light - 1]);
+            variant = LIGHT_SPOT_BIT;
+        }
+        else {
+            glBindTexture(GL_TEXTURE_2D, pointlightTextures[light - 1 - numSpotlights]);
+            variant = LIGHT_POINT_BIT;
+        }
+        // lights are ordered by type, so the specialized programs change at most twice
+        if (shaderPermutations && useShaderVariant(shaderCache, shaderPath, SHADER_FINALPASS, variant)) {
+            setFinalPassSamplers();
+        }
+        glUniform1i(finalPass_lightIndex, light % RENDERER_LIGHTS_PER_BLOCK);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
+
+    glDisable(GL_BLEND);
+    profiler.endPass();
+
+    // Auto-exposure: the average log luminance is reduced on the GPU and never read back
+    if (toneMapping) {
+        profiler.beginPass("luminance");
+        glUseProgram(luminanceShader);
+        glBindFramebuffer(GL_FRAMEBUFFER, luminanceFrameBuffer);
+        glViewport(0, 0, RENDERER_LUMINANCE_SIZE, RENDERER_LUMINANCE_SIZE);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, hdrTexture);
+        glUniform1i(luminanceShader_hdrTexture, 0);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
 
+        // each level averages 2x2 texels of the one above, down to a single texel
+        glBindTexture(GL_TEXTURE_2D, luminanceTexture);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        int previous = adaptedLuminanceIndex;
+        adaptedLuminanceIndex = 1 - adaptedLuminanceIndex;
+        glUseProgram(adaptationShader);
+        glBindFramebuffer(GL_FRAMEBUFFER, adaptedLuminanceFrameBuffers[adaptedLuminanceIndex]);
+        glViewport(0, 0, 1, 1);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, adaptedLuminanceTextures[previous]);
+        glUniform1i(adaptationShader_luminanceTexture, 0);
+        glUniform1i(adaptationShader_previousLuminance, 1);
+        glUniform1i(adaptationShader_averageLevel, (int)glm::log2((float)RENDERER_LUMINANCE_SIZE));
+        glUniform1f(adaptationShader_adaptationRate, adaptedLuminanceValid ? RENDERER_EXPOSURE_ADAPTATION : 1.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        adaptedLuminanceValid = true;
+        profiler.endPass();
+    }
+
+    // Resolve the HDR target into the output framebuffer
+    profiler.beginPass("tonemap");
+    glUseProgram(toneMapShader);
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, hdrTexture);
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, matAmbientTexture);
-    glUniform1i(finalPass_ambientTexture, 1);
+    glBindTexture(GL_TEXTURE_2D, adaptedLuminanceTextures[adaptedLuminanceIndex]);
+    glUniform1i(toneMapShader_hdrTexture, 0);
+    glUniform1i(toneMapShader_adaptedLuminance, 1);
+    glUniform1i(toneMapShader_toneMapping, toneMapping ? 1 : 0);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glActiveTexture(GL_TEXTURE0);
 
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, matDiffuseTexture);
-    glUniform1i(finalPass_diffuseTexture, 2);
+    glBindVertexArray(0);
+    profiler.endPass();
+
+    double hdrMB = estimateHdrBytes(numLights) / (1024.0 * 1024.0);
+    profiler.setCounter("hdr MB/frame (estimate)", hdrMB);
+    if (hdrMB > RENDERER_HDR_ESTIMATE_BUDGET_MB && !hdrBudgetWarned) {
+        std::cout << "Warning: the HDR target's traffic is estimated at " << hdrMB << " MB per frame with " << numLights
+                  << " lights, over the budget of " << RENDERER_HDR_ESTIMATE_BUDGET_MB
+                  << " MB (counted from the target sizes, not measured; see the passes' GPU times)" << std::endl;
+        hdrBudgetWarned = true;
+    }
+}
 
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, matSpecularTexture);
-    glUniform1i(finalPass_specularTexture, 3);
+void Renderer::setMipmapping(bool enabled) {
+    mipmapping = enabled;
+    for (int i = 0; i < textures.size(); i++) {
+        if (textures[i].created && assets->isCanonicalTexture(i)) {
+            glBindTexture(GL_TEXTURE_2D, textures[i].texture);
+            setTextureFiltering(enabled && !assets->getTexture(i).mips.empty());
+        }
+    }
+    for (const TextureArray& array : textureArrays) {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+        setTextureFiltering(enabled && array.levels > 1, GL_TEXTURE_2D_ARRAY);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, matSpecularExponentTexture);
-    glUniform1i(finalPass_specularExponentTexture, 4);
+void Renderer::setStreaming(bool enabled, size_t budgetBytes) {
+    streaming = enabled;
+    uploadBudget = budgetBytes;
+}
 
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, viewTexture);
-    glUniform1i(finalPass_viewTexture, 5);
+bool Renderer::isStreaming() const {
+    return !streamingModels.empty();
+}
 
-    glBindVertexArray(fullscreenQuadVAO);
+// Copies one chunk of a job through the orphaned staging buffer; returns the bytes uploaded
+size_t uploadChunk(Renderer::UploadJob& job, size_t budget) {
+    size_t chunk = glm::min(job.size - job.offset, budget);
+
+    // compressed textures go in rows of 4x4 blocks, 8 bytes each for BC1 and 16 for the others
+    size_t blockSize = (job.format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 8 : 16;
+    size_t rowBytes = (job.format != 0) ? (job.width + 3) / 4 * blockSize : job.width * 4;
+    GLenum stagingTarget = GL_COPY_READ_BUFFER;
+    if (job.target == GL_TEXTURE_2D) {
+        // whole rows only, at least one even if that goes over budget
+        chunk = glm::max(chunk / rowBytes, (size_t)1) * rowBytes;
+        stagingTarget = GL_PIXEL_UNPACK_BUFFER;
+    }
 
-    //Sunlight
-    glActiveTexture(GL_TEXTURE6);
-    glBindTexture(GL_TEXTURE_2D, sunlightTexture);
-    glUniform1i(finalPass_lightMap, 6);
-    glUniform1f(finalPass_ambientLight, sunlight.ambient);
-    glUniform3fv(finalPass_lightColor, 1, glm::value_ptr(sunlight.color));
-    glUniform3f(finalPass_lightAttenuation, 1, 0, 0);
-    glUniform1i(finalPass_lightType, 0);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    // orphaning gives us fresh storage even if the GPU is still reading the previous chunk
+    glBindBuffer(stagingTarget, stagingBuffer);
+    glBufferData(stagingTarget, chunk, NULL, GL_STREAM_DRAW);
+    void * staging = glMapBufferRange(stagingTarget, 0, chunk, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    memcpy(staging, job.data + job.offset, chunk);
+    glUnmapBuffer(stagingTarget);
+
+    if (job.target == GL_TEXTURE_2D && job.format != 0) {
+        int y = job.offset / rowBytes * 4;
+        glBindTexture(GL_TEXTURE_2D, job.object);
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, job.level, 0, y, job.width, glm::min((int)(chunk / rowBytes) * 4, job.height - y), job.format, chunk, 0);
+    }
+    else if (job.target == GL_TEXTURE_2D) {
+        glBindTexture(GL_TEXTURE_2D, job.object);
+        glTexSubImage2D(GL_TEXTURE_2D, job.level, 0, job.offset / rowBytes, job.width, chunk / rowBytes, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    }
+    else {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, job.object);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, job.offset, chunk);
+    }
+    glBindBuffer(stagingTarget, 0);
 
-    //Set ambient light to 0 for rest of lights
-    glUniform1f(finalPass_ambientLight, 0);
+    job.offset += chunk;
+    return chunk;
+}
 
-    glUniform1i(finalPass_lightType, 1);
-    for (int i = 0; i < scene.getSpotlights().size(); i++) {
-        Scene::SpotLight spotlight = scene.getSpotlights()[i];
+/*
+ * Streaming mode, called at the start of each frame:
+ * 1. models whose meshes finished building on the worker threads get their GL objects allocated,
+ *    and one upload job is queued per buffer and per level of each texture no other model has created yet
+ * 2. jobs are copied through the staging buffer until this frame's byte budget is spent
+ * 3. once all of a model's jobs and those of its textures are done, it replaces its proxy in meshMap
+ */
+void Renderer::streamUploads() {
+    for (StreamingModel& pending : streamingModels) {
+        if (pending.ready || pending.built.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            continue;
+        }
 
-        glBindTexture(GL_TEXTURE_2D, spotlightTextures[i]);
-        glUniform1i(finalPass_lightMap, 6);
-        glUniform3fv(finalPass_lightColor, 1, glm::value_ptr(spotlight.color));
-        glUniform3f(finalPass_lightAttenuation, spotlight.Kc, spotlight.Kl, spotlight.Kq);
+        pending.mesh = pending.built.get();
+        pending.ready = true;
+
+        for (SubMesh& submesh : pending.mesh.submeshes) {
+            createSubMeshObjects(submesh, false);
+
+            UploadJob jobs[4] = {
+                { GL_ARRAY_BUFFER, submesh.vertexBuffer, (const unsigned char *)&submesh.vertexArray[0], sizeof(Point3f) * submesh.vertexArray.size(), 0, 0, 0, &pending },
+                { GL_ARRAY_BUFFER, submesh.normalBuffer, (const unsigned char *)&submesh.normalArray[0], sizeof(Point3f) * submesh.normalArray.size(), 0, 0, 0, &pending },
+                { GL_ELEMENT_ARRAY_BUFFER, submesh.indexBuffer, (const unsigned char *)&submesh.indexArray[0], sizeof(int) * submesh.indexArray.size(), 0, 0, 0, &pending },
+                { GL_ARRAY_BUFFER, submesh.texCoordBuffer, (const unsigned char *)&submesh.texCoordArray[0], sizeof(TexCoord) * submesh.texCoordArray.size(), 0, 0, 0, &pending }
+            };
+            int numJobs = (submesh.texCoordBuffer != 0) ? 4 : 3;
+            for (int i = 0; i < numJobs; i++) {
+                if (jobs[i].size > 0) {
+                    uploadJobs.push_back(jobs[i]);
+                    pending.pendingJobs++;
+                }
+            }
+        }
+        glBindVertexArray(0);
 
-        glUniform3fv(finalPass_spotlightDirection, 1, glm::value_ptr(spotlight.direction));
-        glUniform1f(finalPass_cosHalfLightAngle, (float)glm::cos(glm::radians(spotlight.angle / 2)));
-        glUniform1f(finalPass_spotlightFalloff, spotlight.exponent);
+        // shared textures are created and queued by the first model that needs them
+        for (const SubMesh& submesh : pending.mesh.submeshes) {
+            if (submesh.material.map_Kd != -1) {
+                pending.textures.push_back(assets->canonicalTexture(submesh.material.map_Kd));
+            }
+            if (submesh.material.map_Ka != -1) {
+                pending.textures.push_back(assets->canonicalTexture(submesh.material.map_Ka));
+            }
+        }
+        for (int id : pending.textures) {
+            requireTexture(id, true);
+        }
+    }
 
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+    size_t uploaded = 0;
+    while (!uploadJobs.empty() && uploaded < uploadBudget) {
+        UploadJob& job = uploadJobs.front();
+        uploaded += uploadChunk(job, uploadBudget - uploaded);
+
+        if (job.offset == job.size) {
+            if (job.owner != NULL) {
+                job.owner->pendingJobs--;
+            }
+            else {
+                job.texture->pendingJobs--;
+            }
+            uploadJobs.pop_front();
+        }
     }
+    profiler.setCounter("streamed bytes", uploaded);
 
-    glUniform1i(finalPass_lightType, 2);
-    for (int i = 0; i < scene.getPointlights().size(); i++) {
-        Scene::PointLight pointlight = scene.getPointlights()[i];
+    for (auto iter = streamingModels.begin(); iter != streamingModels.end();) {
+        bool resident = iter->ready && iter->pendingJobs == 0;
+        for (int i = 0; resident && i < iter->textures.size(); i++) {
+            resident = textures[iter->textures[i]].pendingJobs == 0;
+        }
 
-        glBindTexture(GL_TEXTURE_2D, pointlightTextures[i]);
-        glUniform1i(finalPass_lightMap, 6);
-        glUniform3fv(finalPass_lightColor, 1, glm::value_ptr(pointlight.color));
-        glUniform3f(finalPass_lightAttenuation, pointlight.Kc, pointlight.Kl, pointlight.Kq);
+        if (resident) {
+            ModelInfo& proxy = meshMap.at(iter->name);
+            for (SubMesh& submesh : proxy.submeshes) {
+                deleteSubMeshObjects(submesh);
+            }
+            meshMap.at(iter->name) = iter->mesh;
+            meshGeneration++;
+
+            std::cout << "Streamed in " << iter->name << std::endl;
+            iter = streamingModels.erase(iter);
+        }
+        else {
+            ++iter;
+        }
+    }
+
+    if (streamingModels.empty()) {
+        glDeleteBuffers(1, &stagingBuffer);
+        stagingBuffer = 0;
+        streamingPool.reset();
+        std::cout << "Finished streaming" << std::endl;
+        printTextureMemory();
+    }
+}
+
+void Renderer::requireTexture(int id, bool streamed) {
+    TextureInfo& info = textures[id];
+    if (info.created) {
+        return;
+    }
+
+    // duplicates of another file's contents share its GL texture
+    int canonical = assets->canonicalTexture(id);
+    if (canonical != id) {
+        requireTexture(canonical, streamed);
+        info = textures[canonical];
+        info.pendingJobs = 0;
+        return;
+    }
+
+    const AssetRegistry::Texture& texture = assets->getTexture(id);
+    const sf::Image& img = texture.image;
+    const Vector<MipLevel>& mips = texture.mips;
+    const CompressedTexture& compressed = texture.compressed;
+
+    glGenTextures(1, &info.texture);
+    size_t bytes = createTexture(info.texture, img, mips, compressed, !streamed, mipmapping);
+    size_t uncompressed = uncompressedTextureSize(img, mips);
+    info.size = Vec2(img.getSize().x, img.getSize().y);
+    info.texelBytes = 4.0f * bytes / glm::max(uncompressed, (size_t)1);
+    info.created = true;
+    textureMemory += bytes;
+    uncompressedTextureMemory += uncompressed;
+
+    if (!streamed) {
+        return;
+    }
+
+    GLenum format = compressedFormat(compressed);
+    if (format != 0) {
+        for (int level = 0; level < compressed.levels.size(); level++) {
+            UploadJob job = { GL_TEXTURE_2D, info.texture, &compressed.levels[level][0], compressed.levels[level].size(), 0,
+                              (int)compressed.widths[level], level, NULL, format, (int)compressed.heights[level], &info };
+            uploadJobs.push_back(job);
+            info.pendingJobs++;
+        }
+        return;
+    }
+
+    UploadJob job = { GL_TEXTURE_2D, info.texture, img.getPixelsPtr(), (size_t)img.getSize().x * img.getSize().y * 4, 0, (int)img.getSize().x, 0, NULL, 0, 0, &info };
+    if (job.size > 0) {
+        uploadJobs.push_back(job);
+        info.pendingJobs++;
+    }
+    for (int level = 0; level < mips.size(); level++) {
+        UploadJob mipJob = { GL_TEXTURE_2D, info.texture, &mips[level].pixels[0], mips[level].pixels.size(), 0, (int)mips[level].width, level + 1, NULL, 0, 0, &info };
+        uploadJobs.push_back(mipJob);
+        info.pendingJobs++;
+    }
+}
+
+void Renderer::setBatching(bool enabled) {
+    batching = enabled;
+}
+
+void Renderer::setShaderHotReload(bool enabled) {
+    shaderHotReload = enabled;
+}
+
+void Renderer::setShaderPermutations(bool enabled) {
+    shaderPermutations = enabled;
+}
+
+void Renderer::setDepthPrepass(bool enabled) {
+    depthPrepass = enabled;
+}
+
+void Renderer::setOverdrawMeasurement(bool enabled) {
+    measureOverdraw = enabled;
+}
+
+void Renderer::setLevelOfDetail(bool enabled) {
+    levelOfDetail = enabled;
+}
+
+void Renderer::setClusterCulling(bool enabled) {
+    clusterCulling = enabled;
+}
+
+void Renderer::setOcclusionCulling(bool enabled) {
+    occlusionCulling = enabled;
+    // a pyramid from before it was turned off would hide whatever the camera has turned to since
+    occluders.clear();
+}
+
+void Renderer::setSoftwareOcclusion(bool enabled) {
+    softwareOcclusion = enabled;
+    occluders.clear();
+}
+
+void Renderer::prepareTransforms(FrameData& frame, const Scene& scene) {
+    glm::mat4 cameraVP = frame.cameraProj * frame.cameraView;
+    glm::mat4 sunlightVP = frame.sunlightProj * frame.sunlightView;
+    const glm::mat4x3 * world = frame.worldMatrices.data();
+    size_t count = frame.meshes.size();
+    frame.cameraMVPs.resize(count);
+    frame.cameraMVs.resize(count);
+    frame.normalMatrices.resize(count);
+    frame.sunlightMVPs.resize(count);
+    frame.localBoundsMin.resize(count);
+    frame.localBoundsMax.resize(count);
+    frame.worldBoundsMin.resize(count);
+    frame.worldBoundsMax.resize(count);
+    frame.inView.resize(count);
+    frame.cameraLodErrors.resize(count);
+    frame.sunlightLodErrors.resize(count);
+
+    batchConcatenate(cameraVP, world, count, frame.cameraMVPs.data());
+    batchConcatenate(frame.cameraView, world, count, frame.cameraMVs.data());
+    batchNormalMatrices(frame.cameraView, world, count, frame.normalMatrices.data());
+    batchConcatenate(sunlightVP, world, count, frame.sunlightMVPs.data());
+
+    // models still waiting for their mesh get an empty box; they are not drawn anyway
+    for (size_t m = 0; m < count; m++) {
+        frame.localBoundsMin[m] = frame.meshes[m] != NULL ? frame.meshes[m]->boundsMin : Vec3(0.0f);
+        frame.localBoundsMax[m] = frame.meshes[m] != NULL ? frame.meshes[m]->boundsMax : Vec3(0.0f);
+    }
+    batchTransformBounds(world, frame.localBoundsMin.data(), frame.localBoundsMax.data(), count, frame.worldBoundsMin.data(), frame.worldBoundsMax.data());
+
+    glm::vec4 planes[6];
+    frustumPlanes(cameraVP, planes);
+    frame.frustumCulled = 0;
+    for (size_t m = 0; m < count; m++) {
+        frame.inView[m] = boxInFrustum(planes, frame.worldBoundsMin[m], frame.worldBoundsMax[m]);
+        frame.frustumCulled += frame.inView[m] ? 0 : 1;
+    }
+
+    // the batched material pass only has the full meshes, so the other camera passes draw them too
+    bool cameraLod = levelOfDetail && !batching;
+    for (size_t m = 0; m < count; m++) {
+        frame.cameraLodErrors[m] = cameraLod ? perspectiveLodError(world[m], frame.worldBoundsMin[m], frame.worldBoundsMax[m], frame.eye, frame.cameraProj[1][1],
+                                                                   SCREEN_HEIGHT, RENDERER_LOD_PIXEL_ERROR) : 0.0f;
+        frame.sunlightLodErrors[m] = levelOfDetail ? orthographicLodError(world[m], frame.sunlightProj[1][1], 1024.0f, RENDERER_SHADOW_LOD_PIXEL_ERROR) : 0.0f;
+    }
+}
+
+void Renderer::cullOccludedModels(FrameData& frame) {
+    const glm::mat4x3 * world = frame.worldMatrices.data();
+    frame.occludedDraws = 0;
+    frame.occludedTriangles = 0;
+    frame.occludedModels = 0;
+    for (size_t m = 0; m < frame.meshes.size() && !occluders.empty(); m++) {
+        if (frame.meshes[m] == NULL || !frame.inView[m] || !occluders.boxOccluded(world[m], frame.localBoundsMin[m], frame.localBoundsMax[m])) {
+            continue;
+        }
+        frame.inView[m] = false;
+        frame.occludedModels++;
+        for (const SubMesh& submesh : frame.meshes[m]->submeshes) {
+            frame.occludedDraws++;
+            frame.occludedTriangles += submesh.selectLod(frame.cameraLodErrors[m]).numIndices / 3;
+        }
+    }
+}
+
+void Renderer::cullClusters(FrameData& frame, ClusterPass& pass, const Vector<float>& lodErrors, bool cameraPass, const MeshletCullView& view) {
+    size_t count = frame.meshes.size();
+    pass.instances.clear();
+    pass.firstInstance.assign(count, -1);
+    if (!clusterCulling) {
+        pass.ranges.clear();
+    }
+
+    for (size_t m = 0; m < count; m++) {
+        if (frame.meshes[m] == NULL || (cameraPass && !frame.inView[m])) {
+            continue;
+        }
+
+        /*
+         * Where the near plane cuts a mesh, its back faces are what the pass sees through the cut; the sun's
+         * shadow volume clips tall casters that way, and the camera when it is inside a model's bounds
+         */
+        Vec3 nearPlane(view.planes[4]);
+        Vec3 nearest = glm::mix(frame.worldBoundsMax[m], frame.worldBoundsMin[m], glm::step(Vec3(0.0f), nearPlane));
+        bool backFacesHidden = glm::dot(nearPlane, nearest) + view.planes[4].w >= 0.0f;
+        pass.firstInstance[m] = (int)pass.instances.size();
+        const Vector<SubMesh>& submeshes = frame.meshes[m]->submeshes;
+        for (const SubMesh& submesh : submeshes) {
+            const SubMesh::Lod& lod = submesh.selectLod(lodErrors[m]);
+
+            // a model with one submesh was tested whole in cullOccludedModels
+            bool occluded = cameraPass && !occluders.empty() && submeshes.size() > 1 &&
+                            occluders.boxOccluded(frame.worldMatrices[m], submesh.boundsMin, submesh.boundsMax);
+            if (occluded) {
+                frame.occludedDraws++;
+                frame.occludedTriangles += lod.numIndices / 3;
+            }
+
+            MeshletInstance instance = { &submesh.clusters, lod.firstCluster, occluded ? 0 : lod.numClusters, frame.worldMatrices[m], backFacesHidden };
+            pass.instances.push_back(instance);
+
+            if (!clusterCulling) {
+                MeshletDrawRange whole = { lod.firstIndex, lod.numIndices };
+                pass.ranges.push_back(Vector<MeshletDrawRange>(occluded ? 0 : 1, whole));
+            }
+        }
+    }
+
+    if (clusterCulling) {
+        MeshletCullStats stats = clusterCuller.cull(view, pass.instances, pass.ranges);
+        frame.clusterStats.clusters += stats.clusters;
+        frame.clusterStats.frustumCulled += stats.frustumCulled;
+        frame.clusterStats.coneCulled += stats.coneCulled;
+    }
+}
+
+// Draws the ranges the pass kept of a model's submesh, whose VAO is bound, in one call
+void Renderer::drawClusters(const ClusterPass& pass, size_t model, size_t submesh) {
+    const Vector<MeshletDrawRange>& ranges = pass.ranges[pass.firstInstance[model] + submesh];
+    if (ranges.size() == 1) {
+        glDrawElements(GL_TRIANGLES, ranges[0].numIndices, GL_UNSIGNED_INT, (void *)(sizeof(int) * ranges[0].firstIndex));
+        trianglesDrawn += ranges[0].numIndices / 3;
+        return;
+    }
+
+    multiDrawCounts.clear();
+    multiDrawOffsets.clear();
+    for (const MeshletDrawRange& range : ranges) {
+        multiDrawCounts.push_back(range.numIndices);
+        multiDrawOffsets.push_back((const void *)(sizeof(int) * range.firstIndex));
+        trianglesDrawn += range.numIndices / 3;
+    }
+    if (!ranges.empty()) {
+        glMultiDrawElements(GL_TRIANGLES, multiDrawCounts.data(), GL_UNSIGNED_INT, multiDrawOffsets.data(), (GLsizei)ranges.size());
+    }
+}
+
+void Renderer::readDepthPyramid(const glm::mat4& viewProj) {
+    // a frame whose buffer is still on its way skips its read back; the pyramid just gets a frame older
+    DepthReadback& readback = depthReadbacks[depthReadbackIndex];
+    if (readback.fence != 0) {
+        return;
+    }
+
+    glUseProgram(hiZShader);
+    glBindFramebuffer(GL_FRAMEBUFFER, hiZFrameBuffer);
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(fullscreenQuadVAO);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(hiZShader_source, 0);
+
+    GLuint source = depthBuffer;
+    int width = SCREEN_WIDTH, height = SCREEN_HEIGHT;
+    for (int i = 0; i < RENDERER_HIZ_REDUCTIONS; i++) {
+        glBindTexture(GL_TEXTURE_2D, source);
+        glUniform2i(hiZShader_sourceSize, width, height);
+        width = glm::max(width / 2, 1);
+        height = glm::max(height / 2, 1);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, hiZTextures[i], 0);
+        glViewport(0, 0, width, height);
         glDrawArrays(GL_TRIANGLES, 0, 6);
+        source = hiZTextures[i];
     }
 
+    // into the pixel buffer, so glReadPixels returns without waiting for the GPU
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glReadPixels(0, 0, width, height, GL_RED, GL_FLOAT, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.viewProj = viewProj;
+    depthReadbackIndex = (depthReadbackIndex + 1) % RENDERER_HIZ_READBACKS;
+
+    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+void Renderer::takeDepthPyramid() {
+    // newest first; fences signal in order, so every read back older than one that has landed has too
+    bool taken = false;
+    for (int age = 1; age <= RENDERER_HIZ_READBACKS; age++) {
+        DepthReadback& readback = depthReadbacks[(depthReadbackIndex + RENDERER_HIZ_READBACKS - age) % RENDERER_HIZ_READBACKS];
+        if (readback.fence == 0) {
+            continue;
+        }
+        if (!taken) {
+            GLenum status = glClientWaitSync(readback.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                continue;
+            }
+
+            int width = glm::max(SCREEN_WIDTH >> RENDERER_HIZ_REDUCTIONS, 1), height = glm::max(SCREEN_HEIGHT >> RENDERER_HIZ_REDUCTIONS, 1);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            const float * depth = (const float *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, width * height * sizeof(float), GL_MAP_READ_BIT);
+            if (depth != NULL) {
+                occluders.build(depth, width, height, readback.viewProj);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            taken = true;
+        }
+        glDeleteSync(readback.fence);
+        readback.fence = 0;
+    }
+}
+
+void Renderer::startOccluders(const Scene& scene, const FrameData& frame) {
+    // streaming proxies occlude as the boxes they are drawn as until their meshes replace them
+    const Vector<StaticModel>& models = scene.getModels();
+    occluderMeshes.clear();
+    for (size_t m = 0; m < models.size(); m++) {
+        if (!models[m].occluder || frame.meshes[m] == NULL) {
+            continue;
+        }
+        for (const SubMesh& submesh : frame.meshes[m]->submeshes) {
+            if (submesh.vertexArray.empty()) {
+                continue;
+            }
+            OccluderMesh mesh = { &submesh.vertexArray[0].x, submesh.vertexArray.size(), submesh.indexArray.data(),
+                                  submesh.lods[0].numIndices, frame.worldMatrices[m] };
+            occluderMeshes.push_back(mesh);
+        }
+    }
+    occlusionRasterizer.start(frame.cameraProj * frame.cameraView, occluderMeshes);
+}
+
+void Renderer::drawPositions(const FrameData& frame, int mvpLocation) {
+    for (size_t m = 0; m < frame.meshes.size(); m++) {
+        if (frame.meshes[m] == NULL || !frame.inView[m]) {
+            continue;
+        }
+
+        // the same matrices as the G-buffer passes, so the depths match for GL_EQUAL
+        glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, glm::value_ptr(frame.cameraMVPs[m]));
+
+        const Vector<SubMesh>& submeshes = frame.meshes[m]->submeshes;
+        for (size_t s = 0; s < submeshes.size(); s++) {
+            glBindVertexArray(submeshes[s].vao);
+
+            drawClusters(frame.cameraClusters, m, s);
+        }
+    }
+}
+
+/*
+ * Draws the scene again with the depth test the material pass used, adding one per fragment that passes it:
+ * without the pre-pass the depth buffer is cleared and written in draw order, with it the pre-pass depth is
+ * tested GL_EQUAL. Reading the counts back stalls the pipeline, so this is only meant for measuring.
+ */
+void Renderer::countOverdraw(const FrameData& frame) {
+    glBindFramebuffer(GL_FRAMEBUFFER, overdrawFrameBuffer);
+    glClear(depthPrepass ? GL_COLOR_BUFFER_BIT : GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glUseProgram(overdrawShader);
+    drawPositions(frame, overdrawShader_mvpMat);
     glDisable(GL_BLEND);
 
+    Vector<float> counts(SCREEN_WIDTH * SCREEN_HEIGHT);
+    glReadPixels(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_RED, GL_FLOAT, &counts[0]);
+    double fragments = 0.0;
+    int coveredPixels = 0;
+    float maxFragments = 0.0f;
+    for (float count : counts) {
+        if (count > 0.0f) {
+            fragments += count;
+            coveredPixels++;
+            maxFragments = glm::max(maxFragments, count);
+        }
+    }
+    profiler.setCounter("overdraw (fragments/pixel)", coveredPixels > 0 ? fragments / coveredPixels : 0.0);
+    profiler.setCounter("overdraw max", maxFragments);
+    profiler.setCounter("covered pixels", coveredPixels);
+}
+
+void Renderer::setToneMapping(bool enabled) {
+    toneMapping = enabled;
+    // the exposure snaps to the scene again instead of adapting from a stale average
+    adaptedLuminanceValid = false;
+}
+
+/*
+ * Groups the registry's textures by size, format and mip count and uploads each group as one texture array,
+ * so draws whose textures differ only in layer can share bindings. Duplicates stay out: materials only
+ * refer to canonical textures.
+ */
+void Renderer::createTextureArrays() {
+    for (int id = 0; id < assets->numTextures(); id++) {
+        const AssetRegistry::Texture& texture = assets->getTexture(id);
+        if (!assets->isCanonicalTexture(id) || texture.image.getSize().x == 0) {
+            continue;
+        }
+
+        unsigned int format = compressedFormat(texture.compressed);
+        int levels = (format != 0) ? texture.compressed.levels.size() : texture.mips.size() + 1;
+        unsigned int width = texture.image.getSize().x;
+        unsigned int height = texture.image.getSize().y;
+
+        int array = 0;
+        while (array < textureArrays.size() && !(textureArrays[array].width == width && textureArrays[array].height == height &&
+                                                 textureArrays[array].format == format && textureArrays[array].levels == levels)) {
+            array++;
+        }
+        if (array == textureArrays.size()) {
+            TextureArray newArray;
+            newArray.width = width;
+            newArray.height = height;
+            newArray.format = format;
+            newArray.levels = levels;
+            textureArrays.push_back(newArray);
+        }
+
+        TextureInfo& info = textures[id];
+        info.array = array;
+        info.layer = textureArrays[array].layers.size();
+        info.size = Vec2(width, height);
+        textureArrays[array].layers.push_back(id);
+    }
+
+    for (TextureArray& array : textureArrays) {
+        int numLayers = array.layers.size();
+        size_t bytes = 0;
+        size_t uncompressed = 0;
+
+        glGenTextures(1, &array.texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+        for (int level = 0; level < array.levels; level++) {
+            unsigned int width = glm::max(array.width >> level, 1u);
+            unsigned int height = glm::max(array.height >> level, 1u);
+
+            if (array.format != 0) {
+                size_t layerSize = assets->getTexture(array.layers[0]).compressed.levels[level].size();
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, array.format, width, height, numLayers, 0, layerSize * numLayers, NULL);
+                for (int layer = 0; layer < numLayers; layer++) {
+                    const Vector<unsigned char>& data = assets->getTexture(array.layers[layer]).compressed.levels[level];
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, array.format, data.size(), &data[0]);
+                }
+                bytes += layerSize * numLayers;
+            }
+            else {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA, width, height, numLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+                for (int layer = 0; layer < numLayers; layer++) {
+                    const AssetRegistry::Texture& texture = assets->getTexture(array.layers[layer]);
+                    const unsigned char * pixels = (level == 0) ? texture.image.getPixelsPtr() : &texture.mips[level - 1].pixels[0];
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+                }
+                bytes += (size_t)width * height * 4 * numLayers;
+            }
+            uncompressed += (size_t)width * height * 4 * numLayers;
+        }
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, array.levels - 1);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        setTextureFiltering(mipmapping && array.levels > 1, GL_TEXTURE_2D_ARRAY);
+
+        for (int id : array.layers) {
+            textures[id].texelBytes = 4.0f * bytes / glm::max(uncompressed, (size_t)1);
+        }
+        textureMemory += bytes;
+        uncompressedTextureMemory += uncompressed;
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    std::cout << "Packed textures into " << textureArrays.size() << " texture arrays" << std::endl;
+}
+
+/*
+ * Merges a model's submeshes into one VAO. Submeshes are sorted by the texture arrays they sample, so each
+ * run of equal arrays is one contiguous range of indices. Vertices carry their material buffer entry.
+ */
+void Renderer::buildBatches(ModelInfo& mesh) {
+    auto arrayOf = [this](int texture) {
+        return (texture == -1) ? -1 : textures[texture].array;
+    };
+
+    Vector<int> order(mesh.submeshes.size());
+    for (int i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        const ObjModel::ObjMtl& ma = mesh.submeshes[a].material;
+        const ObjModel::ObjMtl& mb = mesh.submeshes[b].material;
+        return std::make_pair(arrayOf(ma.map_Ka), arrayOf(ma.map_Kd)) < std::make_pair(arrayOf(mb.map_Ka), arrayOf(mb.map_Kd));
+    });
+
+    Vector<Point3f> vertices;
+    Vector<Point3f> normals;
+    Vector<TexCoord> texCoords;
+    Vector<GLushort> materials;
+    Vector<unsigned int> indices;
+    BatchedMesh& batched = mesh.batched;
+
+    for (int i : order) {
+        const SubMesh& submesh = mesh.submeshes[i];
+        const ObjModel::ObjMtl& material = submesh.material;
+        int ambientArray = arrayOf(material.map_Ka);
+        int diffuseArray = arrayOf(material.map_Kd);
+
+        bool sameArrays = !batched.batches.empty() && batched.batches.back().ambientArray == ambientArray &&
+                          batched.batches.back().diffuseArray == diffuseArray;
+        if (!sameArrays) {
+            Batch batch;
+            batch.ambientArray = ambientArray;
+            batch.diffuseArray = diffuseArray;
+            batch.firstIndex = indices.size();
+            batch.numIndices = 0;
+            batched.batches.push_back(batch);
+        }
+
+        Batch& batch = batched.batches.back();
+        GLushort entry = materialIndex(submesh);
+        batch.submeshes.push_back(i);
+
+        // submeshes without texture coordinates get zeros; they have no texture to sample anyway
+        unsigned int base = vertices.size();
+        bool hasTexCoords = submesh.texCoordArray.size() == submesh.vertexArray.size();
+        for (int v = 0; v < submesh.vertexArray.size(); v++) {
+            vertices.push_back(submesh.vertexArray[v]);
+            normals.push_back(submesh.normalArray[v]);
+            texCoords.push_back(hasTexCoords ? submesh.texCoordArray[v] : TexCoord(0.0f, 0.0f));
+            materials.push_back(entry);
+        }
+        // the batches draw the full meshes only
+        const SubMesh::Lod& full = submesh.lods[0];
+        for (unsigned int k = 0; k < full.numIndices; k++) {
+            indices.push_back(base + submesh.indexArray[full.firstIndex + k]);
+        }
+        batch.numIndices += full.numIndices;
+    }
+
+    if (indices.empty()) {
+        return;
+    }
+
+    glGenVertexArrays(1, &batched.vao);
+    glBindVertexArray(batched.vao);
+
+    glGenBuffers(1, &batched.vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, batched.vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Point3f) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+
+    glGenBuffers(1, &batched.normalBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, batched.normalBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Point3f) * normals.size(), &normals[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(1);
+
+    glGenBuffers(1, &batched.texCoordBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, batched.texCoordBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(TexCoord) * texCoords.size(), &texCoords[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(2);
+
+    glGenBuffers(1, &batched.materialBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, batched.materialBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLushort) * materials.size(), &materials[0], GL_STATIC_DRAW);
+    glVertexAttribIPointer(3, 1, GL_UNSIGNED_SHORT, 0, 0);
+    glEnableVertexAttribArray(3);
+
+    glGenBuffers(1, &batched.indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batched.indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), &indices[0], GL_STATIC_DRAW);
     glBindVertexArray(0);
 }
 
+int Renderer::materialIndex(const SubMesh& submesh) const {
+    return (submesh.materialID == -1 || submesh.materialID >= defaultMaterial) ? defaultMaterial : submesh.materialID;
+}
+
+/*
+ * Writes one entry per registry material, indexed by material id, plus a default material after them.
+ * Needs the texture arrays when batching, since the entries then hold texture layers.
+ */
+void Renderer::createMaterialBuffer() {
+    defaultMaterial = assets->numMaterials();
+
+    auto textureSlot = [this](int texture) {
+        if (texture == -1) {
+            return -1.0f;
+        }
+        return batching ? (float)textures[texture].layer : 0.0f;
+    };
+
+    Vector<MaterialBlock> blocks(defaultMaterial + 1);
+    for (int id = 0; id <= defaultMaterial; id++) {
+        ObjModel::ObjMtl material = (id < defaultMaterial) ? assets->getMaterial(id) : ObjModel::ObjMtl();
+        blocks[id].ambient = glm::vec4(material.Ka, textureSlot(material.map_Ka));
+        blocks[id].diffuse = glm::vec4(material.Kd, textureSlot(material.map_Kd));
+        blocks[id].specular = glm::vec4(material.Ks, material.Ns);
+    }
+
+    glGenBuffers(1, &materialUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, materialUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(MaterialBlock) * materialBlockEntries, NULL, GL_STATIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(MaterialBlock) * blocks.size(), &blocks[0]);
+    glBindBufferBase(GL_UNIFORM_BUFFER, MATERIALS_BINDING, materialUniformBuffer);
+
+    // blocks of lights are bound at offsets that have to be multiples of the alignment
+    GLint alignment = 1;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = glm::max(alignment, 1);
+    frameBlockStride = (sizeof(FrameBlock) + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &frameUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), NULL, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, frameUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+/*
+ * Camera matrices and all lights for the final pass: sunlight first, then spotlights and point lights in scene
+ * order. Every RENDERER_LIGHTS_PER_BLOCK lights get a FrameBlock of their own with a copy of the matrices, and
+ * the final pass binds the block of the light it draws.
+ */
+void Renderer::updateFrameBuffer(const FrameData& frameData) {
+    Vector<LightBlock> lights;
+    lights.reserve(1 + frameData.spotlights.size() + frameData.pointlights.size());
+
+    const Scene::DirectionalLight& sunlight = frameData.sunlight;
+    LightBlock sun;
+    sun.color = glm::vec4(sunlight.color, sunlight.ambient);
+    sun.attenuation = glm::vec4(1, 0, 0, 0);
+    sun.direction = glm::vec4(0, 0, 0, 0);
+    sun.params = glm::vec4(0, 0, 0, 0);
+    lights.push_back(sun);
+
+    for (const SpotlightPass& pass : frameData.spotlights) {
+        const Scene::SpotLight& spotlight = pass.light;
+        LightBlock light;
+        light.color = glm::vec4(spotlight.color, 0);
+        light.attenuation = glm::vec4(spotlight.Kc, spotlight.Kl, spotlight.Kq, 0);
+        light.direction = glm::vec4(spotlight.direction, (float)glm::cos(glm::radians(spotlight.angle / 2)));
+        light.params = glm::vec4(spotlight.exponent, 1, 0, 0);
+        lights.push_back(light);
+    }
+    for (const Scene::PointLight& pointlight : frameData.pointlights) {
+        LightBlock light;
+        light.color = glm::vec4(pointlight.color, 0);
+        light.attenuation = glm::vec4(pointlight.Kc, pointlight.Kl, pointlight.Kq, 0);
+        light.direction = glm::vec4(0, 0, 0, 0);
+        light.params = glm::vec4(0, 2, 0, 0);
+        lights.push_back(light);
+    }
+
+    size_t numBlocks = (lights.size() + RENDERER_LIGHTS_PER_BLOCK - 1) / RENDERER_LIGHTS_PER_BLOCK;
+    Vector<unsigned char> data(numBlocks * frameBlockStride);
+    for (size_t block = 0; block < numBlocks; block++) {
+        FrameBlock& frame = *reinterpret_cast<FrameBlock*>(&data[block * frameBlockStride]);
+        frame.view = frameData.cameraView;
+        frame.projection = frameData.cameraProj;
+        frame.normalMatrix = glm::transpose(glm::inverse(frame.view));
+        size_t first = block * RENDERER_LIGHTS_PER_BLOCK;
+        size_t count = glm::min(lights.size() - first, (size_t)RENDERER_LIGHTS_PER_BLOCK);
+        std::copy(lights.begin() + first, lights.begin() + first + count, frame.lights);
+    }
+
+    // orphaning the old storage lets the driver keep last frame's copy in flight; the last block is allocated
+    // whole, since its binding covers a full FrameBlock
+    size_t size = (numBlocks - 1) * frameBlockStride + sizeof(FrameBlock);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, size, &data[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void Renderer::printTextureMemory() const {
+    std::cout << "Texture memory: " << textureMemory / (1024.0 * 1024.0) << " MB on the GPU ("
+              << uncompressedTextureMemory / (1024.0 * 1024.0) << " MB as RGBA8)" << std::endl;
+}
+
+void Renderer::setOutputFramebuffer(unsigned int framebuffer) {
+    outputFramebuffer = framebuffer;
+}
+
 void Renderer::release()
 {
+    shaderWatcher.stop();
+
+    // let the workers finish before their results are dropped
+    streamingPool.reset();
+    streamingModels.clear();
+    uploadJobs.clear();
+    if (stagingBuffer != 0) {
+        glDeleteBuffers(1, &stagingBuffer);
+        stagingBuffer = 0;
+    }
+
+    for (int i = 0; i < textures.size(); i++) {
+        if (textures[i].created && assets->isCanonicalTexture(i)) {
+            glDeleteTextures(1, &textures[i].texture);
+        }
+    }
+    textures.clear();
+    for (TextureArray& array : textureArrays) {
+        glDeleteTextures(1, &array.texture);
+    }
+    textureArrays.clear();
+    glDeleteBuffers(1, &materialUniformBuffer);
+    glDeleteBuffers(1, &frameUniformBuffer);
+    for (ShaderProgram& shader : shaderPrograms) {
+        deleteShaderVariants(shader);
+    }
+    materialUniformBuffer = 0;
+    frameUniformBuffer = 0;
+
+    glDeleteFramebuffers(1, &hdrFrameBuffer);
+    glDeleteTextures(1, &hdrTexture);
+    glDeleteFramebuffers(1, &luminanceFrameBuffer);
+    glDeleteTextures(1, &luminanceTexture);
+    glDeleteFramebuffers(2, adaptedLuminanceFrameBuffers);
+    glDeleteTextures(2, adaptedLuminanceTextures);
+    glDeleteFramebuffers(1, &overdrawFrameBuffer);
+    glDeleteTextures(1, &overdrawTexture);
+    glDeleteFramebuffers(1, &hiZFrameBuffer);
+    glDeleteTextures(RENDERER_HIZ_REDUCTIONS, hiZTextures);
+    for (DepthReadback& readback : depthReadbacks) {
+        glDeleteBuffers(1, &readback.buffer);
+        if (readback.fence != 0) {
+            glDeleteSync(readback.fence);
+            readback.fence = 0;
+        }
+    }
+
+    profiler.release();
     glDisable(GL_DEPTH_TEST);
 }
\ No newline at end of file
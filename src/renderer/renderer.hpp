@@ -3,7 +3,21 @@
 #define GLEW_STATIC
 
 #include <renderer/camera.hpp>
+#include <renderer/profiler.hpp>
+#include <renderer/shadercache.hpp>
+#include <renderer/shaderwatcher.hpp>
+#include <scene/batchtransform.hpp>
+#include <scene/depthpyramid.hpp>
+#include <scene/meshlet.hpp>
+#include <scene/occlusionraster.hpp>
 #include <scene/scene.hpp>
+#include <scene/simplify.hpp>
+#include <scene/threadpool.hpp>
+#include <SFML/Graphics/Image.hpp>
+#include <deque>
+#include <future>
+#include <list>
+#include <memory>
 
 #define Vec2 glm::vec2
 #define Vec3 glm::vec3
@@ -18,6 +32,40 @@
 #define SCREEN_WIDTH 640
 #define SCREEN_HEIGHT 480
 
+// Upper bound for anisotropic filtering, if the driver supports it
+#define RENDERER_MAX_ANISOTROPY 8.0f
+
+// Fewest entries of the material uniform block; larger scenes get one entry per material, as many as a uniform
+// block can hold (the shaders get the size as MAX_MATERIALS)
+#define RENDERER_MIN_MATERIALS 256
+
+// Lights in one per-frame uniform block; the final pass binds one block after another, so any number of lights
+// is shaded. Must match MAX_LIGHTS in finalpass.frag
+#define RENDERER_LIGHTS_PER_BLOCK 64
+
+// Side of the log luminance texture for auto-exposure; a power of two, mip-mapped down to 1x1
+#define RENDERER_LUMINANCE_SIZE 256
+
+// Fraction of the way the exposure moves towards the current frame's average luminance each frame
+#define RENDERER_EXPOSURE_ADAPTATION 0.05f
+
+// Warn when the HDR target's traffic per frame, estimated from the target sizes rather than measured (see the
+// "hdr MB/frame (estimate)" counter), exceeds this
+#define RENDERER_HDR_ESTIMATE_BUDGET_MB 64.0
+
+// Largest error, in pixels of the target drawn into, that a coarser level of detail may add; shadow map texels
+// are magnified and filtered, so shadow passes accept more
+#define RENDERER_LOD_PIXEL_ERROR 1.0f
+#define RENDERER_SHADOW_LOD_PIXEL_ERROR 2.0f
+
+// Occlusion culling: times the depth buffer is halved on the GPU before it is read back (the CPU builds the
+// coarser levels), and how many read backs may be in flight before a frame skips its own
+#define RENDERER_HIZ_REDUCTIONS 2
+#define RENDERER_HIZ_READBACKS 3
+
+// Software occlusion culling draws the scene's occluders at the screen's size divided by this
+#define RENDERER_OCCLUSION_RASTER_DIVISOR 4
+
 class Renderer {
 public:
 
@@ -73,18 +121,84 @@ public:
         Vector<TexCoord> texCoordArray;
         Vector<int> indexArray;
 
+        /*
+         * Levels of detail, finest first: lods[0] is the whole mesh, and the triangles of the coarser levels
+         * follow it in indexArray, over the same vertices (see scene/simplify.hpp). Every level is split into
+         * clusters, whose triangles are contiguous in it (see scene/meshlet.hpp).
+         */
+        struct Lod {
+            unsigned int firstIndex;
+            unsigned int numIndices;
+            float error;                // distance from the full mesh, in model units
+            unsigned int firstCluster;
+            unsigned int numClusters;
+        };
+        Vector<Lod> lods;
+        MeshletSet clusters;
+
         // I only support meshes that have one vertex type per triangle group
         Triangle::VertexType vType;
 
         // I only support meshes that have one material per triangle group
         ObjModel::ObjMtl material;
+        int materialID = -1;            // entry in the scene's AssetRegistry, -1 for the default material
+
+        unsigned int vertexBuffer = 0;
+        unsigned int normalBuffer = 0;
+        unsigned int texCoordBuffer = 0;
+        unsigned int indexBuffer = 0;
+
+        unsigned int vao = 0;
 
-        unsigned int vertexBuffer;
-        unsigned int normalBuffer;
-        unsigned int texCoordBuffer;
-        unsigned int indexBuffer;
+        // object-space bounding box, for screen-size estimates
+        Vec3 boundsMin;
+        Vec3 boundsMax;
 
-        unsigned int vao;
+        void computeBounds() {
+            boundsMin = boundsMax = vertexArray.empty() ? Vec3(0.0f) : Vec3(vertexArray[0].x, vertexArray[0].y, vertexArray[0].z);
+            for (const Point3f& p : vertexArray) {
+                boundsMin = glm::min(boundsMin, Vec3(p.x, p.y, p.z));
+                boundsMax = glm::max(boundsMax, Vec3(p.x, p.y, p.z));
+            }
+        }
+
+        void buildLods() {
+            Lod full = { 0, (unsigned int)indexArray.size(), 0.0f, 0, 0 };
+            lods.assign(1, full);
+
+            Vector<Vec3> positions, normals;
+            Vector<Vec2> texCoords;
+            for (int i = 0; i < vertexArray.size(); i++) {
+                positions.push_back(Vec3(vertexArray[i].x, vertexArray[i].y, vertexArray[i].z));
+                normals.push_back(Vec3(normalArray[i].x, normalArray[i].y, normalArray[i].z));
+            }
+            if (texCoordArray.size() == vertexArray.size()) {
+                for (const TexCoord& t : texCoordArray) {
+                    texCoords.push_back(Vec2(t.u, t.v));
+                }
+            }
+
+            for (const SimplifiedLevel& level : buildLodChain(positions, normals, texCoords, indexArray)) {
+                Lod lod = { (unsigned int)indexArray.size(), (unsigned int)level.indices.size(), level.error, 0, 0 };
+                indexArray.insert(indexArray.end(), level.indices.begin(), level.indices.end());
+                lods.push_back(lod);
+            }
+
+            clusters.clear();
+            for (Lod& lod : lods) {
+                lod.firstCluster = clusters.size();
+                lod.numClusters = buildMeshlets(positions, indexArray, lod.firstIndex, lod.numIndices, clusters);
+            }
+        }
+
+        // The coarsest level whose error is within maxError, in model units
+        const Lod& selectLod(float maxError) const {
+            size_t level = 0;
+            while (level + 1 < lods.size() && lods[level + 1].error <= maxError) {
+                level++;
+            }
+            return lods[level];
+        }
 
         int attemptToFindVertex(Point3f vertex, Point3f normal) const {
             for (int i = 0; i < vertexArray.size(); i++) {
@@ -111,6 +225,10 @@ public:
             return -1;
         }
 
+        // empty mesh with the default material, filled in by hand (streaming proxies)
+        SubMesh() : vType(Triangle::VertexType::POSITION_NORMAL) {
+        }
+
         SubMesh(TriangleGroup tg, ObjModel obj) {
             Vector<Vec3> vertices = obj.getVertices();
             Vector<Vec3> normals = obj.getNormals();
@@ -121,6 +239,7 @@ public:
             vType = triangles[0].vertexType;
 
             material = obj.getMaterial(triangles[0].materialID);
+            materialID = obj.getMaterialID(triangles[0].materialID);
 
             printf("Number of triangles in group: %d\n", triangles.size());
             int triangleCount = 0;
@@ -228,30 +347,179 @@ public:
                 } break;
                 }
             }
+
+            computeBounds();
+            buildLods();
         }
     };
 
+    /*
+     * Material batching (see setBatching): a model's submeshes are merged into one set of buffers, with a
+     * per-vertex index into the material uniform buffer. Submeshes whose textures live in the same
+     * texture arrays are sorted next to each other in the index buffer and drawn with one call.
+     */
+    struct Batch {
+        int ambientArray;               // index into textureArrays, -1 if no submesh in the batch has the texture
+        int diffuseArray;
+        unsigned int firstIndex;
+        unsigned int numIndices;
+        Vector<int> submeshes;
+    };
+
+    struct BatchedMesh {
+        unsigned int vao = 0;
+        unsigned int vertexBuffer = 0;
+        unsigned int normalBuffer = 0;
+        unsigned int texCoordBuffer = 0;
+        unsigned int materialBuffer = 0;
+        unsigned int indexBuffer = 0;
+        Vector<Batch> batches;
+    };
+
     struct ModelInfo {
         Vector<SubMesh> submeshes;
+        BatchedMesh batched;
+        Vec3 boundsMin;                 // around all submeshes, in model space
+        Vec3 boundsMax;
 
-        Vector<unsigned int> textures;
+        ModelInfo() {
+        }
 
         ModelInfo(StaticModel sm) {
             ObjModel obj = *sm.model;
             Vector<TriangleGroup> triangleGroups = obj.getGroups();
 
-            textures = Vector<unsigned int>(obj.numTextures());
-
             for (TriangleGroup tg : triangleGroups) {
                 SubMesh submesh = SubMesh(tg, obj);
 
                 submeshes.push_back(submesh);
             }
+            computeBounds();
+        }
+
+        void computeBounds() {
+            boundsMin = submeshes.empty() ? Vec3(0.0f) : submeshes[0].boundsMin;
+            boundsMax = submeshes.empty() ? Vec3(0.0f) : submeshes[0].boundsMax;
+            for (const SubMesh& submesh : submeshes) {
+                boundsMin = glm::min(boundsMin, submesh.boundsMin);
+                boundsMax = glm::max(boundsMax, submesh.boundsMax);
+            }
         }
     };
 
     Map<std::string, ModelInfo> meshMap;
 
+    // GL textures, indexed like the scene's AssetRegistry; models that share a texture share one GL texture
+    struct TextureInfo {
+        unsigned int texture = 0;
+        Vec2 size;
+        float texelBytes = 4.0f;        // average GPU bytes per texel, less than 4 when block compressed
+        int pendingJobs = 0;            // streaming uploads still to do
+        bool created = false;
+        int array = -1;                 // with batching, the texture array and layer holding the texture instead
+        int layer = -1;
+    };
+
+    // Textures of the same size, format and mip count, stacked as the layers of one GL_TEXTURE_2D_ARRAY
+    struct TextureArray {
+        unsigned int texture = 0;
+        unsigned int width = 0;
+        unsigned int height = 0;
+        unsigned int format = 0;        // compressed format, 0 for RGBA8
+        int levels = 0;
+        Vector<int> layers;             // registry texture in each layer
+    };
+
+    Vector<TextureArray> textureArrays;
+
+    Vector<TextureInfo> textures;
+    const AssetRegistry * assets = NULL;
+
+    // Pass timings for the transforms, shadow, prepass, intermediate, material, final, luminance and tonemap passes
+    Profiler profiler;
+
+    // Builds the shader programs, keeping their linked binaries next to the shader sources
+    ShaderCache shaderCache;
+    std::string shaderPath;
+
+    // With hot reload, edited shaders are rebuilt at the start of the next frame (see setShaderHotReload)
+    bool shaderHotReload = false;
+    ShaderWatcher shaderWatcher;
+
+    /*
+     * Streaming mode (see setStreaming): models are drawn as bounding boxes until their meshes have been
+     * built on worker threads and uploaded, a limited number of bytes per frame
+     */
+    struct StreamingModel;
+
+    struct UploadJob {
+        unsigned int target;            // GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER or GL_TEXTURE_2D
+        unsigned int object;
+        const unsigned char * data;
+        size_t size;
+        size_t offset;                  // bytes uploaded so far
+        int width;                      // textures are uploaded in whole RGBA rows
+        int level;                      // mip level of texture uploads
+        StreamingModel * owner;         // buffer jobs belong to a model, texture jobs to the shared texture
+        unsigned int format;            // compressed texture format, 0 for RGBA8
+        int height;                     // compressed textures: height of the level
+        TextureInfo * texture;
+    };
+
+    struct StreamingModel {
+        std::string name;
+        std::future<ModelInfo> built;
+        ModelInfo mesh;
+        Vector<int> textures;           // texture uploads read straight from the scene's registry
+        int pendingJobs;
+        bool ready;                     // mesh built and GL objects allocated
+    };
+
+    // GL texture memory, and what it would be without block compression
+    size_t textureMemory = 0;
+    size_t uncompressedTextureMemory = 0;
+
+    bool streaming = false;
+    size_t uploadBudget = 0;
+    std::list<StreamingModel> streamingModels;
+    std::deque<UploadJob> uploadJobs;
+    std::unique_ptr<ThreadPool> streamingPool;
+
+    // Trilinear + anisotropic filtering over the mip chains built at load time; off samples level 0 only
+    bool mipmapping = true;
+
+    bool batching = false;
+
+    // Draw with programs specialized per light type and material textures instead of the uber-shaders
+    bool shaderPermutations = false;
+
+    /*
+     * Lights are added into an RGBA16F target and tone mapped into the output framebuffer, with an exposure
+     * that adapts to the average scene luminance. Without tone mapping the target is clipped to [0, 1] instead.
+     */
+    bool toneMapping = true;
+
+    // Lay down the camera's depth first and fill the light maps and G-buffer with GL_EQUAL (see setDepthPrepass)
+    bool depthPrepass = false;
+
+    // Count the fragments the material pass shades per pixel every frame (see setOverdrawMeasurement)
+    bool measureOverdraw = false;
+
+    // Draw each model at the coarsest level of detail that stays within the pass's pixel error (see setLevelOfDetail)
+    bool levelOfDetail = true;
+
+    // Draw only the clusters of each submesh that each pass can see (see setClusterCulling)
+    bool clusterCulling = true;
+
+    // Skip models and submeshes hidden behind a recent frame's depth in the camera passes (see setOcclusionCulling)
+    bool occlusionCulling = false;
+
+    // Test against the scene's occluders drawn on the CPU for the frame's own view instead (see setSoftwareOcclusion)
+    bool softwareOcclusion = false;
+
+    // Framebuffer the tone mapping pass draws into; 0 is the window, headless runs use an offscreen target
+    unsigned int outputFramebuffer = 0;
+
 	// You may want to build some scene-specific OpenGL data before the first frame
 	bool initialize(const Camera& camera, const Scene& scene, std::string shaderPath);
 
@@ -262,6 +530,208 @@ public:
 	 */
 	void render(const Camera& camera, const Scene& scene);
 
+    /*
+     * render in steps, so the CPU work of the next frame can overlap drawing this one:
+     *   syncFrame     render thread: rebuilds edited shaders, uploads streamed data and takes the newest depth
+     *                 read back, for the frames prepared after it
+     *   prepareFrame  any thread: the frame's transforms, visibility and draw ranges, on the CPU without GL or
+     *                 the profiler; it only reads the camera and scene
+     *   swapFrames    render thread: makes the prepared frame the one drawn, preparing it again if streaming
+     *                 replaced a mesh it uses
+     *   renderFrame   render thread: draws it, without reading the camera or scene
+     * prepareFrame may run while renderFrame does, but never at the same time as the other calls or the setters.
+     * render calls the four in a row.
+     */
+    void syncFrame();
+    void prepareFrame(const Camera& camera, const Scene& scene);
+    void swapFrames(const Camera& camera, const Scene& scene);
+    void renderFrame();
+
+    void setOutputFramebuffer(unsigned int framebuffer);
+
+    // Switches all textures between mipmapped and base-level-only filtering, to compare the two
+    void setMipmapping(bool enabled);
+
+    // Call before initialize; uploads at most budgetBytes per frame (rounded up to a texture row)
+    void setStreaming(bool enabled, size_t budgetBytes);
+
+    // true while models are still being streamed in
+    bool isStreaming() const;
+
+    // Call before initialize; draws the material pass in batches over texture arrays instead of one draw
+    // per submesh. Not combined with streaming, which keeps per-submesh drawing.
+    void setBatching(bool enabled);
+
+    // Call before initialize; watches the shader directory and rebuilds programs whose sources change.
+    // A shader that no longer compiles keeps its previous program.
+    void setShaderHotReload(bool enabled);
+
+    // Specializes the intermediate, material and final pass shaders by light type and by the texture maps a
+    // material has, compiling each variant on first use. Without it, one program per pass branches at runtime.
+    void setShaderPermutations(bool enabled);
+
+    // Switches between tone mapping with auto-exposure and clipping the HDR target, to compare the two
+    void setToneMapping(bool enabled);
+
+    // Renders a depth-only pass before the light maps and the material pass, which then shade each pixel
+    // once. Pays off when the scene has enough overdraw to outweigh drawing all geometry one more time.
+    void setDepthPrepass(bool enabled);
+
+    // Records the "overdraw (fragments/pixel)" and "overdraw max" counters, to decide per scene whether the
+    // depth pre-pass is worth it. Stalls on a read back every frame, so frame times are not representative.
+    void setOverdrawMeasurement(bool enabled);
+
+    // Picks a simplified level per model and pass from its distance and the target's resolution, so the
+    // "triangles drawn" counter drops for distant models. Off draws every model in full.
+    void setLevelOfDetail(bool enabled);
+
+    // Culls the clusters of every submesh against each pass's frustum, and drops clusters that face away from
+    // it entirely when the mesh is closed. The "clusters culled" counters show what it saves; off draws whole levels.
+    void setClusterCulling(bool enabled);
+
+    /*
+     * Tests the bounds of every model in view, then of its submeshes, against a depth pyramid of a recent
+     * frame, and leaves the hidden ones out of the camera passes. The pyramid is read back a frame or two
+     * late and tested with the view it was drawn from, so something uncovered by a fast camera move can be
+     * missing for those frames. The batched material pass only skips whole models. The "occlusion" counters
+     * show the draws and triangles skipped.
+     */
+    void setOcclusionCulling(bool enabled);
+
+    /*
+     * Occlusion culling against the models marked "occluder" in the scene file, rasterized on the CPU for the
+     * frame's own view at a fraction of the screen's resolution (see scene/occlusionraster.hpp): no lag and no
+     * read back, but only the occluders hide anything. They are drawn on worker threads while prepareFrame builds
+     * the frame's transforms. Takes the place of the read-back pyramid while both are on.
+     */
+    void setSoftwareOcclusion(bool enabled);
+
+    /*
+     * The index ranges each pass draws: one instance per submesh of every model the pass draws, at the level of
+     * detail the pass picked, indexed by firstInstance[model] + submesh. All camera passes share one set.
+     */
+    struct ClusterPass {
+        Vector<MeshletInstance> instances;
+        Vector<Vector<MeshletDrawRange>> ranges;
+        Vector<int> firstInstance;      // -1 for models the pass doesn't draw
+    };
+
+    struct SpotlightPass {
+        Scene::SpotLight light;
+        glm::mat4 view;
+        glm::mat4 proj;
+        Vector<glm::mat4> mvps;
+        ClusterPass clusters;
+    };
+
+    // CPU time of a stage of prepareFrame, reported to the profiler by the frame's renderFrame
+    struct StageTime {
+        const char * name;
+        Profiler::Clock::time_point start;
+        Profiler::Clock::time_point end;
+    };
+
+    /*
+     * Everything a frame draws that comes from the camera and the scene, built on the CPU by prepareFrame: the
+     * lights and world matrices as they were, matrices and bounds for all models at once (see
+     * scene/batchtransform.hpp), and what each pass can see. Vectors are indexed like the scene's models.
+     * Models whose world bounds are outside the camera's frustum are left out of the passes drawn from the camera.
+     *
+     * The LOD errors are the model-space errors a level may have in the passes drawn from the camera and from
+     * the sun. All camera passes draw the same levels, so the depths they test GL_EQUAL against match.
+     */
+    struct FrameData {
+        glm::mat4 cameraView;
+        glm::mat4 cameraProj;
+        Vec3 eye;
+        bool textured = false;          // the camera's toggle1
+        Scene::DirectionalLight sunlight;
+        glm::mat4 sunlightView;
+        glm::mat4 sunlightProj;
+        Vector<SpotlightPass> spotlights;
+        Vector<Scene::PointLight> pointlights;
+        Vector<glm::mat4x3> worldMatrices;
+        Vector<const ModelInfo *> meshes;   // NULL for models without one
+        int meshGeneration = -1;        // meshGeneration the meshes were looked up at
+
+        Vector<glm::mat4> cameraMVPs;
+        Vector<glm::mat4> cameraMVs;
+        Vector<glm::mat4> normalMatrices;
+        Vector<glm::mat4> sunlightMVPs;
+        Vector<Vec3> localBoundsMin, localBoundsMax;
+        Vector<Vec3> worldBoundsMin, worldBoundsMax;
+        Vector<unsigned char> inView;
+        Vector<float> cameraLodErrors;
+        Vector<float> sunlightLodErrors;
+        Vector<float> spotlightLodErrors;
+
+        ClusterPass cameraClusters;
+        ClusterPass sunlightClusters;
+
+        // for the counters
+        int frustumCulled = 0;
+        int occludedModels = 0;
+        int occludedDraws = 0;
+        size_t occludedTriangles = 0;
+        bool occludersDrawn = false;
+        size_t occluderTriangles = 0;
+        MeshletCullStats clusterStats;  // summed over the frame's passes
+        Vector<StageTime> stages;
+    };
+
+    /*
+     * Frames are double-buffered so the next one can be prepared on a worker thread while the render thread
+     * draws this one (see main.cpp): renderFrame draws frames[frontFrame] while prepareFrame fills the other.
+     * Meshes replaced by streaming bump meshGeneration, and a frame prepared before that is prepared again.
+     */
+    FrameData frames[2];
+    int frontFrame = 0;
+    int meshGeneration = 0;
+
+    void prepareTransforms(FrameData& frame, const Scene& scene);
+    MeshletCuller clusterCuller;
+    Vector<int> multiDrawCounts;
+    Vector<const void *> multiDrawOffsets;
+    void cullClusters(FrameData& frame, ClusterPass& pass, const Vector<float>& lodErrors, bool cameraPass, const MeshletCullView& view);
+
+    // Farthest depths of a recent frame or of the frame's occluders (see scene/depthpyramid.hpp)
+    DepthPyramid occluders;
+    // Leaves models in view that the pyramid hides out of the camera passes; cullClusters tests the submeshes of the rest
+    void cullOccludedModels(FrameData& frame);
+    // Halves the G-buffer's depth RENDERER_HIZ_REDUCTIONS times and starts reading it back, without waiting
+    void readDepthPyramid(const glm::mat4& viewProj);
+    // Builds occluders from the newest read back that has arrived, if any
+    void takeDepthPyramid();
+    OcclusionRasterizer occlusionRasterizer{ SCREEN_WIDTH / RENDERER_OCCLUSION_RASTER_DIVISOR, SCREEN_HEIGHT / RENDERER_OCCLUSION_RASTER_DIVISOR };
+    Vector<OccluderMesh> occluderMeshes;
+    // Starts drawing the full meshes of the scene's occluders as jobs; the rasterizer's finish builds occluders
+    void startOccluders(const Scene& scene, const FrameData& frame);
+    void drawClusters(const ClusterPass& pass, size_t model, size_t submesh);
+
+    // Draws the positions of the models in view with the bound program, setting its MVP matrix uniform per model
+    void drawPositions(const FrameData& frame, int mvpLocation);
+    void countOverdraw(const FrameData& frame);
+
+    void createTextureArrays();
+    void buildBatches(ModelInfo& mesh);
+
+    /*
+     * Material and light parameters live in std140 uniform buffers: every scene material is written once after
+     * the textures are created, and the camera and lights once per frame. Draws then only select an entry.
+     */
+    int defaultMaterial = 0;            // material buffer entry for submeshes without a material (streaming proxies)
+    int materialIndex(const SubMesh& submesh) const;
+    void createMaterialBuffer();
+    void updateFrameBuffer(const FrameData& frame);
+
+    void streamUploads();
+
+    // Creates the GL texture for a registry texture the first time a model needs it; streamed textures
+    // are allocated empty and their data queued as upload jobs
+    void requireTexture(int id, bool streamed);
+
+    void printTextureMemory() const;
+
 	// release all OpenGL data and allocated memory
 	// you can do this in the destructor instead, but a callable function lets you swap scenes at runtime
 	void release();
@@ -0,0 +1,263 @@
+#define GLEW_STATIC
+
+#include "shadercache.hpp"
+#include <scene/blockcompress.hpp>
+#include <GL/glew.h>
+#include <SFML/OpenGL.hpp>
+#include <fstream>
+#include <iostream>
+
+// Shader compiling reference: http://www.nexcius.net/2012/11/20/how-to-load-a-glsl-shader-in-opengl-using-c/
+
+namespace {
+
+std::string readFile(const std::string& filePath) {
+    std::string content;
+    std::ifstream fileStream(filePath, std::ios::in);
+
+    if (!fileStream.is_open()) {
+        std::cerr << "Could not read file " << filePath << ". File does not exist." << std::endl;
+        return "";
+    }
+
+    std::string line = "";
+    while (!fileStream.eof()) {
+        std::getline(fileStream, line);
+        content.append(line + "\n");
+    }
+
+    fileStream.close();
+    return content;
+}
+
+// returns 0 if the shader does not compile; the log is printed whenever the compiler has something to say
+GLuint compileShader(GLenum type, const std::string& path, const std::string& source) {
+    GLuint shader = glCreateShader(type);
+    const char *src = source.c_str();
+
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+
+    GLint result = GL_FALSE;
+    int logLength = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+    if (logLength > 1) {
+        std::vector<GLchar> log(logLength);
+        glGetShaderInfoLog(shader, logLength, NULL, &log[0]);
+        std::cout << path << ":" << std::endl << &log[0] << std::endl;
+    }
+
+    if (result != GL_TRUE) {
+        std::cerr << "Error compiling shader " << path << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+bool checkLinkStatus(GLuint program, const std::string& name) {
+    GLint result = GL_FALSE;
+    int logLength = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+    if (logLength > 1) {
+        std::vector<char> log(logLength);
+        glGetProgramInfoLog(program, logLength, NULL, &log[0]);
+        std::cout << name << ":" << std::endl << &log[0] << std::endl;
+    }
+
+    if (result != GL_TRUE) {
+        std::cerr << "Error linking program " << name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// the #version directive has to stay first, so the defines go on the lines after it
+std::string insertDefines(const std::string& source, const std::vector<std::string>& defines) {
+    std::string lines;
+    for (const std::string& define : defines) {
+        lines += "#define " + define + "\n";
+    }
+    std::string result = source;
+    size_t version = result.find("#version");
+    if (version == std::string::npos) {
+        return result.insert(0, lines);
+    }
+    size_t lineEnd = result.find('\n', version);
+    if (lineEnd == std::string::npos) {
+        return result + "\n" + lines;
+    }
+    return result.insert(lineEnd + 1, lines);
+}
+
+template <typename T>
+bool readValue(std::istream& istream, T& value) {
+    istream.read((char *)&value, sizeof(T));
+    return istream.good();
+}
+
+template <typename T>
+void writeValue(std::ostream& ostream, T value) {
+    ostream.write((const char *)&value, sizeof(T));
+}
+
+}
+
+ShaderCache::ShaderCache() : binariesSupported(false), loaded(0), compiled(0) {
+}
+
+void ShaderCache::setDirectory(const std::string& directory) {
+    this->directory = directory;
+}
+
+unsigned int ShaderCache::buildProgram(const std::string& name, const std::string& vertPath, const std::string& fragPath,
+                                       const std::vector<std::string>& fragOutputs, const std::vector<std::string>& defines) {
+    std::string vertSource = readFile(vertPath);
+    std::string fragSource = readFile(fragPath);
+    if (vertSource.empty() || fragSource.empty()) {
+        return 0;
+    }
+    std::string programName = name;
+    if (!defines.empty()) {
+        vertSource = insertDefines(vertSource, defines);
+        fragSource = insertDefines(fragSource, defines);
+        for (const std::string& define : defines) {
+            programName += "-" + define;
+        }
+    }
+
+    if (driver.empty()) {
+        const char *vendor = (const char *)glGetString(GL_VENDOR);
+        const char *renderer = (const char *)glGetString(GL_RENDERER);
+        const char *version = (const char *)glGetString(GL_VERSION);
+        driver = std::string(vendor ? vendor : "") + "\n" + (renderer ? renderer : "") + "\n" + (version ? version : "");
+
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        binariesSupported = numFormats > 0;
+        if (!binariesSupported && !directory.empty()) {
+            std::cout << "The driver has no program binary formats, shaders are compiled on every start" << std::endl;
+        }
+    }
+
+    // everything that changes the linked program; outputs are hashed with their order since that sets their locations
+    unsigned long long key = hashBytes((const unsigned char *)vertSource.data(), vertSource.size());
+    key = hashBytes((const unsigned char *)fragSource.data(), fragSource.size(), key);
+    for (const std::string& output : fragOutputs) {
+        key = hashBytes((const unsigned char *)output.c_str(), output.size() + 1, key);
+    }
+    key = hashBytes((const unsigned char *)driver.data(), driver.size(), key);
+
+    bool useCache = binariesSupported && !directory.empty();
+    std::string filename = directory + "/" + programName + ".program";
+
+    GLuint program = glCreateProgram();
+    if (useCache) {
+        if (loadBinary(program, filename, key)) {
+            loaded++;
+            return program;
+        }
+        // a rejected binary may leave the program in an unusable state, so compile into a fresh one
+        glDeleteProgram(program);
+        program = glCreateProgram();
+    }
+
+    std::cout << "Compiling " << programName << " shader" << std::endl;
+    GLuint vertShader = compileShader(GL_VERTEX_SHADER, vertPath, vertSource);
+    GLuint fragShader = compileShader(GL_FRAGMENT_SHADER, fragPath, fragSource);
+    if (vertShader == 0 || fragShader == 0) {
+        glDeleteShader(vertShader);
+        glDeleteShader(fragShader);
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    glAttachShader(program, vertShader);
+    glAttachShader(program, fragShader);
+    for (size_t i = 0; i < fragOutputs.size(); i++) {
+        glBindFragDataLocation(program, i, fragOutputs[i].c_str());
+    }
+    if (useCache) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(program);
+
+    glDetachShader(program, vertShader);
+    glDetachShader(program, fragShader);
+    glDeleteShader(vertShader);
+    glDeleteShader(fragShader);
+
+    if (!checkLinkStatus(program, programName)) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    compiled++;
+
+    if (useCache) {
+        saveBinary(program, filename, key);
+    }
+    return program;
+}
+
+int ShaderCache::numLoaded() const {
+    return loaded;
+}
+
+int ShaderCache::numCompiled() const {
+    return compiled;
+}
+
+// a missing file, a different key or a binary the driver no longer accepts (e.g. after an update) are all misses
+bool ShaderCache::loadBinary(unsigned int program, const std::string& filename, unsigned long long key) {
+    std::ifstream istream(filename, std::ios::binary);
+    if (!istream.good()) {
+        return false;
+    }
+
+    char magic[4];
+    unsigned int version = 0;
+    unsigned long long fileKey = 0;
+    GLenum format = 0;
+    unsigned int length = 0;
+    istream.read(magic, 4);
+    if (!istream.good() || std::string(magic, 4) != "GLPB" || !readValue(istream, version) || version != SHADER_CACHE_VERSION ||
+        !readValue(istream, fileKey) || fileKey != key || !readValue(istream, format) || !readValue(istream, length) || length == 0) {
+        return false;
+    }
+
+    std::vector<char> binary(length);
+    istream.read(&binary[0], length);
+    if (!istream.good()) {
+        return false;
+    }
+
+    glProgramBinary(program, format, &binary[0], length);
+    GLint result = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+    return result == GL_TRUE;
+}
+
+void ShaderCache::saveBinary(unsigned int program, const std::string& filename, unsigned long long key) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, NULL, &format, &binary[0]);
+
+    std::ofstream ostream(filename, std::ios::binary);
+    ostream.write("GLPB", 4);
+    writeValue<unsigned int>(ostream, SHADER_CACHE_VERSION);
+    writeValue<unsigned long long>(ostream, key);
+    writeValue<GLenum>(ostream, format);
+    writeValue<unsigned int>(ostream, length);
+    ostream.write(&binary[0], length);
+    if (!ostream.good()) {
+        std::cerr << "Warning: could not write shader cache " << filename << std::endl;
+    }
+}
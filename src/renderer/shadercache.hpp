@@ -0,0 +1,49 @@
+#ifndef _SHADERCACHE_H_
+#define _SHADERCACHE_H_
+
+#include <string>
+#include <vector>
+
+// Bumped whenever the layout of the .program cache files changes
+#define SHADER_CACHE_VERSION 1
+
+/*
+ * Builds GLSL programs from a vertex and a fragment shader file, and keeps each linked program's
+ * binary (glGetProgramBinary) on disk next to the shaders as <name>.program.
+ *
+ * A cache file is only used if it was written for the same shader sources, defines, fragment outputs and
+ * driver (GL_VENDOR, GL_RENDERER and GL_VERSION). If the driver rejects the binary anyway, or the
+ * driver has no binary formats at all, the program is compiled from source as before. Compile and
+ * link errors are detected and reported, and make buildProgram fail instead of returning a
+ * program that draws nothing.
+ */
+class ShaderCache {
+public:
+    ShaderCache();
+
+    // directory for the .program files; an empty directory disables the cache
+    void setDirectory(const std::string& directory);
+
+    // Returns a linked program, or 0 on failure. The fragment outputs are bound to locations 0, 1, ...
+    // before linking, in the order given. Each define is inserted into both shaders as "#define <define>"
+    // right after the #version line; programs with different defines are cached separately.
+    // Requires a current OpenGL context.
+    unsigned int buildProgram(const std::string& name, const std::string& vertPath, const std::string& fragPath,
+                              const std::vector<std::string>& fragOutputs = std::vector<std::string>(),
+                              const std::vector<std::string>& defines = std::vector<std::string>());
+
+    int numLoaded() const;              // programs restored from a cache file
+    int numCompiled() const;            // programs compiled from source
+
+private:
+    std::string directory;
+    std::string driver;                 // vendor, renderer and version strings, read on first use
+    bool binariesSupported;
+    int loaded;
+    int compiled;
+
+    bool loadBinary(unsigned int program, const std::string& filename, unsigned long long key);
+    void saveBinary(unsigned int program, const std::string& filename, unsigned long long key);
+};
+
+#endif // #ifndef _SHADERCACHE_H_
@@ -0,0 +1,110 @@
+#include "shaderwatcher.hpp"
+#include <chrono>
+#include <iostream>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// only shader sources; the .program files written by the ShaderCache live in the same directory
+bool isShaderSource(const std::string& name) {
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+    std::string extension = name.substr(dot);
+    return extension == ".vert" || extension == ".frag";
+}
+
+}
+
+ShaderWatcher::ShaderWatcher() : inotifyFd(-1), stopping(false) {
+}
+
+ShaderWatcher::~ShaderWatcher() {
+    stop();
+}
+
+bool ShaderWatcher::start(const std::string& directory) {
+#ifdef __linux__
+    stop();
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        std::cerr << "Could not start watching shaders: inotify_init1 failed" << std::endl;
+        return false;
+    }
+    // editors either rewrite the file in place or replace it by renaming a temporary over it
+    if (inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        std::cerr << "Could not watch shader directory " << directory << std::endl;
+        close(inotifyFd);
+        inotifyFd = -1;
+        return false;
+    }
+
+    stopping = false;
+    thread = std::thread(&ShaderWatcher::watchLoop, this);
+    std::cout << "Watching " << directory << " for shader changes" << std::endl;
+    return true;
+#else
+    std::cout << "Shader hot reload needs inotify and is only available on Linux" << std::endl;
+    return false;
+#endif
+}
+
+void ShaderWatcher::stop() {
+    if (thread.joinable()) {
+        stopping = true;
+        thread.join();
+    }
+#ifdef __linux__
+    if (inotifyFd >= 0) {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+#endif
+}
+
+std::vector<std::string> ShaderWatcher::takeChanges() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> changed(changes.begin(), changes.end());
+    changes.clear();
+    return changed;
+}
+
+void ShaderWatcher::watchLoop() {
+#ifdef __linux__
+    typedef std::chrono::steady_clock Clock;
+    std::set<std::string> pending;
+    Clock::time_point lastEvent;
+
+    // inotify records are aligned to their header, and a read always returns whole records
+    alignas(inotify_event) char buffer[4096];
+    while (!stopping) {
+        // wake up regularly to notice stop() and to publish settled changes
+        pollfd fd = { inotifyFd, POLLIN, 0 };
+        if (poll(&fd, 1, SHADER_WATCH_SETTLE_MS / 2) > 0) {
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+                for (char * p = buffer; p < buffer + length; ) {
+                    const inotify_event * event = (const inotify_event *)p;
+                    if (event->len > 0 && isShaderSource(event->name)) {
+                        pending.insert(event->name);
+                        lastEvent = Clock::now();
+                    }
+                    p += sizeof(inotify_event) + event->len;
+                }
+            }
+        }
+
+        if (!pending.empty() && Clock::now() - lastEvent >= std::chrono::milliseconds(SHADER_WATCH_SETTLE_MS)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            changes.insert(pending.begin(), pending.end());
+            pending.clear();
+        }
+    }
+#endif
+}
@@ -0,0 +1,42 @@
+#ifndef _SHADERWATCHER_H_
+#define _SHADERWATCHER_H_
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A burst of file events is reported only once the directory has been quiet this long, so an editor's
+// truncate-then-write (or write-then-rename) is picked up as one change to the finished file
+#define SHADER_WATCH_SETTLE_MS 100
+
+/*
+ * Watches the shader directory for edited .vert and .frag files (inotify, on Linux only) on a background
+ * thread. The render thread collects the changes with takeChanges once per frame, which never blocks.
+ */
+class ShaderWatcher {
+public:
+    ShaderWatcher();
+    ~ShaderWatcher();
+
+    // false if the directory cannot be watched, or file watching is not supported on this platform
+    bool start(const std::string& directory);
+    void stop();
+
+    // file names (without the directory) changed since the last call; empty while a burst is still settling
+    std::vector<std::string> takeChanges();
+
+private:
+    int inotifyFd;
+    std::thread thread;
+    std::atomic<bool> stopping;
+
+    std::mutex mutex;
+    std::set<std::string> changes;
+
+    void watchLoop();
+};
+
+#endif // #ifndef _SHADERWATCHER_H_
@@ -0,0 +1,342 @@
+#include "assetregistry.hpp"
+#include <SFML/System/Err.hpp>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// block rows per compression task; 16 rows of a 1024 wide texture is 64 KB of source pixels
+#define COMPRESSION_BAND_ROWS 16u
+
+namespace {
+
+unsigned long long hashMaterial(const ObjModel::ObjMtl& material) {
+    float values[10] = { material.Ka.x, material.Ka.y, material.Ka.z, material.Kd.x, material.Kd.y, material.Kd.z,
+                         material.Ks.x, material.Ks.y, material.Ks.z, material.Ns };
+    int maps[2] = { material.map_Kd, material.map_Ka };
+    unsigned long long hash = hashBytes((const unsigned char *)values, sizeof(values));
+    return hashBytes((const unsigned char *)maps, sizeof(maps), hash);
+}
+
+bool sameMaterial(const ObjModel::ObjMtl& a, const ObjModel::ObjMtl& b) {
+    return a.Ka == b.Ka && a.Kd == b.Kd && a.Ks == b.Ks && a.Ns == b.Ns && a.map_Kd == b.map_Kd && a.map_Ka == b.map_Ka;
+}
+
+// SFML images are always RGBA8, so equal sizes mean equal channels and byte counts
+bool samePixels(const sf::Image& a, const sf::Image& b) {
+    if (a.getSize().x != b.getSize().x || a.getSize().y != b.getSize().y) {
+        return false;
+    }
+    size_t size = (size_t)a.getSize().x * a.getSize().y * 4;
+    return size == 0 || std::memcmp(a.getPixelsPtr(), b.getPixelsPtr(), size) == 0;
+}
+
+size_t textureBytes(const AssetRegistry::Texture& texture) {
+    size_t bytes = (size_t)texture.image.getSize().x * texture.image.getSize().y * 4;
+    for (const MipLevel& level : texture.mips) {
+        bytes += level.pixels.size();
+    }
+    for (const std::vector<unsigned char>& level : texture.compressed.levels) {
+        bytes += level.size();
+    }
+    return bytes;
+}
+
+}
+
+// the deque may be growing on another thread, so even looking an entry up needs the lock
+AssetRegistry::Texture& AssetRegistry::textureEntry(int id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return textures[id];
+}
+
+// references taken before a texture is decoded sit on its own entry; afterwards they go to the canonical one
+int AssetRegistry::resolveTexture(int id) const {
+    return (textures[id].canonical >= 0) ? textures[id].canonical : id;
+}
+
+int AssetRegistry::acquireTexture(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = texturePaths.find(path);
+    if (iter != texturePaths.end()) {
+        textures[resolveTexture(iter->second)].refCount++;
+        return iter->second;
+    }
+
+    int id = textures.size();
+    textures.push_back(Texture());
+    textures[id].path = path;
+    textures[id].refCount = 1;
+    texturePaths[path] = id;
+    return id;
+}
+
+int AssetRegistry::acquireMaterial(const ObjModel::ObjMtl& material) {
+    unsigned long long hash = hashMaterial(material);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto range = materialHashes.equal_range(hash);
+    for (auto iter = range.first; iter != range.second; ++iter) {
+        if (sameMaterial(materials[iter->second].mtl, material)) {
+            materials[iter->second].refCount++;
+
+            // the existing material already holds references to the same textures
+            if (material.map_Kd != -1) {
+                releaseTextureLocked(material.map_Kd);
+            }
+            if (material.map_Ka != -1) {
+                releaseTextureLocked(material.map_Ka);
+            }
+            return iter->second;
+        }
+    }
+
+    int id = materials.size();
+    Material entry = { material, id, 1 };
+    materials.push_back(entry);
+    materialHashes.insert({ hash, id });
+    return id;
+}
+
+void AssetRegistry::releaseTexture(int id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    releaseTextureLocked(id);
+}
+
+void AssetRegistry::releaseTextureLocked(int id) {
+    Texture& texture = textures[resolveTexture(id)];
+    if (--texture.refCount == 0) {
+        texture.image = sf::Image();
+        std::vector<MipLevel>().swap(texture.mips);
+        texture.compressed = CompressedTexture();
+    }
+}
+
+void AssetRegistry::releaseMaterial(int id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    releaseMaterialLocked(id);
+}
+
+void AssetRegistry::releaseMaterialLocked(int id) {
+    Material& material = materials[materials[id].canonical];
+    if (--material.refCount == 0) {
+        if (material.mtl.map_Kd != -1) {
+            releaseTextureLocked(material.mtl.map_Kd);
+        }
+        if (material.mtl.map_Ka != -1) {
+            releaseTextureLocked(material.mtl.map_Ka);
+        }
+    }
+}
+
+bool AssetRegistry::claimTextureLoad(int id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (textures[id].loadClaimed) {
+        return false;
+    }
+    textures[id].loadClaimed = true;
+    return true;
+}
+
+/*
+ * Only the thread that claimed the texture touches its image, so decoding runs unlocked. The lock is taken
+ * to look up the pixel hash: if another file already had the same contents, compared pixel by pixel so a hash
+ * collision can't swap textures, this one becomes an alias, hands its references over and frees its copy before
+ * the (expensive) mip chain is built.
+ */
+bool AssetRegistry::loadTexture(int id) {
+    Texture& texture = textureEntry(id);
+    if (!texture.image.loadFromFile(texture.path)) {
+        sf::err() << "Error loading texture: " << texture.path << std::endl;
+        std::lock_guard<std::mutex> lock(mutex);
+        texture.canonical = id;
+        return false;
+    }
+
+    unsigned int width = texture.image.getSize().x;
+    unsigned int height = texture.image.getSize().y;
+    unsigned long long hash = hashBytes(texture.image.getPixelsPtr(), (size_t)width * height * 4);
+    hash = hashBytes((const unsigned char *)&width, sizeof(width), hash);
+    hash = hashBytes((const unsigned char *)&height, sizeof(height), hash);
+    texture.hash = hash;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto range = textureHashes.equal_range(hash);
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            Texture& canonical = textures[iter->second];
+            if (!samePixels(canonical.image, texture.image)) {
+                continue;
+            }
+            texture.canonical = iter->second;
+            canonical.refCount += texture.refCount;
+            texture.refCount = 0;
+            texture.image = sf::Image();
+            return true;
+        }
+        texture.canonical = id;
+        textureHashes.insert({ hash, id });
+    }
+
+    buildMipChain(texture.image.getPixelsPtr(), width, height, texture.mips);
+    return true;
+}
+
+int AssetRegistry::prepareCompressedTexture(int id) {
+    Texture& texture = textureEntry(id);
+    unsigned int width = texture.image.getSize().x;
+    unsigned int height = texture.image.getSize().y;
+    size_t size = (size_t)width * height * 4;
+    if (size == 0 || texture.canonical != id) {
+        return 0;
+    }
+
+    // BC1 has no useful alpha, so only textures with transparency pay for BC3
+    BlockFormat format = BLOCK_BC1;
+    const unsigned char * pixels = texture.image.getPixelsPtr();
+    for (size_t p = 3; p < size; p += 4) {
+        if (pixels[p] != 255) {
+            format = BLOCK_BC3;
+            break;
+        }
+    }
+
+    CompressedTexture& compressed = texture.compressed;
+    if (loadCompressedTexture(texture.path + ".bc", format, texture.hash, compressed)) {
+        return 0;
+    }
+
+    compressed = CompressedTexture();
+    compressed.format = format;
+    compressed.hash = texture.hash;
+    for (size_t level = 0; level <= texture.mips.size(); level++) {
+        unsigned int levelWidth = (level == 0) ? width : texture.mips[level - 1].width;
+        unsigned int levelHeight = (level == 0) ? height : texture.mips[level - 1].height;
+        compressed.widths.push_back(levelWidth);
+        compressed.heights.push_back(levelHeight);
+        compressed.levels.push_back(std::vector<unsigned char>(compressedSize(levelWidth, levelHeight, format)));
+
+        unsigned int rows = numBlockRows(levelHeight);
+        for (unsigned int first = 0; first < rows; first += COMPRESSION_BAND_ROWS) {
+            CompressedTexture::Band band = { (int)level, first, std::min(first + COMPRESSION_BAND_ROWS, rows) };
+            compressed.bands.push_back(band);
+        }
+    }
+    return compressed.bands.size();
+}
+
+void AssetRegistry::compressTextureBand(int id, int band) {
+    Texture& texture = textureEntry(id);
+    CompressedTexture& compressed = texture.compressed;
+    const CompressedTexture::Band& work = compressed.bands[band];
+    const unsigned char * pixels = (work.level == 0) ? texture.image.getPixelsPtr() : &texture.mips[work.level - 1].pixels[0];
+
+    compressBlockRows(pixels, compressed.widths[work.level], compressed.heights[work.level], compressed.format,
+                      work.firstRow, work.lastRow, &compressed.levels[work.level][0]);
+}
+
+void AssetRegistry::finishCompressedTexture(int id) {
+    Texture& texture = textureEntry(id);
+    CompressedTexture& compressed = texture.compressed;
+    compressed.bands.clear();
+
+    std::vector<unsigned char> decoded((size_t)compressed.widths[0] * compressed.heights[0] * 4);
+    decompressBlocks(&compressed.levels[0][0], compressed.widths[0], compressed.heights[0], compressed.format, &decoded[0]);
+    compressed.psnr = computePSNR(texture.image.getPixelsPtr(), &decoded[0], (size_t)compressed.widths[0] * compressed.heights[0], compressed.format);
+
+    if (!saveCompressedTexture(texture.path + ".bc", compressed)) {
+        sf::err() << "Warning: could not write texture cache " << texture.path << ".bc" << std::endl;
+    }
+}
+
+/*
+ * Materials were deduplicated by the texture ids they were parsed with; now that every texture is decoded,
+ * point them at canonical textures, which can make more of them equal. A merged material hands its
+ * references to the one it matches and drops its own texture references.
+ */
+void AssetRegistry::resolveDuplicates() {
+    std::lock_guard<std::mutex> lock(mutex);
+    materialHashes.clear();
+    for (int id = 0; id < (int)materials.size(); id++) {
+        Material& material = materials[id];
+        if (material.canonical != id) {
+            continue;
+        }
+        if (material.mtl.map_Kd != -1) {
+            material.mtl.map_Kd = resolveTexture(material.mtl.map_Kd);
+        }
+        if (material.mtl.map_Ka != -1) {
+            material.mtl.map_Ka = resolveTexture(material.mtl.map_Ka);
+        }
+
+        unsigned long long hash = hashMaterial(material.mtl);
+        auto range = materialHashes.equal_range(hash);
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            if (sameMaterial(materials[iter->second].mtl, material.mtl)) {
+                material.canonical = iter->second;
+                break;
+            }
+        }
+
+        if (material.canonical != id) {
+            materials[material.canonical].refCount += material.refCount;
+            material.refCount = 0;
+            if (material.mtl.map_Kd != -1) {
+                releaseTextureLocked(material.mtl.map_Kd);
+            }
+            if (material.mtl.map_Ka != -1) {
+                releaseTextureLocked(material.mtl.map_Ka);
+            }
+        }
+        else {
+            materialHashes.insert({ hash, id });
+        }
+    }
+}
+
+int AssetRegistry::numTextures() const {
+    return textures.size();
+}
+
+int AssetRegistry::numMaterials() const {
+    return materials.size();
+}
+
+const AssetRegistry::Texture& AssetRegistry::getTexture(int id) const {
+    return textures[resolveTexture(id)];
+}
+
+const ObjModel::ObjMtl& AssetRegistry::getMaterial(int id) const {
+    return materials[materials[id].canonical].mtl;
+}
+
+int AssetRegistry::canonicalTexture(int id) const {
+    return resolveTexture(id);
+}
+
+bool AssetRegistry::isCanonicalTexture(int id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return resolveTexture(id) == id;
+}
+
+void AssetRegistry::printSummary() const {
+    int uniqueTextures = 0, uniqueMaterials = 0;
+    int textureRefs = 0, materialRefs = 0;
+    size_t bytes = 0;
+    for (int id = 0; id < (int)textures.size(); id++) {
+        if (isCanonicalTexture(id)) {
+            uniqueTextures++;
+            textureRefs += textures[id].refCount;
+            bytes += textureBytes(textures[id]);
+        }
+    }
+    for (int id = 0; id < (int)materials.size(); id++) {
+        if (materials[id].canonical == id) {
+            uniqueMaterials++;
+            materialRefs += materials[id].refCount;
+        }
+    }
+
+    std::cout << "Assets: " << textures.size() << " texture files -> " << uniqueTextures << " unique textures ("
+              << textureRefs << " references, " << bytes / (1024.0 * 1024.0) << " MB with mips), "
+              << materialRefs << " material references -> " << uniqueMaterials << " unique materials" << std::endl;
+}
@@ -0,0 +1,102 @@
+#ifndef _ASSETREGISTRY_H_
+#define _ASSETREGISTRY_H_
+
+#include <scene/blockcompress.hpp>
+#include <scene/mipmap.hpp>
+#include <scene/objmodel.hpp>
+#include <SFML/Graphics/Image.hpp>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Scene-wide list of textures and materials, shared by all models, so each asset is loaded
+ * (and uploaded by the renderer) once no matter how many .obj/.mtl files refer to it.
+ *
+ * Textures are deduplicated by path when registered and by content once decoded: a texture with
+ * the same pixels as an earlier one becomes an alias of it and drops its own data. Materials are
+ * deduplicated by value. Both are reference counted; an asset's CPU data is freed when its last
+ * reference is released.
+ *
+ * Registering and loading may happen on several threads at once. Once the scene has finished
+ * loading (resolveDuplicates), the registry is read-only and the getters need no locking.
+ */
+class AssetRegistry {
+public:
+    struct Texture {
+        std::string path;
+        sf::Image image;
+        std::vector<MipLevel> mips;
+        CompressedTexture compressed;
+        unsigned long long hash;        // of the decoded pixels
+        int canonical;                  // first texture with the same pixels; its own id if unique, -1 until decoded
+        int refCount;
+        bool loadClaimed;
+
+        Texture() : hash(0), canonical(-1), refCount(0), loadClaimed(false) {
+        }
+    };
+
+    // returns the id for a texture file, registering it on first use; takes a reference
+    int acquireTexture(const std::string& path);
+
+    // returns the id of an equal material, or registers this one; takes a reference.
+    // The material's own texture references are kept only if it is new.
+    int acquireMaterial(const ObjModel::ObjMtl& material);
+
+    void releaseTexture(int id);
+    void releaseMaterial(int id);
+
+    // true for exactly one caller per texture, which should then call loadTexture
+    bool claimTextureLoad(int id);
+
+    // decodes a texture and, unless it duplicates an earlier one, builds its mip chain
+    bool loadTexture(int id);
+
+    // Block compression of a canonical texture, run after loadTexture. prepare picks the format and tries the
+    // disk cache; on a miss it returns the number of bands to encode, which may run on separate threads.
+    // finish measures the quality and writes the cache once every band is done.
+    int prepareCompressedTexture(int id);
+    void compressTextureBand(int id, int band);
+    void finishCompressedTexture(int id);
+
+    // points materials at canonical textures and merges materials that became equal; call after loading
+    void resolveDuplicates();
+
+    int numTextures() const;
+    int numMaterials() const;
+
+    // both resolve aliases, so the returned asset always holds data
+    const Texture& getTexture(int id) const;
+    const ObjModel::ObjMtl& getMaterial(int id) const;
+    int canonicalTexture(int id) const;
+
+    // false for textures that turned out to duplicate another; safe to call while loading
+    bool isCanonicalTexture(int id) const;
+
+    void printSummary() const;
+
+private:
+    struct Material {
+        ObjModel::ObjMtl mtl;
+        int canonical;
+        int refCount;
+    };
+
+    // deques, so references stay valid while other threads register more assets
+    std::deque<Texture> textures;
+    std::deque<Material> materials;
+    std::unordered_map<std::string, int> texturePaths;
+    std::unordered_multimap<unsigned long long, int> textureHashes;
+    std::unordered_multimap<unsigned long long, int> materialHashes;
+    mutable std::mutex mutex;
+
+    Texture& textureEntry(int id);
+    int resolveTexture(int id) const;
+    void releaseTextureLocked(int id);
+    void releaseMaterialLocked(int id);
+};
+
+#endif // #ifndef _ASSETREGISTRY_H_
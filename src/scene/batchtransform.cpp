@@ -0,0 +1,347 @@
+#include "batchtransform.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+// the AVX code is compiled for AVX on its own, so the rest of the build keeps running on CPUs without it
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BATCH_TRANSFORM_HAS_AVX
+#define AVX_FUNCTION __attribute__((target("avx")))
+#include <immintrin.h>
+#endif
+
+namespace {
+
+void concatenateScalar(const glm::mat4& a, const glm::mat4x3 * models, size_t count, glm::mat4 * out) {
+    for (size_t i = 0; i < count; i++) {
+        const glm::mat4x3& m = models[i];
+        for (int j = 0; j < 3; j++) {
+            out[i][j] = a[0] * m[j].x + a[1] * m[j].y + a[2] * m[j].z;
+        }
+        out[i][3] = a[0] * m[3].x + a[1] * m[3].y + a[2] * m[3].z + a[3];
+    }
+}
+
+void normalMatricesScalar(const glm::mat4& view, const glm::mat4x3 * models, size_t count, glm::mat4 * out) {
+    glm::vec3 v0(view[0]), v1(view[1]), v2(view[2]), v3(view[3]);
+    for (size_t i = 0; i < count; i++) {
+        const glm::mat4x3& m = models[i];
+        glm::vec3 c0 = v0 * m[0].x + v1 * m[0].y + v2 * m[0].z;
+        glm::vec3 c1 = v0 * m[1].x + v1 * m[1].y + v2 * m[1].z;
+        glm::vec3 c2 = v0 * m[2].x + v1 * m[2].y + v2 * m[2].z;
+        glm::vec3 t = v0 * m[3].x + v1 * m[3].y + v2 * m[3].z + v3;
+
+        // the inverse transpose of the 3x3 part is its cofactor matrix over the determinant
+        glm::vec3 n0 = glm::cross(c1, c2);
+        glm::vec3 n1 = glm::cross(c2, c0);
+        glm::vec3 n2 = glm::cross(c0, c1);
+        float invDet = 1.0f / (c0.x * n0.x + c0.y * n0.y + c0.z * n0.z);
+        n0 = n0 * invDet;
+        n1 = n1 * invDet;
+        n2 = n2 * invDet;
+
+        // the translation of the inverse ends up in the bottom row
+        out[i][0] = glm::vec4(n0, 0.0f - (n0.x * t.x + n0.y * t.y + n0.z * t.z));
+        out[i][1] = glm::vec4(n1, 0.0f - (n1.x * t.x + n1.y * t.y + n1.z * t.z));
+        out[i][2] = glm::vec4(n2, 0.0f - (n2.x * t.x + n2.y * t.y + n2.z * t.z));
+        out[i][3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+}
+
+// the center moves with the whole matrix, the half extent with the absolute value of its 3x3 part
+void transformBoundsScalar(const glm::mat4x3 * models, const glm::vec3 * localMin, const glm::vec3 * localMax, size_t count,
+                           glm::vec3 * worldMin, glm::vec3 * worldMax) {
+    for (size_t i = 0; i < count; i++) {
+        const glm::mat4x3& m = models[i];
+        glm::vec3 center = (localMin[i] + localMax[i]) * 0.5f;
+        glm::vec3 extent = (localMax[i] - localMin[i]) * 0.5f;
+        glm::vec3 c = m[0] * center.x + m[1] * center.y + m[2] * center.z + m[3];
+        glm::vec3 e = glm::abs(m[0]) * extent.x + glm::abs(m[1]) * extent.y + glm::abs(m[2]) * extent.z;
+        worldMin[i] = c - e;
+        worldMax[i] = c + e;
+    }
+}
+
+#ifdef __SSE2__
+// a.yzx * b.zxy - a.zxy * b.yzx, the same products as glm::cross
+__m128 cross4(__m128 a, __m128 b) {
+    __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bZXY = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 aZXY = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    return _mm_sub_ps(_mm_mul_ps(aYZX, bZXY), _mm_mul_ps(aZXY, bYZX));
+}
+
+__m128 broadcast(__m128 v, int lane) {
+    switch (lane) {
+    case 0: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+    case 1: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+    default: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+    }
+}
+
+// column j of matrix * model, in the order of the scalar code; the model's columns are broadcast one float at a time
+__m128 productColumn(__m128 a0, __m128 a1, __m128 a2, const float * column) {
+    __m128 sum = _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(column[0])), _mm_mul_ps(a1, _mm_set1_ps(column[1])));
+    return _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(column[2])));
+}
+
+void concatenateSSE2(const glm::mat4& matrix, const glm::mat4x3 * models, size_t count, glm::mat4 * out) {
+    __m128 a0 = _mm_loadu_ps(&matrix[0][0]);
+    __m128 a1 = _mm_loadu_ps(&matrix[1][0]);
+    __m128 a2 = _mm_loadu_ps(&matrix[2][0]);
+    __m128 a3 = _mm_loadu_ps(&matrix[3][0]);
+    for (size_t i = 0; i < count; i++) {
+        const float * m = &models[i][0][0];
+        float * o = &out[i][0][0];
+        _mm_storeu_ps(o + 0, productColumn(a0, a1, a2, m + 0));
+        _mm_storeu_ps(o + 4, productColumn(a0, a1, a2, m + 3));
+        _mm_storeu_ps(o + 8, productColumn(a0, a1, a2, m + 6));
+        _mm_storeu_ps(o + 12, _mm_add_ps(productColumn(a0, a1, a2, m + 9), a3));
+    }
+}
+
+void normalMatricesSSE2(const glm::mat4& view, const glm::mat4x3 * models, size_t count, glm::mat4 * out) {
+    __m128 v0 = _mm_loadu_ps(&view[0][0]);
+    __m128 v1 = _mm_loadu_ps(&view[1][0]);
+    __m128 v2 = _mm_loadu_ps(&view[2][0]);
+    __m128 v3 = _mm_loadu_ps(&view[3][0]);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 bottom = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+    for (size_t i = 0; i < count; i++) {
+        const float * m = &models[i][0][0];
+
+        // with an affine view the w lanes stay 0 all the way through
+        __m128 c0 = productColumn(v0, v1, v2, m + 0);
+        __m128 c1 = productColumn(v0, v1, v2, m + 3);
+        __m128 c2 = productColumn(v0, v1, v2, m + 6);
+        __m128 t = _mm_add_ps(productColumn(v0, v1, v2, m + 9), v3);
+
+        __m128 n0 = cross4(c1, c2);
+        __m128 n1 = cross4(c2, c0);
+        __m128 n2 = cross4(c0, c1);
+        __m128 p = _mm_mul_ps(c0, n0);
+        __m128 det = _mm_add_ps(_mm_add_ps(p, broadcast(p, 1)), broadcast(p, 2));
+        __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), broadcast(det, 0));
+        n0 = _mm_mul_ps(n0, invDet);
+        n1 = _mm_mul_ps(n1, invDet);
+        n2 = _mm_mul_ps(n2, invDet);
+
+        // rows of the cofactor matrix, whose dot products with t give the bottom row
+        __m128 rx = n0, ry = n1, rz = n2, rw = zero;
+        _MM_TRANSPOSE4_PS(rx, ry, rz, rw);
+        __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, broadcast(t, 0)), _mm_mul_ps(ry, broadcast(t, 1))), _mm_mul_ps(rz, broadcast(t, 2)));
+        rw = _mm_sub_ps(bottom, r);
+        _MM_TRANSPOSE4_PS(rx, ry, rz, rw);
+
+        float * o = &out[i][0][0];
+        _mm_storeu_ps(o + 0, rx);
+        _mm_storeu_ps(o + 4, ry);
+        _mm_storeu_ps(o + 8, rz);
+        _mm_storeu_ps(o + 12, rw);
+    }
+}
+
+void storeVec3(glm::vec3& v, __m128 value) {
+    float lanes[4];
+    _mm_storeu_ps(lanes, value);
+    v = glm::vec3(lanes[0], lanes[1], lanes[2]);
+}
+
+void transformBoundsSSE2(const glm::mat4x3 * models, const glm::vec3 * localMin, const glm::vec3 * localMax, size_t count,
+                         glm::vec3 * worldMin, glm::vec3 * worldMax) {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (size_t i = 0; i < count; i++) {
+        // the fourth lane of the first three columns is the next column's x, and is never stored
+        const float * m = &models[i][0][0];
+        __m128 m0 = _mm_loadu_ps(m + 0);
+        __m128 m1 = _mm_loadu_ps(m + 3);
+        __m128 m2 = _mm_loadu_ps(m + 6);
+        __m128 m3 = _mm_setr_ps(m[9], m[10], m[11], 0.0f);
+
+        __m128 lo = _mm_setr_ps(localMin[i].x, localMin[i].y, localMin[i].z, 0.0f);
+        __m128 hi = _mm_setr_ps(localMax[i].x, localMax[i].y, localMax[i].z, 0.0f);
+        __m128 center = _mm_mul_ps(_mm_add_ps(lo, hi), half);
+        __m128 extent = _mm_mul_ps(_mm_sub_ps(hi, lo), half);
+
+        __m128 c = _mm_add_ps(_mm_mul_ps(m0, broadcast(center, 0)), _mm_mul_ps(m1, broadcast(center, 1)));
+        c = _mm_add_ps(_mm_add_ps(c, _mm_mul_ps(m2, broadcast(center, 2))), m3);
+        __m128 e = _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, m0), broadcast(extent, 0)), _mm_mul_ps(_mm_andnot_ps(signMask, m1), broadcast(extent, 1)));
+        e = _mm_add_ps(e, _mm_mul_ps(_mm_andnot_ps(signMask, m2), broadcast(extent, 2)));
+
+        storeVec3(worldMin[i], _mm_sub_ps(c, e));
+        storeVec3(worldMax[i], _mm_add_ps(c, e));
+    }
+}
+#endif
+
+#ifdef BATCH_TRANSFORM_HAS_AVX
+AVX_FUNCTION __m256 twoColumns(const float * low, const float * high) {
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(low)), _mm_loadu_ps(high), 1);
+}
+
+// two columns of matrix * model per instruction: columns 0 and 1, then 2 and 3
+AVX_FUNCTION void concatenateAVX(const glm::mat4& matrix, const glm::mat4x3 * models, size_t count, glm::mat4 * out) {
+    __m256 a0 = _mm256_broadcast_ps((const __m128 *)&matrix[0][0]);
+    __m256 a1 = _mm256_broadcast_ps((const __m128 *)&matrix[1][0]);
+    __m256 a2 = _mm256_broadcast_ps((const __m128 *)&matrix[2][0]);
+    __m256 a3 = _mm256_broadcast_ps((const __m128 *)&matrix[3][0]);
+
+    // columns 2 and 3 are loaded from floats 6 and 8, so the fourth column starts one lane later in its half
+    const __m256i x23 = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+    const __m256i y23 = _mm256_setr_epi32(1, 1, 1, 1, 2, 2, 2, 2);
+    const __m256i z23 = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+
+    for (size_t i = 0; i < count; i++) {
+        const float * m = &models[i][0][0];
+        float * o = &out[i][0][0];
+
+        __m256 c01 = twoColumns(m + 0, m + 3);
+        __m256 sum = _mm256_add_ps(_mm256_mul_ps(a0, _mm256_permute_ps(c01, 0x00)), _mm256_mul_ps(a1, _mm256_permute_ps(c01, 0x55)));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(a2, _mm256_permute_ps(c01, 0xAA)));
+        _mm256_storeu_ps(o + 0, sum);
+
+        __m256 c23 = twoColumns(m + 6, m + 8);
+        sum = _mm256_add_ps(_mm256_mul_ps(a0, _mm256_permutevar_ps(c23, x23)), _mm256_mul_ps(a1, _mm256_permutevar_ps(c23, y23)));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(a2, _mm256_permutevar_ps(c23, z23)));
+        _mm256_storeu_ps(o + 8, _mm256_blend_ps(sum, _mm256_add_ps(sum, a3), 0xF0));
+    }
+}
+
+// two models per instruction, the first in the low half and the second in the high half
+AVX_FUNCTION void transformBoundsAVX(const glm::mat4x3 * models, const glm::vec3 * localMin, const glm::vec3 * localMax, size_t count,
+                                     glm::vec3 * worldMin, glm::vec3 * worldMax) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    size_t i = 0;
+    for (; i + 1 < count; i += 2) {
+        const float * a = &models[i][0][0];
+        const float * b = &models[i + 1][0][0];
+        __m256 m0 = twoColumns(a + 0, b + 0);
+        __m256 m1 = twoColumns(a + 3, b + 3);
+        __m256 m2 = twoColumns(a + 6, b + 6);
+        __m256 m3 = _mm256_setr_ps(a[9], a[10], a[11], 0.0f, b[9], b[10], b[11], 0.0f);
+
+        __m256 lo = _mm256_setr_ps(localMin[i].x, localMin[i].y, localMin[i].z, 0.0f, localMin[i + 1].x, localMin[i + 1].y, localMin[i + 1].z, 0.0f);
+        __m256 hi = _mm256_setr_ps(localMax[i].x, localMax[i].y, localMax[i].z, 0.0f, localMax[i + 1].x, localMax[i + 1].y, localMax[i + 1].z, 0.0f);
+        __m256 center = _mm256_mul_ps(_mm256_add_ps(lo, hi), half);
+        __m256 extent = _mm256_mul_ps(_mm256_sub_ps(hi, lo), half);
+
+        __m256 c = _mm256_add_ps(_mm256_mul_ps(m0, _mm256_permute_ps(center, 0x00)), _mm256_mul_ps(m1, _mm256_permute_ps(center, 0x55)));
+        c = _mm256_add_ps(_mm256_add_ps(c, _mm256_mul_ps(m2, _mm256_permute_ps(center, 0xAA))), m3);
+        __m256 e = _mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(signMask, m0), _mm256_permute_ps(extent, 0x00)),
+                                 _mm256_mul_ps(_mm256_andnot_ps(signMask, m1), _mm256_permute_ps(extent, 0x55)));
+        e = _mm256_add_ps(e, _mm256_mul_ps(_mm256_andnot_ps(signMask, m2), _mm256_permute_ps(extent, 0xAA)));
+
+        float lanes[2][8];
+        _mm256_storeu_ps(lanes[0], _mm256_sub_ps(c, e));
+        _mm256_storeu_ps(lanes[1], _mm256_add_ps(c, e));
+        worldMin[i] = glm::vec3(lanes[0][0], lanes[0][1], lanes[0][2]);
+        worldMin[i + 1] = glm::vec3(lanes[0][4], lanes[0][5], lanes[0][6]);
+        worldMax[i] = glm::vec3(lanes[1][0], lanes[1][1], lanes[1][2]);
+        worldMax[i + 1] = glm::vec3(lanes[1][4], lanes[1][5], lanes[1][6]);
+    }
+    transformBoundsSSE2(models + i, localMin + i, localMax + i, count - i, worldMin + i, worldMax + i);
+}
+
+bool cpuHasAvx() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx") != 0;
+}
+#endif
+
+bool pathAvailable(BatchTransformPath path) {
+    switch (path) {
+    case BATCH_TRANSFORM_SCALAR:
+        return true;
+    case BATCH_TRANSFORM_SSE2:
+#ifdef __SSE2__
+        return true;
+#else
+        return false;
+#endif
+    case BATCH_TRANSFORM_AVX:
+#ifdef BATCH_TRANSFORM_HAS_AVX
+        return cpuHasAvx();
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+BatchTransformPath& activePath() {
+    static BatchTransformPath path = pathAvailable(BATCH_TRANSFORM_AVX) ? BATCH_TRANSFORM_AVX :
+                                     pathAvailable(BATCH_TRANSFORM_SSE2) ? BATCH_TRANSFORM_SSE2 : BATCH_TRANSFORM_SCALAR;
+    return path;
+}
+
+}
+
+void batchConcatenate(const glm::mat4& matrix, const glm::mat4x3 * models, size_t count, glm::mat4 * out) {
+    switch (activePath()) {
+#ifdef BATCH_TRANSFORM_HAS_AVX
+    case BATCH_TRANSFORM_AVX:
+        concatenateAVX(matrix, models, count, out);
+        return;
+#endif
+#ifdef __SSE2__
+    case BATCH_TRANSFORM_SSE2:
+        concatenateSSE2(matrix, models, count, out);
+        return;
+#endif
+    default:
+        concatenateScalar(matrix, models, count, out);
+    }
+}
+
+void batchNormalMatrices(const glm::mat4& view, const glm::mat4x3 * models, size_t count, glm::mat4 * out) {
+#ifdef __SSE2__
+    if (activePath() != BATCH_TRANSFORM_SCALAR) {
+        normalMatricesSSE2(view, models, count, out);
+        return;
+    }
+#endif
+    normalMatricesScalar(view, models, count, out);
+}
+
+void batchTransformBounds(const glm::mat4x3 * models, const glm::vec3 * localMin, const glm::vec3 * localMax, size_t count,
+                          glm::vec3 * worldMin, glm::vec3 * worldMax) {
+    switch (activePath()) {
+#ifdef BATCH_TRANSFORM_HAS_AVX
+    case BATCH_TRANSFORM_AVX:
+        transformBoundsAVX(models, localMin, localMax, count, worldMin, worldMax);
+        return;
+#endif
+#ifdef __SSE2__
+    case BATCH_TRANSFORM_SSE2:
+        transformBoundsSSE2(models, localMin, localMax, count, worldMin, worldMax);
+        return;
+#endif
+    default:
+        transformBoundsScalar(models, localMin, localMax, count, worldMin, worldMax);
+    }
+}
+
+BatchTransformPath getBatchTransformPath() {
+    return activePath();
+}
+
+bool setBatchTransformPath(BatchTransformPath path) {
+    if (!pathAvailable(path)) {
+        return false;
+    }
+    activePath() = path;
+    return true;
+}
+
+const char * batchTransformPathName(BatchTransformPath path) {
+    switch (path) {
+    case BATCH_TRANSFORM_AVX: return "AVX";
+    case BATCH_TRANSFORM_SSE2: return "SSE2";
+    default: return "scalar";
+    }
+}
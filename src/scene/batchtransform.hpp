@@ -0,0 +1,41 @@
+#ifndef _BATCHTRANSFORM_H_
+#define _BATCHTRANSFORM_H_
+
+#include <cstddef>
+#include <glm/glm.hpp>
+
+/*
+ * The per-frame matrix math of the render loop, done for all models at once over arrays of their affine
+ * world matrices (see transform.hpp).
+ *
+ * There are three implementations, picked once at the first call:
+ *   - AVX, which works on two matrix columns or two models per instruction. GCC and Clang only, and only
+ *     when the CPU has it. Normal matrices use the SSE2 code on this path.
+ *   - SSE2, with one column per instruction.
+ *   - Scalar code.
+ *
+ * All three do the same operations in the same order, so they give the same results.
+ */
+
+enum BatchTransformPath {
+    BATCH_TRANSFORM_SCALAR,
+    BATCH_TRANSFORM_SSE2,
+    BATCH_TRANSFORM_AVX
+};
+
+// out[i] = matrix * models[i], exactly what glm gives for the product with the models' bottom row added back
+void batchConcatenate(const glm::mat4& matrix, const glm::mat4x3 * models, size_t count, glm::mat4 * out);
+
+// out[i] = transpose(inverse(view * models[i])) for transforming normals; view has to be affine too
+void batchNormalMatrices(const glm::mat4& view, const glm::mat4x3 * models, size_t count, glm::mat4 * out);
+
+// World space boxes around the models' local bounding boxes
+void batchTransformBounds(const glm::mat4x3 * models, const glm::vec3 * localMin, const glm::vec3 * localMax, size_t count,
+                          glm::vec3 * worldMin, glm::vec3 * worldMax);
+
+// The path the functions above take; setBatchTransformPath is false if this CPU or build can't take the one asked for
+BatchTransformPath getBatchTransformPath();
+bool setBatchTransformPath(BatchTransformPath path);
+const char * batchTransformPathName(BatchTransformPath path);
+
+#endif // #ifndef _BATCHTRANSFORM_H_
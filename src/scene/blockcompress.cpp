@@ -0,0 +1,492 @@
+#include "blockcompress.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// bump when the encoder changes, so old cache files are re-encoded
+#define BLOCK_CACHE_VERSION 1
+
+namespace {
+
+// copies the 4x4 block at block coordinates (bx, by), repeating the last row/column past the edges
+void extractBlock(const unsigned char * rgba, unsigned int width, unsigned int height, unsigned int bx, unsigned int by, unsigned char block[64]) {
+    for (unsigned int y = 0; y < 4; y++) {
+        unsigned int sy = std::min(by * 4 + y, height - 1);
+        for (unsigned int x = 0; x < 4; x++) {
+            unsigned int sx = std::min(bx * 4 + x, width - 1);
+            memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+        }
+    }
+}
+
+// per-channel min and max over the block's 16 pixels
+void blockBounds(const unsigned char block[64], unsigned char lo[4], unsigned char hi[4]) {
+#ifdef __SSE2__
+    __m128i r0 = _mm_loadu_si128((const __m128i *)(block + 0));
+    __m128i r1 = _mm_loadu_si128((const __m128i *)(block + 16));
+    __m128i r2 = _mm_loadu_si128((const __m128i *)(block + 32));
+    __m128i r3 = _mm_loadu_si128((const __m128i *)(block + 48));
+    __m128i mn = _mm_min_epu8(_mm_min_epu8(r0, r1), _mm_min_epu8(r2, r3));
+    __m128i mx = _mm_max_epu8(_mm_max_epu8(r0, r1), _mm_max_epu8(r2, r3));
+
+    // fold the four pixels in each register onto the first
+    mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(1, 0, 3, 2)));
+    mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(1, 0, 3, 2)));
+    mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(2, 3, 0, 1)));
+    mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    int packedLo = _mm_cvtsi128_si32(mn);
+    int packedHi = _mm_cvtsi128_si32(mx);
+    memcpy(lo, &packedLo, 4);
+    memcpy(hi, &packedHi, 4);
+#else
+    for (int c = 0; c < 4; c++) {
+        lo[c] = 255;
+        hi[c] = 0;
+        for (int i = 0; i < 16; i++) {
+            lo[c] = std::min(lo[c], block[i * 4 + c]);
+            hi[c] = std::max(hi[c], block[i * 4 + c]);
+        }
+    }
+#endif
+}
+
+#ifdef __SSE2__
+// moves bit i of a 16-bit mask to bit 2 i
+unsigned int spreadBits(unsigned int bits) {
+    bits = (bits | (bits << 8)) & 0x00FF00FF;
+    bits = (bits | (bits << 4)) & 0x0F0F0F0F;
+    bits = (bits | (bits << 2)) & 0x33333333;
+    return (bits | (bits << 1)) & 0x55555555;
+}
+#endif
+
+unsigned short packRGB565(const unsigned char c[3]) {
+    return (unsigned short)((((c[0] * 31 + 127) / 255) << 11) | (((c[1] * 63 + 127) / 255) << 5) | ((c[2] * 31 + 127) / 255));
+}
+
+void unpackRGB565(unsigned short packed, int c[3]) {
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    c[0] = (r << 3) | (r >> 2);
+    c[1] = (g << 2) | (g >> 4);
+    c[2] = (b << 3) | (b >> 2);
+}
+
+void writeU16(unsigned char * out, unsigned short value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+/*
+ * BC1 color block: endpoints are the corners of the colors' bounding box, inset a little
+ * and flipped along red/blue when those channels are anticorrelated with green, so the line
+ * between them follows the colors; each pixel then takes the nearest of the four palette
+ * entries along that line.
+ */
+void encodeColorBlock(const unsigned char block[64], unsigned char out[8]) {
+    unsigned char lo[4], hi[4];
+    blockBounds(block, lo, hi);
+
+    int mean[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            mean[c] += block[i * 4 + c];
+        }
+    }
+    int covRG = 0, covBG = 0;
+    for (int i = 0; i < 16; i++) {
+        int g = block[i * 4 + 1] * 16 - mean[1];
+        covRG += (block[i * 4 + 0] * 16 - mean[0]) * g;
+        covBG += (block[i * 4 + 2] * 16 - mean[2]) * g;
+    }
+
+    unsigned char c0[3], c1[3];
+    for (int c = 0; c < 3; c++) {
+        int inset = (hi[c] - lo[c]) >> 4;
+        c0[c] = hi[c] - inset;
+        c1[c] = lo[c] + inset;
+    }
+    if (covRG < 0) {
+        std::swap(c0[0], c1[0]);
+    }
+    if (covBG < 0) {
+        std::swap(c0[2], c1[2]);
+    }
+
+    unsigned short packed0 = packRGB565(c0);
+    unsigned short packed1 = packRGB565(c1);
+    if (packed0 < packed1) {
+        std::swap(packed0, packed1); // color0 > color1 selects the four-color palette
+    }
+    writeU16(out, packed0);
+    writeU16(out + 2, packed1);
+
+    unsigned int indices = 0;
+    if (packed0 != packed1) {
+        int p0[3], p1[3];
+        unpackRGB565(packed0, p0);
+        unpackRGB565(packed1, p1);
+        int axis[3] = { p0[0] - p1[0], p0[1] - p1[1], p0[2] - p1[2] };
+        int length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+        // palette order along the axis from p1 to p0 is 1, 3, 2, 0
+#ifdef __SSE2__
+        // four pixels at a time; the step is how many of 2, 4 and 6 times length dot * 6 + length reaches,
+        // which is the division below without dividing
+        __m128i zero = _mm_setzero_si128();
+        __m128i weights = _mm_setr_epi16(axis[0], axis[1], axis[2], 0, axis[0], axis[1], axis[2], 0);
+        __m128i offset = _mm_set1_epi32(length - 6 * (p1[0] * axis[0] + p1[1] * axis[1] + p1[2] * axis[2]));
+        __m128i step1 = _mm_set1_epi32(2 * length - 1);
+        __m128i step2 = _mm_set1_epi32(4 * length - 1);
+        __m128i step3 = _mm_set1_epi32(6 * length - 1);
+        unsigned int lowBits = 0, highBits = 0;
+        for (int i = 0; i < 16; i += 4) {
+            __m128i pixels = _mm_loadu_si128((const __m128i *)(block + i * 4));
+            __m128 halves0 = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights));
+            __m128 halves1 = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights));
+            __m128i dot = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(halves0, halves1, _MM_SHUFFLE(2, 0, 2, 0))),
+                                        _mm_castps_si128(_mm_shuffle_ps(halves0, halves1, _MM_SHUFFLE(3, 1, 3, 1))));
+            __m128i scaled = _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(dot, 1), _mm_slli_epi32(dot, 2)), offset);
+            unsigned int reached1 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(scaled, step1)));
+            unsigned int reached2 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(scaled, step2)));
+            unsigned int reached3 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(scaled, step3)));
+            lowBits |= (~reached2 & 15) << i;                   // indices 1 and 3
+            highBits |= (reached1 & ~reached3 & 15) << i;       // indices 3 and 2
+        }
+        indices = spreadBits(lowBits) | (spreadBits(highBits) << 1);
+#else
+        static const unsigned int order[4] = { 1, 3, 2, 0 };
+        for (int i = 0; i < 16; i++) {
+            const unsigned char * px = block + i * 4;
+            int dot = (px[0] - p1[0]) * axis[0] + (px[1] - p1[1]) * axis[1] + (px[2] - p1[2]) * axis[2];
+            int step = (dot * 6 + length) / (2 * length); // nearest of 0, 1/3, 2/3, 1
+            step = std::min(std::max(step, 0), 3);
+            indices |= order[step] << (i * 2);
+        }
+#endif
+    }
+    out[4] = indices & 0xFF;
+    out[5] = (indices >> 8) & 0xFF;
+    out[6] = (indices >> 16) & 0xFF;
+    out[7] = indices >> 24;
+}
+
+// BC4 block for one channel: eight-value palette between the channel's min and max
+void encodeChannelBlock(const unsigned char block[64], int channel, unsigned char out[8]) {
+    unsigned char lo[4], hi[4];
+    blockBounds(block, lo, hi);
+    int a0 = hi[channel];
+    int a1 = lo[channel];
+    out[0] = a0;
+    out[1] = a1;
+
+    unsigned long long indices = 0;
+    if (a0 != a1) {
+#ifdef __SSE2__
+        // eight pixels at a time in 16 bits; the step is how many multiples of 2 (a0 - a1) the numerator reaches
+        __m128i mask = _mm_set1_epi32(0xFF);
+        __m128i values[2];
+        for (int half = 0; half < 2; half++) {
+            __m128i first = _mm_loadu_si128((const __m128i *)(block + half * 32));
+            __m128i second = _mm_loadu_si128((const __m128i *)(block + half * 32 + 16));
+            first = _mm_and_si128(_mm_srli_epi32(first, channel * 8), mask);
+            second = _mm_and_si128(_mm_srli_epi32(second, channel * 8), mask);
+            values[half] = _mm_packs_epi32(first, second);
+        }
+        __m128i offset = _mm_set1_epi16((short)(a0 - a1 - a1 * 14));
+        __m128i one = _mm_set1_epi16(1), two = _mm_set1_epi16(2), seven = _mm_set1_epi16(7);
+        unsigned char steps[16];
+        for (int half = 0; half < 2; half++) {
+            __m128i numerator = _mm_add_epi16(_mm_mullo_epi16(values[half], _mm_set1_epi16(14)), offset);
+            __m128i step = _mm_setzero_si128();
+            for (int k = 1; k < 8; k++) {
+                step = _mm_sub_epi16(step, _mm_cmpgt_epi16(numerator, _mm_set1_epi16((short)(k * 2 * (a0 - a1) - 1))));
+            }
+            // steps 7, 6 ... 1, 0 are palette entries 0, 2 ... 7, 1: 8 - step, with 0 and 1 swapped
+            __m128i index = _mm_and_si128(_mm_sub_epi16(_mm_set1_epi16(8), step), seven);
+            index = _mm_xor_si128(index, _mm_and_si128(_mm_cmplt_epi16(index, two), one));
+            _mm_storel_epi64((__m128i *)(steps + half * 8), _mm_packus_epi16(index, index));
+        }
+        for (int i = 0; i < 16; i++) {
+            indices |= (unsigned long long)steps[i] << (i * 3);
+        }
+#else
+        for (int i = 0; i < 16; i++) {
+            int step = ((block[i * 4 + channel] - a1) * 14 + (a0 - a1)) / (2 * (a0 - a1)); // nearest of 0..7
+            unsigned long long index = (step == 7) ? 0 : (step == 0) ? 1 : 8 - step;
+            indices |= index << (i * 3);
+        }
+#endif
+    }
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = (indices >> (i * 8)) & 0xFF;
+    }
+}
+
+void decodeColorBlock(const unsigned char in[8], bool forceFourColor, unsigned char pixels[64]) {
+    unsigned short packed0 = in[0] | (in[1] << 8);
+    unsigned short packed1 = in[2] | (in[3] << 8);
+    int palette[4][4];
+    unpackRGB565(packed0, palette[0]);
+    unpackRGB565(packed1, palette[1]);
+    palette[0][3] = palette[1][3] = palette[2][3] = 255;
+    palette[3][3] = 255;
+    for (int c = 0; c < 3; c++) {
+        if (packed0 > packed1 || forceFourColor) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+    if (!(packed0 > packed1 || forceFourColor)) {
+        palette[3][3] = 0;
+    }
+
+    unsigned int indices = in[4] | (in[5] << 8) | (in[6] << 16) | ((unsigned int)in[7] << 24);
+    for (int i = 0; i < 16; i++) {
+        const int * color = palette[(indices >> (i * 2)) & 3];
+        for (int c = 0; c < 4; c++) {
+            pixels[i * 4 + c] = color[c];
+        }
+    }
+}
+
+void decodeChannelBlock(const unsigned char in[8], int channel, unsigned char pixels[64]) {
+    int a0 = in[0];
+    int a1 = in[1];
+    int palette[8] = { a0, a1 };
+    for (int i = 2; i < 8; i++) {
+        palette[i] = (a0 > a1) ? ((8 - i) * a0 + (i - 1) * a1) / 7 : (i < 6) ? ((6 - i) * a0 + (i - 1) * a1) / 5 : (i == 6 ? 0 : 255);
+    }
+
+    unsigned long long indices = 0;
+    for (int i = 0; i < 6; i++) {
+        indices |= (unsigned long long)in[2 + i] << (i * 8);
+    }
+    for (int i = 0; i < 16; i++) {
+        pixels[i * 4 + channel] = palette[(indices >> (i * 3)) & 7];
+    }
+}
+
+template <class T>
+void writeValue(std::ofstream& ostream, T value) {
+    ostream.write((const char *)&value, sizeof(T));
+}
+
+template <class T>
+bool readValue(std::ifstream& istream, T& value) {
+    return (bool)istream.read((char *)&value, sizeof(T));
+}
+
+}
+
+const char * blockFormatName(BlockFormat format) {
+    switch (format) {
+    case BLOCK_BC1: return "BC1";
+    case BLOCK_BC3: return "BC3";
+    case BLOCK_BC5: return "BC5";
+    }
+    return "?";
+}
+
+unsigned int blockBytes(BlockFormat format) {
+    return (format == BLOCK_BC1) ? 8 : 16;
+}
+
+unsigned int numBlockRows(unsigned int height) {
+    return (height + 3) / 4;
+}
+
+size_t compressedSize(unsigned int width, unsigned int height, BlockFormat format) {
+    return (size_t)((width + 3) / 4) * numBlockRows(height) * blockBytes(format);
+}
+
+void compressBlockRows(const unsigned char * rgba, unsigned int width, unsigned int height, BlockFormat format,
+                       unsigned int firstRow, unsigned int lastRow, unsigned char * out) {
+    unsigned int blocksWide = (width + 3) / 4;
+    unsigned int size = blockBytes(format);
+    unsigned char block[64];
+
+    for (unsigned int by = firstRow; by < lastRow; by++) {
+        unsigned char * row = out + (size_t)by * blocksWide * size;
+        for (unsigned int bx = 0; bx < blocksWide; bx++) {
+            extractBlock(rgba, width, height, bx, by, block);
+            unsigned char * dst = row + bx * size;
+
+            switch (format) {
+            case BLOCK_BC1:
+                encodeColorBlock(block, dst);
+                break;
+            case BLOCK_BC3:
+                encodeChannelBlock(block, 3, dst);
+                encodeColorBlock(block, dst + 8);
+                break;
+            case BLOCK_BC5:
+                encodeChannelBlock(block, 0, dst);
+                encodeChannelBlock(block, 1, dst + 8);
+                break;
+            }
+        }
+    }
+}
+
+void decompressBlocks(const unsigned char * blocks, unsigned int width, unsigned int height, BlockFormat format, unsigned char * rgba) {
+    unsigned int blocksWide = (width + 3) / 4;
+    unsigned int size = blockBytes(format);
+    unsigned char pixels[64];
+
+    for (unsigned int by = 0; by < numBlockRows(height); by++) {
+        for (unsigned int bx = 0; bx < blocksWide; bx++) {
+            const unsigned char * src = blocks + ((size_t)by * blocksWide + bx) * size;
+
+            switch (format) {
+            case BLOCK_BC1:
+                decodeColorBlock(src, false, pixels);
+                break;
+            case BLOCK_BC3:
+                decodeColorBlock(src + 8, true, pixels);
+                decodeChannelBlock(src, 3, pixels);
+                break;
+            case BLOCK_BC5:
+                for (int i = 0; i < 16; i++) {
+                    pixels[i * 4 + 2] = 0;
+                    pixels[i * 4 + 3] = 255;
+                }
+                decodeChannelBlock(src, 0, pixels);
+                decodeChannelBlock(src + 8, 1, pixels);
+                break;
+            }
+
+            for (unsigned int y = 0; y < 4 && by * 4 + y < height; y++) {
+                for (unsigned int x = 0; x < 4 && bx * 4 + x < width; x++) {
+                    memcpy(rgba + ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4, pixels + (y * 4 + x) * 4, 4);
+                }
+            }
+        }
+    }
+}
+
+float computePSNR(const unsigned char * original, const unsigned char * decoded, size_t numPixels, BlockFormat format) {
+    int firstChannel = 0;
+    int lastChannel = (format == BLOCK_BC1) ? 3 : (format == BLOCK_BC3) ? 4 : 2;
+
+    double squaredError = 0.0;
+    size_t first = 0;
+#ifdef __SSE2__
+    // four pixels at a time; the 32-bit sums are moved into the total before they can overflow
+    __m128i zero = _mm_setzero_si128();
+    __m128i channels = _mm_setr_epi16(-1, lastChannel > 1 ? -1 : 0, lastChannel > 2 ? -1 : 0, lastChannel > 3 ? -1 : 0,
+                                      -1, lastChannel > 1 ? -1 : 0, lastChannel > 2 ? -1 : 0, lastChannel > 3 ? -1 : 0);
+    for (; first + 4 <= numPixels; ) {
+        size_t last = std::min(first + 4 * 4096, numPixels & ~(size_t)3);
+        __m128i sums = _mm_setzero_si128();
+        for (; first < last; first += 4) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(original + first * 4));
+            __m128i b = _mm_loadu_si128((const __m128i *)(decoded + first * 4));
+            __m128i low = _mm_and_si128(_mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)), channels);
+            __m128i high = _mm_and_si128(_mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)), channels);
+            sums = _mm_add_epi32(sums, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+        }
+        int lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, sums);
+        squaredError += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+    for (size_t i = first; i < numPixels; i++) {
+        for (int c = firstChannel; c < lastChannel; c++) {
+            double difference = (double)original[i * 4 + c] - decoded[i * 4 + c];
+            squaredError += difference * difference;
+        }
+    }
+
+    double mse = squaredError / ((double)numPixels * (lastChannel - firstChannel));
+    if (mse <= 0.0) {
+        return 99.0f; // lossless
+    }
+    return (float)(10.0 * std::log10(255.0 * 255.0 / mse));
+}
+
+unsigned long long hashBytes(const unsigned char * data, size_t size, unsigned long long hash) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Cache file layout (native byte order, it is a local cache):
+ *     "BCTX" version format hash psnr numLevels
+ *     per level: width height size data
+ */
+bool loadCompressedTexture(const std::string& filename, BlockFormat format, unsigned long long hash, CompressedTexture& texture) {
+    std::ifstream istream(filename, std::ios::binary);
+    if (!istream.good()) {
+        return false;
+    }
+
+    char magic[4];
+    unsigned int version, storedFormat, numLevels;
+    unsigned long long storedHash;
+    float psnr;
+    if (!istream.read(magic, 4) || memcmp(magic, "BCTX", 4) != 0 ||
+        !readValue(istream, version) || version != BLOCK_CACHE_VERSION ||
+        !readValue(istream, storedFormat) || storedFormat != (unsigned int)format ||
+        !readValue(istream, storedHash) || storedHash != hash ||
+        !readValue(istream, psnr) || !readValue(istream, numLevels)) {
+        return false;
+    }
+
+    CompressedTexture loaded;
+    loaded.format = format;
+    loaded.hash = hash;
+    loaded.psnr = psnr;
+    loaded.cached = true;
+    for (unsigned int i = 0; i < numLevels; i++) {
+        unsigned int width, height, size;
+        if (!readValue(istream, width) || !readValue(istream, height) || !readValue(istream, size) ||
+            size != compressedSize(width, height, format)) {
+            return false;
+        }
+        loaded.widths.push_back(width);
+        loaded.heights.push_back(height);
+        loaded.levels.push_back(std::vector<unsigned char>(size));
+        if (!istream.read((char *)&loaded.levels.back()[0], size)) {
+            return false;
+        }
+    }
+
+    texture = loaded;
+    return true;
+}
+
+bool saveCompressedTexture(const std::string& filename, const CompressedTexture& texture) {
+    std::ofstream ostream(filename, std::ios::binary);
+    if (!ostream.good()) {
+        return false;
+    }
+
+    ostream.write("BCTX", 4);
+    writeValue<unsigned int>(ostream, BLOCK_CACHE_VERSION);
+    writeValue<unsigned int>(ostream, texture.format);
+    writeValue<unsigned long long>(ostream, texture.hash);
+    writeValue<float>(ostream, texture.psnr);
+    writeValue<unsigned int>(ostream, texture.levels.size());
+    for (size_t i = 0; i < texture.levels.size(); i++) {
+        writeValue<unsigned int>(ostream, texture.widths[i]);
+        writeValue<unsigned int>(ostream, texture.heights[i]);
+        writeValue<unsigned int>(ostream, texture.levels[i].size());
+        ostream.write((const char *)&texture.levels[i][0], texture.levels[i].size());
+    }
+    return ostream.good();
+}
@@ -0,0 +1,67 @@
+#ifndef _BLOCKCOMPRESS_H_
+#define _BLOCKCOMPRESS_H_
+
+#include <string>
+#include <vector>
+
+/*
+ * 4x4 block compression of RGBA8 images:
+ *   BC1 (DXT1)  RGB, 8 bytes per block, 6:1 against RGB / 8:1 against RGBA
+ *   BC3 (DXT5)  RGBA, 16 bytes per block, 4:1
+ *   BC5 (RGTC2) two channels (red and green, e.g. tangent-space normals), 16 bytes per block
+ * Blocks are stored row by row, so any range of block rows can be encoded independently.
+ */
+enum BlockFormat {
+    BLOCK_BC1,
+    BLOCK_BC3,
+    BLOCK_BC5
+};
+
+const char * blockFormatName(BlockFormat format);
+unsigned int blockBytes(BlockFormat format);
+unsigned int numBlockRows(unsigned int height);
+size_t compressedSize(unsigned int width, unsigned int height, BlockFormat format);
+
+// encodes block rows [firstRow, lastRow) of an RGBA8 image into out, which holds the whole compressed image
+void compressBlockRows(const unsigned char * rgba, unsigned int width, unsigned int height, BlockFormat format,
+                       unsigned int firstRow, unsigned int lastRow, unsigned char * out);
+
+void decompressBlocks(const unsigned char * blocks, unsigned int width, unsigned int height, BlockFormat format, unsigned char * rgba);
+
+// peak signal to noise ratio in dB over the channels the format stores
+float computePSNR(const unsigned char * original, const unsigned char * decoded, size_t numPixels, BlockFormat format);
+
+// A texture cooked to a block format, with all of its mip levels
+struct CompressedTexture {
+    BlockFormat format;
+    unsigned long long hash;            // of the source pixels, so stale cache files are ignored
+    std::vector<unsigned int> widths;
+    std::vector<unsigned int> heights;
+    std::vector<std::vector<unsigned char>> levels;
+    float psnr;                         // of level 0
+    bool cached;                        // read from the disk cache rather than encoded
+
+    // work split used while cooking: a range of block rows in one level
+    struct Band {
+        int level;
+        unsigned int firstRow;
+        unsigned int lastRow;
+    };
+    std::vector<Band> bands;
+
+    CompressedTexture() : format(BLOCK_BC1), hash(0), psnr(0.0f), cached(false) {
+    }
+
+    bool empty() const {
+        return levels.empty();
+    }
+};
+
+// FNV-1a, 64 bit
+unsigned long long hashBytes(const unsigned char * data, size_t size, unsigned long long hash = 14695981039346656037ULL);
+
+// the cache file is only used if it holds the same format and source hash
+bool loadCompressedTexture(const std::string& filename, BlockFormat format, unsigned long long hash, CompressedTexture& texture);
+bool saveCompressedTexture(const std::string& filename, const CompressedTexture& texture);
+
+#endif // #ifndef _BLOCKCOMPRESS_H_
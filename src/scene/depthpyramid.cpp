@@ -0,0 +1,96 @@
+#include "depthpyramid.hpp"
+#include <algorithm>
+#include <cmath>
+
+void DepthPyramid::build(const float * depth, int width, int height, const glm::mat4& viewProj) {
+    this->viewProj = viewProj;
+    levels.resize(1);
+    widths.assign(1, width);
+    heights.assign(1, height);
+    levels[0].assign(depth, depth + (size_t)width * height);
+
+    while (widths.back() > 1 || heights.back() > 1) {
+        int w = widths.back(), h = heights.back();
+        int halfW = std::max(w / 2, 1), halfH = std::max(h / 2, 1);
+        std::vector<float> half((size_t)halfW * halfH);
+        const std::vector<float>& fine = levels.back();
+        for (int y = 0; y < halfH; y++) {
+            // the last row and column take the odd texel left over, if there is one
+            int y0 = y * 2, y1 = (y == halfH - 1) ? h - 1 : y * 2 + 1;
+            for (int x = 0; x < halfW; x++) {
+                int x0 = x * 2, x1 = (x == halfW - 1) ? w - 1 : x * 2 + 1;
+                float farthest = 0.0f;
+                for (int fy = y0; fy <= y1; fy++) {
+                    for (int fx = x0; fx <= x1; fx++) {
+                        farthest = std::max(farthest, fine[(size_t)fy * w + fx]);
+                    }
+                }
+                half[(size_t)y * halfW + x] = farthest;
+            }
+        }
+        levels.push_back(half);
+        widths.push_back(halfW);
+        heights.push_back(halfH);
+    }
+}
+
+void DepthPyramid::clear() {
+    levels.clear();
+    widths.clear();
+    heights.clear();
+}
+
+bool DepthPyramid::empty() const {
+    return levels.empty();
+}
+
+const glm::mat4& DepthPyramid::getViewProj() const {
+    return viewProj;
+}
+
+bool DepthPyramid::boxOccluded(const glm::mat4x3& world, const glm::vec3& boxMin, const glm::vec3& boxMax) const {
+    if (levels.empty()) {
+        return false;
+    }
+
+    glm::vec2 screenMin(1.0f), screenMax(-1.0f);
+    float nearest = 1.0f;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+        glm::vec4 clip = viewProj * glm::vec4(world * glm::vec4(corner, 1.0f), 1.0f);
+        if (clip.w <= 0.0f || clip.z < -clip.w) {
+            return false;               // in front of the near plane, or behind the eye
+        }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        screenMin = glm::min(screenMin, glm::vec2(ndc));
+        screenMax = glm::max(screenMax, glm::vec2(ndc));
+        nearest = std::min(nearest, ndc.z);
+    }
+    if (screenMax.x < -1.0f || screenMax.y < -1.0f || screenMin.x > 1.0f || screenMin.y > 1.0f) {
+        return false;
+    }
+
+    // every texel the box's screen rectangle touches, grown by half a texel since level 0 only holds the depth at
+    // texel centres, then the level where that is a few texels
+    int width = widths[0], height = heights[0];
+    int x0 = (int)glm::clamp(std::floor((screenMin.x * 0.5f + 0.5f) * width - 0.5f), 0.0f, width - 1.0f);
+    int x1 = (int)glm::clamp(std::floor((screenMax.x * 0.5f + 0.5f) * width + 0.5f), 0.0f, width - 1.0f);
+    int y0 = (int)glm::clamp(std::floor((screenMin.y * 0.5f + 0.5f) * height - 0.5f), 0.0f, height - 1.0f);
+    int y1 = (int)glm::clamp(std::floor((screenMax.y * 0.5f + 0.5f) * height + 0.5f), 0.0f, height - 1.0f);
+    size_t level = 0;
+    while (level + 1 < levels.size() && ((x1 >> level) - (x0 >> level) >= DEPTH_PYRAMID_TEST_TEXELS ||
+                                         (y1 >> level) - (y0 >> level) >= DEPTH_PYRAMID_TEST_TEXELS)) {
+        level++;
+    }
+
+    float depth = nearest * 0.5f + 0.5f;
+    int levelWidth = widths[level], levelHeight = heights[level];
+    for (int y = std::min(y0 >> level, levelHeight - 1); y <= std::min(y1 >> level, levelHeight - 1); y++) {
+        for (int x = std::min(x0 >> level, levelWidth - 1); x <= std::min(x1 >> level, levelWidth - 1); x++) {
+            if (levels[level][(size_t)y * levelWidth + x] >= depth) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
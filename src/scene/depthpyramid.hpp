@@ -0,0 +1,42 @@
+#ifndef _DEPTHPYRAMID_H_
+#define _DEPTHPYRAMID_H_
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Texels of the level a box is tested at, at most, along each axis; boxes smaller than this on screen test finer levels
+#define DEPTH_PYRAMID_TEST_TEXELS 4
+
+/*
+ * Hierarchical depth buffer for occlusion tests on the CPU: level 0 holds window depths in [0, 1] (larger is
+ * farther, as with GL_LESS), and each coarser level halves it, keeping the farthest depth of the texels it
+ * covers. On odd sizes the last row and column of a level cover three texels of the finer one.
+ *
+ * A box is occluded when its nearest point is farther than the farthest depth everywhere it covers on screen.
+ * The depths only hold for the view they were rendered from, so boxes are projected with that view's matrix.
+ */
+class DepthPyramid {
+public:
+    // Builds the levels from width x height depths, rows from the bottom of the screen up like glReadPixels
+    void build(const float * depth, int width, int height, const glm::mat4& viewProj);
+    void clear();
+    bool empty() const;
+
+    // The projection and view the depths were rendered with
+    const glm::mat4& getViewProj() const;
+
+    /*
+     * Whether the box [boxMin, boxMax] is hidden behind the depths, placed in the world by an affine matrix
+     * (see transform.hpp). Only the part on screen is tested, grown by half a texel of level 0; boxes crossing
+     * the near plane are never occluded, nor is anything while the pyramid is empty.
+     */
+    bool boxOccluded(const glm::mat4x3& world, const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+
+private:
+    std::vector<std::vector<float>> levels;
+    std::vector<int> widths;
+    std::vector<int> heights;
+    glm::mat4 viewProj;
+};
+
+#endif // #ifndef _DEPTHPYRAMID_H_
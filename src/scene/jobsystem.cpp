@@ -0,0 +1,216 @@
+#include "jobsystem.hpp"
+#include <algorithm>
+
+namespace {
+
+// the system whose worker this thread is, if any, and the worker's deque
+thread_local JobSystem * currentSystem = nullptr;
+thread_local int currentIndex = -1;
+
+}
+
+JobSystem::JobSystem(unsigned int numThreads) : queued(0), sleeping(0), waiting(0), stopping(false)
+{
+    if (numThreads == 0) {
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    for (unsigned int i = 0; i < numThreads; i++) {
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (unsigned int i = 0; i + 1 < numThreads; i++) {
+        workers.push_back(std::thread(&JobSystem::workerLoop, this, (int)i));
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    // without workers, whatever is left only runs here
+    while (runOne(queueIndex())) {
+    }
+}
+
+JobSystem& JobSystem::shared() {
+    static JobSystem system;
+    return system;
+}
+
+unsigned int JobSystem::size() const {
+    return workers.size() + 1;
+}
+
+JobSystem::JobHandle JobSystem::create(std::function<void()> task, const JobHandle& parent) {
+    JobHandle job = std::make_shared<Job>();
+    job->task = std::move(task);
+    job->parent = parent;
+    job->unfinished = 1;
+    job->done = false;
+    if (parent) {
+        parent->unfinished++;
+    }
+    return job;
+}
+
+JobSystem::JobHandle JobSystem::continueWith(const JobHandle& job, std::function<void()> task, const JobHandle& parent) {
+    JobHandle continuation = create(std::move(task), parent);
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        if (!job->done) {
+            job->continuations.push_back(continuation);
+            return continuation;
+        }
+    }
+    run(continuation);
+    return continuation;
+}
+
+void JobSystem::run(const JobHandle& job) {
+    Queue& queue = *queues[queueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(job);
+    }
+    queued++;
+    if (sleeping > 0) {
+        notify(false);
+    }
+}
+
+bool JobSystem::finished(const JobHandle& job) const {
+    return job->unfinished == 0;
+}
+
+void JobSystem::wait(const JobHandle& job) {
+    int index = queueIndex();
+    while (!finished(job)) {
+        if (runOne(index)) {
+            continue;
+        }
+        // nothing to help with: the rest of job is running on other threads
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleeping++;
+        waiting++;
+        wake.wait(lock, [this, &job]() { return queued > 0 || finished(job); });
+        waiting--;
+        sleeping--;
+    }
+}
+
+int JobSystem::queueIndex() const {
+    return currentSystem == this ? currentIndex : (int)workers.size();
+}
+
+JobSystem::JobHandle JobSystem::pop(int index) {
+    JobHandle job;
+    {
+        Queue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            return job;
+        }
+    }
+
+    // steal the oldest job of the next deque that has one
+    for (size_t i = 1; i < queues.size(); i++) {
+        Queue& victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return job;
+        }
+    }
+    return job;
+}
+
+bool JobSystem::runOne(int index) {
+    if (queued == 0) {
+        return false;
+    }
+    JobHandle job = pop(index);
+    if (!job) {
+        return false;
+    }
+    queued--;
+    execute(job);
+    return true;
+}
+
+void JobSystem::execute(const JobHandle& job) {
+    if (job->task) {
+        job->task();
+        job->task = nullptr; // let go of what it captured
+    }
+    finish(job);
+}
+
+void JobSystem::finish(JobHandle job) {
+    while (job && --job->unfinished == 0) {
+        std::vector<JobHandle> continuations;
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->done = true;
+            continuations.swap(job->continuations);
+        }
+        for (const JobHandle& continuation : continuations) {
+            run(continuation);
+        }
+        if (waiting > 0) {
+            notify(true);
+        }
+        job = std::move(job->parent);
+    }
+}
+
+void JobSystem::notify(bool all) {
+    // taking the lock orders this after a sleeper's check of what it waits for, so the wake up isn't lost
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    if (all) {
+        wake.notify_all();
+    } else {
+        wake.notify_one();
+    }
+}
+
+void JobSystem::workerLoop(int index) {
+    currentSystem = this;
+    currentIndex = index;
+    while (true) {
+        if (runOne(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        if (stopping && queued == 0) {
+            return; // stopping, and nothing left to do
+        }
+        sleeping++;
+        wake.wait(lock, [this]() { return stopping || queued > 0; });
+        sleeping--;
+    }
+}
+
+void JobSystem::splitRange(const JobHandle& root, size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body) {
+    // the job keeps the first half of its range and queues the second, until what it keeps is one piece
+    run(create([this, root, begin, end, grain, &body]() {
+        size_t last = end;
+        while (last - begin > grain) {
+            size_t middle = begin + (last - begin) / 2;
+            splitRange(root, middle, last, grain, body);
+            last = middle;
+        }
+        body(begin, last);
+    }, root));
+}
@@ -0,0 +1,159 @@
+#ifndef _JOBSYSTEM_H_
+#define _JOBSYSTEM_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// parallelFor splits a range in halves down to this many elements when no grain is given
+#define JOB_SYSTEM_DEFAULT_GRAIN 1024
+
+// A contiguous run of elements, as parallelFor hands them out
+template <class T>
+struct Span {
+    T * data;
+    size_t count;
+
+    T * begin() const { return data; }
+    T * end() const { return data + count; }
+    size_t size() const { return count; }
+    T& operator[](size_t i) const { return data[i]; }
+    Span<T> subspan(size_t offset, size_t length) const { Span<T> span = { data + offset, length }; return span; }
+};
+
+template <class T>
+Span<T> makeSpan(T * data, size_t count) {
+    Span<T> span = { data, count };
+    return span;
+}
+
+template <class T>
+Span<T> makeSpan(std::vector<T>& vector) {
+    return makeSpan(vector.data(), vector.size());
+}
+
+template <class T>
+Span<const T> makeSpan(const std::vector<T>& vector) {
+    return makeSpan(vector.data(), vector.size());
+}
+
+/*
+ * Work-stealing job scheduler shared by the engine's parallel work (scene loading, the scene graph, culling
+ * and occlusion), so none of it needs threads of its own.
+ *
+ * Every worker has a deque of jobs: it pushes and pops its own at the back, newest first, so a job's children
+ * run while their data is still in the cache, and idle workers steal the oldest from the front of the others'
+ * deques, which are usually the biggest pieces of work. Threads outside the system queue their jobs on a
+ * deque of their own that workers steal from.
+ *
+ * Dependencies are expressed with parents and continuations instead of blocking:
+ *   - a job finishes once its task has returned and all its children have finished; children are created with
+ *     the parent while it is unfinished, usually from the parent's own task or before running it,
+ *   - a continuation is a job that is queued when the job it follows has finished,
+ * so "C after A and B" is an empty parent of A and B with C as its continuation. wait runs other jobs while
+ * it waits, so, unlike ThreadPool tasks, jobs may wait on other jobs (but not on a continuation of themselves).
+ */
+class JobSystem {
+public:
+    struct Job;
+    typedef std::shared_ptr<Job> JobHandle;
+
+    /*
+     * numThreads counts the thread that waits: numThreads - 1 workers are started, and a thread calling wait
+     * or parallelFor does the rest of the work. 0 means one per hardware thread; with 1, jobs only run while
+     * someone waits.
+     */
+    explicit JobSystem(unsigned int numThreads = 0);
+
+    // finishes all queued jobs before joining the workers
+    ~JobSystem();
+
+    // One per hardware thread, created on first use, for everything that doesn't need a system of its own
+    static JobSystem& shared();
+
+    unsigned int size() const;
+
+    // A job that runs task once run is called on it; with a parent, the parent doesn't finish before it does
+    JobHandle create(std::function<void()> task, const JobHandle& parent = JobHandle());
+
+    // A job that runs task once job has finished, or right away if it already has; it must not be run by hand
+    JobHandle continueWith(const JobHandle& job, std::function<void()> task, const JobHandle& parent = JobHandle());
+
+    void run(const JobHandle& job);
+    bool finished(const JobHandle& job) const;
+
+    // Runs queued jobs until job has finished
+    void wait(const JobHandle& job);
+
+    /*
+     * Calls body(first, last) over pieces of [begin, end) of at most grain elements, on the calling thread and
+     * any idle workers, and returns when all of them have. Ranges are halved as they are handed out, so a
+     * worker that steals takes half of what is left.
+     */
+    template <class F>
+    void parallelFor(size_t begin, size_t end, size_t grain, F body) {
+        grain = grain > 0 ? grain : JOB_SYSTEM_DEFAULT_GRAIN;
+        if (end - begin <= grain || size() == 1) {
+            for (size_t first = begin; first < end; first += grain) {
+                body(first, first + grain < end ? first + grain : end);
+            }
+            return;
+        }
+        std::function<void(size_t, size_t)> function(body);
+        JobHandle root = create(std::function<void()>());
+        splitRange(root, begin, end, grain, function);
+        finish(root); // it has no task of its own
+        wait(root);
+    }
+
+    // The same over a span: body(piece, offset) gets pieces of span and where each starts in it
+    template <class T, class F>
+    void parallelFor(Span<T> span, size_t grain, F body) {
+        parallelFor(0, span.size(), grain, [&span, &body](size_t first, size_t last) {
+            body(span.subspan(first, last - first), first);
+        });
+    }
+
+    struct Job {
+        std::function<void()> task;
+        JobHandle parent;
+        std::atomic<int> unfinished;            // the task and every unfinished child
+        std::mutex mutex;                       // guards continuations and done
+        std::vector<JobHandle> continuations;
+        bool done;
+    };
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<JobHandle> jobs;
+    };
+
+    // workers' deques, then the one for threads outside the system
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    // idle threads sleep until there is something queued, and threads in wait also until a job finishes
+    std::atomic<int> queued;
+    std::atomic<int> sleeping;
+    std::atomic<int> waiting;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    int queueIndex() const;
+    JobHandle pop(int index);
+    bool runOne(int index);
+    void execute(const JobHandle& job);
+    void finish(JobHandle job);
+    void notify(bool all);
+    void workerLoop(int index);
+    void splitRange(const JobHandle& root, size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body);
+};
+
+#endif // #ifndef _JOBSYSTEM_H_
@@ -0,0 +1,236 @@
+#include "lightstore.hpp"
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Cephes' range reduction: x - j * pi/4 with pi/4 split into three parts, so the products are exact
+const float FOUR_OVER_PI = 1.27323954473516f;
+const float DP1 = 0.78515625f;
+const float DP2 = 2.4187564849853515625e-4f;
+const float DP3 = 3.77489497744594108e-8f;
+
+// minimax polynomials for sin and cos on [-pi/4, pi/4]
+const float SIN_P0 = -1.9515295891e-4f;
+const float SIN_P1 = 8.3321608736e-3f;
+const float SIN_P2 = -1.6666654611e-1f;
+const float COS_P0 = 2.443315711809948e-5f;
+const float COS_P1 = -1.388731625493765e-3f;
+const float COS_P2 = 4.166664568298827e-2f;
+
+size_t roundUpToBatch(size_t count) {
+    return (count + LIGHT_STORE_BATCH - 1) / LIGHT_STORE_BATCH * LIGHT_STORE_BATCH;
+}
+
+// new slots are lights with no velocity at the origin, which animate leaves alone
+void resizeArrays(std::vector<float> * const arrays[], int numArrays, size_t size) {
+    for (int i = 0; i < numArrays; i++) {
+        arrays[i]->resize(size, 0.0f);
+    }
+}
+
+#ifdef __SSE2__
+// Four lanes of sinCos; the same operations in the same order, so the results match it bit for bit
+void sinCos4(__m128 x, __m128& s, __m128& c) {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 sinSign = _mm_and_ps(x, signMask);
+    x = _mm_andnot_ps(signMask, x);
+
+    // octant, rounded up to even so the remainder lies in [-pi/4, pi/4]
+    __m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(FOUR_OVER_PI)));
+    j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+    __m128 y = _mm_cvtepi32_ps(j);
+
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_set1_epi32(2)));
+    sinSign = _mm_xor_ps(sinSign, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29)));
+    __m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(j, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(DP1)));
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(DP2)));
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(DP3)));
+    __m128 z = _mm_mul_ps(x, x);
+
+    __m128 cosPoly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(COS_P0), z), _mm_set1_ps(COS_P1));
+    cosPoly = _mm_add_ps(_mm_mul_ps(cosPoly, z), _mm_set1_ps(COS_P2));
+    cosPoly = _mm_mul_ps(_mm_mul_ps(cosPoly, z), z);
+    cosPoly = _mm_sub_ps(cosPoly, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    cosPoly = _mm_add_ps(cosPoly, _mm_set1_ps(1.0f));
+
+    __m128 sinPoly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(SIN_P0), z), _mm_set1_ps(SIN_P1));
+    sinPoly = _mm_add_ps(_mm_mul_ps(sinPoly, z), _mm_set1_ps(SIN_P2));
+    sinPoly = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sinPoly, z), x), x);
+
+    s = _mm_or_ps(_mm_and_ps(swap, cosPoly), _mm_andnot_ps(swap, sinPoly));
+    c = _mm_or_ps(_mm_and_ps(swap, sinPoly), _mm_andnot_ps(swap, cosPoly));
+    s = _mm_xor_ps(s, sinSign);
+    c = _mm_xor_ps(c, cosSign);
+}
+
+__m128 select(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+}
+
+void sinCos(float x, float& s, float& c) {
+    bool negative = x < 0.0f;
+    x = std::fabs(x);
+
+    int j = (int)(x * FOUR_OVER_PI);
+    j = (j + 1) & ~1;
+    float y = (float)j;
+
+    x = x - y * DP1;
+    x = x - y * DP2;
+    x = x - y * DP3;
+    float z = x * x;
+
+    float cosPoly = ((COS_P0 * z + COS_P1) * z + COS_P2) * z * z - z * 0.5f + 1.0f;
+    float sinPoly = ((SIN_P0 * z + SIN_P1) * z + SIN_P2) * z * x + x;
+
+    // odd octants swap the polynomials; the sign follows the quadrant
+    bool swap = (j & 2) != 0;
+    s = swap ? cosPoly : sinPoly;
+    c = swap ? sinPoly : cosPoly;
+    if (((j & 4) != 0) != negative) {
+        s = -s;
+    }
+    if (((j - 2) & 4) == 0) {
+        c = -c;
+    }
+}
+
+LightStore::LightStore() : pointCount(0), spotCount(0) {
+}
+
+void LightStore::clear() {
+    points = PointLights();
+    spots = SpotLights();
+    pointCount = 0;
+    spotCount = 0;
+}
+
+void LightStore::addPointLight(const glm::vec3& initialPosition, float velocity) {
+    std::vector<float> * const arrays[] = { &points.initialX, &points.initialY, &points.initialZ, &points.velocity, &points.x, &points.y, &points.z };
+    resizeArrays(arrays, sizeof(arrays) / sizeof(arrays[0]), roundUpToBatch(pointCount + 1));
+
+    size_t i = pointCount++;
+    points.initialX[i] = points.x[i] = initialPosition.x;
+    points.initialY[i] = points.y[i] = initialPosition.y;
+    points.initialZ[i] = points.z[i] = initialPosition.z;
+    points.velocity[i] = velocity;
+}
+
+void LightStore::addSpotLight(const glm::vec3& initialPosition, const glm::vec3& direction, float velocity) {
+    std::vector<float> * const arrays[] = { &spots.initialX, &spots.initialY, &spots.initialZ, &spots.velocity, &spots.x, &spots.y, &spots.z,
+                                            &spots.directionX, &spots.directionY, &spots.directionZ };
+    resizeArrays(arrays, sizeof(arrays) / sizeof(arrays[0]), roundUpToBatch(spotCount + 1));
+
+    size_t i = spotCount++;
+    spots.initialX[i] = spots.x[i] = initialPosition.x;
+    spots.initialY[i] = spots.y[i] = initialPosition.y;
+    spots.initialZ[i] = spots.z[i] = initialPosition.z;
+    spots.velocity[i] = velocity;
+    spots.directionX[i] = direction.x;
+    spots.directionY[i] = direction.y;
+    spots.directionZ[i] = direction.z;
+}
+
+void LightStore::animate(float t) {
+#ifdef __SSE2__
+    const __m128 time = _mm_set1_ps(t);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 radius = _mm_set1_ps(5.0f);
+
+    for (size_t i = 0; i < points.velocity.size(); i += LIGHT_STORE_BATCH) {
+        __m128 velocity = _mm_loadu_ps(&points.velocity[i]);
+        __m128 moving = _mm_cmpgt_ps(velocity, zero);
+        if (_mm_movemask_ps(moving) == 0) {
+            continue;
+        }
+
+        __m128 s, c;
+        sinCos4(_mm_mul_ps(time, velocity), s, c);
+        __m128 x = _mm_add_ps(_mm_loadu_ps(&points.initialX[i]), _mm_mul_ps(radius, s));
+        __m128 z = _mm_add_ps(_mm_loadu_ps(&points.initialZ[i]), _mm_mul_ps(radius, c));
+        _mm_storeu_ps(&points.x[i], select(moving, x, _mm_loadu_ps(&points.x[i])));
+        _mm_storeu_ps(&points.y[i], select(moving, _mm_loadu_ps(&points.initialY[i]), _mm_loadu_ps(&points.y[i])));
+        _mm_storeu_ps(&points.z[i], select(moving, z, _mm_loadu_ps(&points.z[i])));
+    }
+
+    for (size_t i = 0; i < spots.velocity.size(); i += LIGHT_STORE_BATCH) {
+        __m128 velocity = _mm_loadu_ps(&spots.velocity[i]);
+        __m128 moving = _mm_cmpgt_ps(velocity, zero);
+        if (_mm_movemask_ps(moving) == 0) {
+            continue;
+        }
+
+        // sin(-a) = -sin(a) and cos(-a) = cos(a), so the position needs no second sinCos
+        __m128 s, c;
+        sinCos4(_mm_mul_ps(time, velocity), s, c);
+        __m128 x = _mm_sub_ps(_mm_loadu_ps(&spots.initialX[i]), s);
+        __m128 z = _mm_add_ps(_mm_loadu_ps(&spots.initialZ[i]), c);
+        _mm_storeu_ps(&spots.x[i], select(moving, x, _mm_loadu_ps(&spots.x[i])));
+        _mm_storeu_ps(&spots.y[i], select(moving, _mm_loadu_ps(&spots.initialY[i]), _mm_loadu_ps(&spots.y[i])));
+        _mm_storeu_ps(&spots.z[i], select(moving, z, _mm_loadu_ps(&spots.z[i])));
+        _mm_storeu_ps(&spots.directionX[i], select(moving, s, _mm_loadu_ps(&spots.directionX[i])));
+        _mm_storeu_ps(&spots.directionY[i], select(moving, _mm_set1_ps(-2.0f), _mm_loadu_ps(&spots.directionY[i])));
+        _mm_storeu_ps(&spots.directionZ[i], select(moving, c, _mm_loadu_ps(&spots.directionZ[i])));
+    }
+#else
+    for (size_t i = 0; i < pointCount; i++) {
+        if (points.velocity[i] > 0) {
+            float s, c;
+            sinCos(t * points.velocity[i], s, c);
+            points.x[i] = points.initialX[i] + 5.0f * s;
+            points.y[i] = points.initialY[i];
+            points.z[i] = points.initialZ[i] + 5.0f * c;
+        }
+    }
+
+    for (size_t i = 0; i < spotCount; i++) {
+        if (spots.velocity[i] > 0) {
+            float s, c;
+            sinCos(t * spots.velocity[i], s, c);
+            spots.x[i] = spots.initialX[i] - s;
+            spots.y[i] = spots.initialY[i];
+            spots.z[i] = spots.initialZ[i] + c;
+            spots.directionX[i] = s;
+            spots.directionY[i] = -2.0f;
+            spots.directionZ[i] = c;
+        }
+    }
+#endif
+}
+
+size_t LightStore::numPointLights() const {
+    return pointCount;
+}
+
+size_t LightStore::numSpotLights() const {
+    return spotCount;
+}
+
+glm::vec3 LightStore::getPointLightPosition(size_t i) const {
+    return glm::vec3(points.x[i], points.y[i], points.z[i]);
+}
+
+glm::vec3 LightStore::getSpotLightPosition(size_t i) const {
+    return glm::vec3(spots.x[i], spots.y[i], spots.z[i]);
+}
+
+glm::vec3 LightStore::getSpotLightDirection(size_t i) const {
+    return glm::vec3(spots.directionX[i], spots.directionY[i], spots.directionZ[i]);
+}
+
+const LightStore::PointLights& LightStore::getPointLights() const {
+    return points;
+}
+
+const LightStore::SpotLights& LightStore::getSpotLights() const {
+    return spots;
+}
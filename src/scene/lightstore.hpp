@@ -0,0 +1,62 @@
+#ifndef _LIGHTSTORE_H_
+#define _LIGHTSTORE_H_
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Lights are animated this many at a time; the arrays are padded to a multiple of it with lights that don't move
+#define LIGHT_STORE_BATCH 4
+
+/*
+ * The animated state of the scene's point and spot lights as a structure of arrays, so the per-frame
+ * animation runs over LIGHT_STORE_BATCH lights at once with SSE2 (scalar code with the same math otherwise).
+ *
+ * The animation is the one Scene::update has always done; lights with a velocity of 0 or less stay put:
+ *     point light:  position = initial + 5 * (sin(t * v), 0, cos(t * v))
+ *     spot light:   direction = (sin(t * v), -2, cos(t * v)),  position = initial + (sin(-t * v), 0, cos(-t * v))
+ */
+class LightStore {
+public:
+    struct PointLights {
+        std::vector<float> initialX, initialY, initialZ;
+        std::vector<float> velocity;
+        std::vector<float> x, y, z;
+    };
+
+    struct SpotLights {
+        std::vector<float> initialX, initialY, initialZ;
+        std::vector<float> velocity;
+        std::vector<float> x, y, z;
+        std::vector<float> directionX, directionY, directionZ;
+    };
+
+    LightStore();
+
+    void clear();
+    void addPointLight(const glm::vec3& initialPosition, float velocity);
+    void addSpotLight(const glm::vec3& initialPosition, const glm::vec3& direction, float velocity);
+
+    // Moves every animated light to where it is at time t
+    void animate(float t);
+
+    size_t numPointLights() const;
+    size_t numSpotLights() const;
+    glm::vec3 getPointLightPosition(size_t i) const;
+    glm::vec3 getSpotLightPosition(size_t i) const;
+    glm::vec3 getSpotLightDirection(size_t i) const;
+
+    // the arrays are padded past numPointLights / numSpotLights to a whole batch
+    const PointLights& getPointLights() const;
+    const SpotLights& getSpotLights() const;
+
+private:
+    PointLights points;
+    SpotLights spots;
+    size_t pointCount;
+    size_t spotCount;
+};
+
+// sin and cos of x, accurate to about 1e-7 for |x| up to a few thousand (Cephes' single precision sinf/cosf)
+void sinCos(float x, float& s, float& c);
+
+#endif // #ifndef _LIGHTSTORE_H_
@@ -0,0 +1,513 @@
+#include "meshlet.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+size_t MeshletSet::size() const {
+    return firstIndex.size();
+}
+
+void MeshletSet::clear() {
+    firstIndex.clear();
+    numIndices.clear();
+    centerX.clear();
+    centerY.clear();
+    centerZ.clear();
+    radius.clear();
+    axisX.clear();
+    axisY.clear();
+    axisZ.clear();
+    cutoff.clear();
+}
+
+namespace {
+
+struct PositionHash {
+    size_t operator()(const glm::vec3& p) const {
+        // adding 0 turns -0 into 0, which compares equal to it and has to hash the same
+        glm::vec3 q = p + 0.0f;
+        unsigned int bits[3];
+        std::memcpy(bits, &q[0], sizeof(bits));
+        return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    }
+};
+
+// Per triangle corner, an id shared by all the corners at the same position; returns the number of ids
+int weldCorners(const std::vector<glm::vec3>& positions, const int * indices, size_t numTriangles, std::vector<int>& corners) {
+    std::unordered_map<glm::vec3, int, PositionHash> welded;
+    corners.resize(numTriangles * 3);
+    for (size_t i = 0; i < corners.size(); i++) {
+        corners[i] = welded.insert(std::make_pair(positions[indices[i]], (int)welded.size())).first->second;
+    }
+    return (int)welded.size();
+}
+
+/*
+ * Whether the triangles close up into surfaces whose back faces can't be seen from outside: every edge between
+ * welded positions is shared by exactly two triangles that run along it in opposite directions. outward tells
+ * whether the winding is counter-clockwise seen from outside, from the sign of the enclosed volume.
+ */
+bool isClosed(const std::vector<glm::vec3>& positions, const int * indices, const std::vector<int>& corners, size_t numTriangles,
+              bool& outward) {
+    // per undirected edge: how many triangles use it, and the directions they run along it summed as +1 and -1
+    std::unordered_map<unsigned long long, std::pair<int, int>> edges;
+    double volume = 0.0;
+    for (size_t t = 0; t < numTriangles; t++) {
+        const int * tri = &corners[t * 3];
+        if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) {
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            unsigned long long a = tri[k], b = tri[(k + 1) % 3];
+            std::pair<int, int>& edge = edges[a < b ? (a << 32) | b : (b << 32) | a];
+            edge.first++;
+            edge.second += a < b ? 1 : -1;
+        }
+        glm::dvec3 p0(positions[indices[t * 3]]), p1(positions[indices[t * 3 + 1]]), p2(positions[indices[t * 3 + 2]]);
+        volume += glm::dot(p0, glm::cross(p1, p2));
+    }
+
+    if (edges.empty()) {
+        return false;
+    }
+    for (const auto& edge : edges) {
+        if (edge.second.first != 2 || edge.second.second != 0) {
+            return false;
+        }
+    }
+    outward = volume > 0.0;
+    return true;
+}
+
+void appendMeshlet(const std::vector<glm::vec3>& positions, const int * indices, size_t numIndices, const std::vector<int>& vertices,
+                   bool closed, bool outward, unsigned int firstIndex, MeshletSet& set) {
+    glm::vec3 lo = positions[vertices[0]], hi = lo;
+    for (int v : vertices) {
+        lo = glm::min(lo, positions[v]);
+        hi = glm::max(hi, positions[v]);
+    }
+    glm::vec3 center = (lo + hi) * 0.5f;
+    float radius = 0.0f;
+    for (int v : vertices) {
+        radius = std::max(radius, glm::length(positions[v] - center));
+    }
+
+    // the cone around the outward normals, none if they spread over a half space or more
+    glm::vec3 axis(0.0f);
+    float cutoff = MESHLET_NO_CONE;
+    if (closed) {
+        std::vector<glm::vec3> normals;
+        glm::vec3 sum(0.0f);
+        for (size_t i = 0; i < numIndices; i += 3) {
+            glm::vec3 p0 = positions[indices[i]], p1 = positions[indices[i + 1]], p2 = positions[indices[i + 2]];
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float length = glm::length(normal);
+            if (length > 0.0f) {
+                normals.push_back(outward ? normal / length : -normal / length);
+                sum += normals.back();
+            }
+        }
+        if (glm::length(sum) > 0.0f) {
+            axis = glm::normalize(sum);
+            float minDot = 1.0f;
+            for (const glm::vec3& normal : normals) {
+                minDot = std::min(minDot, glm::dot(axis, normal));
+            }
+            if (minDot > 0.0f) {
+                cutoff = std::sqrt(1.0f - minDot * minDot);
+            }
+        }
+    }
+
+    set.firstIndex.push_back(firstIndex);
+    set.numIndices.push_back((unsigned int)numIndices);
+    set.centerX.push_back(center.x);
+    set.centerY.push_back(center.y);
+    set.centerZ.push_back(center.z);
+    set.radius.push_back(radius);
+    set.axisX.push_back(axis.x);
+    set.axisY.push_back(axis.y);
+    set.axisZ.push_back(axis.z);
+    set.cutoff.push_back(cutoff);
+}
+
+}
+
+size_t buildMeshlets(const std::vector<glm::vec3>& positions, std::vector<int>& indices, size_t first, size_t count, MeshletSet& set) {
+    size_t numTriangles = count / 3;
+    if (numTriangles == 0) {
+        return 0;
+    }
+    const int * source = &indices[first];
+    std::vector<int> corners;
+    int numPositions = weldCorners(positions, source, numTriangles, corners);
+    bool outward = true;
+    bool closed = isClosed(positions, source, corners, numTriangles, outward);
+
+    // triangles around each welded position, as offsets into one array; flat shaded meshes don't share vertices
+    // between faces, so clusters grow over positions
+    std::vector<int> positionStarts(numPositions + 1, 0);
+    for (size_t i = 0; i < numTriangles * 3; i++) {
+        positionStarts[corners[i] + 1]++;
+    }
+    for (int p = 1; p <= numPositions; p++) {
+        positionStarts[p] += positionStarts[p - 1];
+    }
+    std::vector<int> positionTriangles(numTriangles * 3);
+    std::vector<int> fill(positionStarts.begin(), positionStarts.end() - 1);
+    for (size_t i = 0; i < numTriangles * 3; i++) {
+        positionTriangles[fill[corners[i]]++] = (int)(i / 3);
+    }
+
+    std::vector<int> reordered;
+    reordered.reserve(numTriangles * 3);
+    std::vector<unsigned char> used(numTriangles, 0);
+    std::vector<int> vertexCluster(positions.size(), -1);
+    std::vector<int> positionCluster(numPositions, -1);
+    std::vector<int> vertices, candidates;
+    size_t added = 0;
+    size_t seed = 0;
+
+    while (true) {
+        while (seed < numTriangles && used[seed]) {
+            seed++;
+        }
+        if (seed == numTriangles) {
+            break;
+        }
+
+        int cluster = (int)added;
+        size_t clusterStart = reordered.size();
+        vertices.clear();
+        candidates.clear();
+        glm::vec3 centroidSum(0.0f);
+
+        auto addTriangle = [&](size_t t) {
+            used[t] = 1;
+            for (int k = 0; k < 3; k++) {
+                int v = source[t * 3 + k];
+                reordered.push_back(v);
+                centroidSum += positions[v];
+                if (vertexCluster[v] != cluster) {
+                    vertexCluster[v] = cluster;
+                    vertices.push_back(v);
+                }
+                int p = corners[t * 3 + k];
+                if (positionCluster[p] != cluster) {
+                    positionCluster[p] = cluster;
+                    candidates.insert(candidates.end(), positionTriangles.begin() + positionStarts[p], positionTriangles.begin() + positionStarts[p + 1]);
+                }
+            }
+        };
+        addTriangle(seed);
+
+        // grow over the neighbouring triangle that brings the fewest new vertices, the closest to the cluster's
+        // centroid among equals, so clusters stay round and their cones and spheres tight
+        while ((reordered.size() - clusterStart) / 3 < MESHLET_MAX_TRIANGLES) {
+            glm::vec3 centroid = centroidSum / (float)(reordered.size() - clusterStart);
+            int best = -1;
+            int bestNew = 4;
+            float bestDistance = 0.0f;
+            size_t kept = 0;
+            for (size_t c = 0; c < candidates.size(); c++) {
+                int t = candidates[c];
+                if (used[t]) {
+                    continue;
+                }
+                candidates[kept++] = t;
+
+                int a = source[t * 3], b = source[t * 3 + 1], d = source[t * 3 + 2];
+                int newVertices = (vertexCluster[a] != cluster) + (vertexCluster[b] != cluster && b != a) +
+                                  (vertexCluster[d] != cluster && d != a && d != b);
+                if (vertices.size() + newVertices > MESHLET_MAX_VERTICES || newVertices > bestNew) {
+                    continue;
+                }
+                glm::vec3 offset = (positions[a] + positions[b] + positions[d]) / 3.0f - centroid;
+                float distance = glm::dot(offset, offset);
+                if (newVertices < bestNew || distance < bestDistance || (distance == bestDistance && t < best)) {
+                    best = t;
+                    bestNew = newVertices;
+                    bestDistance = distance;
+                }
+            }
+            candidates.resize(kept);
+            if (best == -1) {
+                break;
+            }
+            addTriangle(best);
+        }
+
+        appendMeshlet(positions, &reordered[clusterStart], reordered.size() - clusterStart, vertices, closed, outward,
+                      (unsigned int)(first + clusterStart), set);
+        added++;
+    }
+
+    std::copy(reordered.begin(), reordered.end(), indices.begin() + first);
+    return added;
+}
+
+namespace {
+
+void normalizedFrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6]) {
+    glm::mat4 rows = glm::transpose(viewProj);
+    for (int axis = 0; axis < 3; axis++) {
+        planes[axis * 2] = rows[3] + rows[axis];
+        planes[axis * 2 + 1] = rows[3] - rows[axis];
+    }
+    for (int i = 0; i < 6; i++) {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
+
+// A view brought into one instance's model space
+struct LocalView {
+    glm::vec4 planes[6];
+    float radiusScale;                  // model to world distances, at most
+    bool cone;
+    bool orthographic;
+    glm::vec3 eye;
+    glm::vec3 direction;
+};
+
+/*
+ * A world plane (n, w) is (A^T n, dot(n, t) + w) in the space of a model with matrix [A | t]. The cone test
+ * needs angles to survive the transform, so it only runs for uniformly scaled models (a rotation times s),
+ * where A^-1 = A^T / s^2; otherwise spheres are scaled by a bound on the stretch and the cone test is off.
+ */
+LocalView localView(const MeshletCullView& view, const MeshletInstance& instance) {
+    const glm::mat4x3& m = instance.world;
+    glm::vec3 a0 = m[0], a1 = m[1], a2 = m[2], t = m[3];
+
+    LocalView local;
+    for (int i = 0; i < 6; i++) {
+        glm::vec3 n(view.planes[i]);
+        local.planes[i] = glm::vec4(glm::dot(a0, n), glm::dot(a1, n), glm::dot(a2, n), glm::dot(n, t) + view.planes[i].w);
+    }
+
+    float s0 = glm::dot(a0, a0), s1 = glm::dot(a1, a1), s2 = glm::dot(a2, a2);
+    float tolerance = 1e-3f * std::max(s0, std::max(s1, s2));
+    bool uniform = std::abs(s0 - s1) <= tolerance && std::abs(s0 - s2) <= tolerance && std::abs(glm::dot(a0, a1)) <= tolerance &&
+                   std::abs(glm::dot(a0, a2)) <= tolerance && std::abs(glm::dot(a1, a2)) <= tolerance && s0 > 0.0f;
+    local.radiusScale = uniform ? std::sqrt(s0) : std::sqrt(s0 + s1 + s2);
+    local.cone = uniform && instance.backFacesHidden;
+    local.orthographic = view.orthographic;
+
+    glm::mat3 transposed = glm::transpose(glm::mat3(a0, a1, a2));
+    local.eye = uniform ? transposed * (view.eye - t) / s0 : glm::vec3(0.0f);
+    local.direction = uniform ? glm::normalize(transposed * view.direction) : glm::vec3(0.0f);
+    return local;
+}
+
+void emitRange(std::vector<MeshletDrawRange>& ranges, unsigned int firstIndex, unsigned int numIndices) {
+    if (!ranges.empty() && ranges.back().firstIndex + ranges.back().numIndices == firstIndex) {
+        ranges.back().numIndices += numIndices;
+        return;
+    }
+    MeshletDrawRange range = { firstIndex, numIndices };
+    ranges.push_back(range);
+}
+
+// 0 visible, 1 outside the frustum, 2 back-facing
+int testCluster(const LocalView& view, const MeshletSet& set, size_t i) {
+    float cx = set.centerX[i], cy = set.centerY[i], cz = set.centerZ[i];
+    float reach = 0.0f - set.radius[i] * view.radiusScale;
+    for (int k = 0; k < 6; k++) {
+        const glm::vec4& p = view.planes[k];
+        if (p.x * cx + p.y * cy + p.z * cz + p.w < reach) {
+            return 1;
+        }
+    }
+    if (!view.cone) {
+        return 0;
+    }
+    float ax = set.axisX[i], ay = set.axisY[i], az = set.axisZ[i];
+    if (view.orthographic) {
+        return view.direction.x * ax + view.direction.y * ay + view.direction.z * az >= set.cutoff[i] ? 2 : 0;
+    }
+    float dx = cx - view.eye.x, dy = cy - view.eye.y, dz = cz - view.eye.z;
+    float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+    return dx * ax + dy * ay + dz * az >= set.cutoff[i] * distance + set.radius[i] ? 2 : 0;
+}
+
+#ifdef __SSE2__
+// bit i set for every cluster begin + i that is outside the frustum, and for every one that is back-facing
+void testClusters4(const LocalView& view, const MeshletSet& set, size_t begin, int& outside, int& backFacing) {
+    __m128 cx = _mm_loadu_ps(&set.centerX[begin]);
+    __m128 cy = _mm_loadu_ps(&set.centerY[begin]);
+    __m128 cz = _mm_loadu_ps(&set.centerZ[begin]);
+    __m128 radius = _mm_loadu_ps(&set.radius[begin]);
+    __m128 reach = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(radius, _mm_set1_ps(view.radiusScale)));
+
+    __m128 out = _mm_setzero_ps();
+    for (int k = 0; k < 6; k++) {
+        const glm::vec4& p = view.planes[k];
+        __m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.x), cx), _mm_mul_ps(_mm_set1_ps(p.y), cy));
+        d = _mm_add_ps(_mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p.z), cz)), _mm_set1_ps(p.w));
+        out = _mm_or_ps(out, _mm_cmplt_ps(d, reach));
+    }
+    outside = _mm_movemask_ps(out);
+    backFacing = 0;
+    if (!view.cone) {
+        return;
+    }
+
+    __m128 ax = _mm_loadu_ps(&set.axisX[begin]);
+    __m128 ay = _mm_loadu_ps(&set.axisY[begin]);
+    __m128 az = _mm_loadu_ps(&set.axisZ[begin]);
+    __m128 cutoff = _mm_loadu_ps(&set.cutoff[begin]);
+    __m128 back;
+    if (view.orthographic) {
+        __m128 dot = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(view.direction.x), ax), _mm_mul_ps(_mm_set1_ps(view.direction.y), ay));
+        dot = _mm_add_ps(dot, _mm_mul_ps(_mm_set1_ps(view.direction.z), az));
+        back = _mm_cmpge_ps(dot, cutoff);
+    }
+    else {
+        __m128 dx = _mm_sub_ps(cx, _mm_set1_ps(view.eye.x));
+        __m128 dy = _mm_sub_ps(cy, _mm_set1_ps(view.eye.y));
+        __m128 dz = _mm_sub_ps(cz, _mm_set1_ps(view.eye.z));
+        __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ax), _mm_mul_ps(dy, ay)), _mm_mul_ps(dz, az));
+        back = _mm_cmpge_ps(dot, _mm_add_ps(_mm_mul_ps(cutoff, distance), radius));
+    }
+    backFacing = _mm_movemask_ps(back) & ~outside;
+}
+#endif
+
+void cullClusters(const LocalView& view, const MeshletSet& set, size_t begin, size_t end, bool simd,
+                  std::vector<MeshletDrawRange>& ranges, MeshletCullStats& stats) {
+    size_t i = begin;
+#ifdef __SSE2__
+    for (; simd && i + 4 <= end; i += 4) {
+        int outside, backFacing;
+        testClusters4(view, set, i, outside, backFacing);
+        for (int lane = 0; lane < 4; lane++) {
+            if (outside & (1 << lane)) {
+                stats.frustumCulled++;
+            }
+            else if (backFacing & (1 << lane)) {
+                stats.coneCulled++;
+            }
+            else {
+                emitRange(ranges, set.firstIndex[i + lane], set.numIndices[i + lane]);
+            }
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        switch (testCluster(view, set, i)) {
+        case 1: stats.frustumCulled++; break;
+        case 2: stats.coneCulled++; break;
+        default: emitRange(ranges, set.firstIndex[i], set.numIndices[i]);
+        }
+    }
+    stats.clusters += end - begin;
+}
+
+}
+
+MeshletCullView MeshletCullView::perspective(const glm::mat4& viewProj, const glm::vec3& eye) {
+    MeshletCullView view;
+    normalizedFrustumPlanes(viewProj, view.planes);
+    view.eye = eye;
+    view.direction = glm::vec3(0.0f);
+    view.orthographic = false;
+    return view;
+}
+
+MeshletCullView MeshletCullView::orthographicView(const glm::mat4& viewProj, const glm::vec3& direction) {
+    MeshletCullView view;
+    normalizedFrustumPlanes(viewProj, view.planes);
+    view.eye = glm::vec3(0.0f);
+    view.direction = glm::normalize(direction);
+    view.orthographic = true;
+    return view;
+}
+
+MeshletCuller::MeshletCuller(unsigned int numThreads) : numThreads(numThreads), simd(true) {
+}
+
+void MeshletCuller::setSimd(bool enabled) {
+    simd = enabled;
+}
+
+bool MeshletCuller::getSimd() const {
+    return simd;
+}
+
+MeshletCullStats MeshletCuller::cull(const MeshletCullView& view, const std::vector<MeshletInstance>& instances,
+                                     std::vector<std::vector<MeshletDrawRange>>& ranges) {
+    MeshletCullStats stats = { 0, 0, 0 };
+    ranges.resize(instances.size());
+    size_t total = 0;
+    for (size_t i = 0; i < instances.size(); i++) {
+        ranges[i].clear();
+        total += instances[i].count;
+    }
+
+    if (numThreads == 1 || total < 2 * MESHLET_TASK_CLUSTERS) {
+        for (size_t i = 0; i < instances.size(); i++) {
+            const MeshletInstance& instance = instances[i];
+            cullClusters(localView(view, instance), *instance.set, instance.first, instance.first + instance.count, simd, ranges[i], stats);
+        }
+        return stats;
+    }
+
+    // every task takes MESHLET_TASK_CLUSTERS clusters, split into pieces at instance boundaries; pieces of the
+    // same instance are joined in order afterwards, merging ranges across the seams
+    struct Piece {
+        size_t instance;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<std::vector<Piece>> tasks(1);
+    size_t taskClusters = 0;
+    for (size_t i = 0; i < instances.size(); i++) {
+        size_t begin = instances[i].first, end = begin + instances[i].count;
+        while (begin < end) {
+            if (taskClusters == MESHLET_TASK_CLUSTERS) {
+                tasks.emplace_back();
+                taskClusters = 0;
+            }
+            size_t take = std::min(end - begin, MESHLET_TASK_CLUSTERS - taskClusters);
+            Piece piece = { i, begin, begin + take };
+            tasks.back().push_back(piece);
+            taskClusters += take;
+            begin += take;
+        }
+    }
+
+    // 0 threads shares the engine's job system, more get one of their own
+    if (numThreads > 1 && !jobs) {
+        jobs.reset(new JobSystem(numThreads));
+    }
+    std::vector<std::vector<std::vector<MeshletDrawRange>>> pieceRanges(tasks.size());
+    std::vector<MeshletCullStats> taskStats(tasks.size());
+    (jobs ? *jobs : JobSystem::shared()).parallelFor(0, tasks.size(), 1, [&](size_t first, size_t last) {
+        for (size_t t = first; t < last; t++) {
+            taskStats[t] = MeshletCullStats();
+            pieceRanges[t].resize(tasks[t].size());
+            for (size_t p = 0; p < tasks[t].size(); p++) {
+                const Piece& piece = tasks[t][p];
+                const MeshletInstance& instance = instances[piece.instance];
+                cullClusters(localView(view, instance), *instance.set, piece.begin, piece.end, simd, pieceRanges[t][p], taskStats[t]);
+            }
+        }
+    });
+    for (size_t t = 0; t < tasks.size(); t++) {
+        stats.clusters += taskStats[t].clusters;
+        stats.frustumCulled += taskStats[t].frustumCulled;
+        stats.coneCulled += taskStats[t].coneCulled;
+        for (size_t p = 0; p < tasks[t].size(); p++) {
+            for (const MeshletDrawRange& range : pieceRanges[t][p]) {
+                emitRange(ranges[tasks[t][p].instance], range.firstIndex, range.numIndices);
+            }
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,104 @@
+#ifndef _MESHLET_H_
+#define _MESHLET_H_
+
+#include <scene/jobsystem.hpp>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Limits of one cluster, the sizes mesh shader pipelines favour
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// Culling is split into jobs of this many clusters once there are at least twice as many
+#define MESHLET_TASK_CLUSTERS 4096
+
+// Cone cutoff of clusters whose triangles face too many ways to ever be back-facing together
+#define MESHLET_NO_CONE 2.0f
+
+/*
+ * Clusters of a triangle mesh as a structure of arrays, so culling tests four of them at once with SSE2.
+ * Each cluster is a contiguous run of the mesh's index buffer, with a bounding sphere around its vertices
+ * and a cone around its triangles' normals: the cluster is entirely back-facing from a point p when
+ *     dot(center - p, axis) >= cutoff * length(center - p) + radius
+ * and from an orthographic view looking along d when dot(d, axis) >= cutoff (cutoff is the sine of the cone's
+ * half angle). Clusters of open meshes get MESHLET_NO_CONE, since their back faces can be seen.
+ */
+struct MeshletSet {
+    std::vector<unsigned int> firstIndex;
+    std::vector<unsigned int> numIndices;
+    std::vector<float> centerX, centerY, centerZ, radius;
+    std::vector<float> axisX, axisY, axisZ, cutoff;
+
+    size_t size() const;
+    void clear();
+};
+
+/*
+ * Splits the triangles indices[first, first + count) into clusters of at most MESHLET_MAX_VERTICES distinct
+ * indices and MESHLET_MAX_TRIANGLES triangles, growing each cluster over the triangles that touch it and add
+ * the fewest vertices to it. The triangles are reordered in place so every cluster is contiguous, and the clusters
+ * are appended to set. Returns the number of clusters added.
+ */
+size_t buildMeshlets(const std::vector<glm::vec3>& positions, std::vector<int>& indices, size_t first, size_t count, MeshletSet& set);
+
+// One view to cull against: the camera, or a light's shadow map
+struct MeshletCullView {
+    glm::vec4 planes[6];                // frustum planes in world space, normalized, pointing inwards; planes[4] is the near plane
+    glm::vec3 eye;                      // perspective views: the world position looked from
+    glm::vec3 direction;                // orthographic views: the direction looked along
+    bool orthographic;
+
+    static MeshletCullView perspective(const glm::mat4& viewProj, const glm::vec3& eye);
+    static MeshletCullView orthographicView(const glm::mat4& viewProj, const glm::vec3& direction);
+};
+
+// Clusters [first, first + count) of set, placed in the world by an affine matrix (see transform.hpp)
+struct MeshletInstance {
+    const MeshletSet * set;
+    size_t first;
+    size_t count;
+    glm::mat4x3 world;
+    bool backFacesHidden;               // false turns the cone test off, e.g. when the near plane may cut the mesh
+};
+
+// Index buffer range of visible clusters; clusters next to each other in the buffer are merged into one range
+struct MeshletDrawRange {
+    unsigned int firstIndex;
+    unsigned int numIndices;
+};
+
+struct MeshletCullStats {
+    size_t clusters;
+    size_t frustumCulled;
+    size_t coneCulled;
+};
+
+/*
+ * Culls the clusters of many instances against one view. Per instance the view is brought into the model's
+ * space once, then the clusters are tested four at a time with SSE2 (scalar code with the same math
+ * otherwise). Large workloads are split into jobs of MESHLET_TASK_CLUSTERS clusters.
+ */
+class MeshletCuller {
+public:
+    // 0 threads culls on the shared job system (see jobsystem.hpp), 1 on the calling thread only, and more on a
+    // job system of that many threads
+    explicit MeshletCuller(unsigned int numThreads = 0);
+
+    // ranges[i] receives the visible ranges of instances[i]; the vectors are reused between calls
+    MeshletCullStats cull(const MeshletCullView& view, const std::vector<MeshletInstance>& instances,
+                          std::vector<std::vector<MeshletDrawRange>>& ranges);
+
+    // Off tests one cluster at a time with scalar code, for comparison; has no effect without SSE2
+    void setSimd(bool enabled);
+    bool getSimd() const;
+
+private:
+    unsigned int numThreads;
+    bool simd;
+
+    // with more than one thread, created the first time there is enough work to split
+    std::unique_ptr<JobSystem> jobs;
+};
+
+#endif // #ifndef _MESHLET_H_
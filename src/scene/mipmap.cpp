@@ -0,0 +1,117 @@
+#include "mipmap.hpp"
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// resolution of the linear -> sRGB table; finer than 8 bits so dark values don't band
+#define LINEAR_TO_SRGB_STEPS 4096
+
+namespace {
+
+struct GammaTables {
+    float toLinear[256];
+    unsigned char toSrgb[LINEAR_TO_SRGB_STEPS + 1];
+
+    GammaTables() {
+        for (int i = 0; i < 256; i++) {
+            float c = i / 255.0f;
+            toLinear[i] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i <= LINEAR_TO_SRGB_STEPS; i++) {
+            float l = (float)i / LINEAR_TO_SRGB_STEPS;
+            float c = (l <= 0.0031308f) ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            toSrgb[i] = (unsigned char)(c * 255.0f + 0.5f);
+        }
+    }
+};
+
+const GammaTables& gammaTables() {
+    static const GammaTables tables;
+    return tables;
+}
+
+// averages the 2x2 block under each destination pixel; src and dst are linear RGBA floats
+void downsample(const float * src, unsigned int width, unsigned int height, float * dst, unsigned int dstWidth, unsigned int dstHeight) {
+    for (unsigned int y = 0; y < dstHeight; y++) {
+        const float * row0 = src + (size_t)std::min(2 * y, height - 1) * width * 4;
+        const float * row1 = src + (size_t)std::min(2 * y + 1, height - 1) * width * 4;
+
+        for (unsigned int x = 0; x < dstWidth; x++) {
+            unsigned int x0 = std::min(2 * x, width - 1) * 4;
+            unsigned int x1 = std::min(2 * x + 1, width - 1) * 4;
+            float * out = dst + ((size_t)y * dstWidth + x) * 4;
+#ifdef __SSE2__
+            // one RGBA pixel per register
+            __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+                                    _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+            _mm_storeu_ps(out, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+            for (int c = 0; c < 4; c++) {
+                out[c] = 0.25f * (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]);
+            }
+#endif
+        }
+    }
+}
+
+// converts linear RGBA floats back to sRGB bytes; alpha is stored linearly
+void encode(const float * src, size_t numPixels, unsigned char * dst) {
+    const GammaTables& tables = gammaTables();
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 scale = _mm_setr_ps(LINEAR_TO_SRGB_STEPS, LINEAR_TO_SRGB_STEPS, LINEAR_TO_SRGB_STEPS, 255.0f);
+    for (; i < numPixels; i++) {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i * 4), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        int idx[4];
+        _mm_storeu_si128((__m128i *)idx, _mm_cvtps_epi32(_mm_mul_ps(v, scale)));
+        dst[i * 4 + 0] = tables.toSrgb[idx[0]];
+        dst[i * 4 + 1] = tables.toSrgb[idx[1]];
+        dst[i * 4 + 2] = tables.toSrgb[idx[2]];
+        dst[i * 4 + 3] = (unsigned char)idx[3];
+    }
+#endif
+    for (; i < numPixels; i++) {
+        for (int c = 0; c < 4; c++) {
+            float v = std::min(std::max(src[i * 4 + c], 0.0f), 1.0f);
+            dst[i * 4 + c] = (c < 3) ? tables.toSrgb[(int)(v * LINEAR_TO_SRGB_STEPS + 0.5f)] : (unsigned char)(v * 255.0f + 0.5f);
+        }
+    }
+}
+
+}
+
+void buildMipChain(const unsigned char * pixels, unsigned int width, unsigned int height, std::vector<MipLevel>& levels) {
+    levels.clear();
+    if (width == 0 || height == 0) {
+        return;
+    }
+
+    const GammaTables& tables = gammaTables();
+    std::vector<float> current((size_t)width * height * 4);
+    for (size_t i = 0; i < current.size(); i++) {
+        current[i] = (i % 4 == 3) ? pixels[i] / 255.0f : tables.toLinear[pixels[i]];
+    }
+
+    // each level is filtered from the float version of the one above, so rounding doesn't accumulate
+    std::vector<float> next;
+    while (width > 1 || height > 1) {
+        unsigned int nextWidth = std::max(width / 2, 1u);
+        unsigned int nextHeight = std::max(height / 2, 1u);
+        next.resize((size_t)nextWidth * nextHeight * 4);
+        downsample(&current[0], width, height, &next[0], nextWidth, nextHeight);
+
+        MipLevel level;
+        level.width = nextWidth;
+        level.height = nextHeight;
+        level.pixels.resize(next.size());
+        encode(&next[0], (size_t)nextWidth * nextHeight, &level.pixels[0]);
+        levels.push_back(level);
+
+        current.swap(next);
+        width = nextWidth;
+        height = nextHeight;
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef _MIPMAP_H_
+#define _MIPMAP_H_
+
+#include <vector>
+
+// One level of a texture's mip chain, RGBA8 in sRGB like the image it was built from
+struct MipLevel {
+    unsigned int width;
+    unsigned int height;
+    std::vector<unsigned char> pixels;
+};
+
+/*
+ * Builds mip levels 1..n (down to 1x1) for an RGBA8 image; level 0 is the image itself.
+ * Each level is a 2x2 box filter of the one above, averaged in linear space so that
+ * minified textures don't darken. Odd sizes round down and repeat the last row/column.
+ */
+void buildMipChain(const unsigned char * pixels, unsigned int width, unsigned int height, std::vector<MipLevel>& levels);
+
+#endif // #ifndef _MIPMAP_H_
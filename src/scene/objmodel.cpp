@@ -1,5 +1,7 @@
 #include "objmodel.hpp"
+#include "assetregistry.hpp"
 #include <SFML/System/Err.hpp>
+#include <algorithm>
 #include <fstream>
 #include <limits>
 
@@ -10,7 +12,7 @@
 #define SKIP_RETURN ;
 #endif
 
-// private helper function - reads a .mtl file and adds to the material table
+// private helper function - reads a .mtl file and adds its materials to the registry
 bool ObjModel::loadMTL( std::string path, std::string filename )
 {
 	std::string token;
@@ -39,7 +41,7 @@ bool ObjModel::loadMTL( std::string path, std::string filename )
 		{
 			// push the latest material, begin a new one
 			materialIDs[mat_name] = materials.size( );
-			materials.push_back( material );
+			materials.push_back( assets->acquireMaterial( material ) );
 			material = ObjMtl();
 			istream >> mat_name;		
 		}
@@ -83,35 +85,17 @@ bool ObjModel::loadMTL( std::string path, std::string filename )
 		else if ( token == "map_Kd" )
 		{
 			istream >> token;
-			// load only one copy of each texture
-			if ( textureIDs.count( token ) == 0 )
-			{
-				textures.push_back( sf::Image() );
-				if ( !textures.back().loadFromFile( path + token ) )
-				{
-					sf::err() << "Error loading texture: " << token << std::endl;
-					return false;
-				}
-				textureIDs[token] = textures.size();
-			}
-			material.map_Kd = textureIDs[token];
+			// the registry keeps one copy of each texture; decoding happens later in AssetRegistry::loadTexture
+			material.map_Kd = assets->acquireTexture( path + token );
+			textureIDs.push_back( material.map_Kd );
 		}
 		else if ( token == "map_Ka" )
 		{
 			// this is likely the same as map_Kd, but you may want to try lightmapping
 			// or pre-computed radiance at some point
 			istream >> token;
-			if ( textureIDs.count( token ) == 0 )
-			{
-				textures.push_back( sf::Image( ) );
-				if ( !textures.back( ).loadFromFile( path + token ) )
-				{
-					sf::err( ) << "Error loading texture: " << token << std::endl;
-					return false;
-				}
-				textureIDs[token] = textures.size( );
-			}
-			material.map_Ka = textureIDs[token];
+			material.map_Ka = assets->acquireTexture( path + token );
+			textureIDs.push_back( material.map_Ka );
 		}
 		// ignore all other parameters, and move to next line after each property read
 		SKIP_THRU_CHAR( istream, '\n' );
@@ -120,7 +104,7 @@ bool ObjModel::loadMTL( std::string path, std::string filename )
 
 	// don't forget to save the last material
 	materialIDs[mat_name] = materials.size( );
-	materials.push_back( material );
+	materials.push_back( assets->acquireMaterial( material ) );
 	return true;
 }
 
@@ -128,13 +112,15 @@ bool ObjModel::loadMTL( std::string path, std::string filename )
  * Parses an input .obj file, loading data into memory.
  * This does not cover the entire .obj spec, just the most common cases, namely v/t/n triangles.
  * You will need to perform additional processing to generate meshes from the vectors of raw data.
+ * Textures named in the .mtl files are only registered here; call AssetRegistry::loadTexture for each of getTextureIDs().
  *
  * Known issues:
  * -Lines in an .obj file must not have trailing whitespace
  */
-bool ObjModel::loadFromFile( std::string path, std::string filename )
+bool ObjModel::loadFromFile( std::string path, std::string filename, AssetRegistry& assets )
 {
 	name = filename;
+	this->assets = &assets;
 
 	std::string token;
 	std::ifstream istream( path + filename );
@@ -395,12 +381,21 @@ const std::vector<glm::vec3> ObjModel::getNormals() const {
 const std::vector<ObjModel::TriangleGroup> ObjModel::getGroups() const {
     return groups;
 }
-const int ObjModel::numTextures() const {
-    return textures.size();
-}
-const sf::Image ObjModel::getTexture(int i) const {
-    return textures[i];
+const std::vector<int>& ObjModel::getTextureIDs() const {
+    return textureIDs;
 }
 const ObjModel::ObjMtl ObjModel::getMaterial(int i) const {
+    return assets->getMaterial(materials[i]);
+}
+const int ObjModel::getMaterialID(int i) const {
     return materials[i];
+}
+
+void ObjModel::release()
+{
+	for ( int material : materials )
+		assets->releaseMaterial( material );
+	materials.clear();
+	materialIDs.clear();
+	textureIDs.clear();
 }
\ No newline at end of file
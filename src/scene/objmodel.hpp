@@ -5,7 +5,8 @@
 #include <vector>
 #include <unordered_map>
 #include <glm/glm.hpp>
-#include <SFML/Graphics/Image.hpp>
+
+class AssetRegistry;
 
 class ObjModel
 {
@@ -19,7 +20,7 @@ public:
 		glm::vec3 Ks;
 		float Ns; // specular exponent in [0,1000]
 		
-		// indexes into the textures array; -1 for no texture
+		// ids in the scene's AssetRegistry; -1 for no texture
 		int map_Kd;
 		int map_Ka;
 
@@ -62,7 +63,15 @@ public:
 		std::vector<Triangle> triangles;
 	};
 
-	bool loadFromFile( std::string path, std::string filename );
+	ObjModel() : assets( NULL )
+	{
+	}
+
+	// textures and materials are registered with (and shared through) the scene's asset registry
+	bool loadFromFile( std::string path, std::string filename, AssetRegistry& assets );
+
+	// drops this model's references to its materials
+	void release();
 
     const std::string getName() const;
     const std::vector<glm::vec3> getVertices() const;
@@ -70,9 +79,9 @@ public:
     const std::vector<glm::vec3> getNormals() const;
 
     const std::vector<TriangleGroup> getGroups() const;
-    const int numTextures() const;
-    const sf::Image getTexture(int i) const;
+    const std::vector<int>& getTextureIDs() const; // every texture the .mtl files named, possibly repeated
     const ObjMtl getMaterial(int i) const;
+    const int getMaterialID(int i) const; // the material's id in the registry
 
 private:
 	std::string name;
@@ -80,12 +89,11 @@ private:
 	std::vector<glm::vec2> texcoords;
 	std::vector<glm::vec3> normals;
 
-	// you may want to hoist materials out of models into a global scene list
-	// that way multiple .obj's can inherit the same .mtl without duplication
-	std::vector<ObjMtl> materials;
+	// materials live in the scene-wide registry, so multiple .obj's can share the same .mtl without duplication
+	AssetRegistry * assets;
+	std::vector<int> materials; // registry ids, indexed by Triangle::materialID
 	std::unordered_map<std::string, int> materialIDs;
-	std::vector<sf::Image> textures; // also take a look at sf::Texture - what is different about them?
-	std::unordered_map<std::string, int> textureIDs;
+	std::vector<int> textureIDs;
 
 	std::vector<TriangleGroup> groups;
 
@@ -0,0 +1,370 @@
+#include "occlusionraster.hpp"
+#include "transform.hpp"
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+// the AVX code is compiled for AVX on its own, so the rest of the build keeps running on CPUs without it
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define OCCLUSION_RASTER_HAS_AVX
+#define AVX_FUNCTION __attribute__((target("avx")))
+#include <immintrin.h>
+#endif
+
+typedef OcclusionRasterizer::SetupTriangle SetupTriangle;
+
+namespace {
+
+/*
+ * The fill functions draw a triangle into the rows y0 to y1 of pixels x0 to x1, where x0 and x1 + 1 are multiples
+ * of OCCLUSION_RASTER_GROUP. All three do the same float operations per pixel, so they give the same depths.
+ */
+void fillScalar(const SetupTriangle& t, float * depth, int width, int x0, int x1, int y0, int y1) {
+    for (int y = y0; y <= y1; y++) {
+        float py = y + 0.5f;
+        float row0 = t.edgeB[0] * py + t.edgeC[0];
+        float row1 = t.edgeB[1] * py + t.edgeC[1];
+        float row2 = t.edgeB[2] * py + t.edgeC[2];
+        float rowDepth = t.depthB * py + t.depthC;
+        float * line = depth + (size_t)y * width;
+        for (int x = x0; x <= x1; x++) {
+            float px = (float)x + 0.5f;
+            bool inside = t.edgeA[0] * px + row0 >= 0.0f && t.edgeA[1] * px + row1 >= 0.0f && t.edgeA[2] * px + row2 >= 0.0f;
+            float z = t.depthA * px + rowDepth;
+            z = z < t.depthMax ? z : t.depthMax;
+            if (inside) {
+                line[x] = line[x] < z ? line[x] : z;
+            }
+        }
+    }
+}
+
+#ifdef __SSE2__
+void fillSSE2(const SetupTriangle& t, float * depth, int width, int x0, int x1, int y0, int y1) {
+    const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 a0 = _mm_set1_ps(t.edgeA[0]), a1 = _mm_set1_ps(t.edgeA[1]), a2 = _mm_set1_ps(t.edgeA[2]);
+    __m128 depthA = _mm_set1_ps(t.depthA), depthMax = _mm_set1_ps(t.depthMax);
+    for (int y = y0; y <= y1; y++) {
+        float py = y + 0.5f;
+        __m128 row0 = _mm_set1_ps(t.edgeB[0] * py + t.edgeC[0]);
+        __m128 row1 = _mm_set1_ps(t.edgeB[1] * py + t.edgeC[1]);
+        __m128 row2 = _mm_set1_ps(t.edgeB[2] * py + t.edgeC[2]);
+        __m128 rowDepth = _mm_set1_ps(t.depthB * py + t.depthC);
+        float * line = depth + (size_t)y * width;
+        for (int x = x0; x <= x1; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), row0), zero),
+                                                  _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), row1), zero)),
+                                       _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), row2), zero));
+            if (_mm_movemask_ps(inside) == 0) {
+                continue;
+            }
+            __m128 z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(depthA, px), rowDepth), depthMax);
+            __m128 old = _mm_loadu_ps(line + x);
+            __m128 nearer = _mm_min_ps(old, z);
+            _mm_storeu_ps(line + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+        }
+    }
+}
+#endif
+
+#ifdef OCCLUSION_RASTER_HAS_AVX
+AVX_FUNCTION void fillAVX(const SetupTriangle& t, float * depth, int width, int x0, int x1, int y0, int y1) {
+    const __m256 offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 a0 = _mm256_set1_ps(t.edgeA[0]), a1 = _mm256_set1_ps(t.edgeA[1]), a2 = _mm256_set1_ps(t.edgeA[2]);
+    __m256 depthA = _mm256_set1_ps(t.depthA), depthMax = _mm256_set1_ps(t.depthMax);
+    for (int y = y0; y <= y1; y++) {
+        float py = y + 0.5f;
+        __m256 row0 = _mm256_set1_ps(t.edgeB[0] * py + t.edgeC[0]);
+        __m256 row1 = _mm256_set1_ps(t.edgeB[1] * py + t.edgeC[1]);
+        __m256 row2 = _mm256_set1_ps(t.edgeB[2] * py + t.edgeC[2]);
+        __m256 rowDepth = _mm256_set1_ps(t.depthB * py + t.depthC);
+        float * line = depth + (size_t)y * width;
+        for (int x = x0; x <= x1; x += 8) {
+            __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), offsets);
+            __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a0, px), row0), zero, _CMP_GE_OQ),
+                                                        _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a1, px), row1), zero, _CMP_GE_OQ)),
+                                          _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a2, px), row2), zero, _CMP_GE_OQ));
+            if (_mm256_movemask_ps(inside) == 0) {
+                continue;
+            }
+            __m256 z = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(depthA, px), rowDepth), depthMax);
+            __m256 old = _mm256_loadu_ps(line + x);
+            __m256 nearer = _mm256_min_ps(old, z);
+            _mm256_storeu_ps(line + x, _mm256_or_ps(_mm256_and_ps(inside, nearer), _mm256_andnot_ps(inside, old)));
+        }
+    }
+}
+
+bool cpuHasAvx() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx") != 0;
+}
+#endif
+
+bool pathAvailable(OcclusionRasterPath path) {
+    switch (path) {
+    case OCCLUSION_RASTER_SCALAR:
+        return true;
+    case OCCLUSION_RASTER_SSE2:
+#ifdef __SSE2__
+        return true;
+#else
+        return false;
+#endif
+    case OCCLUSION_RASTER_AVX:
+#ifdef OCCLUSION_RASTER_HAS_AVX
+        return cpuHasAvx();
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+// Screen position in pixels and window depth of a clip space position in front of the eye
+glm::vec3 toWindow(const glm::vec4& clip, int width, int height) {
+    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+    return glm::vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f);
+}
+
+}
+
+OcclusionRasterizer::OcclusionRasterizer(int width, int height, unsigned int numThreads)
+    : width((std::max(width, 1) + OCCLUSION_RASTER_GROUP - 1) / OCCLUSION_RASTER_GROUP * OCCLUSION_RASTER_GROUP),
+      height(std::max(height, 1)), numThreads(numThreads) {
+    tilesX = (this->width + OCCLUSION_RASTER_TILE_WIDTH - 1) / OCCLUSION_RASTER_TILE_WIDTH;
+    tilesY = (this->height + OCCLUSION_RASTER_TILE_HEIGHT - 1) / OCCLUSION_RASTER_TILE_HEIGHT;
+    bins.resize((size_t)tilesX * tilesY);
+    depth.assign((size_t)this->width * this->height, 1.0f);
+    path = pathAvailable(OCCLUSION_RASTER_AVX) ? OCCLUSION_RASTER_AVX :
+           pathAvailable(OCCLUSION_RASTER_SSE2) ? OCCLUSION_RASTER_SSE2 : OCCLUSION_RASTER_SCALAR;
+    stats = OcclusionRasterStats();
+}
+
+OcclusionRasterizer::~OcclusionRasterizer() {
+    if (pending) {
+        jobSystem().wait(pending);
+    }
+}
+
+OcclusionRasterStats OcclusionRasterizer::rasterize(const glm::mat4& viewProj, const std::vector<OccluderMesh>& occluders, DepthPyramid& pyramid) {
+    start(viewProj, occluders);
+    return finish(pyramid);
+}
+
+void OcclusionRasterizer::start(const glm::mat4& viewProj, const std::vector<OccluderMesh>& occluders) {
+    if (pending) {
+        jobSystem().wait(pending);
+    }
+    this->viewProj = viewProj;
+    this->occluders = occluders;
+
+    if (numThreads == 1) {
+        setup();
+        for (int row = 0; row < tilesY; row++) {
+            fillRow(row);
+        }
+        return;
+    }
+
+    // the set up job queues the rows itself, as children of pending, so finish only waits on that
+    JobSystem& system = jobSystem();
+    JobSystem::JobHandle frame = system.create(nullptr);
+    system.run(system.create([this, &system, frame]() {
+        setup();
+        for (int row = 0; row < tilesY; row++) {
+            system.run(system.create([this, row]() { fillRow(row); }, frame));
+        }
+    }, frame));
+    system.run(frame);
+    pending = frame;
+}
+
+OcclusionRasterStats OcclusionRasterizer::finish(DepthPyramid& pyramid) {
+    if (pending) {
+        jobSystem().wait(pending);
+        pending.reset();
+    }
+    pyramid.build(depth.data(), width, height, viewProj);
+    return stats;
+}
+
+const std::vector<float>& OcclusionRasterizer::getDepth() const {
+    return depth;
+}
+
+int OcclusionRasterizer::getWidth() const {
+    return width;
+}
+
+int OcclusionRasterizer::getHeight() const {
+    return height;
+}
+
+OcclusionRasterPath OcclusionRasterizer::getPath() const {
+    return path;
+}
+
+bool OcclusionRasterizer::setPath(OcclusionRasterPath path) {
+    if (!pathAvailable(path)) {
+        return false;
+    }
+    this->path = path;
+    return true;
+}
+
+const char * OcclusionRasterizer::pathName(OcclusionRasterPath path) {
+    switch (path) {
+    case OCCLUSION_RASTER_AVX: return "AVX";
+    case OCCLUSION_RASTER_SSE2: return "SSE2";
+    default: return "scalar";
+    }
+}
+
+JobSystem& OcclusionRasterizer::jobSystem() {
+    if (numThreads <= 1) {
+        return JobSystem::shared();
+    }
+    if (!jobs) {
+        jobs.reset(new JobSystem(numThreads));
+    }
+    return *jobs;
+}
+
+void OcclusionRasterizer::setup() {
+    stats = OcclusionRasterStats();
+    triangles.clear();
+    for (std::vector<unsigned int>& bin : bins) {
+        bin.clear();
+    }
+
+    for (const OccluderMesh& mesh : occluders) {
+        glm::mat4 mvp = viewProj * affineToMat4(mesh.world);
+        clipPositions.resize(mesh.numVertices);
+        for (size_t i = 0; i < mesh.numVertices; i++) {
+            const float * p = mesh.positions + i * 3;
+            clipPositions[i] = mvp * glm::vec4(p[0], p[1], p[2], 1.0f);
+        }
+
+        stats.triangles += mesh.numIndices / 3;
+        for (size_t i = 0; i + 2 < mesh.numIndices; i += 3) {
+            // the part in front of the near plane (z >= -w), a triangle or a quad
+            glm::vec4 polygon[4];
+            int count = 0;
+            for (int k = 0; k < 3; k++) {
+                const glm::vec4& p = clipPositions[mesh.indices[i + k]];
+                const glm::vec4& q = clipPositions[mesh.indices[i + (k + 1) % 3]];
+                float dp = p.z + p.w, dq = q.z + q.w;
+                if (dp >= 0.0f) {
+                    polygon[count++] = p;
+                }
+                if ((dp >= 0.0f) != (dq >= 0.0f)) {
+                    polygon[count++] = p + (q - p) * (dp / (dp - dq));
+                }
+            }
+            for (int k = 1; k + 1 < count; k++) {
+                addTriangle(polygon[0], polygon[k], polygon[k + 1]);
+            }
+        }
+    }
+}
+
+void OcclusionRasterizer::addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c) {
+    // entirely beyond one side of the frustum
+    if ((a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w) ||
+        (a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w) ||
+        (a.z > a.w && b.z > b.w && c.z > c.w) || a.w <= 0.0f || b.w <= 0.0f || c.w <= 0.0f) {
+        return;
+    }
+
+    glm::vec3 s0 = toWindow(a, width, height), s1 = toWindow(b, width, height), s2 = toWindow(c, width, height);
+    float area = (s1.x - s0.x) * (s2.y - s0.y) - (s1.y - s0.y) * (s2.x - s0.x);
+    if (!(area != 0.0f) || !std::isfinite(area)) {
+        return;
+    }
+    // both sides are drawn: wind every triangle counter-clockwise on screen
+    if (area < 0.0f) {
+        std::swap(s1, s2);
+        area = -area;
+    }
+
+    SetupTriangle t;
+    glm::vec2 lo = glm::min(glm::vec2(s0), glm::min(glm::vec2(s1), glm::vec2(s2)));
+    glm::vec2 hi = glm::max(glm::vec2(s0), glm::max(glm::vec2(s1), glm::vec2(s2)));
+    t.minX = (int)std::ceil(glm::clamp(lo.x - 0.5f, 0.0f, (float)width));
+    t.maxX = (int)std::floor(glm::clamp(hi.x - 0.5f, -1.0f, width - 1.0f));
+    t.minY = (int)std::ceil(glm::clamp(lo.y - 0.5f, 0.0f, (float)height));
+    t.maxY = (int)std::floor(glm::clamp(hi.y - 0.5f, -1.0f, height - 1.0f));
+    if (t.minX > t.maxX || t.minY > t.maxY) {
+        return;
+    }
+
+    // an edge from p to q and the same edge from q to p get exactly opposite functions, so there are no cracks
+    // between the triangles of a mesh
+    const glm::vec3 * corners[3] = { &s0, &s1, &s2 };
+    for (int k = 0; k < 3; k++) {
+        const glm::vec3& p = *corners[k];
+        const glm::vec3& q = *corners[(k + 1) % 3];
+        t.edgeA[k] = p.y - q.y;
+        t.edgeB[k] = q.x - p.x;
+        t.edgeC[k] = p.x * q.y - p.y * q.x;
+    }
+
+    // the plane through the three depths, moved back by the most it changes between a pixel's centre and corners
+    float dx1 = s1.x - s0.x, dy1 = s1.y - s0.y, dz1 = s1.z - s0.z;
+    float dx2 = s2.x - s0.x, dy2 = s2.y - s0.y, dz2 = s2.z - s0.z;
+    t.depthA = (dz1 * dy2 - dz2 * dy1) / area;
+    t.depthB = (dz2 * dx1 - dz1 * dx2) / area;
+    t.depthC = s0.z - t.depthA * s0.x - t.depthB * s0.y + 0.5f * (std::abs(t.depthA) + std::abs(t.depthB));
+    t.depthMax = std::min(1.0f, std::max(s0.z, std::max(s1.z, s2.z)));
+
+    unsigned int index = (unsigned int)triangles.size();
+    triangles.push_back(t);
+    stats.rasterized++;
+    for (int ty = t.minY / OCCLUSION_RASTER_TILE_HEIGHT; ty <= t.maxY / OCCLUSION_RASTER_TILE_HEIGHT; ty++) {
+        for (int tx = t.minX / OCCLUSION_RASTER_TILE_WIDTH; tx <= t.maxX / OCCLUSION_RASTER_TILE_WIDTH; tx++) {
+            bins[(size_t)ty * tilesX + tx].push_back(index);
+            stats.binned++;
+        }
+    }
+}
+
+void OcclusionRasterizer::fillRow(int tileRow) {
+    int y0 = tileRow * OCCLUSION_RASTER_TILE_HEIGHT;
+    int y1 = std::min(y0 + OCCLUSION_RASTER_TILE_HEIGHT, height) - 1;
+    for (int tile = 0; tile < tilesX; tile++) {
+        int x0 = tile * OCCLUSION_RASTER_TILE_WIDTH;
+        int x1 = std::min(x0 + OCCLUSION_RASTER_TILE_WIDTH, width) - 1;
+        for (int y = y0; y <= y1; y++) {
+            std::fill(depth.begin() + (size_t)y * width + x0, depth.begin() + (size_t)y * width + x1 + 1, 1.0f);
+        }
+
+        for (unsigned int index : bins[(size_t)tileRow * tilesX + tile]) {
+            const SetupTriangle& t = triangles[index];
+            int fx0 = std::max(t.minX, x0) / OCCLUSION_RASTER_GROUP * OCCLUSION_RASTER_GROUP;
+            int fx1 = (std::min(t.maxX, x1) / OCCLUSION_RASTER_GROUP + 1) * OCCLUSION_RASTER_GROUP - 1;
+            int fy0 = std::max(t.minY, y0), fy1 = std::min(t.maxY, y1);
+            switch (path) {
+#ifdef OCCLUSION_RASTER_HAS_AVX
+            case OCCLUSION_RASTER_AVX:
+                fillAVX(t, depth.data(), width, fx0, fx1, fy0, fy1);
+                break;
+#endif
+#ifdef __SSE2__
+            case OCCLUSION_RASTER_SSE2:
+                fillSSE2(t, depth.data(), width, fx0, fx1, fy0, fy1);
+                break;
+#endif
+            default:
+                fillScalar(t, depth.data(), width, fx0, fx1, fy0, fy1);
+            }
+        }
+    }
+}
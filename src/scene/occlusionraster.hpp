@@ -0,0 +1,114 @@
+#ifndef _OCCLUSIONRASTER_H_
+#define _OCCLUSIONRASTER_H_
+
+#include <scene/depthpyramid.hpp>
+#include <scene/jobsystem.hpp>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Tiles the depth buffer is split into; every tile keeps the triangles touching it, and a row of tiles is one job
+#define OCCLUSION_RASTER_TILE_WIDTH 32
+#define OCCLUSION_RASTER_TILE_HEIGHT 16
+
+// Pixels of a row every path fills at once (one AVX or two SSE2 vectors); the buffer's width is a multiple of it
+#define OCCLUSION_RASTER_GROUP 8
+
+enum OcclusionRasterPath {
+    OCCLUSION_RASTER_SCALAR,
+    OCCLUSION_RASTER_SSE2,
+    OCCLUSION_RASTER_AVX
+};
+
+// Triangles to draw as occluders: numIndices indices into numVertices positions (x, y, z each), placed in the world
+// by an affine matrix (see transform.hpp)
+struct OccluderMesh {
+    const float * positions;
+    size_t numVertices;
+    const int * indices;
+    size_t numIndices;
+    glm::mat4x3 world;
+};
+
+struct OcclusionRasterStats {
+    size_t triangles;                   // in the meshes
+    size_t rasterized;                  // left after clipping, and dropping those off screen or between pixel centres
+    size_t binned;                      // triangle and tile pairs
+};
+
+/*
+ * Depth-only software rasterizer for occlusion culling without the GPU: it draws the occluders seen through
+ * a view at low resolution and builds a DepthPyramid of the result to test boxes against (see depthpyramid.hpp).
+ *
+ * Triangles are clipped at the near plane and set up on one thread, binned into tiles, then the rows of tiles
+ * are filled as jobs, eight pixels at a time with AVX or SSE2 (picked once, like batchtransform.hpp)
+ * or scalar code doing the same operations. Every pixel keeps the nearest depth drawn at its centre, raised
+ * to the farthest the triangle's plane reaches inside the pixel, so the pyramid never puts an occluder in front
+ * of where it really is. Both sides of every triangle are drawn.
+ */
+class OcclusionRasterizer {
+public:
+    // width is rounded up to a multiple of OCCLUSION_RASTER_GROUP; 0 threads rasterizes on the shared job system
+    // (see jobsystem.hpp), 1 on the calling thread only, and more on a job system of that many threads
+    OcclusionRasterizer(int width, int height, unsigned int numThreads = 0);
+    ~OcclusionRasterizer();
+
+    // start and finish in one call
+    OcclusionRasterStats rasterize(const glm::mat4& viewProj, const std::vector<OccluderMesh>& occluders, DepthPyramid& pyramid);
+
+    /*
+     * Starts drawing the occluders as jobs and returns, so the caller can get on with other work;
+     * the positions and indices they point to must stay as they are until finish. With one thread, start does
+     * all the work.
+     */
+    void start(const glm::mat4& viewProj, const std::vector<OccluderMesh>& occluders);
+
+    // Waits for the started frame and builds pyramid from it
+    OcclusionRasterStats finish(DepthPyramid& pyramid);
+
+    // Window depths in [0, 1] of the last finished frame, rows from the bottom up, 1 where nothing was drawn
+    const std::vector<float>& getDepth() const;
+    int getWidth() const;
+    int getHeight() const;
+
+    // setPath is false if this CPU or build can't take the path asked for
+    OcclusionRasterPath getPath() const;
+    bool setPath(OcclusionRasterPath path);
+    static const char * pathName(OcclusionRasterPath path);
+
+    // A triangle ready to fill: edge functions and depth plane over pixel coordinates
+    struct SetupTriangle {
+        float edgeA[3], edgeB[3], edgeC[3];     // inside where edgeA[i] * x + edgeB[i] * y + edgeC[i] >= 0 for all three
+        float depthA, depthB, depthC;           // depthA * x + depthB * y + depthC, at most depthMax
+        float depthMax;
+        int minX, maxX, minY, maxY;             // pixels whose centres the triangle's bounding box holds
+    };
+
+private:
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    unsigned int numThreads;
+    OcclusionRasterPath path;
+
+    glm::mat4 viewProj;
+    std::vector<OccluderMesh> occluders;
+    std::vector<glm::vec4> clipPositions;
+    std::vector<SetupTriangle> triangles;
+    std::vector<std::vector<unsigned int>> bins;
+    std::vector<float> depth;
+    OcclusionRasterStats stats;
+
+    // created at the first start with more than one thread; pending finishes with the last row of the frame
+    std::unique_ptr<JobSystem> jobs;
+    JobSystem::JobHandle pending;
+
+    JobSystem& jobSystem();
+
+    void setup();
+    void addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+    void fillRow(int tileRow);
+};
+
+#endif // #ifndef _OCCLUSIONRASTER_H_
@@ -1,6 +1,10 @@
 #include "scene.hpp"
+#include "jobsystem.hpp"
 #include <SFML/System/Err.hpp>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <iostream>
 #include <limits>
 
 /* Using a macro to avoid repeating excessively long, templated statement for a simple effect.
@@ -16,8 +20,20 @@
 #define SKIP_RETURN ;
 #endif
 
-Scene::Scene()
+typedef std::chrono::high_resolution_clock Clock;
+
+static float secondsSince( Clock::time_point start )
+{
+	return std::chrono::duration<float>( Clock::now() - start ).count();
+}
+
+Scene::Scene() : compressTextures( false )
+{
+}
+
+void Scene::setTextureCompression( bool enabled )
 {
+	compressTextures = enabled;
 }
 
 bool Scene::loadFromFile( std::string filename )
@@ -37,6 +53,10 @@ bool Scene::loadFromFile( std::string filename )
 		return false;
 	}
 
+	Clock::time_point loadStart = Clock::now();
+	std::vector<std::string> objFiles;
+	std::vector<std::string> parentNames; // per model, resolved once all models are known
+
 	while ( istream.good() && (istream.peek() != EOF) )
 	{
 		istream >> token;
@@ -157,6 +177,7 @@ bool Scene::loadFromFile( std::string filename )
                 SKIP_RETURN(istream);
 			}
 			spotlights.push_back( spotlight );
+			lightStore.addSpotLight( spotlight.initialPosition, spotlight.direction, spotlight.velocity );
             SKIP_THRU_CHAR(istream, '\n');
             SKIP_RETURN(istream);
 		}
@@ -206,6 +227,7 @@ bool Scene::loadFromFile( std::string filename )
                 SKIP_RETURN(istream);
 			}
 			pointlights.push_back( pointlight );
+			lightStore.addPointLight( pointlight.initialPosition, pointlight.velocity );
             SKIP_THRU_CHAR(istream, '\n');
             SKIP_RETURN(istream);
 		}
@@ -216,6 +238,7 @@ bool Scene::loadFromFile( std::string filename )
             SKIP_RETURN(istream);
 
 			StaticModel model;
+			std::string parentName;
 			while ( istream.good( ) && istream.peek( ) != '}' )
 			{
 				istream >> token;
@@ -234,7 +257,7 @@ bool Scene::loadFromFile( std::string filename )
 					istream >> roll;
 					istream >> pitch;
 					istream >> yaw;
-					model.orientation = glm::vec3( roll, pitch, yaw );
+					model.rotation = orientationToQuat( glm::vec3( roll, pitch, yaw ) );
 				}
 				else if ( token == "scale" )
 				{
@@ -250,17 +273,28 @@ bool Scene::loadFromFile( std::string filename )
 					std::getline( istream, token, '\"' );
 
 					// strip duplicate objects - only one copy of the model data in memory
-					if ( objmodels.count( token ) == 0 && !objmodels[token].loadFromFile( path, token ) )
-					{
-						sf::err() << "Error reading .obj file: " << token << std::endl;
-						return false;
-					}
+					// the files themselves are read in parallel once the whole scene is parsed
+					if ( objmodels.count( token ) == 0 )
+						objFiles.push_back( token );
 					model.model = &objmodels[token];
 				}
+				else if ( token == "name" )
+				{
+					istream >> model.name;
+				}
+				else if ( token == "parent" )
+				{
+					istream >> parentName;
+				}
+				else if ( token == "occluder" )
+				{
+					model.occluder = true;
+				}
                 SKIP_THRU_CHAR(istream, '\n');
                 SKIP_RETURN(istream);
 			}
 			models.push_back( model );
+			parentNames.push_back( parentName );
             SKIP_THRU_CHAR(istream, '\n');
             SKIP_RETURN(istream);
 		}
@@ -271,18 +305,161 @@ bool Scene::loadFromFile( std::string filename )
 		sf::err() << "An error occured while reading scene file; last token was: " << token << std::endl;
 		return false;
 	}
+	if ( !buildGraph( parentNames ) )
+		return false;
+	loadStats.parseSeconds = secondsSince( loadStart );
 
+	if ( !loadModels( path, objFiles ) )
+		return false;
+
+	loadStats.totalSeconds = secondsSince( loadStart );
+	std::cout << "Loaded scene in " << loadStats.totalSeconds << " s on " << loadStats.numThreads << " threads: "
+	          << "parse " << loadStats.parseSeconds << " s, "
+	          << loadStats.numModels << " .obj/.mtl " << loadStats.modelSeconds << " s, "
+	          << loadStats.numTextures << " textures " << loadStats.textureSeconds << " s (summed over threads)" << std::endl;
+
+	assets.resolveDuplicates();
+	assets.printSummary();
+
+	if ( compressTextures )
+	{
+		std::cout << "Compressed " << loadStats.numCompressed << " textures in " << loadStats.compressSeconds << " s (summed over threads), "
+		          << loadStats.numCacheHits << " read from cache" << std::endl;
+		for ( int i = 0; i < assets.numTextures(); i++ )
+		{
+			const CompressedTexture& compressed = assets.getTexture( i ).compressed;
+			if ( !assets.isCanonicalTexture( i ) || compressed.empty() )
+				continue;
+
+			size_t bytes = 0;
+			for ( const std::vector<unsigned char>& level : compressed.levels )
+				bytes += level.size();
+			std::cout << "  " << assets.getTexture( i ).path << ": " << blockFormatName( compressed.format ) << " "
+			          << compressed.widths[0] << "x" << compressed.heights[0] << ", " << bytes / 1024 << " KB with mips, PSNR "
+			          << compressed.psnr << " dB" << ( compressed.cached ? " (cached)" : "" ) << std::endl;
+		}
+	}
 	return true;
 }
 
+/*
+ * Loads the .obj files named in the scene on the shared job system. As soon as a model's .mtl files are parsed,
+ * decoding of its textures is queued as separate jobs, so large textures and large meshes overlap.
+ * Each texture is decoded once even if several models name it, and only textures with unique contents are compressed.
+ * All jobs are children of one root, so a single wait covers the jobs that other jobs queue.
+ * GL resources are created later by the renderer, on the thread that owns the context.
+ */
+bool Scene::loadModels( const std::string& path, const std::vector<std::string>& files )
+{
+	JobSystem& jobs = JobSystem::shared();
+	JobSystem::JobHandle root = jobs.create( nullptr );
+	std::atomic<bool> success( true );
+	std::atomic<long long> modelMicros( 0 );
+	std::atomic<long long> textureMicros( 0 );
+	std::atomic<long long> compressMicros( 0 );
+	std::atomic<int> numTextures( 0 );
+	std::atomic<int> numCompressed( 0 );
+	std::atomic<int> numCacheHits( 0 );
+
+	for ( const std::string& file : files )
+	{
+		ObjModel * obj = &objmodels[file];
+		jobs.run( jobs.create( [&, obj, file]()
+		{
+			Clock::time_point start = Clock::now();
+			bool loaded = obj->loadFromFile( path, file, assets );
+			modelMicros += std::chrono::duration_cast<std::chrono::microseconds>( Clock::now() - start ).count();
+
+			if ( !loaded )
+			{
+				sf::err() << "Error reading .obj file: " << file << std::endl;
+				success = false;
+				return;
+			}
+
+			for ( int i : obj->getTextureIDs() )
+			{
+				// another model may have named the same file already
+				if ( !assets.claimTextureLoad( i ) )
+					continue;
+
+				numTextures++;
+				jobs.run( jobs.create( [&, i]()
+				{
+					Clock::time_point start = Clock::now();
+					bool decoded = assets.loadTexture( i );
+					textureMicros += std::chrono::duration_cast<std::chrono::microseconds>( Clock::now() - start ).count();
+					if ( !decoded )
+						success = false;
+
+					// duplicates share the compressed copy of the texture they alias
+					if ( decoded && compressTextures && assets.isCanonicalTexture( i ) )
+					{
+						start = Clock::now();
+						int numBands = assets.prepareCompressedTexture( i );
+						compressMicros += std::chrono::duration_cast<std::chrono::microseconds>( Clock::now() - start ).count();
+						if ( numBands == 0 )
+						{
+							numCacheHits++;
+							return;
+						}
+
+						// once every band is done, a continuation checks the result and writes the cache
+						JobSystem::JobHandle bands = jobs.create( nullptr, root );
+						for ( int band = 0; band < numBands; band++ )
+						{
+							jobs.run( jobs.create( [&, i, band]()
+							{
+								Clock::time_point start = Clock::now();
+								assets.compressTextureBand( i, band );
+								compressMicros += std::chrono::duration_cast<std::chrono::microseconds>( Clock::now() - start ).count();
+							}, bands ) );
+						}
+						jobs.continueWith( bands, [&, i]()
+						{
+							Clock::time_point start = Clock::now();
+							assets.finishCompressedTexture( i );
+							numCompressed++;
+							compressMicros += std::chrono::duration_cast<std::chrono::microseconds>( Clock::now() - start ).count();
+						}, root );
+						jobs.run( bands );
+					}
+				}, root ) );
+			}
+		}, root ) );
+	}
+	jobs.run( root );
+	jobs.wait( root );
+
+	loadStats.numThreads = jobs.size();
+	loadStats.numModels = files.size();
+	loadStats.numTextures = numTextures;
+	loadStats.modelSeconds = modelMicros / 1e6f;
+	loadStats.textureSeconds = textureMicros / 1e6f;
+	loadStats.compressSeconds = compressMicros / 1e6f;
+	loadStats.numCompressed = numCompressed;
+	loadStats.numCacheHits = numCacheHits;
+	return success;
+}
+
+const Scene::LoadStats& Scene::getLoadStats() const {
+    return loadStats;
+}
+
+const AssetRegistry& Scene::getAssets() const {
+    return assets;
+}
+
 Scene::~Scene()
 {
+	for ( auto& entry : objmodels )
+		entry.second.release();
 }
 
 const std::unordered_map<std::string, ObjModel> Scene::getObjModels() const {
     return objmodels;
 }
-const std::vector<Scene::StaticModel> Scene::getModels() const {
+const std::vector<Scene::StaticModel>& Scene::getModels() const {
     return models;
 }
 const Scene::DirectionalLight Scene::getSunlight() const {
@@ -297,25 +474,110 @@ const std::vector<Scene::PointLight> Scene::getPointlights() const {
 
 float totalTime;
 void Scene::update(float deltaTime) {
-    for (int i = 0; i < pointlights.size(); i++) {
-        Scene::PointLight p = pointlights[i];
+    lightStore.animate(totalTime);
 
-        if (p.velocity > 0) {
-
-            p.position = p.initialPosition + 5.0f * glm::vec3(glm::sin(totalTime * p.velocity), 0, glm::cos(totalTime * p.velocity));
-
-            pointlights[i] = p;
+    // only the animated fields go back into the light structs the renderer reads
+    const LightStore::PointLights& points = lightStore.getPointLights();
+    for (size_t i = 0; i < pointlights.size(); i++) {
+        if (points.velocity[i] > 0) {
+            pointlights[i].position = glm::vec3(points.x[i], points.y[i], points.z[i]);
         }
     }
 
-    for (int i = 0; i < spotlights.size(); i++) {
-        Scene::SpotLight s = spotlights[i];
-
-        if (s.velocity > 0) {
-            s.direction = glm::vec3(glm::sin(totalTime * s.velocity), -2.0f, glm::cos(totalTime * s.velocity));
-            s.position = s.initialPosition + glm::vec3(glm::sin(totalTime * -s.velocity), 0, glm::cos(totalTime * -s.velocity));
-            spotlights[i] = s;
+    const LightStore::SpotLights& spots = lightStore.getSpotLights();
+    for (size_t i = 0; i < spotlights.size(); i++) {
+        if (spots.velocity[i] > 0) {
+            spotlights[i].position = glm::vec3(spots.x[i], spots.y[i], spots.z[i]);
+            spotlights[i].direction = glm::vec3(spots.directionX[i], spots.directionY[i], spots.directionZ[i]);
         }
     }
+    graph.update();
     totalTime += deltaTime;
+}
+
+const LightStore& Scene::getLightStore() const {
+    return lightStore;
+}
+
+/*
+ * Resolves the models' parents by name and sorts the models so every parent comes before its children
+ * (see SceneGraph). Models without parents keep the order of the file.
+ */
+bool Scene::buildGraph( const std::vector<std::string>& parentNames )
+{
+	std::unordered_map<std::string, int> byName;
+	for ( int i = 0; i < models.size(); i++ )
+	{
+		if ( models[i].name.empty() )
+			continue;
+		if ( !byName.insert( std::make_pair( models[i].name, i ) ).second )
+		{
+			sf::err() << "Model name " << models[i].name << " is used more than once" << std::endl;
+			return false;
+		}
+	}
+
+	std::vector<int> parents( models.size(), -1 );
+	for ( int i = 0; i < models.size(); i++ )
+	{
+		if ( parentNames[i].empty() )
+			continue;
+		auto iter = byName.find( parentNames[i] );
+		if ( iter == byName.end() )
+		{
+			sf::err() << "Unknown parent " << parentNames[i] << " for model " << ( models[i].name.empty() ? "(unnamed)" : models[i].name ) << std::endl;
+			return false;
+		}
+		parents[i] = iter->second;
+	}
+
+	std::vector<int> order;
+	int cycleNode;
+	if ( !SceneGraph::sortByDepth( parents, order, cycleNode ) )
+	{
+		sf::err() << "Model " << models[cycleNode].name << " is its own ancestor" << std::endl;
+		return false;
+	}
+
+	std::vector<int> sortedIndex( models.size() );
+	for ( int i = 0; i < order.size(); i++ )
+		sortedIndex[order[i]] = i;
+
+	std::vector<StaticModel> sorted;
+	std::vector<glm::mat4x3> localMatrices;
+	std::vector<int> sortedParents;
+	for ( int i : order )
+	{
+		sorted.push_back( models[i] );
+		sorted.back().parent = parents[i] < 0 ? -1 : sortedIndex[parents[i]];
+		localMatrices.push_back( localMatrix( models[i] ) );
+		sortedParents.push_back( sorted.back().parent );
+	}
+	models.swap( sorted );
+	graph.build( sortedParents, localMatrices );
+	graph.update();
+	return true;
+}
+
+glm::mat4x3 Scene::localMatrix( const StaticModel& model )
+{
+	return composeAffine( model.position, model.rotation, model.scale );
+}
+
+void Scene::setModelTransform( int model, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale )
+{
+	models[model].position = position;
+	models[model].rotation = rotation;
+	models[model].scale = scale;
+	graph.setLocalMatrix( model, localMatrix( models[model] ) );
+}
+
+const glm::mat4x3& Scene::getWorldMatrix( int model ) const
+{
+	return graph.getWorldMatrix( model );
+}
+
+const std::vector<glm::mat4x3>& Scene::getWorldMatrices() const
+{
+	return graph.getWorldMatrices();
 }
\ No newline at end of file
@@ -2,6 +2,10 @@
 #define _SCENE_H_
 
 #include <SFML/System/String.hpp>
+#include <scene/assetregistry.hpp>
+#include <scene/lightstore.hpp>
+#include <scene/scenegraph.hpp>
+#include <scene/transform.hpp>
 #include <scene/objmodel.hpp>
 #include <vector>
 #include <string>
@@ -14,16 +18,20 @@ public:
 	struct StaticModel
 	{
 		glm::vec3 position;
-		glm::vec3 orientation; // you may want to change this to a rotation matrix or quaternion
-		                       // if so, you can edit the scene loader to do the conversion up-front
-		                       // look through glm's docs to see what options are available!
-							   // keep in mind the values from the scene file are in degrees!
+		glm::quat rotation; // converted from the scene file's orientation (in degrees) when the scene is loaded
 		glm::vec3 scale;
 
 		// you may want to change this when you build meshes
 		const ObjModel * model;
+
+		// with a parent, position, rotation and scale are relative to the parent's transform
+		std::string name;
+		int parent; // index into the scene's models, -1 for none; parents always come before their children
+
+		// drawn on the CPU to hide what is behind it ("occluder" in the scene file); large, solid models work best
+		bool occluder;
 	
-        StaticModel() : scale(glm::vec3(1.0f, 1.0f, 1.0f))
+        StaticModel() : scale(glm::vec3(1.0f, 1.0f, 1.0f)), parent(-1), occluder(false)
         {
         };
     };
@@ -68,22 +76,68 @@ public:
 		float Kc, Kl, Kq;
 	};
 
+	// wall time of each loading stage; model and texture times are summed over all threads
+	struct LoadStats
+	{
+		float parseSeconds;
+		float modelSeconds;
+		float textureSeconds;
+		float compressSeconds;
+		float totalSeconds;
+		int numModels;
+		int numTextures;
+		int numCompressed;
+		int numCacheHits;
+		int numThreads;
+
+		LoadStats() : parseSeconds( 0.0f ), modelSeconds( 0.0f ), textureSeconds( 0.0f ), compressSeconds( 0.0f ), totalSeconds( 0.0f ),
+		              numModels( 0 ), numTextures( 0 ), numCompressed( 0 ), numCacheHits( 0 ), numThreads( 0 )
+		{
+		};
+	};
+
 private:
+	AssetRegistry assets;
 	std::unordered_map<std::string, ObjModel> objmodels;
 	std::vector<StaticModel> models;
 	DirectionalLight sunlight;
 	std::vector<SpotLight> spotlights;
 	std::vector<PointLight> pointlights;
+	LightStore lightStore; // animated state of the spot and point lights, in the same order
+	SceneGraph graph;      // world transforms of the models, in the same order
+	LoadStats loadStats;
+	bool compressTextures;
+
+	bool loadModels( const std::string& path, const std::vector<std::string>& files );
+	bool buildGraph( const std::vector<std::string>& parentNames );
 	
 public:
 	Scene();
 	bool loadFromFile( std::string filename );
 
+	// cook textures to BC1/BC3 while loading (cached next to each texture as <name>.bc); call before loadFromFile
+	void setTextureCompression( bool enabled );
+    const LoadStats& getLoadStats() const;
+
+    // textures and materials shared by all models, indexed by the ids in ObjMtl
+    const AssetRegistry& getAssets() const;
+
     const std::unordered_map<std::string, ObjModel> getObjModels() const;
-    const std::vector<StaticModel> getModels() const;
+    const std::vector<StaticModel>& getModels() const;
     const DirectionalLight getSunlight() const;
     const std::vector<SpotLight> getSpotlights() const;
     const std::vector<PointLight> getPointlights() const;
+    const LightStore& getLightStore() const;
+
+    // a model's transform relative to its parent, from its position, rotation and scale
+    static glm::mat4x3 localMatrix( const StaticModel& model );
+
+    // moves a model and, with the next update, everything attached to it
+    void setModelTransform( int model, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale );
+
+    // model to world matrices (affine, see transform.hpp), indexed like getModels(); brought up to date by update
+    const glm::mat4x3& getWorldMatrix( int model ) const;
+    const std::vector<glm::mat4x3>& getWorldMatrices() const;
 
     void update(float deltaTime);
 
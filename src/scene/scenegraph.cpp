@@ -0,0 +1,145 @@
+#include "scenegraph.hpp"
+#include "jobsystem.hpp"
+#include <algorithm>
+#include <atomic>
+
+SceneGraph::SceneGraph() : anyDirty(false) {
+}
+
+bool SceneGraph::sortByDepth(const std::vector<int>& parents, std::vector<int>& order, int& cycleNode) {
+    const int unvisited = -1, visiting = -2;
+    std::vector<int> depths(parents.size(), unvisited);
+    std::vector<int> chain;
+    int maxDepth = 0;
+
+    for (size_t i = 0; i < parents.size(); i++) {
+        // walk up until a node whose depth is known, then assign depths on the way back down
+        int node = (int)i;
+        while (node != -1 && depths[node] == unvisited) {
+            depths[node] = visiting;
+            chain.push_back(node);
+            node = parents[node];
+        }
+        if (node != -1 && depths[node] == visiting) {
+            cycleNode = node;
+            return false;
+        }
+
+        int depth = node == -1 ? -1 : depths[node];
+        while (!chain.empty()) {
+            depths[chain.back()] = ++depth;
+            chain.pop_back();
+        }
+        maxDepth = std::max(maxDepth, depth);
+    }
+
+    // counting sort by depth keeps the original order within a level
+    std::vector<size_t> starts(maxDepth + 2, 0);
+    for (int depth : depths) {
+        starts[depth + 1]++;
+    }
+    for (size_t d = 1; d < starts.size(); d++) {
+        starts[d] += starts[d - 1];
+    }
+    order.resize(parents.size());
+    for (size_t i = 0; i < parents.size(); i++) {
+        order[starts[depths[i]]++] = (int)i;
+    }
+    return true;
+}
+
+void SceneGraph::build(const std::vector<int>& parents, const std::vector<glm::mat4x3>& localMatrices) {
+    this->parents = parents;
+    this->localMatrices = localMatrices;
+    worldMatrices = localMatrices;
+    dirty.assign(parents.size(), 1);
+    changed.assign(parents.size(), 0);
+    anyDirty = !parents.empty();
+
+    // a node starts a new level when its parent is in the level that is currently last
+    levelStarts.assign(1, 0);
+    std::vector<int> depths(parents.size(), 0);
+    for (size_t i = 0; i < parents.size(); i++) {
+        depths[i] = parents[i] < 0 ? 0 : depths[parents[i]] + 1;
+        if (depths[i] == (int)levelStarts.size()) {
+            levelStarts.push_back(i);
+        }
+    }
+    levelStarts.push_back(parents.size());
+}
+
+void SceneGraph::clear() {
+    build(std::vector<int>(), std::vector<glm::mat4x3>());
+}
+
+void SceneGraph::setLocalMatrix(size_t node, const glm::mat4x3& local) {
+    localMatrices[node] = local;
+    dirty[node] = 1;
+    anyDirty = true;
+}
+
+size_t SceneGraph::updateRange(size_t begin, size_t end) {
+    size_t updated = 0;
+    for (size_t i = begin; i < end; i++) {
+        int parent = parents[i];
+        if (dirty[i] || (parent >= 0 && changed[parent])) {
+            worldMatrices[i] = parent >= 0 ? multiplyAffine(worldMatrices[parent], localMatrices[i]) : localMatrices[i];
+            dirty[i] = 0;
+            changed[i] = 1;
+            updated++;
+        }
+        else {
+            changed[i] = 0;
+        }
+    }
+    return updated;
+}
+
+size_t SceneGraph::update() {
+    if (!anyDirty) {
+        return 0;
+    }
+
+    size_t updated = 0;
+    for (size_t level = 0; level + 1 < levelStarts.size(); level++) {
+        size_t begin = levelStarts[level];
+        size_t end = levelStarts[level + 1];
+        if (end - begin < 2 * SCENE_GRAPH_TASK_NODES) {
+            updated += updateRange(begin, end);
+            continue;
+        }
+
+        // a level only reads the one above it, which is finished, so its nodes can be updated in any order
+        std::atomic<size_t> levelUpdated(0);
+        JobSystem::shared().parallelFor(begin, end, SCENE_GRAPH_TASK_NODES, [this, &levelUpdated](size_t first, size_t last) {
+            levelUpdated += updateRange(first, last);
+        });
+        updated += levelUpdated;
+    }
+    anyDirty = false;
+    return updated;
+}
+
+size_t SceneGraph::size() const {
+    return parents.size();
+}
+
+size_t SceneGraph::numLevels() const {
+    return levelStarts.size() - 1;
+}
+
+int SceneGraph::getParent(size_t node) const {
+    return parents[node];
+}
+
+const glm::mat4x3& SceneGraph::getLocalMatrix(size_t node) const {
+    return localMatrices[node];
+}
+
+const glm::mat4x3& SceneGraph::getWorldMatrix(size_t node) const {
+    return worldMatrices[node];
+}
+
+const std::vector<glm::mat4x3>& SceneGraph::getWorldMatrices() const {
+    return worldMatrices;
+}
@@ -0,0 +1,62 @@
+#ifndef _SCENEGRAPH_H_
+#define _SCENEGRAPH_H_
+
+#include <scene/transform.hpp>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Levels with at least twice this many nodes are split into jobs of this size for the job system
+#define SCENE_GRAPH_TASK_NODES 4096
+
+/*
+ * Transform hierarchy over flat arrays. Nodes are sorted by depth: all roots first, then their children,
+ * then the grandchildren and so on, so every parent comes before its children (a topological order) and
+ * the nodes of one depth form a contiguous level.
+ *
+ * A node's world matrix is its parent's world matrix times its local matrix, both affine (see transform.hpp). Changing a local matrix only
+ * marks the node dirty; update then recomputes the dirty nodes and everything below them, one level at a
+ * time, with the nodes of a large level split across worker threads (they only read the level above).
+ */
+class SceneGraph {
+public:
+    SceneGraph();
+
+    /*
+     * Order in which nodes with the given parents (-1 for a root, otherwise the index of another node)
+     * have to be stored: sorted by depth, keeping the given order within a depth. False if the parents
+     * form a cycle; cycleNode is then one of the nodes on it.
+     */
+    static bool sortByDepth(const std::vector<int>& parents, std::vector<int>& order, int& cycleNode);
+
+    // Nodes in the order from sortByDepth, their parents renumbered to match; all of them start dirty
+    void build(const std::vector<int>& parents, const std::vector<glm::mat4x3>& localMatrices);
+    void clear();
+
+    void setLocalMatrix(size_t node, const glm::mat4x3& local);
+
+    // Brings the world matrices of dirty nodes and their descendants up to date; returns how many changed
+    size_t update();
+
+    size_t size() const;
+    size_t numLevels() const;
+    int getParent(size_t node) const;
+    const glm::mat4x3& getLocalMatrix(size_t node) const;
+    const glm::mat4x3& getWorldMatrix(size_t node) const;
+
+    // in node order; valid until the next build
+    const std::vector<glm::mat4x3>& getWorldMatrices() const;
+
+private:
+    std::vector<int> parents;
+    std::vector<glm::mat4x3> localMatrices;
+    std::vector<glm::mat4x3> worldMatrices;
+    std::vector<unsigned char> dirty;           // local matrix changed since the last update
+    std::vector<unsigned char> changed;         // world matrix recomputed by the current update
+    std::vector<size_t> levelStarts;            // level d holds nodes [levelStarts[d], levelStarts[d + 1])
+    bool anyDirty;
+
+    size_t updateRange(size_t begin, size_t end);
+};
+
+#endif // #ifndef _SCENEGRAPH_H_
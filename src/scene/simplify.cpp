@@ -0,0 +1,461 @@
+#include "simplify.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+
+namespace {
+
+// Sum of plane equations as a symmetric 4x4 matrix: error(p) is the sum of the squared distances from p to the planes
+struct Quadric {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    double planes;
+
+    Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0), planes(0) {
+    }
+
+    // the plane dot(n, p) + d = 0, n of unit length
+    Quadric(const glm::dvec3& n, double d) : a2(n.x * n.x), ab(n.x * n.y), ac(n.x * n.z), ad(n.x * d), b2(n.y * n.y), bc(n.y * n.z),
+                                             bd(n.y * d), c2(n.z * n.z), cd(n.z * d), d2(d * d), planes(1) {
+    }
+
+    Quadric& operator+=(const Quadric& q) {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+        planes += q.planes;
+        return *this;
+    }
+
+    double error(const glm::vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        return a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x + b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y +
+               c2 * z * z + 2.0 * cd * z + d2;
+    }
+};
+
+// Moving vertex from onto vertex to; the versions tell whether either quadric changed since the cost was computed
+struct Collapse {
+    double cost;
+    int from;
+    int to;
+    unsigned int fromVersion;
+    unsigned int toVersion;
+
+    // std::priority_queue keeps the largest on top, so the order is reversed to get the cheapest
+    bool operator<(const Collapse& other) const {
+        return cost > other.cost;
+    }
+};
+
+struct PositionHash {
+    size_t operator()(const glm::vec3& p) const {
+        // adding 0 turns -0 into 0, which compares equal to it and has to hash the same
+        glm::vec3 q = p + 0.0f;
+        unsigned int bits[3];
+        std::memcpy(bits, &q[0], sizeof(bits));
+        return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    }
+};
+
+// Distance from p to the triangle abc, through its closest point (Ericson, "Real-Time Collision Detection", 5.1.5);
+// in double, as the region tests cancel badly in float on the long slivers that simplified flat areas end up with.
+// inside tells whether the closest point is inside the triangle rather than on its border
+float triangleDistance(const glm::vec3& point, const glm::vec3& corner0, const glm::vec3& corner1, const glm::vec3& corner2, bool& inside) {
+    glm::dvec3 p(point), a(corner0), b(corner1), c(corner2);
+    glm::dvec3 ab = b - a, ac = c - a, ap = p - a;
+    inside = false;
+    double d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0 && d2 <= 0.0) {
+        return (float)glm::length(ap);
+    }
+    glm::dvec3 bp = p - b;
+    double d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0 && d4 <= d3) {
+        return (float)glm::length(bp);
+    }
+    double vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+        return (float)glm::length(ap - ab * (d1 / (d1 - d3)));
+    }
+    glm::dvec3 cp = p - c;
+    double d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0 && d5 <= d6) {
+        return (float)glm::length(cp);
+    }
+    double vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+        return (float)glm::length(ap - ac * (d2 / (d2 - d6)));
+    }
+    double va = d3 * d6 - d5 * d4;
+    if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0) {
+        return (float)glm::length(bp - (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))));
+    }
+    double denominator = va + vb + vc;
+    if (denominator <= 0.0) {
+        return (float)glm::length(ap); // degenerate
+    }
+    inside = true;
+    return (float)glm::length(ap - ab * (vb / denominator) - ac * (vc / denominator));
+}
+
+class Simplifier {
+public:
+    Simplifier(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+               const std::vector<glm::vec2>& texCoords, const std::vector<int>& indices);
+
+    // Collapses the cheapest edges until there are no more than target triangles or the next collapse costs more than maxCost
+    void collapseUntil(size_t target, double maxCost);
+
+    void emit(SimplifiedLevel& level) const;
+    size_t numTriangles() const;
+
+private:
+    const std::vector<glm::vec3>& normals;
+    const std::vector<glm::vec2>& texCoords;
+
+    // welded positions; corners are positions, attributes the original vertices of the same corners
+    std::vector<glm::vec3> points;
+    std::vector<int> vertexPoint;
+    std::vector<std::vector<int>> pointVertices;
+    std::vector<int> corners;
+    std::vector<int> attributes;
+    std::vector<unsigned char> alive;
+    size_t liveTriangles;
+
+    std::vector<std::vector<int>> pointTriangles;       // may still list triangles that have been removed
+    std::vector<Quadric> quadrics;
+    std::vector<unsigned int> versions;
+    std::vector<unsigned char> locked;
+    std::vector<unsigned char> removed;
+    std::priority_queue<Collapse> queue;
+
+    // every removed point is tracked onto a live triangle, and its distance to it kept
+    std::vector<std::vector<int>> trianglePoints;
+    std::vector<float> pointDistance;
+
+    void push(int from, int to);
+    bool contains(int triangle, int point) const;
+    void neighbours(int point, std::vector<int>& result) const;
+    bool canCollapse(int from, int to) const;
+    void collapse(int from, int to);
+    void track(const std::vector<int>& orphans, int to, const std::vector<int>& triangles);
+    int closestVertex(int vertex, int point) const;
+};
+
+Simplifier::Simplifier(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+                       const std::vector<glm::vec2>& texCoords, const std::vector<int>& indices)
+    : normals(normals), texCoords(texCoords), liveTriangles(0) {
+    std::unordered_map<glm::vec3, int, PositionHash> welded;
+    vertexPoint.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) {
+        auto inserted = welded.insert(std::make_pair(positions[i], (int)points.size()));
+        if (inserted.second) {
+            points.push_back(positions[i]);
+            pointVertices.emplace_back();
+        }
+        vertexPoint[i] = inserted.first->second;
+        pointVertices[vertexPoint[i]].push_back((int)i);
+    }
+
+    // triangles that welding made degenerate are dropped
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        int a = vertexPoint[indices[i]], b = vertexPoint[indices[i + 1]], c = vertexPoint[indices[i + 2]];
+        if (a == b || b == c || a == c) {
+            continue;
+        }
+        corners.insert(corners.end(), { a, b, c });
+        attributes.insert(attributes.end(), { indices[i], indices[i + 1], indices[i + 2] });
+    }
+    liveTriangles = corners.size() / 3;
+    alive.assign(liveTriangles, 1);
+
+    pointTriangles.resize(points.size());
+    quadrics.resize(points.size());
+    versions.assign(points.size(), 0);
+    removed.assign(points.size(), 0);
+    trianglePoints.resize(liveTriangles);
+    pointDistance.assign(points.size(), 0.0f);
+    locked.assign(points.size(), 0);
+
+    std::unordered_map<unsigned long long, int> edgeUses;
+    for (size_t t = 0; t < liveTriangles; t++) {
+        const int * tri = &corners[t * 3];
+        glm::dvec3 p0(points[tri[0]]), p1(points[tri[1]]), p2(points[tri[2]]);
+        glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        double length = glm::length(normal);
+        Quadric plane = length > 0.0 ? Quadric(normal / length, -glm::dot(normal / length, p0)) : Quadric();
+
+        for (int k = 0; k < 3; k++) {
+            pointTriangles[tri[k]].push_back((int)t);
+            quadrics[tri[k]] += plane;
+
+            unsigned long long a = std::min(tri[k], tri[(k + 1) % 3]), b = std::max(tri[k], tri[(k + 1) % 3]);
+            edgeUses[(a << 32) | b]++;
+        }
+    }
+
+    // open borders and non-manifold edges stay where they are
+    for (const auto& edge : edgeUses) {
+        if (edge.second != 2) {
+            locked[edge.first >> 32] = 1;
+            locked[edge.first & 0xffffffffull] = 1;
+        }
+    }
+
+    for (size_t t = 0; t < liveTriangles; t++) {
+        for (int k = 0; k < 3; k++) {
+            push(corners[t * 3 + k], corners[t * 3 + (k + 1) % 3]);
+            push(corners[t * 3 + (k + 1) % 3], corners[t * 3 + k]);
+        }
+    }
+}
+
+void Simplifier::push(int from, int to) {
+    if (locked[from]) {
+        return;
+    }
+    Quadric sum = quadrics[from];
+    sum += quadrics[to];
+    // the mean over the planes, so vertices that have absorbed many triangles aren't held back by their count
+    Collapse collapse = { std::max(sum.error(points[to]), 0.0) / std::max(sum.planes, 1.0), from, to, versions[from], versions[to] };
+    queue.push(collapse);
+}
+
+bool Simplifier::contains(int triangle, int point) const {
+    return corners[triangle * 3] == point || corners[triangle * 3 + 1] == point || corners[triangle * 3 + 2] == point;
+}
+
+void Simplifier::neighbours(int point, std::vector<int>& result) const {
+    result.clear();
+    for (int t : pointTriangles[point]) {
+        if (!alive[t]) {
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            if (corners[t * 3 + k] != point) {
+                result.push_back(corners[t * 3 + k]);
+            }
+        }
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+}
+
+bool Simplifier::canCollapse(int from, int to) const {
+    int shared = 0;
+    for (int t : pointTriangles[from]) {
+        if (alive[t] && contains(t, to)) {
+            shared++;
+        }
+    }
+    if (shared == 0) {
+        return false; // no longer an edge
+    }
+
+    // the link condition: the two vertices may only share the neighbours across their common triangles,
+    // otherwise the collapse pinches the surface into a non-manifold edge
+    std::vector<int> fromNeighbours, toNeighbours, common;
+    neighbours(from, fromNeighbours);
+    neighbours(to, toNeighbours);
+    std::set_intersection(fromNeighbours.begin(), fromNeighbours.end(), toNeighbours.begin(), toNeighbours.end(), std::back_inserter(common));
+    if ((int)common.size() != shared) {
+        return false;
+    }
+
+    // none of the remaining triangles around from may flip over or turn nearly edge-on
+    for (int t : pointTriangles[from]) {
+        if (!alive[t] || contains(t, to)) {
+            continue;
+        }
+        glm::vec3 before[3], after[3];
+        for (int k = 0; k < 3; k++) {
+            before[k] = points[corners[t * 3 + k]];
+            after[k] = corners[t * 3 + k] == from ? points[to] : before[k];
+        }
+        glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+        glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+        if (glm::dot(normalBefore, normalAfter) <= 0.1f * glm::length(normalBefore) * glm::length(normalAfter)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Simplifier::collapse(int from, int to) {
+    // from and the points on its triangles have to be tracked again: those triangles either go or change shape
+    std::vector<int> orphans(1, from), moved;
+    for (int t : pointTriangles[from]) {
+        if (!alive[t]) {
+            continue;
+        }
+        orphans.insert(orphans.end(), trianglePoints[t].begin(), trianglePoints[t].end());
+        trianglePoints[t].clear();
+        if (contains(t, to)) {
+            alive[t] = 0;
+            liveTriangles--;
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            if (corners[t * 3 + k] == from) {
+                corners[t * 3 + k] = to;
+            }
+        }
+        pointTriangles[to].push_back(t);
+        moved.push_back(t);
+    }
+    pointTriangles[from].clear();
+    removed[from] = 1;
+    quadrics[to] += quadrics[from];
+    versions[to]++;
+
+    std::vector<int>& triangles = pointTriangles[to];
+    triangles.erase(std::remove_if(triangles.begin(), triangles.end(), [this](int t) { return !alive[t]; }), triangles.end());
+
+    // every edge around to now has a new cost
+    std::vector<int> around;
+    neighbours(to, around);
+    for (int neighbour : around) {
+        push(neighbour, to);
+        push(to, neighbour);
+    }
+    track(orphans, to, moved.empty() ? pointTriangles[to] : moved);
+}
+
+void Simplifier::track(const std::vector<int>& orphans, int to, const std::vector<int>& triangles) {
+    for (int p : orphans) {
+        // the search starts on the triangles that now cover what the collapsed ones did, and walks on to the
+        // triangles around the closest one's corners for as long as they are closer, until p is over the closest
+        int best = -1;
+        float bestDistance = glm::distance(points[p], points[to]);
+        bool bestInside = false;
+        const std::vector<int> * around[3] = { &triangles, &triangles, &triangles };
+        int numAround = 1;
+        bool closer = true;
+        while (closer && !bestInside) {
+            closer = false;
+            for (int i = 0; i < numAround; i++) {
+                for (int t : *around[i]) {
+                    if (!alive[t]) {
+                        continue;
+                    }
+                    bool inside;
+                    float distance = triangleDistance(points[p], points[corners[t * 3]], points[corners[t * 3 + 1]], points[corners[t * 3 + 2]], inside);
+                    if (best < 0 || distance < bestDistance) {
+                        best = t;
+                        bestDistance = distance;
+                        bestInside = inside;
+                        closer = true;
+                    }
+                }
+            }
+            if (best < 0) {
+                break;
+            }
+            for (int k = 0; k < 3; k++) {
+                around[k] = &pointTriangles[corners[best * 3 + k]];
+            }
+            numAround = 3;
+        }
+        if (best >= 0) {
+            trianglePoints[best].push_back(p);
+        }
+        pointDistance[p] = bestDistance;
+    }
+}
+
+void Simplifier::collapseUntil(size_t target, double maxCost) {
+    while (liveTriangles > target && !queue.empty()) {
+        Collapse next = queue.top();
+        if (removed[next.from] || removed[next.to] || versions[next.from] != next.fromVersion || versions[next.to] != next.toVersion) {
+            queue.pop();
+            continue;
+        }
+        if (next.cost > maxCost) {
+            return;
+        }
+        queue.pop();
+        if (!canCollapse(next.from, next.to)) {
+            continue;
+        }
+        collapse(next.from, next.to);
+    }
+}
+
+int Simplifier::closestVertex(int vertex, int point) const {
+    int best = pointVertices[point][0];
+    float bestDistance = -1.0f;
+    for (int candidate : pointVertices[point]) {
+        glm::vec3 normal = normals[candidate] - normals[vertex];
+        float distance = glm::dot(normal, normal);
+        if (!texCoords.empty()) {
+            glm::vec2 texCoord = texCoords[candidate] - texCoords[vertex];
+            distance += glm::dot(texCoord, texCoord);
+        }
+        if (bestDistance < 0.0f || distance < bestDistance) {
+            best = candidate;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+void Simplifier::emit(SimplifiedLevel& level) const {
+    level.indices.clear();
+    for (size_t t = 0; t < alive.size(); t++) {
+        if (!alive[t]) {
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            int vertex = attributes[t * 3 + k];
+            int point = corners[t * 3 + k];
+            level.indices.push_back(vertexPoint[vertex] == point ? vertex : closestVertex(vertex, point));
+        }
+    }
+
+    level.error = 0.0f;
+    for (size_t p = 0; p < points.size(); p++) {
+        level.error = std::max(level.error, pointDistance[p]);
+    }
+}
+
+size_t Simplifier::numTriangles() const {
+    return liveTriangles;
+}
+
+}
+
+std::vector<SimplifiedLevel> buildLodChain(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+                                           const std::vector<glm::vec2>& texCoords, const std::vector<int>& indices) {
+    std::vector<SimplifiedLevel> levels;
+    if (indices.size() / 3 < SIMPLIFY_MIN_TRIANGLES || positions.empty()) {
+        return levels;
+    }
+
+    glm::vec3 boundsMin = positions[0], boundsMax = positions[0];
+    for (const glm::vec3& p : positions) {
+        boundsMin = glm::min(boundsMin, p);
+        boundsMax = glm::max(boundsMax, p);
+    }
+    double maxError = SIMPLIFY_MAX_ERROR * glm::length(boundsMax - boundsMin);
+
+    Simplifier simplifier(positions, normals, texCoords, indices);
+    size_t previous = indices.size() / 3;
+    while (levels.size() < SIMPLIFY_MAX_LEVELS && previous >= SIMPLIFY_MIN_TRIANGLES) {
+        simplifier.collapseUntil((size_t)(previous * SIMPLIFY_LEVEL_RATIO), maxError * maxError);
+        if (simplifier.numTriangles() > previous * SIMPLIFY_MIN_REDUCTION) {
+            break;
+        }
+
+        levels.emplace_back();
+        simplifier.emit(levels.back());
+        if (levels.size() > 1) {
+            // a coarser level may happen to pass closer to the original vertices, but selection expects the error to grow
+            levels.back().error = std::max(levels.back().error, levels[levels.size() - 2].error);
+        }
+        previous = simplifier.numTriangles();
+    }
+    return levels;
+}
@@ -0,0 +1,49 @@
+#ifndef _SIMPLIFY_H_
+#define _SIMPLIFY_H_
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Coarser levels built per mesh at most, each aiming for this fraction of the previous level's triangles
+#define SIMPLIFY_MAX_LEVELS 4
+#define SIMPLIFY_LEVEL_RATIO 0.5f
+
+// A level that keeps more than this fraction of the previous one's triangles isn't worth storing; the chain ends there
+#define SIMPLIFY_MIN_REDUCTION 0.85f
+
+// Meshes with fewer triangles are left alone
+#define SIMPLIFY_MIN_TRIANGLES 64
+
+// Collapses whose cost, the mean squared distance from the kept vertex to the planes merged into it, is over the square
+// of this fraction of the bounding box diagonal are never made
+#define SIMPLIFY_MAX_ERROR 0.05f
+
+struct SimplifiedLevel {
+    std::vector<int> indices;           // triangles over the original vertices
+
+    /*
+     * In the mesh's units, the largest distance from an original vertex to the triangle of this level it is
+     * tracked onto, or the previous level's error if that is larger. A removed vertex is tracked onto a triangle
+     * near its collapse and tracked again when that triangle changes, so the distance is to a triangle of the
+     * level: never less than the distance to its surface, and 0 for a flat mesh.
+     */
+    float error;
+};
+
+/*
+ * Level of detail chain of a triangle mesh, simplified with the quadric error metric (Garland and Heckbert,
+ * "Surface Simplification Using Quadric Error Metrics"): each vertex accumulates the planes of the triangles
+ * around it, and the edge whose collapse adds the least squared distance to those planes goes first.
+ *
+ * The collapses are half-edge collapses, moving a vertex onto a neighbour, so every level indexes the
+ * original vertex arrays and can share their buffers. Vertices at the same position are welded first, so
+ * normal and texture seams don't stop the simplification. A corner whose vertex moved takes the vertex at
+ * the new position whose normal and texture coordinate are closest to its own. Vertices on open borders and
+ * non-manifold edges never move, so meshes that meet along a border stay closed at every level.
+ *
+ * texCoords may be empty. Returns the levels from finest to coarsest; none if the mesh can't be reduced.
+ */
+std::vector<SimplifiedLevel> buildLodChain(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+                                           const std::vector<glm::vec2>& texCoords, const std::vector<int>& indices);
+
+#endif // #ifndef _SIMPLIFY_H_
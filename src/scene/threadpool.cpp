@@ -0,0 +1,48 @@
+#include "threadpool.hpp"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int numThreads) : stopping(false)
+{
+    if (numThreads == 0) {
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    for (unsigned int i = 0; i < numThreads; i++) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+// finishes all queued tasks before joining the workers
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+unsigned int ThreadPool::size() const {
+    return workers.size();
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+            if (tasks.empty()) {
+                return; // stopping, and nothing left to do
+            }
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
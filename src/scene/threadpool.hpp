@@ -0,0 +1,49 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/*
+ * A fixed set of worker threads pulling tasks from a shared queue.
+ * Tasks may submit more tasks, but must not block waiting on them (there may be no free worker to run them).
+ */
+class ThreadPool {
+public:
+    // 0 threads means one per hardware thread
+    explicit ThreadPool(unsigned int numThreads = 0);
+    ~ThreadPool();
+
+    template <class F>
+    std::future<typename std::result_of<F()>::type> submit(F task) {
+        typedef typename std::result_of<F()>::type Result;
+
+        std::shared_ptr<std::packaged_task<Result()>> packaged = std::make_shared<std::packaged_task<Result()>>(task);
+        std::future<Result> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push([packaged]() { (*packaged)(); });
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    unsigned int size() const;
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    void workerLoop();
+};
+
+#endif // #ifndef _THREADPOOL_H_
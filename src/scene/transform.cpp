@@ -0,0 +1,35 @@
+#include "transform.hpp"
+
+glm::quat orientationToQuat(const glm::vec3& degrees) {
+    glm::quat x = glm::angleAxis(glm::radians(degrees.x), glm::vec3(1, 0, 0));
+    glm::quat y = glm::angleAxis(glm::radians(degrees.y), glm::vec3(0, 1, 0));
+    glm::quat z = glm::angleAxis(glm::radians(degrees.z), glm::vec3(0, 0, 1));
+    return glm::normalize(z * y * x);
+}
+
+glm::mat4x3 composeAffine(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+    float xx = rotation.x * rotation.x, yy = rotation.y * rotation.y, zz = rotation.z * rotation.z;
+    float xy = rotation.x * rotation.y, xz = rotation.x * rotation.z, yz = rotation.y * rotation.z;
+    float wx = rotation.w * rotation.x, wy = rotation.w * rotation.y, wz = rotation.w * rotation.z;
+
+    // the columns of the quaternion's rotation matrix, each scaled by its axis' scale
+    glm::mat4x3 result;
+    result[0] = glm::vec3(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy)) * scale.x;
+    result[1] = glm::vec3(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx)) * scale.y;
+    result[2] = glm::vec3(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy)) * scale.z;
+    result[3] = translation;
+    return result;
+}
+
+glm::mat4x3 multiplyAffine(const glm::mat4x3& a, const glm::mat4x3& b) {
+    glm::mat4x3 result;
+    for (int i = 0; i < 4; i++) {
+        result[i] = a[0] * b[i].x + a[1] * b[i].y + a[2] * b[i].z;
+    }
+    result[3] += a[3];
+    return result;
+}
+
+glm::mat4 affineToMat4(const glm::mat4x3& affine) {
+    return glm::mat4(affine);
+}
@@ -0,0 +1,25 @@
+#ifndef _TRANSFORM_H_
+#define _TRANSFORM_H_
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+/*
+ * Affine transforms stored as 3x4 matrices (glm::mat4x3: four columns of three rows). The bottom row of an
+ * affine 4x4 matrix is always (0, 0, 0, 1), so leaving it out saves a quarter of the storage, and composing
+ * two of them takes 36 multiplications instead of the 64 of a full mat4 product.
+ */
+
+// The rotation of the scene files' orientation, in degrees: about x first, then y, then z
+glm::quat orientationToQuat(const glm::vec3& degrees);
+
+// translate(translation) * rotation * scale(scale); rotation has to be a unit quaternion
+glm::mat4x3 composeAffine(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale);
+
+// a * b, as if both had the (0, 0, 0, 1) bottom row
+glm::mat4x3 multiplyAffine(const glm::mat4x3& a, const glm::mat4x3& b);
+
+// adds the (0, 0, 0, 1) bottom row back for the shaders
+glm::mat4 affineToMat4(const glm::mat4x3& affine);
+
+#endif // #ifndef _TRANSFORM_H_
@@ -0,0 +1,17 @@
+#version 330 core
+
+in vec2 UV;
+
+out float adaptedLogLuminance;
+
+uniform sampler2D luminanceTexture;
+uniform sampler2D previousLuminance;
+uniform int averageLevel;       // last mip level of luminanceTexture, a single texel
+uniform float adaptationRate;   // fraction of the way to the new average per frame; 1 snaps to it
+
+void main(){
+    // glGenerateMipmap has averaged the log luminance down to one texel
+    float average = texelFetch(luminanceTexture, ivec2(0, 0), averageLevel).r;
+    float previous = texelFetch(previousLuminance, ivec2(0, 0), 0).r;
+    adaptedLogLuminance = mix(previous, average, adaptationRate);
+}
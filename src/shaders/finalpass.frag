@@ -12,17 +12,48 @@ uniform sampler2D specularTexture;
 uniform sampler2D specularExponentTexture;
 uniform sampler2D viewTexture;
 
-uniform mat4 normalMatrix; // For transforming light directions into camera space
+// must match RENDERER_LIGHTS_PER_BLOCK in renderer.hpp
+#define MAX_LIGHTS 64
 
-uniform float ambientLight; // Should be black for all lights except sunlight
-uniform vec3 lightColor;
-uniform vec3 lightAttenuation;
-uniform vec3 spotlightDirection; // For spotlights
-uniform float cosHalfLightAngle; // For spotlights
-uniform float spotlightFalloff; // For spotlights
-uniform int lightType;
+// rgb is the color, w the ambient term (sunlight only); attenuation holds Kc, Kl, Kq;
+// direction is the spotlight direction with the cosine of half its angle in w;
+// params.x is the spotlight falloff and params.y the light type (0 sun, 1 spot, 2 point)
+struct Light {
+    vec4 color;
+    vec4 attenuation;
+    vec4 direction;
+    vec4 params;
+};
+
+// Written once per frame (Renderer::updateFrameBuffer), one block per MAX_LIGHTS lights; lightIndex is within the bound block
+layout(std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    mat4 normalMatrix; // For transforming light directions into camera space
+    Light lights[MAX_LIGHTS];
+};
+
+uniform int lightIndex;
  
 void main(){
+    Light light = lights[lightIndex];
+    vec3 lightColor = light.color.rgb;
+    float ambientLight = light.color.w;
+    vec3 lightAttenuation = light.attenuation.xyz;
+    vec3 spotlightDirection = light.direction.xyz;
+    float cosHalfLightAngle = light.direction.w;
+    float spotlightFalloff = light.params.x;
+    // LIGHT_SUN, LIGHT_SPOT or LIGHT_POINT compile a program for one light type (see shaderPrograms in renderer.cpp)
+#if defined(LIGHT_SUN)
+    const int lightType = 0;
+#elif defined(LIGHT_SPOT)
+    const int lightType = 1;
+#elif defined(LIGHT_POINT)
+    const int lightType = 2;
+#else
+    int lightType = int(light.params.y);
+#endif
+
     vec3 normal = normalize(texture(normalTexture, UV).xyz);
     vec4 lightInfo = texture(lightMap, UV);
     vec3 lightVector = lightInfo.xyz;
@@ -73,4 +104,7 @@ void main(){
         color += specularColor * lightColor * pow(max(dot(viewDir, reflectedLight), 0), specularExponent);
     }
     //color *= clamp((40 - length(view)) / 10, 0, 1); // Depth fog
+
+    // the HDR target is not clamped like an 8-bit one was, so a light facing away must not subtract
+    color = max(color, vec3(0));
 }
\ No newline at end of file
@@ -0,0 +1,28 @@
+#version 330 core
+
+out float farthestDepth;
+
+uniform sampler2D source;       // the depth buffer, or the previous level of the pyramid
+uniform ivec2 sourceSize;       // texels of source in use; the depth buffer is larger than the screen
+
+void main(){
+    // each texel keeps the farthest of the 2x2 it covers, and the last row and column also take the odd texel left over
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 last = sourceSize / 2 - 1;
+    ivec2 first = texel * 2;
+    ivec2 end = first + 1;
+    if (texel.x == last.x) {
+        end.x = sourceSize.x - 1;
+    }
+    if (texel.y == last.y) {
+        end.y = sourceSize.y - 1;
+    }
+
+    float farthest = 0.0;
+    for (int y = first.y; y <= end.y; y++) {
+        for (int x = first.x; x <= end.x; x++) {
+            farthest = max(farthest, texelFetch(source, ivec2(x, y), 0).r);
+        }
+    }
+    farthestDepth = farthest;
+}
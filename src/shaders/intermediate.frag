@@ -8,7 +8,17 @@ in vec4 interpolated_ShadowCoord;
 
 out vec4 lightVisibility;
 
+// LIGHT_SUN, LIGHT_SPOT or LIGHT_POINT compile a program for one light type (see shaderPrograms in renderer.cpp);
+// without them the type is a uniform and every light type's code is in the program
+#if defined(LIGHT_SUN)
+const int lightType = 0;
+#elif defined(LIGHT_SPOT)
+const int lightType = 1;
+#elif defined(LIGHT_POINT)
+const int lightType = 2;
+#else
 uniform int lightType;
+#endif
 uniform sampler2D shadowMap;
 uniform mat4 cameraVPMat;
 
@@ -4,11 +4,23 @@ uniform mat4 lightMVPMat;
 uniform mat4 cameraMVPMat;
 uniform mat4 modelMat;
 
+// LIGHT_SUN, LIGHT_SPOT or LIGHT_POINT compile a program for one light type (see shaderPrograms in renderer.cpp);
+// without them the type is a uniform and every light type's code is in the program
+#if defined(LIGHT_SUN)
+const int lightType = 0;
+#elif defined(LIGHT_SPOT)
+const int lightType = 1;
+#elif defined(LIGHT_POINT)
+const int lightType = 2;
+#else
 uniform int lightType;
+#endif
 uniform vec3 lightPosition;
 
 in vec3 in_Position;
 
+invariant gl_Position; // must match the depth pre-pass (shadowmap.vert)
+
 out vec3 interpolated_LightDirection;
 out vec4 interpolated_ShadowCoord;
 
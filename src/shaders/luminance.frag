@@ -0,0 +1,15 @@
+#version 330 core
+
+in vec2 UV;
+
+out float logLuminance;
+
+uniform sampler2D hdrTexture;
+
+void main(){
+    vec3 hdr = texture(hdrTexture, UV).rgb;
+    float luminance = dot(hdr, vec3(0.2126, 0.7152, 0.0722));
+    // averaged in log space so a few very bright pixels don't set the exposure for the whole frame;
+    // the floor keeps black pixels from going to -infinity
+    logLuminance = log(max(luminance, 0.001));
+}
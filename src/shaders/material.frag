@@ -12,36 +12,68 @@ layout(location = 4) out float specularEx;
 layout(location = 5) out vec3 view;
 
 uniform bool useTextures;
-uniform bool hasAmbientTexture;
 uniform sampler2D ambientTexture;
-uniform bool hasDiffuseTexture;
 uniform sampler2D diffuseTexture;
 
+// the renderer defines it to the entries of its material buffer (at least RENDERER_MIN_MATERIALS in renderer.hpp)
+#ifndef MAX_MATERIALS
+#define MAX_MATERIALS 256
+#endif
 
-uniform vec3 ambientColor;
-uniform vec3 diffuseColor;
-uniform vec3 specularColor;
-uniform float specularExponent;
+// One entry per scene material, filled once at load time (Renderer::createMaterialBuffer).
+// rgb is the color; w of ambient and diffuse is -1 without a texture, otherwise the texture's layer
+// when batching (see materialbatch.frag) and 0 here; w of specular is the exponent
+struct Material {
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+};
+
+layout(std140) uniform Materials {
+    Material materials[MAX_MATERIALS];
+};
+
+uniform int materialIndex;
+
+// With FIXED_TEXTURES the texture maps to sample (AMBIENT_MAP, DIFFUSE_MAP) are compiled into the program
+// (see shaderPrograms in renderer.cpp) instead of tested per fragment
+#ifdef FIXED_TEXTURES
+#ifdef AMBIENT_MAP
+#define SAMPLE_AMBIENT(material) true
+#else
+#define SAMPLE_AMBIENT(material) false
+#endif
+#ifdef DIFFUSE_MAP
+#define SAMPLE_DIFFUSE(material) true
+#else
+#define SAMPLE_DIFFUSE(material) false
+#endif
+#else
+#define SAMPLE_AMBIENT(material) (material.ambient.w >= 0 && useTextures)
+#define SAMPLE_DIFFUSE(material) (material.diffuse.w >= 0 && useTextures)
+#endif
 
 void main() {
     normal = interpolated_Normal;
     
-    if (hasAmbientTexture && useTextures) {
-        ambient = ambientColor * texture(ambientTexture, interpolated_TexCoord).rgb;
+    Material material = materials[materialIndex];
+
+    if (SAMPLE_AMBIENT(material)) {
+        ambient = material.ambient.rgb * texture(ambientTexture, interpolated_TexCoord).rgb;
     }
     else {
-        ambient = ambientColor;
+        ambient = material.ambient.rgb;
     }
     
-    if (hasDiffuseTexture && useTextures) {
-        diffuse = diffuseColor * texture(diffuseTexture, interpolated_TexCoord).rgb;
+    if (SAMPLE_DIFFUSE(material)) {
+        diffuse = material.diffuse.rgb * texture(diffuseTexture, interpolated_TexCoord).rgb;
     }
     else {
-        diffuse = diffuseColor;
+        diffuse = material.diffuse.rgb;
     }
     
-    specular = specularColor;
-    specularEx = specularExponent;
+    specular = material.specular.rgb;
+    specularEx = material.specular.w;
     
     view = interpolated_View;
 }
\ No newline at end of file
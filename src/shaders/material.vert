@@ -8,6 +8,8 @@ in vec3 in_Position;
 in vec3 in_Normal;
 in vec2 in_TexCoord;
 
+invariant gl_Position; // must match the depth pre-pass (shadowmap.vert)
+
 out vec3 interpolated_View;
 out vec3 interpolated_Normal;
 out vec2 interpolated_TexCoord;
@@ -0,0 +1,58 @@
+#version 330 core
+
+in vec3 interpolated_View;
+in vec3 interpolated_Normal;
+in vec2 interpolated_TexCoord;
+flat in int material;
+
+layout(location = 0) out vec3 normal;
+layout(location = 1) out vec3 ambient;
+layout(location = 2) out vec3 diffuse;
+layout(location = 3) out vec3 specular;
+layout(location = 4) out float specularEx;
+layout(location = 5) out vec3 view;
+
+uniform bool useTextures;
+uniform sampler2DArray ambientTextures;
+uniform sampler2DArray diffuseTextures;
+
+// the renderer defines it to the entries of its material buffer (at least RENDERER_MIN_MATERIALS in renderer.hpp)
+#ifndef MAX_MATERIALS
+#define MAX_MATERIALS 256
+#endif
+
+// same layout as in material.frag; w of ambient and diffuse is the layer in the bound texture array
+struct Material {
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+};
+
+layout(std140) uniform Materials {
+    Material materials[MAX_MATERIALS];
+};
+
+void main() {
+    normal = interpolated_Normal;
+
+    Material m = materials[material];
+
+    if (m.ambient.w >= 0 && useTextures) {
+        ambient = m.ambient.rgb * texture(ambientTextures, vec3(interpolated_TexCoord, m.ambient.w)).rgb;
+    }
+    else {
+        ambient = m.ambient.rgb;
+    }
+
+    if (m.diffuse.w >= 0 && useTextures) {
+        diffuse = m.diffuse.rgb * texture(diffuseTextures, vec3(interpolated_TexCoord, m.diffuse.w)).rgb;
+    }
+    else {
+        diffuse = m.diffuse.rgb;
+    }
+
+    specular = m.specular.rgb;
+    specularEx = m.specular.w;
+
+    view = interpolated_View;
+}
@@ -0,0 +1,25 @@
+#version 330 core
+
+uniform mat4 cameraMVPMat;
+uniform mat4 cameraMVMat;
+uniform mat4 normalMat;
+
+layout(location = 0) in vec3 in_Position;
+layout(location = 1) in vec3 in_Normal;
+layout(location = 2) in vec2 in_TexCoord;
+layout(location = 3) in int in_Material;
+
+invariant gl_Position; // must match the depth pre-pass (shadowmap.vert)
+
+out vec3 interpolated_View;
+out vec3 interpolated_Normal;
+out vec2 interpolated_TexCoord;
+flat out int material;
+
+void main() {
+    gl_Position = cameraMVPMat * vec4(in_Position, 1);
+    interpolated_Normal = (normalMat * vec4(in_Normal, 1)).xyz;
+    interpolated_TexCoord = in_TexCoord;
+    interpolated_View = (cameraMVMat * vec4(in_Position, 1)).xyz;
+    material = in_Material;
+}
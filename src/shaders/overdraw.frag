@@ -0,0 +1,8 @@
+#version 330 core
+
+out float fragments;
+
+// additively blended, so each pixel ends up with the number of fragments that passed the depth test
+void main() {
+    fragments = 1;
+}
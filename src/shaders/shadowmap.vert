@@ -4,6 +4,9 @@ uniform mat4 lightMVPMat;
 
 in vec3 in_Position;
 
+// the depth pre-pass draws with this shader too; the G-buffer passes test GL_EQUAL against its depth
+invariant gl_Position;
+
 void main() {
     gl_Position = lightMVPMat * vec4(in_Position, 1);
 }
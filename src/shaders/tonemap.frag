@@ -0,0 +1,33 @@
+#version 330 core
+
+in vec2 UV;
+
+out vec3 color;
+
+uniform sampler2D hdrTexture;
+uniform sampler2D adaptedLuminance;
+uniform int toneMapping;
+
+// average luminance is mapped to middle grey; the clamp stops a dark frame from being blown up
+const float keyValue = 0.18;
+const float minExposure = 0.25;
+const float maxExposure = 4.0;
+
+// Filmic curve fitted to the ACES reference transform, by Krzysztof Narkowicz:
+// https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
+vec3 filmic(vec3 x){
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0, 1);
+}
+
+void main(){
+    vec3 hdr = texture(hdrTexture, UV).rgb;
+    if (toneMapping == 0) {
+        // clipped like the 8-bit framebuffer the lights used to be added into
+        color = clamp(hdr, 0, 1);
+        return;
+    }
+
+    float average = exp(texelFetch(adaptedLuminance, ivec2(0, 0), 0).r);
+    float exposure = clamp(keyValue / average, minExposure, maxExposure);
+    color = filmic(hdr * exposure);
+}